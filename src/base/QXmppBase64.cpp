@@ -0,0 +1,599 @@
+/*
+ * Copyright (C) 2008-2020 The QXmpp developers
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "QXmppBase64_p.h"
+
+// The x86 kernels are compiled for their instruction set using function
+// attributes and selected at runtime, which requires GCC or Clang. Other
+// compilers use the scalar implementation.
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define QXMPP_BASE64_X86 1
+#include <immintrin.h>
+#else
+#define QXMPP_BASE64_X86 0
+#endif
+
+// NEON is part of the AArch64 baseline, no runtime detection is needed.
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#define QXMPP_BASE64_NEON 1
+#include <arm_neon.h>
+#else
+#define QXMPP_BASE64_NEON 0
+#endif
+
+// number of UTF-16 characters which are narrowed at once before decoding
+static const int NARROW_CHUNK_SIZE = 4096;
+
+// number of bytes the block functions may write past their output
+static const int OUTPUT_SLACK = 32;
+
+static const char ALPHABET[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// value of each base64 character, or -1
+static const signed char DECODE_TABLE[256] = {
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 62, -1, -1, -1, 63,
+    52, 53, 54, 55, 56, 57, 58, 59, 60, 61, -1, -1, -1, -1, -1, -1,
+    -1, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14,
+    15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, -1, -1, -1, -1, -1,
+    -1, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+    41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
+};
+
+// Block functions process as many complete blocks as possible and return
+// the number of input bytes or characters they consumed. Decoders stop at
+// the first block which contains a character outside of the alphabet.
+typedef int (*EncodeBlocks)(const uchar *in, int size, char *out);
+typedef int (*DecodeBlocks)(const uchar *in, int size, uchar *out);
+
+#if QXMPP_BASE64_X86
+// Translates 16 characters to their 6-bit values, returns false if one of
+// them is not in the alphabet.
+__attribute__((target("ssse3"))) static inline bool translateSsse3(__m128i in, __m128i &values)
+{
+    const __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(in, _mm_set1_epi8('A' - 1)), _mm_cmplt_epi8(in, _mm_set1_epi8('Z' + 1)));
+    const __m128i lower = _mm_and_si128(_mm_cmpgt_epi8(in, _mm_set1_epi8('a' - 1)), _mm_cmplt_epi8(in, _mm_set1_epi8('z' + 1)));
+    const __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(in, _mm_set1_epi8('0' - 1)), _mm_cmplt_epi8(in, _mm_set1_epi8('9' + 1)));
+    const __m128i plus = _mm_cmpeq_epi8(in, _mm_set1_epi8('+'));
+    const __m128i slash = _mm_cmpeq_epi8(in, _mm_set1_epi8('/'));
+
+    const __m128i valid = _mm_or_si128(_mm_or_si128(upper, lower), _mm_or_si128(_mm_or_si128(digit, plus), slash));
+    if (_mm_movemask_epi8(valid) != 0xffff)
+        return false;
+
+    __m128i shift = _mm_and_si128(upper, _mm_set1_epi8(-65));
+    shift = _mm_or_si128(shift, _mm_and_si128(lower, _mm_set1_epi8(-71)));
+    shift = _mm_or_si128(shift, _mm_and_si128(digit, _mm_set1_epi8(4)));
+    shift = _mm_or_si128(shift, _mm_and_si128(plus, _mm_set1_epi8(19)));
+    shift = _mm_or_si128(shift, _mm_and_si128(slash, _mm_set1_epi8(16)));
+    values = _mm_add_epi8(in, shift);
+    return true;
+}
+
+__attribute__((target("ssse3"))) static int encodeSsse3(const uchar *in, int size, char *out)
+{
+    const __m128i shuffle = _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+    const __m128i shiftLut = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                           '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+                                           '/' - 63, 'A', 0, 0);
+    int pos = 0;
+    // 12 bytes are encoded, but 16 are loaded
+    for (; pos + 16 <= size; pos += 12, out += 16) {
+        // split each 3 bytes into 4 6-bit indices
+        const __m128i data = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in + pos)), shuffle);
+        const __m128i t0 = _mm_mulhi_epu16(_mm_and_si128(data, _mm_set1_epi32(0x0fc0fc00)), _mm_set1_epi32(0x04000040));
+        const __m128i t1 = _mm_mullo_epi16(_mm_and_si128(data, _mm_set1_epi32(0x003f03f0)), _mm_set1_epi32(0x01000010));
+        const __m128i indices = _mm_or_si128(t0, t1);
+
+        // map the indices to characters by adding the offset of their range
+        __m128i range = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+        range = _mm_or_si128(range, _mm_and_si128(_mm_cmpgt_epi8(_mm_set1_epi8(26), indices), _mm_set1_epi8(13)));
+        const __m128i chars = _mm_add_epi8(_mm_shuffle_epi8(shiftLut, range), indices);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out), chars);
+    }
+    return pos;
+}
+
+__attribute__((target("ssse3"))) static int decodeSsse3(const uchar *in, int size, uchar *out)
+{
+    const __m128i shuffle = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    int pos = 0;
+    // 16 bytes are stored, but only 12 are used
+    for (; pos + 16 <= size; pos += 16, out += 12) {
+        __m128i values;
+        if (!translateSsse3(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in + pos)), values))
+            break;
+
+        // merge the 6-bit values into 24-bit groups
+        const __m128i merged = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+        const __m128i packed = _mm_madd_epi16(merged, _mm_set1_epi32(0x00011000));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out), _mm_shuffle_epi8(packed, shuffle));
+    }
+    return pos;
+}
+
+__attribute__((target("avx2"))) static int encodeAvx2(const uchar *in, int size, char *out)
+{
+    const __m256i shuffle = _mm256_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+                                            10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+    const __m256i shiftLut = _mm256_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                              '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+                                              '/' - 63, 'A', 0, 0,
+                                              'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                              '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+                                              '/' - 63, 'A', 0, 0);
+    int pos = 0;
+    // each lane encodes 12 bytes, 28 bytes are loaded
+    for (; pos + 28 <= size; pos += 24, out += 32) {
+        const __m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + pos));
+        const __m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + pos + 12));
+        const __m256i data = _mm256_shuffle_epi8(_mm256_inserti128_si256(_mm256_castsi128_si256(low), high, 1), shuffle);
+        const __m256i t0 = _mm256_mulhi_epu16(_mm256_and_si256(data, _mm256_set1_epi32(0x0fc0fc00)), _mm256_set1_epi32(0x04000040));
+        const __m256i t1 = _mm256_mullo_epi16(_mm256_and_si256(data, _mm256_set1_epi32(0x003f03f0)), _mm256_set1_epi32(0x01000010));
+        const __m256i indices = _mm256_or_si256(t0, t1);
+
+        __m256i range = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+        range = _mm256_or_si256(range, _mm256_and_si256(_mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices), _mm256_set1_epi8(13)));
+        const __m256i chars = _mm256_add_epi8(_mm256_shuffle_epi8(shiftLut, range), indices);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out), chars);
+    }
+    return pos;
+}
+
+__attribute__((target("avx2"))) static int decodeAvx2(const uchar *in, int size, uchar *out)
+{
+    const __m256i shuffle = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+                                             2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    const __m256i compact = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+    int pos = 0;
+    // 32 bytes are stored, but only 24 are used
+    for (; pos + 32 <= size; pos += 32, out += 24) {
+        const __m256i in256 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(in + pos));
+        const __m256i upper = _mm256_and_si256(_mm256_cmpgt_epi8(in256, _mm256_set1_epi8('A' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), in256));
+        const __m256i lower = _mm256_and_si256(_mm256_cmpgt_epi8(in256, _mm256_set1_epi8('a' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), in256));
+        const __m256i digit = _mm256_and_si256(_mm256_cmpgt_epi8(in256, _mm256_set1_epi8('0' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), in256));
+        const __m256i plus = _mm256_cmpeq_epi8(in256, _mm256_set1_epi8('+'));
+        const __m256i slash = _mm256_cmpeq_epi8(in256, _mm256_set1_epi8('/'));
+
+        const __m256i valid = _mm256_or_si256(_mm256_or_si256(upper, lower), _mm256_or_si256(_mm256_or_si256(digit, plus), slash));
+        if (_mm256_movemask_epi8(valid) != -1)
+            break;
+
+        __m256i shift = _mm256_and_si256(upper, _mm256_set1_epi8(-65));
+        shift = _mm256_or_si256(shift, _mm256_and_si256(lower, _mm256_set1_epi8(-71)));
+        shift = _mm256_or_si256(shift, _mm256_and_si256(digit, _mm256_set1_epi8(4)));
+        shift = _mm256_or_si256(shift, _mm256_and_si256(plus, _mm256_set1_epi8(19)));
+        shift = _mm256_or_si256(shift, _mm256_and_si256(slash, _mm256_set1_epi8(16)));
+        const __m256i values = _mm256_add_epi8(in256, shift);
+
+        const __m256i merged = _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140));
+        const __m256i packed = _mm256_shuffle_epi8(_mm256_madd_epi16(merged, _mm256_set1_epi32(0x00011000)), shuffle);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out), _mm256_permutevar8x32_epi32(packed, compact));
+    }
+    return pos;
+}
+#endif
+
+#if QXMPP_BASE64_NEON
+static inline bool translateNeon(uint8x16_t in, uint8x16_t &values)
+{
+    const uint8x16_t upper = vandq_u8(vcgeq_u8(in, vdupq_n_u8('A')), vcleq_u8(in, vdupq_n_u8('Z')));
+    const uint8x16_t lower = vandq_u8(vcgeq_u8(in, vdupq_n_u8('a')), vcleq_u8(in, vdupq_n_u8('z')));
+    const uint8x16_t digit = vandq_u8(vcgeq_u8(in, vdupq_n_u8('0')), vcleq_u8(in, vdupq_n_u8('9')));
+    const uint8x16_t plus = vceqq_u8(in, vdupq_n_u8('+'));
+    const uint8x16_t slash = vceqq_u8(in, vdupq_n_u8('/'));
+
+    const uint8x16_t valid = vorrq_u8(vorrq_u8(upper, lower), vorrq_u8(vorrq_u8(digit, plus), slash));
+    if (vminvq_u8(valid) != 0xff)
+        return false;
+
+    uint8x16_t shift = vandq_u8(upper, vdupq_n_u8(uint8_t(-65)));
+    shift = vorrq_u8(shift, vandq_u8(lower, vdupq_n_u8(uint8_t(-71))));
+    shift = vorrq_u8(shift, vandq_u8(digit, vdupq_n_u8(4)));
+    shift = vorrq_u8(shift, vandq_u8(plus, vdupq_n_u8(19)));
+    shift = vorrq_u8(shift, vandq_u8(slash, vdupq_n_u8(16)));
+    values = vaddq_u8(in, shift);
+    return true;
+}
+
+static int encodeNeon(const uchar *in, int size, char *out)
+{
+    const uint8_t *alphabet = reinterpret_cast<const uint8_t *>(ALPHABET);
+    uint8x16x4_t table;
+    table.val[0] = vld1q_u8(alphabet);
+    table.val[1] = vld1q_u8(alphabet + 16);
+    table.val[2] = vld1q_u8(alphabet + 32);
+    table.val[3] = vld1q_u8(alphabet + 48);
+    const uint8x16_t mask = vdupq_n_u8(0x3f);
+
+    int pos = 0;
+    for (; pos + 48 <= size; pos += 48, out += 64) {
+        // the bytes are deinterleaved, so that each register holds the
+        // first, second or third byte of 16 groups
+        const uint8x16x3_t data = vld3q_u8(in + pos);
+        uint8x16x4_t chars;
+        chars.val[0] = vshrq_n_u8(data.val[0], 2);
+        chars.val[1] = vandq_u8(vorrq_u8(vshlq_n_u8(data.val[0], 4), vshrq_n_u8(data.val[1], 4)), mask);
+        chars.val[2] = vandq_u8(vorrq_u8(vshlq_n_u8(data.val[1], 2), vshrq_n_u8(data.val[2], 6)), mask);
+        chars.val[3] = vandq_u8(data.val[2], mask);
+        for (int i = 0; i < 4; ++i)
+            chars.val[i] = vqtbl4q_u8(table, chars.val[i]);
+        vst4q_u8(reinterpret_cast<uint8_t *>(out), chars);
+    }
+    return pos;
+}
+
+static int decodeNeon(const uchar *in, int size, uchar *out)
+{
+    int pos = 0;
+    for (; pos + 64 <= size; pos += 64, out += 48) {
+        const uint8x16x4_t chars = vld4q_u8(in + pos);
+        uint8x16x4_t values;
+        if (!translateNeon(chars.val[0], values.val[0]) ||
+            !translateNeon(chars.val[1], values.val[1]) ||
+            !translateNeon(chars.val[2], values.val[2]) ||
+            !translateNeon(chars.val[3], values.val[3]))
+            break;
+
+        uint8x16x3_t data;
+        data.val[0] = vorrq_u8(vshlq_n_u8(values.val[0], 2), vshrq_n_u8(values.val[1], 4));
+        data.val[1] = vorrq_u8(vshlq_n_u8(values.val[1], 4), vshrq_n_u8(values.val[2], 2));
+        data.val[2] = vorrq_u8(vshlq_n_u8(values.val[2], 6), values.val[3]);
+        vst3q_u8(out, data);
+    }
+    return pos;
+}
+#endif
+
+struct Codec
+{
+    QXmppBase64::Implementation implementation;
+    EncodeBlocks encodeBlocks;
+    DecodeBlocks decodeBlocks;
+};
+
+static Codec detectCodec()
+{
+#if QXMPP_BASE64_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return Codec { QXmppBase64::Avx2, encodeAvx2, decodeAvx2 };
+    if (__builtin_cpu_supports("ssse3"))
+        return Codec { QXmppBase64::Ssse3, encodeSsse3, decodeSsse3 };
+#elif QXMPP_BASE64_NEON
+    return Codec { QXmppBase64::Neon, encodeNeon, decodeNeon };
+#endif
+    return Codec { QXmppBase64::Scalar, nullptr, nullptr };
+}
+
+static Codec &codec()
+{
+    static Codec codec = detectCodec();
+    return codec;
+}
+
+// Decodes characters while keeping the bits which do not form a complete
+// byte yet, so that input can be fed in several parts.
+class Decoder
+{
+public:
+    Decoder(uchar *out, DecodeBlocks blocks)
+        : m_out(out), m_blocks(blocks), m_buffer(0), m_bits(0)
+    {
+    }
+
+    uchar *out() const
+    {
+        return m_out;
+    }
+
+    void feed(const uchar *in, int size)
+    {
+        int pos = 0;
+        while (pos < size) {
+            // the block functions require that no bits are pending
+            if (m_bits == 0 && m_blocks) {
+                const int consumed = m_blocks(in + pos, size - pos, m_out);
+                pos += consumed;
+                m_out += consumed / 4 * 3;
+            }
+
+            // skip past the block which was rejected, and until the
+            // pending bits are complete again
+            const int end = qMin(size, pos + 64);
+            while (pos < size && (pos < end || m_bits != 0)) {
+                const int value = DECODE_TABLE[in[pos++]];
+                if (value < 0)
+                    continue;
+
+                m_buffer = (m_buffer << 6) | uint(value);
+                m_bits += 6;
+                if (m_bits >= 8) {
+                    m_bits -= 8;
+                    *m_out++ = uchar(m_buffer >> m_bits);
+                    m_buffer &= (1u << m_bits) - 1;
+                }
+            }
+        }
+    }
+
+private:
+    uchar *m_out;
+    DecodeBlocks m_blocks;
+    uint m_buffer;
+    int m_bits;
+};
+
+/// Returns the base64 encoding of \a data, with padding.
+///
+/// \param data
+
+QByteArray QXmppBase64::encode(const QByteArray &data)
+{
+    const auto *in = reinterpret_cast<const uchar *>(data.constData());
+    const int size = data.size();
+
+    // the block functions may write past the end of the encoded data
+    QByteArray encoded((size + 2) / 3 * 4 + OUTPUT_SLACK, Qt::Uninitialized);
+    char *out = encoded.data();
+
+    const EncodeBlocks blocks = codec().encodeBlocks;
+    int pos = blocks ? blocks(in, size, out) : 0;
+    out += pos / 3 * 4;
+
+    for (; pos + 3 <= size; pos += 3) {
+        const uint value = (uint(in[pos]) << 16) | (uint(in[pos + 1]) << 8) | in[pos + 2];
+        *out++ = ALPHABET[value >> 18];
+        *out++ = ALPHABET[(value >> 12) & 0x3f];
+        *out++ = ALPHABET[(value >> 6) & 0x3f];
+        *out++ = ALPHABET[value & 0x3f];
+    }
+
+    if (size - pos == 1) {
+        const uint value = uint(in[pos]) << 16;
+        *out++ = ALPHABET[value >> 18];
+        *out++ = ALPHABET[(value >> 12) & 0x3f];
+        *out++ = '=';
+        *out++ = '=';
+    } else if (size - pos == 2) {
+        const uint value = (uint(in[pos]) << 16) | (uint(in[pos + 1]) << 8);
+        *out++ = ALPHABET[value >> 18];
+        *out++ = ALPHABET[(value >> 12) & 0x3f];
+        *out++ = ALPHABET[(value >> 6) & 0x3f];
+        *out++ = '=';
+    }
+
+    encoded.truncate(int(out - encoded.constData()));
+    return encoded;
+}
+
+/// Decodes the base64 data in \a encoded.
+///
+/// Characters which are not part of the base64 alphabet are skipped.
+///
+/// \param encoded
+
+QByteArray QXmppBase64::decode(const QByteArray &encoded)
+{
+    QByteArray data(encoded.size() / 4 * 3 + OUTPUT_SLACK, Qt::Uninitialized);
+    auto *out = reinterpret_cast<uchar *>(data.data());
+
+    Decoder decoder(out, codec().decodeBlocks);
+    decoder.feed(reinterpret_cast<const uchar *>(encoded.constData()), encoded.size());
+
+    data.truncate(int(decoder.out() - out));
+    return data;
+}
+
+/// Decodes the base64 data in \a encoded, as found in the text of a DOM
+/// element, without converting it to Latin-1 first.
+///
+/// Characters which are not part of the base64 alphabet are skipped.
+///
+/// \param encoded
+
+QByteArray QXmppBase64::decode(const QString &encoded)
+{
+    QByteArray data(encoded.size() / 4 * 3 + OUTPUT_SLACK, Qt::Uninitialized);
+    auto *out = reinterpret_cast<uchar *>(data.data());
+
+    Decoder decoder(out, codec().decodeBlocks);
+    const ushort *in = encoded.utf16();
+    uchar chunk[NARROW_CHUNK_SIZE];
+    for (int pos = 0; pos < encoded.size(); pos += NARROW_CHUNK_SIZE) {
+        const int size = qMin(NARROW_CHUNK_SIZE, encoded.size() - pos);
+
+        // characters beyond Latin-1 are mapped to a byte which is not
+        // part of the alphabet either
+        for (int i = 0; i < size; ++i)
+            chunk[i] = in[pos + i] < 0x100 ? uchar(in[pos + i]) : uchar(0xff);
+        decoder.feed(chunk, size);
+    }
+
+    data.truncate(int(decoder.out() - out));
+    return data;
+}
+
+/// Returns the implementation which is currently used.
+
+QXmppBase64::Implementation QXmppBase64::implementation()
+{
+    return codec().implementation;
+}
+
+/// Forces the use of the given \a implementation, for instance to compare
+/// their throughput.
+///
+/// Returns false if the implementation is not supported by the CPU.
+///
+/// \param implementation
+
+bool QXmppBase64::setImplementation(Implementation implementation)
+{
+    switch (implementation) {
+    case Scalar:
+        codec() = Codec { Scalar, nullptr, nullptr };
+        return true;
+#if QXMPP_BASE64_X86
+    case Ssse3:
+        if (!__builtin_cpu_supports("ssse3"))
+            return false;
+        codec() = Codec { Ssse3, encodeSsse3, decodeSsse3 };
+        return true;
+    case Avx2:
+        if (!__builtin_cpu_supports("avx2"))
+            return false;
+        codec() = Codec { Avx2, encodeAvx2, decodeAvx2 };
+        return true;
+#endif
+#if QXMPP_BASE64_NEON
+    case Neon:
+        codec() = Codec { Neon, encodeNeon, decodeNeon };
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+/// Returns true if the given \a implementation can be used on this CPU.
+///
+/// \param implementation
+
+bool QXmppBase64::isSupported(Implementation implementation)
+{
+    switch (implementation) {
+    case Scalar:
+        return true;
+#if QXMPP_BASE64_X86
+    case Ssse3:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("ssse3");
+    case Avx2:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+#endif
+#if QXMPP_BASE64_NEON
+    case Neon:
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+QXmppLazyBase64::QXmppLazyBase64()
+    : m_decoded(nullptr)
+{
+}
+
+QXmppLazyBase64::QXmppLazyBase64(const QXmppLazyBase64 &other)
+    : m_data(other.m_data),
+      m_encoded(other.m_encoded),
+      m_decoded(nullptr)
+{
+    if (const QByteArray *decoded = other.m_decoded.loadAcquire())
+        m_decoded.storeRelease(new QByteArray(*decoded));
+}
+
+QXmppLazyBase64::~QXmppLazyBase64()
+{
+    delete m_decoded.loadAcquire();
+}
+
+QXmppLazyBase64 &QXmppLazyBase64::operator=(const QXmppLazyBase64 &other)
+{
+    if (this != &other) {
+        m_data = other.m_data;
+        m_encoded = other.m_encoded;
+        const QByteArray *decoded = other.m_decoded.loadAcquire();
+        reset(decoded ? new QByteArray(*decoded) : nullptr);
+    }
+    return *this;
+}
+
+/// Returns true if there is no payload.
+
+bool QXmppLazyBase64::isEmpty() const
+{
+    return m_encoded.isEmpty() && m_data.isEmpty();
+}
+
+/// Returns the payload in binary form, decoding it if necessary.
+
+QByteArray QXmppLazyBase64::data() const
+{
+    if (m_encoded.isEmpty())
+        return m_data;
+
+    if (const QByteArray *decoded = m_decoded.loadAcquire())
+        return *decoded;
+
+    // concurrent readers may both decode, only the first result is kept
+    auto *decoded = new QByteArray(QXmppBase64::decode(m_encoded));
+    QByteArray *current = nullptr;
+    if (!m_decoded.testAndSetOrdered(nullptr, decoded, current)) {
+        delete decoded;
+        return *current;
+    }
+    return *decoded;
+}
+
+/// Sets the payload in binary form.
+
+void QXmppLazyBase64::setData(const QByteArray &data)
+{
+    m_data = data;
+    m_encoded.clear();
+    reset(nullptr);
+}
+
+/// Returns the base64 encoded payload.
+
+QString QXmppLazyBase64::toBase64() const
+{
+    // a payload which was received is written back unchanged
+    if (!m_encoded.isEmpty())
+        return QString::fromLatin1(m_encoded);
+    return QString::fromLatin1(QXmppBase64::encode(m_data));
+}
+
+/// Sets the base64 encoded payload, which is decoded on first access.
+
+void QXmppLazyBase64::setBase64(const QByteArray &encoded)
+{
+    m_data.clear();
+    m_encoded = encoded;
+    reset(nullptr);
+}
+
+void QXmppLazyBase64::reset(QByteArray *decoded)
+{
+    delete m_decoded.fetchAndStoreOrdered(decoded);
+}
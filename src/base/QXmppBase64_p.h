@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2008-2020 The QXmpp developers
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPBASE64_P_H
+#define QXMPPBASE64_P_H
+
+#include "QXmppGlobal.h"
+
+#include <QAtomicPointer>
+#include <QByteArray>
+#include <QString>
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API. It exists for the convenience
+// of the classes which carry base64-encoded payloads.
+//
+// This header file may change from version to version without notice,
+// or even be removed.
+//
+// We mean it.
+//
+
+/// \internal
+///
+/// The QXmppBase64 class encodes and decodes the base64 payloads of IBB,
+/// BoB, vCard, SASL and RPC elements.
+///
+/// Complete blocks are processed using the widest SIMD instruction set
+/// which is available at runtime, the remaining bytes using a lookup
+/// table. The results are identical to QByteArray::toBase64() and
+/// QByteArray::fromBase64(): characters outside of the base64 alphabet,
+/// such as line breaks and padding, are skipped when decoding.
+///
+
+class QXMPP_AUTOTEST_EXPORT QXmppBase64
+{
+public:
+    enum Implementation {
+        Scalar,  ///< Portable lookup table implementation.
+        Ssse3,   ///< x86 implementation processing 16 bytes at a time.
+        Avx2,    ///< x86 implementation processing 32 bytes at a time.
+        Neon     ///< AArch64 implementation processing 64 bytes at a time.
+    };
+
+    static QByteArray encode(const QByteArray &data);
+    static QByteArray decode(const QByteArray &encoded);
+    static QByteArray decode(const QString &encoded);
+
+    static Implementation implementation();
+    static bool setImplementation(Implementation implementation);
+    static bool isSupported(Implementation implementation);
+};
+
+/// \internal
+///
+/// The QXmppLazyBase64 class holds a payload which was either set in binary
+/// form or received base64 encoded. A received payload is only decoded the
+/// first time it is accessed and is written back as it was received.
+///
+/// The encoded text is never modified by the const accessors. The decoded
+/// copy is published atomically, so copies sharing the same private data
+/// may be read from different threads.
+///
+
+class QXMPP_AUTOTEST_EXPORT QXmppLazyBase64
+{
+public:
+    QXmppLazyBase64();
+    QXmppLazyBase64(const QXmppLazyBase64 &other);
+    ~QXmppLazyBase64();
+
+    QXmppLazyBase64 &operator=(const QXmppLazyBase64 &other);
+
+    bool isEmpty() const;
+
+    QByteArray data() const;
+    void setData(const QByteArray &data);
+
+    QString toBase64() const;
+    void setBase64(const QByteArray &encoded);
+
+private:
+    void reset(QByteArray *decoded);
+
+    QByteArray m_data;
+    QByteArray m_encoded;
+    mutable QAtomicPointer<QByteArray> m_decoded;
+};
+
+#endif
@@ -23,6 +23,7 @@
 
 #include "QXmppBitsOfBinaryData.h"
 
+#include "QXmppBase64_p.h"
 #include "QXmppBitsOfBinaryContentId.h"
 #include "QXmppConstants_p.h"
 #include "QXmppUtils.h"
@@ -41,7 +42,9 @@ public:
     QXmppBitsOfBinaryContentId cid;
     int maxAge;
     QMimeType contentType;
-    QByteArray data;
+
+    // the parsed base64 data is only decoded on first use
+    QXmppLazyBase64 data;
 };
 
 QXmppBitsOfBinaryDataPrivate::QXmppBitsOfBinaryDataPrivate()
@@ -116,17 +119,19 @@ void QXmppBitsOfBinaryData::setContentType(const QMimeType &contentType)
 }
 
 /// Returns the included data in binary form
+///
+/// Parsed data is only decoded the first time it is accessed.
 
 QByteArray QXmppBitsOfBinaryData::data() const
 {
-    return d->data;
+    return d->data.data();
 }
 
 /// Sets the data in binary form
 
 void QXmppBitsOfBinaryData::setData(const QByteArray &data)
 {
-    d->data = data;
+    d->data.setData(data);
 }
 
 /// Returns true, if \c element is a \xep{0231}: Bits of Binary data element
@@ -142,7 +147,7 @@ void QXmppBitsOfBinaryData::parseElementFromChild(const QDomElement &dataElement
     d->cid = QXmppBitsOfBinaryContentId::fromContentId(dataElement.attribute(QStringLiteral("cid")));
     d->maxAge = dataElement.attribute(QStringLiteral("max-age"), QStringLiteral("-1")).toInt();
     d->contentType = QMimeDatabase().mimeTypeForName(dataElement.attribute(QStringLiteral("type")));
-    d->data = QByteArray::fromBase64(dataElement.text().toUtf8());
+    d->data.setBase64(dataElement.text().toLatin1());
 }
 
 void QXmppBitsOfBinaryData::toXmlElementFromChild(QXmlStreamWriter *writer) const
@@ -163,5 +168,5 @@ bool QXmppBitsOfBinaryData::operator==(const QXmppBitsOfBinaryData &other) const
     return d->cid == other.cid() &&
         d->maxAge == other.maxAge() &&
         d->contentType == other.contentType() &&
-        d->data == other.data();
+        d->data.data() == other.data();
 }
@@ -0,0 +1,376 @@
+/*
+ * Copyright (C) 2008-2020 The QXmpp developers
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "QXmppCompression_p.h"
+
+#include "QXmppConstants_p.h"
+
+#include <QDomElement>
+#include <QElapsedTimer>
+#include <QStringList>
+#include <QXmlStreamWriter>
+
+#ifdef QXMPP_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef Q_OS_UNIX
+#include <time.h>
+#endif
+
+static const QStringList COMPRESS_TYPES = {
+    QStringLiteral("compress"),
+    QStringLiteral("compressed"),
+    QStringLiteral("failure")
+};
+
+// size of the chunks produced by zlib
+static const int CHUNK_SIZE = 16384;
+
+QXmppCompressPacket::QXmppCompressPacket(Type type)
+    : m_type(type)
+{
+}
+
+/// Returns the type of the packet.
+
+QXmppCompressPacket::Type QXmppCompressPacket::type() const
+{
+    return m_type;
+}
+
+/// Sets the type of the packet.
+///
+/// \param type
+
+void QXmppCompressPacket::setType(Type type)
+{
+    m_type = type;
+}
+
+/// Returns the compression method requested by a Compress packet.
+
+QString QXmppCompressPacket::method() const
+{
+    return m_method;
+}
+
+/// Sets the compression method requested by a Compress packet.
+///
+/// \param method
+
+void QXmppCompressPacket::setMethod(const QString &method)
+{
+    m_method = method;
+}
+
+/// Returns the error condition of a Failure packet, for instance
+/// "unsupported-method" or "setup-failed".
+
+QString QXmppCompressPacket::condition() const
+{
+    return m_condition;
+}
+
+/// Sets the error condition of a Failure packet.
+///
+/// \param condition
+
+void QXmppCompressPacket::setCondition(const QString &condition)
+{
+    m_condition = condition;
+}
+
+/// Returns true if the element is a stream compression negotiation packet.
+///
+/// \param element
+
+bool QXmppCompressPacket::isCompressPacket(const QDomElement &element)
+{
+    return element.namespaceURI() == ns_compress && COMPRESS_TYPES.contains(element.tagName());
+}
+
+/// \cond
+void QXmppCompressPacket::parse(const QDomElement &element)
+{
+    if (!isCompressPacket(element))
+        return;
+
+    m_type = Type(COMPRESS_TYPES.indexOf(element.tagName()));
+    m_method = element.firstChildElement(QStringLiteral("method")).text();
+    m_condition = element.firstChildElement().tagName();
+    if (m_type != Failure)
+        m_condition.clear();
+}
+
+void QXmppCompressPacket::toXml(QXmlStreamWriter *writer) const
+{
+    writer->writeStartElement(COMPRESS_TYPES.at(int(m_type)));
+    writer->writeDefaultNamespace(ns_compress);
+    if (m_type == Compress)
+        writer->writeTextElement(QStringLiteral("method"), m_method);
+    else if (m_type == Failure && !m_condition.isEmpty())
+        writer->writeEmptyElement(m_condition);
+    writer->writeEndElement();
+}
+/// \endcond
+
+class QXmppStreamCompressorPrivate
+{
+public:
+    int level;
+    bool deflateValid;
+    bool inflateValid;
+#ifdef QXMPP_ZLIB
+    z_stream deflateStream;
+    z_stream inflateStream;
+#endif
+
+    qint64 uncompressedBytesWritten;
+    qint64 compressedBytesWritten;
+    qint64 compressedBytesRead;
+    qint64 uncompressedBytesRead;
+    qint64 cpuTime;
+};
+
+// Returns the CPU time consumed by the calling thread in nanoseconds, or -1
+// if the platform does not provide a per-thread CPU clock.
+
+static qint64 threadCpuTime()
+{
+#if defined(Q_OS_UNIX) && defined(CLOCK_THREAD_CPUTIME_ID)
+    timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0)
+        return qint64(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+#endif
+    return -1;
+}
+
+// Measures the CPU time spent by the calling thread, falling back to
+// wall-clock time where no per-thread CPU clock is available.
+
+class QXmppCpuTimer
+{
+public:
+    QXmppCpuTimer()
+        : m_start(threadCpuTime())
+    {
+        if (m_start < 0)
+            m_wallClock.start();
+    }
+
+    qint64 nsecsElapsed() const
+    {
+        if (m_start < 0)
+            return m_wallClock.nsecsElapsed();
+        return threadCpuTime() - m_start;
+    }
+
+private:
+    qint64 m_start;
+    QElapsedTimer m_wallClock;
+};
+
+/// Constructs a compressor using the given zlib compression \a level,
+/// from 0 (no compression) to 9 (best compression), or -1 for the zlib
+/// default.
+///
+/// \param level
+
+QXmppStreamCompressor::QXmppStreamCompressor(int level)
+    : d(new QXmppStreamCompressorPrivate)
+{
+    d->level = level;
+    d->deflateValid = false;
+    d->inflateValid = false;
+    d->uncompressedBytesWritten = 0;
+    d->compressedBytesWritten = 0;
+    d->compressedBytesRead = 0;
+    d->uncompressedBytesRead = 0;
+    d->cpuTime = 0;
+
+#ifdef QXMPP_ZLIB
+    d->deflateStream.zalloc = Z_NULL;
+    d->deflateStream.zfree = Z_NULL;
+    d->deflateStream.opaque = Z_NULL;
+    d->deflateValid = (deflateInit(&d->deflateStream, level) == Z_OK);
+
+    d->inflateStream.zalloc = Z_NULL;
+    d->inflateStream.zfree = Z_NULL;
+    d->inflateStream.opaque = Z_NULL;
+    d->inflateStream.next_in = Z_NULL;
+    d->inflateStream.avail_in = 0;
+    d->inflateValid = (inflateInit(&d->inflateStream) == Z_OK);
+#endif
+}
+
+QXmppStreamCompressor::~QXmppStreamCompressor()
+{
+#ifdef QXMPP_ZLIB
+    if (d->deflateValid)
+        deflateEnd(&d->deflateStream);
+    if (d->inflateValid)
+        inflateEnd(&d->inflateStream);
+#endif
+    delete d;
+}
+
+/// Returns true if QXmpp was built with zlib support.
+
+bool QXmppStreamCompressor::isSupported()
+{
+#ifdef QXMPP_ZLIB
+    return true;
+#else
+    return false;
+#endif
+}
+
+/// Returns true if the zlib contexts were successfully initialised.
+
+bool QXmppStreamCompressor::isValid() const
+{
+    return d->deflateValid && d->inflateValid;
+}
+
+/// Returns the zlib compression level.
+
+int QXmppStreamCompressor::level() const
+{
+    return d->level;
+}
+
+/// Compresses \a data and flushes the result to \a output.
+///
+/// Returns false if a compression error occurred.
+///
+/// \param data
+/// \param output
+
+bool QXmppStreamCompressor::compress(const QByteArray &data, QByteArray &output)
+{
+    output.clear();
+#ifdef QXMPP_ZLIB
+    if (!d->deflateValid)
+        return false;
+
+    const QXmppCpuTimer timer;
+
+    char buffer[CHUNK_SIZE];
+    d->deflateStream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data.constData()));
+    d->deflateStream.avail_in = uInt(data.size());
+    do {
+        d->deflateStream.next_out = reinterpret_cast<Bytef *>(buffer);
+        d->deflateStream.avail_out = CHUNK_SIZE;
+        const int ret = deflate(&d->deflateStream, Z_SYNC_FLUSH);
+        if (ret != Z_OK && ret != Z_BUF_ERROR)
+            return false;
+        output.append(buffer, CHUNK_SIZE - int(d->deflateStream.avail_out));
+    } while (d->deflateStream.avail_out == 0);
+
+    d->cpuTime += timer.nsecsElapsed();
+    d->uncompressedBytesWritten += data.size();
+    d->compressedBytesWritten += output.size();
+    return true;
+#else
+    Q_UNUSED(data);
+    return false;
+#endif
+}
+
+/// Decompresses \a data and stores the result to \a output.
+///
+/// Returns false if the data could not be decompressed.
+///
+/// \param data
+/// \param output
+
+bool QXmppStreamCompressor::decompress(const QByteArray &data, QByteArray &output)
+{
+    output.clear();
+#ifdef QXMPP_ZLIB
+    if (!d->inflateValid)
+        return false;
+    if (data.isEmpty())
+        return true;
+
+    const QXmppCpuTimer timer;
+
+    char buffer[CHUNK_SIZE];
+    d->inflateStream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data.constData()));
+    d->inflateStream.avail_in = uInt(data.size());
+    do {
+        d->inflateStream.next_out = reinterpret_cast<Bytef *>(buffer);
+        d->inflateStream.avail_out = CHUNK_SIZE;
+        const int ret = inflate(&d->inflateStream, Z_SYNC_FLUSH);
+        if (ret != Z_OK && ret != Z_BUF_ERROR && ret != Z_STREAM_END)
+            return false;
+        output.append(buffer, CHUNK_SIZE - int(d->inflateStream.avail_out));
+        if (ret == Z_STREAM_END)
+            break;
+    } while (d->inflateStream.avail_out == 0);
+
+    d->cpuTime += timer.nsecsElapsed();
+    d->compressedBytesRead += data.size();
+    d->uncompressedBytesRead += output.size();
+    return true;
+#else
+    Q_UNUSED(data);
+    return false;
+#endif
+}
+
+/// Returns the number of bytes passed to compress().
+
+qint64 QXmppStreamCompressor::uncompressedBytesWritten() const
+{
+    return d->uncompressedBytesWritten;
+}
+
+/// Returns the number of bytes produced by compress().
+
+qint64 QXmppStreamCompressor::compressedBytesWritten() const
+{
+    return d->compressedBytesWritten;
+}
+
+/// Returns the number of bytes passed to decompress().
+
+qint64 QXmppStreamCompressor::compressedBytesRead() const
+{
+    return d->compressedBytesRead;
+}
+
+/// Returns the number of bytes produced by decompress().
+
+qint64 QXmppStreamCompressor::uncompressedBytesRead() const
+{
+    return d->uncompressedBytesRead;
+}
+
+/// Returns the CPU time spent compressing and decompressing, in nanoseconds.
+///
+/// Where the platform has no per-thread CPU clock, the elapsed wall-clock
+/// time is counted instead.
+
+qint64 QXmppStreamCompressor::cpuTime() const
+{
+    return d->cpuTime;
+}
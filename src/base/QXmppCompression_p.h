@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2008-2020 The QXmpp developers
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPCOMPRESSION_P_H
+#define QXMPPCOMPRESSION_P_H
+
+#include "QXmppStanza.h"
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API. It exists for the convenience
+// of the QXmppStream class and its subclasses.
+//
+// This header file may change from version to version without notice,
+// or even be removed.
+//
+// We mean it.
+//
+
+class QXmppStreamCompressorPrivate;
+
+/// \internal
+///
+/// The QXmppCompressPacket class represents the packets used to negotiate
+/// stream compression as defined by \xep{0138}: Stream Compression.
+///
+
+class QXMPP_AUTOTEST_EXPORT QXmppCompressPacket : public QXmppStanza
+{
+public:
+    enum Type {
+        Compress,    ///< Used by the client to request compression.
+        Compressed,  ///< Used by the server to accept compression.
+        Failure      ///< Used by the server to reject compression.
+    };
+
+    QXmppCompressPacket(Type type = Compress);
+
+    Type type() const;
+    void setType(Type type);
+
+    QString method() const;
+    void setMethod(const QString &method);
+
+    QString condition() const;
+    void setCondition(const QString &condition);
+
+    static bool isCompressPacket(const QDomElement &element);
+
+    /// \cond
+    void parse(const QDomElement &element) override;
+    void toXml(QXmlStreamWriter *writer) const override;
+    /// \endcond
+
+private:
+    Type m_type;
+    QString m_method;
+    QString m_condition;
+};
+
+/// \internal
+///
+/// The QXmppStreamCompressor class holds the zlib contexts used to compress
+/// the outgoing and decompress the incoming data of a stream.
+///
+/// Each call to compress() ends with a sync flush, so that the peer can
+/// process everything which was written so far.
+///
+
+class QXMPP_AUTOTEST_EXPORT QXmppStreamCompressor
+{
+public:
+    QXmppStreamCompressor(int level = -1);
+    ~QXmppStreamCompressor();
+
+    static bool isSupported();
+
+    bool isValid() const;
+    int level() const;
+
+    bool compress(const QByteArray &data, QByteArray &output);
+    bool decompress(const QByteArray &data, QByteArray &output);
+
+    qint64 uncompressedBytesWritten() const;
+    qint64 compressedBytesWritten() const;
+    qint64 compressedBytesRead() const;
+    qint64 uncompressedBytesRead() const;
+    qint64 cpuTime() const;
+
+private:
+    Q_DISABLE_COPY(QXmppStreamCompressor)
+    QXmppStreamCompressorPrivate *const d;
+};
+
+#endif
@@ -0,0 +1,391 @@
+/*
+ * Copyright (C) 2008-2020 The QXmpp developers
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "QXmppConnectionRacer_p.h"
+
+#include "QXmppUtils.h"
+
+#include <QHostInfo>
+#include <QMap>
+#include <QNetworkProxy>
+#include <QTcpSocket>
+#include <QTimer>
+
+#include <algorithm>
+
+#ifdef Q_OS_UNIX
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// RFC 8305 recommends a delay of 250 ms between connection attempts
+static const int DEFAULT_ATTEMPT_DELAY = 250;
+
+// Orders the records of a single priority according to their weight, as
+// described in RFC 2782.
+static QList<QXmppServiceRecord> weightedOrder(QList<QXmppServiceRecord> records)
+{
+    // records with a weight of 0 are placed first
+    std::stable_sort(records.begin(), records.end(), [](const QXmppServiceRecord &a, const QXmppServiceRecord &b) {
+        return a.weight == 0 && b.weight != 0;
+    });
+
+    QList<QXmppServiceRecord> ordered;
+    while (!records.isEmpty()) {
+        int weightSum = 0;
+        for (const auto &record : qAsConst(records))
+            weightSum += record.weight;
+
+        // select the first record whose running sum is greater than or
+        // equal to a random number between 0 and the sum of the weights
+        const int selection = QXmppUtils::generateRandomInteger(weightSum + 1);
+        int runningSum = 0;
+        for (int i = 0; i < records.size(); ++i) {
+            runningSum += records.at(i).weight;
+            if (runningSum >= selection) {
+                ordered << records.takeAt(i);
+                break;
+            }
+        }
+    }
+    return ordered;
+}
+
+// Returns a copy of the native descriptor of a connected socket, which stays
+// open once the socket is destroyed, or -1 if descriptors cannot be shared.
+static qintptr duplicateDescriptor(QTcpSocket *socket)
+{
+#ifdef Q_OS_UNIX
+    const qintptr descriptor = socket->socketDescriptor();
+    if (descriptor < 0)
+        return -1;
+    return ::fcntl(int(descriptor), F_DUPFD_CLOEXEC, 0);
+#else
+    Q_UNUSED(socket);
+    return -1;
+#endif
+}
+
+// Interleaves IPv6 and IPv4 addresses, starting with IPv6 (RFC 8305, section 4).
+static QList<QHostAddress> interleaveAddresses(const QList<QHostAddress> &addresses)
+{
+    QList<QHostAddress> ipv6, ipv4;
+    for (const auto &address : addresses) {
+        if (address.protocol() == QAbstractSocket::IPv6Protocol)
+            ipv6 << address;
+        else
+            ipv4 << address;
+    }
+
+    QList<QHostAddress> interleaved;
+    while (!ipv6.isEmpty() || !ipv4.isEmpty()) {
+        if (!ipv6.isEmpty())
+            interleaved << ipv6.takeFirst();
+        if (!ipv4.isEmpty())
+            interleaved << ipv4.takeFirst();
+    }
+    return interleaved;
+}
+
+QXmppConnectionRacer::QXmppConnectionRacer(QObject *parent)
+    : QXmppLoggable(parent),
+      m_attemptTimer(new QTimer(this)),
+      m_running(false)
+{
+    m_attemptTimer->setSingleShot(true);
+    m_attemptTimer->setInterval(DEFAULT_ATTEMPT_DELAY);
+    connect(m_attemptTimer, &QTimer::timeout, this, &QXmppConnectionRacer::startNextAttempt);
+    connect(QXmppDnsCache::instance(), &QXmppDnsCache::finished, this, &QXmppConnectionRacer::_q_dnsLookupFinished);
+}
+
+QXmppConnectionRacer::~QXmppConnectionRacer()
+{
+    abort();
+}
+
+/// Returns the delay in milliseconds after which the next connection attempt
+/// is started if the current one has not completed yet.
+
+int QXmppConnectionRacer::attemptDelay() const
+{
+    return m_attemptTimer->interval();
+}
+
+/// Sets the delay in milliseconds after which the next connection attempt
+/// is started if the current one has not completed yet.
+///
+/// \param msecs
+
+void QXmppConnectionRacer::setAttemptDelay(int msecs)
+{
+    m_attemptTimer->setInterval(msecs);
+}
+
+/// Returns true if the racer is looking up or connecting to addresses.
+
+bool QXmppConnectionRacer::isRunning() const
+{
+    return m_running;
+}
+
+/// Starts racing connections to the given \a records, which are expected
+/// to be sorted by order of preference.
+///
+/// \param records
+
+void QXmppConnectionRacer::start(const QList<QXmppServiceRecord> &records)
+{
+    abort();
+    m_running = true;
+
+    for (const auto &record : records) {
+        Target target;
+        target.record = record;
+        m_targets << target;
+    }
+
+    // resolve all host names concurrently
+    for (auto &target : m_targets) {
+        QHostAddress address;
+        if (address.setAddress(target.record.host)) {
+            target.resolved = true;
+            target.addresses << address;
+        } else {
+            target.ipv6Pending = true;
+            target.ipv4Pending = true;
+            QXmppDnsCache::instance()->lookup(target.record.host, QDnsLookup::AAAA);
+            QXmppDnsCache::instance()->lookup(target.record.host, QDnsLookup::A);
+        }
+    }
+
+    startNextAttempt();
+}
+
+/// Aborts all pending host lookups and connection attempts.
+
+void QXmppConnectionRacer::abort()
+{
+    for (const auto &target : qAsConst(m_targets)) {
+        if (!target.resolved && target.lookupId >= 0)
+            QHostInfo::abortHostLookup(target.lookupId);
+    }
+    m_targets.clear();
+    clearAttempts();
+    m_attemptTimer->stop();
+    m_running = false;
+}
+
+/// Sorts service records by priority and weight, as described in RFC 2782.
+///
+/// Within a priority, Direct TLS records are preferred as they save a round
+/// trip and a stream restart.
+///
+/// \param records
+
+QList<QXmppServiceRecord> QXmppConnectionRacer::sortServiceRecords(const QList<QXmppServiceRecord> &records)
+{
+    QMap<quint16, QList<QXmppServiceRecord>> directTlsRecords, startTlsRecords;
+    for (const auto &record : records) {
+        if (record.directTls)
+            directTlsRecords[record.priority] << record;
+        else
+            startTlsRecords[record.priority] << record;
+    }
+
+    QList<quint16> priorities = directTlsRecords.keys() + startTlsRecords.keys();
+    std::sort(priorities.begin(), priorities.end());
+    priorities.erase(std::unique(priorities.begin(), priorities.end()), priorities.end());
+
+    QList<QXmppServiceRecord> sorted;
+    for (const auto priority : qAsConst(priorities)) {
+        sorted << weightedOrder(directTlsRecords.value(priority));
+        sorted << weightedOrder(startTlsRecords.value(priority));
+    }
+    return sorted;
+}
+
+void QXmppConnectionRacer::_q_dnsLookupFinished(const QString &name, QDnsLookup::Type type, const QXmppDnsResult &result)
+{
+    if (type != QDnsLookup::A && type != QDnsLookup::AAAA)
+        return;
+
+    bool changed = false;
+    for (auto &target : m_targets) {
+        if (target.resolved || target.lookupId >= 0 ||
+            target.record.host.compare(name, Qt::CaseInsensitive) != 0)
+            continue;
+
+        if (type == QDnsLookup::AAAA && target.ipv6Pending) {
+            target.ipv6Pending = false;
+            target.ipv6Addresses = result.addresses;
+        } else if (type == QDnsLookup::A && target.ipv4Pending) {
+            target.ipv4Pending = false;
+            target.ipv4Addresses = result.addresses;
+        } else {
+            continue;
+        }
+
+        if (target.ipv6Pending || target.ipv4Pending)
+            continue;
+
+        if (target.ipv6Addresses.isEmpty() && target.ipv4Addresses.isEmpty()) {
+            // the name may not be in the DNS, ask the system resolver
+            target.lookupId = QHostInfo::lookupHost(target.record.host, this, SLOT(_q_hostLookupFinished(QHostInfo)));
+        } else {
+            targetResolved(target, target.ipv6Addresses + target.ipv4Addresses);
+            changed = true;
+        }
+    }
+
+    // start connecting right away unless we are waiting for a pending
+    // attempt to complete
+    if (changed && !m_attemptTimer->isActive())
+        startNextAttempt();
+}
+
+void QXmppConnectionRacer::_q_hostLookupFinished(const QHostInfo &hostInfo)
+{
+    for (auto &target : m_targets) {
+        if (target.resolved || target.lookupId != hostInfo.lookupId())
+            continue;
+
+        if (hostInfo.error() != QHostInfo::NoError)
+            warning(QStringLiteral("Lookup for host %1 failed: %2").arg(target.record.host, hostInfo.errorString()));
+        targetResolved(target, hostInfo.addresses());
+        break;
+    }
+
+    if (!m_attemptTimer->isActive())
+        startNextAttempt();
+}
+
+void QXmppConnectionRacer::_q_attemptConnected()
+{
+    const int targetIndex = takeAttempt(sender());
+    if (targetIndex < 0)
+        return;
+
+    auto *socket = qobject_cast<QTcpSocket *>(sender());
+    const QHostAddress address = socket->peerAddress();
+    const QXmppServiceRecord record = m_targets.at(targetIndex).record;
+
+    // the connection lives on in the duplicated descriptor, which is not
+    // affected by closing the socket's own descriptor
+    const qintptr descriptor = duplicateDescriptor(socket);
+    socket->disconnect(this);
+    socket->abort();
+    socket->deleteLater();
+
+    debug(QStringLiteral("Connection to %1 [%2]:%3 won the race").arg(record.host, address.toString(), QString::number(record.port)));
+    abort();
+    emit finished(record, address, descriptor);
+}
+
+void QXmppConnectionRacer::_q_attemptError()
+{
+    const int targetIndex = takeAttempt(sender());
+    if (targetIndex < 0)
+        return;
+
+    auto *socket = qobject_cast<QTcpSocket *>(sender());
+    debug(QStringLiteral("Connection to %1 failed: %2").arg(m_targets.at(targetIndex).record.host, socket->errorString()));
+    socket->deleteLater();
+
+    // do not wait for the attempt delay to expire
+    startNextAttempt();
+}
+
+void QXmppConnectionRacer::startNextAttempt()
+{
+    if (!m_running)
+        return;
+
+    for (int i = 0; i < m_targets.size(); ++i) {
+        Target &target = m_targets[i];
+
+        // targets whose lookup is still pending are skipped, so that a slow
+        // resolver does not hold up the other targets
+        if (!target.resolved || target.nextAddress >= target.addresses.size())
+            continue;
+
+        const QHostAddress address = target.addresses.at(target.nextAddress++);
+        debug(QStringLiteral("Trying %1 [%2]:%3").arg(target.record.host, address.toString(), QString::number(target.record.port)));
+
+        auto *socket = new QTcpSocket(this);
+        socket->setProxy(QNetworkProxy::NoProxy);
+        connect(socket, &QAbstractSocket::connected, this, &QXmppConnectionRacer::_q_attemptConnected);
+        connect(socket, QOverload<QAbstractSocket::SocketError>::of(&QAbstractSocket::error), this, &QXmppConnectionRacer::_q_attemptError);
+        m_attempts << Attempt { socket, i };
+        socket->connectToHost(address, target.record.port);
+
+        m_attemptTimer->start();
+        return;
+    }
+
+    checkFailed();
+}
+
+void QXmppConnectionRacer::targetResolved(Target &target, const QList<QHostAddress> &addresses)
+{
+    target.resolved = true;
+    target.addresses = interleaveAddresses(addresses);
+}
+
+// Emits failed() once all addresses have been tried unsuccessfully.
+
+void QXmppConnectionRacer::checkFailed()
+{
+    if (!m_running || !m_attempts.isEmpty())
+        return;
+
+    for (const auto &target : qAsConst(m_targets)) {
+        if (!target.resolved || target.nextAddress < target.addresses.size())
+            return;
+    }
+
+    warning("Could not connect to any of the addresses");
+    abort();
+    emit failed();
+}
+
+void QXmppConnectionRacer::clearAttempts()
+{
+    for (const auto &attempt : qAsConst(m_attempts)) {
+        attempt.socket->disconnect(this);
+        attempt.socket->abort();
+        attempt.socket->deleteLater();
+    }
+    m_attempts.clear();
+}
+
+// Removes the attempt for the given socket and returns the index of its
+// target, or -1 if the socket is unknown.
+
+int QXmppConnectionRacer::takeAttempt(QObject *socket)
+{
+    for (int i = 0; i < m_attempts.size(); ++i) {
+        if (m_attempts.at(i).socket == socket) {
+            const int target = m_attempts.at(i).target;
+            m_attempts.removeAt(i);
+            return target;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2008-2020 The QXmpp developers
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPCONNECTIONRACER_P_H
+#define QXMPPCONNECTIONRACER_P_H
+
+#include "QXmppDnsCache_p.h"
+
+#include <QHostAddress>
+#include <QList>
+
+class QHostInfo;
+class QTcpSocket;
+class QTimer;
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API. It exists for the convenience
+// of the QXmppOutgoingClient and QXmppOutgoingServer classes.
+//
+// This header file may change from version to version without notice,
+// or even be removed.
+//
+// We mean it.
+//
+
+/// \internal
+///
+/// The QXmppConnectionRacer class finds the first reachable address among a
+/// list of service records.
+///
+/// The host name of each record is resolved to its IPv6 and IPv4 addresses
+/// using the QXmppDnsCache, falling back to the system resolver for names
+/// which are not in the DNS (such as those from the hosts file), and TCP
+/// connection attempts are started in record order, each one after a short
+/// delay or as soon as the previous one failed (RFC 8305, "Happy Eyeballs").
+/// The first attempt which succeeds wins and all other attempts are aborted.
+///
+/// Where the platform allows it, the native descriptor of the winning
+/// connection is handed over so that it can be adopted by the stream's
+/// socket without connecting again.
+///
+
+class QXMPP_AUTOTEST_EXPORT QXmppConnectionRacer : public QXmppLoggable
+{
+    Q_OBJECT
+
+public:
+    QXmppConnectionRacer(QObject *parent = nullptr);
+    ~QXmppConnectionRacer() override;
+
+    int attemptDelay() const;
+    void setAttemptDelay(int msecs);
+
+    bool isRunning() const;
+
+    void start(const QList<QXmppServiceRecord> &records);
+    void abort();
+
+    static QList<QXmppServiceRecord> sortServiceRecords(const QList<QXmppServiceRecord> &records);
+
+Q_SIGNALS:
+    /// This signal is emitted when a connection to \a address succeeded.
+    ///
+    /// The receiver takes ownership of \a socketDescriptor, which is the
+    /// connected native socket or -1 if it could not be transferred, in
+    /// which case the receiver has to connect to \a address again.
+    void finished(const QXmppServiceRecord &record, const QHostAddress &address, qintptr socketDescriptor);
+
+    /// This signal is emitted when no address could be reached.
+    void failed();
+
+private Q_SLOTS:
+    void _q_dnsLookupFinished(const QString &name, QDnsLookup::Type type, const QXmppDnsResult &result);
+    void _q_hostLookupFinished(const QHostInfo &hostInfo);
+    void _q_attemptConnected();
+    void _q_attemptError();
+    void startNextAttempt();
+
+private:
+    struct Target
+    {
+        QXmppServiceRecord record;
+        bool ipv6Pending = false;
+        bool ipv4Pending = false;
+        QList<QHostAddress> ipv6Addresses;
+        QList<QHostAddress> ipv4Addresses;
+        int lookupId = -1;
+        bool resolved = false;
+        QList<QHostAddress> addresses;
+        int nextAddress = 0;
+    };
+
+    struct Attempt
+    {
+        QTcpSocket *socket;
+        int target;
+    };
+
+    void checkFailed();
+    void targetResolved(Target &target, const QList<QHostAddress> &addresses);
+    void clearAttempts();
+    int takeAttempt(QObject *socket);
+
+    QList<Target> m_targets;
+    QList<Attempt> m_attempts;
+    QTimer *m_attemptTimer;
+    bool m_running;
+};
+
+#endif
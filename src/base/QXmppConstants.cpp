@@ -83,6 +83,8 @@ const char* ns_data = "jabber:x:data";
 // XEP-0095: Stream Initiation
 const char* ns_stream_initiation = "http://jabber.org/protocol/si";
 const char* ns_stream_initiation_file_transfer = "http://jabber.org/protocol/si/profile/file-transfer";
+// Ranges of XEP-0096 proposed by the sender, a QXmpp extension
+const char* ns_stream_initiation_file_transfer_ranges = "urn:qxmpp:si-file-transfer:ranges:0";
 // XEP-0108: User Activity
 const char* ns_activity = "http://jabber.org/protocol/activity";
 // XEP-0115: Entity Capabilities
@@ -129,6 +131,9 @@ const char* ns_conference = "jabber:x:conference";
 const char* ns_carbons = "urn:xmpp:carbons:2";
 // XEP-0297: Stanza Forwarding
 const char* ns_forwarding = "urn:xmpp:forward:0";
+// XEP-0300: Use of Cryptographic Hash Functions in XMPP
+const char* ns_hashes = "urn:xmpp:hashes:2";
+const char* ns_hash_function_text_names = "urn:xmpp:hash-function-text-names";
 // XEP-0308: Last Message Correction
 const char* ns_message_correct = "urn:xmpp:message-correct:0";
 // XEP-0313: Message Archive Management
@@ -168,6 +173,10 @@ const char* ns_eme = "urn:xmpp:eme:0";
 const char* ns_spoiler = "urn:xmpp:spoiler:0";
 // XEP-0384: OMEMO Encryption
 const char* ns_omemo = "eu.siacs.conversations.axolotl";
+// XEP-0386: Bind 2
+const char* ns_bind2 = "urn:xmpp:bind:0";
+// XEP-0388: Extensible SASL Profile
+const char* ns_sasl_2 = "urn:xmpp:sasl:2";
 // XEP-0405: Mediated Information eXchange (MIX): Participant Server Requirements
 const char* ns_mix_pam = "urn:xmpp:mix:pam:1";
 const char* ns_mix_roster = "urn:xmpp:mix:roster:0";
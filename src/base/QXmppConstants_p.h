@@ -95,6 +95,8 @@ extern const char* ns_data;
 // XEP-0095: Stream Initiation
 extern const char* ns_stream_initiation;
 extern const char* ns_stream_initiation_file_transfer;
+// Ranges of XEP-0096 proposed by the sender, a QXmpp extension
+extern const char* ns_stream_initiation_file_transfer_ranges;
 // XEP-0108: User Activity
 extern const char* ns_activity;
 // XEP-0115: Entity Capabilities
@@ -141,6 +143,9 @@ extern const char* ns_conference;
 extern const char* ns_carbons;
 // XEP-0297: Stanza Forwarding
 extern const char* ns_forwarding;
+// XEP-0300: Use of Cryptographic Hash Functions in XMPP
+extern const char* ns_hashes;
+extern const char* ns_hash_function_text_names;
 // XEP-0308: Last Message Correction
 extern const char* ns_message_correct;
 // XEP-0313: Message Archive Management
@@ -180,6 +185,10 @@ extern const char* ns_eme;
 extern const char* ns_spoiler;
 // XEP-0384: OMEMO Encryption
 extern const char* ns_omemo;
+// XEP-0386: Bind 2
+extern const char* ns_bind2;
+// XEP-0388: Extensible SASL Profile
+extern const char* ns_sasl_2;
 // XEP-0405: Mediated Information eXchange (MIX): Participant Server Requirements
 extern const char* ns_mix_pam;
 extern const char* ns_mix_roster;
@@ -0,0 +1,273 @@
+/*
+ * Copyright (C) 2008-2020 The QXmpp developers
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "QXmppDnsCache_p.h"
+
+#include <QDnsLookup>
+#include <QThreadStorage>
+
+#include <limits>
+
+// default time to live of negative answers, in seconds
+static const int DEFAULT_NEGATIVE_TTL = 60;
+
+// upper bound for the time to live of positive answers, in seconds
+static const qint64 MAXIMUM_TTL = 86400;
+
+// number of hits after which an entry is refreshed ahead of its expiry
+static const int POPULAR_HITS = 2;
+
+// maximum number of entries kept in the cache
+static const int MAXIMUM_ENTRIES = 1024;
+
+static QString cacheKey(const QString &name, QDnsLookup::Type type)
+{
+    return QString::number(type) + QLatin1Char(' ') + name;
+}
+
+QXmppDnsResult::QXmppDnsResult()
+    : error(QDnsLookup::NoError),
+      timeToLive(0)
+{
+}
+
+QXmppDnsResolver::QXmppDnsResolver(QObject *parent)
+    : QObject(parent)
+{
+}
+
+/// Starts a lookup of the given \a type for \a name.
+///
+/// The finished() signal is emitted once the lookup has completed.
+///
+/// \param name
+/// \param type
+
+void QXmppDnsResolver::lookup(const QString &name, QDnsLookup::Type type)
+{
+    auto *dns = new QDnsLookup(type, name, this);
+    connect(dns, &QDnsLookup::finished, this, [this, dns]() {
+        QXmppDnsResult result;
+        result.error = dns->error();
+        result.errorString = dns->errorString();
+
+        // the answer is valid as long as its shortest-lived record
+        quint32 ttl = std::numeric_limits<quint32>::max();
+        if (dns->type() == QDnsLookup::SRV) {
+            const auto records = dns->serviceRecords();
+            for (const auto &record : records) {
+                result.serviceRecords << QXmppServiceRecord { record.target(), record.port(), record.priority(), record.weight(), false };
+                ttl = qMin(ttl, record.timeToLive());
+            }
+        } else {
+            const auto records = dns->hostAddressRecords();
+            for (const auto &record : records) {
+                result.addresses << record.value();
+                ttl = qMin(ttl, record.timeToLive());
+            }
+        }
+        if (!result.serviceRecords.isEmpty() || !result.addresses.isEmpty())
+            result.timeToLive = ttl;
+
+        dns->deleteLater();
+        emit finished(dns->name(), dns->type(), result);
+    });
+    dns->lookup();
+}
+
+// QDnsLookup and timers are bound to a thread, so each thread gets its own
+// cache
+Q_GLOBAL_STATIC(QThreadStorage<QXmppDnsCache *>, threadCaches)
+
+/// Constructs a new DNS cache.
+///
+/// \param parent
+
+QXmppDnsCache::QXmppDnsCache(QObject *parent)
+    : QXmppLoggable(parent),
+      m_resolver(nullptr),
+      m_negativeTtl(DEFAULT_NEGATIVE_TTL)
+{
+    qRegisterMetaType<QDnsLookup::Type>();
+    qRegisterMetaType<QXmppDnsResult>();
+    m_clock.start();
+    setResolver(new QXmppDnsResolver);
+}
+
+QXmppDnsCache::~QXmppDnsCache()
+{
+}
+
+/// Returns the DNS cache shared by all streams of the calling thread.
+
+QXmppDnsCache *QXmppDnsCache::instance()
+{
+    QThreadStorage<QXmppDnsCache *> *caches = threadCaches();
+    if (!caches->hasLocalData())
+        caches->setLocalData(new QXmppDnsCache());
+
+    return caches->localData();
+}
+
+/// Returns the resolver used to perform lookups.
+
+QXmppDnsResolver *QXmppDnsCache::resolver() const
+{
+    return m_resolver;
+}
+
+/// Sets the resolver used to perform lookups and takes ownership of it.
+///
+/// The cache is cleared as its entries came from the previous resolver.
+///
+/// \param resolver
+
+void QXmppDnsCache::setResolver(QXmppDnsResolver *resolver)
+{
+    if (m_resolver == resolver)
+        return;
+
+    delete m_resolver;
+    m_resolver = resolver;
+    m_resolver->setParent(this);
+    connect(m_resolver, &QXmppDnsResolver::finished, this, &QXmppDnsCache::_q_resolverFinished);
+    m_pending.clear();
+    clear();
+}
+
+/// Returns the number of seconds for which non-existent names are cached.
+
+int QXmppDnsCache::negativeTtl() const
+{
+    return m_negativeTtl;
+}
+
+/// Sets the number of seconds for which non-existent names are cached.
+///
+/// \param secs
+
+void QXmppDnsCache::setNegativeTtl(int secs)
+{
+    m_negativeTtl = secs;
+}
+
+/// Looks up records of the given \a type for \a name.
+///
+/// The finished() signal is always emitted asynchronously, even when the
+/// answer is cached.
+///
+/// \param name
+/// \param type
+
+void QXmppDnsCache::lookup(const QString &name, QDnsLookup::Type type)
+{
+    const QString normalizedName = name.toLower();
+    const QString key = cacheKey(normalizedName, type);
+
+    auto itr = m_entries.find(key);
+    if (itr != m_entries.end()) {
+        const qint64 now = m_clock.elapsed();
+        if (itr->expiry > now) {
+            // refresh popular entries before they expire, so that the next
+            // lookup does not have to wait
+            if (++itr->hits >= POPULAR_HITS &&
+                itr->expiry - now < itr->ttl / 10 &&
+                !m_pending.contains(key)) {
+                debug(QStringLiteral("Refreshing DNS cache entry for %1").arg(normalizedName));
+                startLookup(key, normalizedName, type);
+            }
+
+            QMetaObject::invokeMethod(this, "_q_emitCached", Qt::QueuedConnection,
+                                      Q_ARG(QString, normalizedName),
+                                      Q_ARG(int, type));
+            return;
+        }
+        m_entries.erase(itr);
+    }
+
+    // collapse concurrent lookups for the same name
+    if (!m_pending.contains(key))
+        startLookup(key, normalizedName, type);
+}
+
+/// Removes all entries from the cache.
+
+void QXmppDnsCache::clear()
+{
+    m_entries.clear();
+}
+
+void QXmppDnsCache::_q_emitCached(const QString &name, int type)
+{
+    const auto dnsType = QDnsLookup::Type(type);
+    const auto itr = m_entries.constFind(cacheKey(name, dnsType));
+    if (itr != m_entries.constEnd())
+        emit finished(name, dnsType, itr->result);
+    else
+        lookup(name, dnsType);
+}
+
+void QXmppDnsCache::_q_resolverFinished(const QString &name, QDnsLookup::Type type, const QXmppDnsResult &result)
+{
+    const QString normalizedName = name.toLower();
+    const QString key = cacheKey(normalizedName, type);
+    m_pending.remove(key);
+
+    qint64 ttl = 0;
+    if (result.error == QDnsLookup::NoError && (!result.serviceRecords.isEmpty() || !result.addresses.isEmpty()))
+        ttl = qMin(qint64(result.timeToLive), MAXIMUM_TTL);
+    else if (result.error == QDnsLookup::NoError || result.error == QDnsLookup::NotFoundError)
+        ttl = m_negativeTtl;
+
+    const qint64 now = m_clock.elapsed();
+    auto itr = m_entries.find(key);
+    if (ttl > 0) {
+        if (itr == m_entries.end()) {
+            // make room by dropping expired entries
+            if (m_entries.size() >= MAXIMUM_ENTRIES) {
+                for (auto entry = m_entries.begin(); entry != m_entries.end();) {
+                    if (entry->expiry <= now)
+                        entry = m_entries.erase(entry);
+                    else
+                        ++entry;
+                }
+            }
+            if (m_entries.size() < MAXIMUM_ENTRIES)
+                itr = m_entries.insert(key, Entry { QXmppDnsResult(), 0, 0, 0 });
+        }
+        if (itr != m_entries.end()) {
+            itr->result = result;
+            itr->ttl = ttl * 1000;
+            itr->expiry = now + itr->ttl;
+        }
+    } else if (itr != m_entries.end() && itr->expiry > now) {
+        // a refresh failed temporarily, keep serving the previous answer
+        warning(QStringLiteral("Could not refresh DNS cache entry for %1: %2").arg(normalizedName, result.errorString));
+        return;
+    }
+
+    emit finished(normalizedName, type, result);
+}
+
+void QXmppDnsCache::startLookup(const QString &key, const QString &name, QDnsLookup::Type type)
+{
+    m_pending.insert(key);
+    m_resolver->lookup(name, type);
+}
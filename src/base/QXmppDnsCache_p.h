@@ -0,0 +1,162 @@
+/*
+ * Copyright (C) 2008-2020 The QXmpp developers
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPDNSCACHE_P_H
+#define QXMPPDNSCACHE_P_H
+
+#include "QXmppLogger.h"
+
+#include <QDnsLookup>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QHostAddress>
+#include <QList>
+#include <QSet>
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API. It exists for the convenience
+// of the QXmppOutgoingClient and QXmppOutgoingServer classes.
+//
+// This header file may change from version to version without notice,
+// or even be removed.
+//
+// We mean it.
+//
+
+/// \internal
+///
+/// A server address discovered using DNS SRV records, either for a
+/// STARTTLS or a Direct TLS (\xep{0368}) connection.
+///
+
+struct QXmppServiceRecord
+{
+    QString host;
+    quint16 port;
+    quint16 priority;
+    quint16 weight;
+    bool directTls;
+};
+
+/// \internal
+///
+/// The result of a DNS lookup for SRV, A or AAAA records.
+///
+
+struct QXmppDnsResult
+{
+    QXmppDnsResult();
+
+    QDnsLookup::Error error;
+    QString errorString;
+    QList<QXmppServiceRecord> serviceRecords;
+    QList<QHostAddress> addresses;
+    quint32 timeToLive;
+};
+
+Q_DECLARE_METATYPE(QXmppDnsResult)
+
+/// \internal
+///
+/// The QXmppDnsResolver class performs DNS lookups for the QXmppDnsCache.
+///
+/// The default implementation uses QDnsLookup, tests can replace it by a
+/// subclass which answers locally.
+///
+
+class QXMPP_AUTOTEST_EXPORT QXmppDnsResolver : public QObject
+{
+    Q_OBJECT
+
+public:
+    QXmppDnsResolver(QObject *parent = nullptr);
+
+    virtual void lookup(const QString &name, QDnsLookup::Type type);
+
+Q_SIGNALS:
+    /// This signal is emitted when a lookup has completed.
+    void finished(const QString &name, QDnsLookup::Type type, const QXmppDnsResult &result);
+};
+
+/// \internal
+///
+/// The QXmppDnsCache class caches the results of SRV, A and AAAA lookups
+/// according to the time to live of the records.
+///
+/// Failed lookups for non-existent names are cached for negativeTtl()
+/// seconds. Entries which were used repeatedly are refreshed in the
+/// background shortly before they expire, and concurrent lookups for the
+/// same name are collapsed into a single query.
+///
+/// Each thread has its own instance(), which is shared by all streams
+/// living in that thread and destroyed when the thread exits.
+///
+
+class QXMPP_AUTOTEST_EXPORT QXmppDnsCache : public QXmppLoggable
+{
+    Q_OBJECT
+
+public:
+    QXmppDnsCache(QObject *parent = nullptr);
+    ~QXmppDnsCache() override;
+
+    static QXmppDnsCache *instance();
+
+    QXmppDnsResolver *resolver() const;
+    void setResolver(QXmppDnsResolver *resolver);
+
+    int negativeTtl() const;
+    void setNegativeTtl(int secs);
+
+    void lookup(const QString &name, QDnsLookup::Type type);
+    void clear();
+
+Q_SIGNALS:
+    /// This signal is emitted when the result of a lookup is available,
+    /// either from the cache or from the resolver. The \a name is in lower
+    /// case.
+    void finished(const QString &name, QDnsLookup::Type type, const QXmppDnsResult &result);
+
+private Q_SLOTS:
+    void _q_emitCached(const QString &name, int type);
+    void _q_resolverFinished(const QString &name, QDnsLookup::Type type, const QXmppDnsResult &result);
+
+private:
+    struct Entry
+    {
+        QXmppDnsResult result;
+        qint64 ttl;
+        qint64 expiry;
+        int hits;
+    };
+
+    void startLookup(const QString &key, const QString &name, QDnsLookup::Type type);
+
+    QXmppDnsResolver *m_resolver;
+    QHash<QString, Entry> m_entries;
+    QSet<QString> m_pending;
+    QElapsedTimer m_clock;
+    int m_negativeTtl;
+};
+
+#endif
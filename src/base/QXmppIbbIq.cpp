@@ -24,12 +24,13 @@
 
 #include "QXmppIbbIq.h"
 
+#include "QXmppBase64_p.h"
 #include "QXmppConstants_p.h"
 
 #include <QDomElement>
 #include <QXmlStreamWriter>
 
-QXmppIbbOpenIq::QXmppIbbOpenIq() : QXmppIq(QXmppIq::Set), m_block_size(1024)
+QXmppIbbOpenIq::QXmppIbbOpenIq() : QXmppIq(QXmppIq::Set), m_block_size(1024), m_stanzaType(IqStanza)
 {
 }
 
@@ -53,6 +54,26 @@ void QXmppIbbOpenIq::setSid(const QString &sid)
     m_sid = sid;
 }
 
+///
+/// Returns the kind of stanzas used to send the data.
+///
+/// \since QXmpp 1.4
+///
+QXmppIbbOpenIq::StanzaType QXmppIbbOpenIq::stanzaType() const
+{
+    return m_stanzaType;
+}
+
+///
+/// Sets the kind of stanzas used to send the data.
+///
+/// \since QXmpp 1.4
+///
+void QXmppIbbOpenIq::setStanzaType(StanzaType stanzaType)
+{
+    m_stanzaType = stanzaType;
+}
+
 /// \cond
 bool QXmppIbbOpenIq::isIbbOpenIq(const QDomElement &element)
 {
@@ -65,6 +86,7 @@ void QXmppIbbOpenIq::parseElementFromChild(const QDomElement &element)
     QDomElement openElement = element.firstChildElement("open");
     m_sid = openElement.attribute("sid");
     m_block_size = openElement.attribute("block-size").toLong();
+    m_stanzaType = openElement.attribute("stanza") == QStringLiteral("message") ? MessageStanza : IqStanza;
 }
 
 void QXmppIbbOpenIq::toXmlElementFromChild(QXmlStreamWriter *writer) const
@@ -73,6 +95,8 @@ void QXmppIbbOpenIq::toXmlElementFromChild(QXmlStreamWriter *writer) const
     writer->writeDefaultNamespace(ns_ibb);
     writer->writeAttribute("sid", m_sid);
     writer->writeAttribute("block-size", QString::number(m_block_size));
+    if (m_stanzaType == MessageStanza)
+        writer->writeAttribute("stanza", QStringLiteral("message"));
     writer->writeEndElement();
 }
 /// \endcond
@@ -137,6 +161,9 @@ void QXmppIbbDataIq::setSid(const QString &sid)
     m_sid = sid;
 }
 
+///
+/// Returns the data of the chunk.
+///
 QByteArray QXmppIbbDataIq::payload() const
 {
     return m_payload;
@@ -159,7 +186,7 @@ void QXmppIbbDataIq::parseElementFromChild(const QDomElement &element)
     QDomElement dataElement = element.firstChildElement("data");
     m_sid = dataElement.attribute("sid");
     m_seq = dataElement.attribute("seq").toLong();
-    m_payload = QByteArray::fromBase64(dataElement.text().toLatin1());
+    m_payload = QXmppBase64::decode(dataElement.text());
 }
 
 void QXmppIbbDataIq::toXmlElementFromChild(QXmlStreamWriter *writer) const
@@ -168,7 +195,7 @@ void QXmppIbbDataIq::toXmlElementFromChild(QXmlStreamWriter *writer) const
     writer->writeDefaultNamespace(ns_ibb);
     writer->writeAttribute("sid", m_sid);
     writer->writeAttribute("seq", QString::number(m_seq));
-    writer->writeCharacters(m_payload.toBase64());
+    writer->writeCharacters(QXmppBase64::encode(m_payload));
     writer->writeEndElement();
 }
 /// \endcond
@@ -36,6 +36,14 @@
 class QXmppIbbOpenIq : public QXmppIq
 {
 public:
+    /// This enum describes the kind of stanzas which carry the data.
+    ///
+    /// \since QXmpp 1.4
+    enum StanzaType {
+        IqStanza,       ///< Each data chunk is acknowledged using an IQ.
+        MessageStanza   ///< Data chunks are sent in messages, without acknowledgement.
+    };
+
     QXmppIbbOpenIq();
 
     long blockSize() const;
@@ -44,6 +52,9 @@ public:
     QString sid() const;
     void setSid(const QString &sid);
 
+    StanzaType stanzaType() const;
+    void setStanzaType(StanzaType stanzaType);
+
     static bool isIbbOpenIq(const QDomElement &element);
 
 protected:
@@ -55,6 +66,7 @@ protected:
 private:
     long m_block_size;
     QString m_sid;
+    StanzaType m_stanzaType;
 };
 
 ///
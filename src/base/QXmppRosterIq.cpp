@@ -85,6 +85,9 @@ QString QXmppRosterIq::version() const
 ///
 /// Sets the roster version of IQ.
 ///
+/// An empty, but not null version can be used to request a versioned roster
+/// when no roster is cached yet (\xep{0237}).
+///
 /// \param version as a QString
 ///
 /// \since QXmpp 1.0
@@ -144,7 +147,8 @@ void QXmppRosterIq::toXmlElementFromChild(QXmlStreamWriter *writer) const
     writer->writeDefaultNamespace(ns_roster);
 
     // XEP-0237 roster versioning - If the server does not advertise support for roster versioning, the client MUST NOT include the 'ver' attribute.
-    if (!version().isEmpty())
+    // An empty version is sent to request a versioned roster without a cached roster.
+    if (!version().isNull())
         writer->writeAttribute(QStringLiteral("ver"), version());
 
     // XEP-0405: Mediated Information eXchange (MIX): Participant Server Requirements
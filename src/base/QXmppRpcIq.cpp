@@ -24,6 +24,7 @@
 
 #include "QXmppRpcIq.h"
 
+#include "QXmppBase64_p.h"
 #include "QXmppConstants_p.h"
 #include "QXmppUtils.h"
 
@@ -83,7 +84,7 @@ void QXmppRpcMarshaller::marshall(QXmlStreamWriter *writer, const QVariant &valu
         break;
     }
     case QVariant::ByteArray: {
-        writer->writeTextElement(QStringLiteral("base64"), value.toByteArray().toBase64());
+        writer->writeTextElement(QStringLiteral("base64"), QXmppBase64::encode(value.toByteArray()));
         break;
     }
     default: {
@@ -153,10 +154,7 @@ QVariant QXmppRpcMarshaller::demarshall(const QDomElement &elem, QStringList &er
         }
         return QVariant(stct);
     } else if (typeName == QStringLiteral("base64")) {
-        QVariant returnVariant;
-        QByteArray dest;
-        QByteArray src = typeData.text().toLatin1();
-        return QVariant(QByteArray::fromBase64(src));
+        return QVariant(QXmppBase64::decode(typeData.text()));
     }
 
     errors << QStringLiteral("Cannot handle type %1").arg(typeName);
@@ -22,6 +22,8 @@
  *
  */
 
+#include "QXmppBase64_p.h"
+#include "QXmppConstants_p.h"
 #include "QXmppSasl_p.h"
 #include "QXmppUtils.h"
 
@@ -132,7 +134,7 @@ void QXmppSaslAuth::setValue(const QByteArray &value)
 void QXmppSaslAuth::parse(const QDomElement &element)
 {
     m_mechanism = element.attribute(QStringLiteral("mechanism"));
-    m_value = QByteArray::fromBase64(element.text().toLatin1());
+    m_value = QXmppBase64::decode(element.text());
 }
 
 void QXmppSaslAuth::toXml(QXmlStreamWriter *writer) const
@@ -141,7 +143,7 @@ void QXmppSaslAuth::toXml(QXmlStreamWriter *writer) const
     writer->writeDefaultNamespace(ns_xmpp_sasl);
     writer->writeAttribute(QStringLiteral("mechanism"), m_mechanism);
     if (!m_value.isEmpty())
-        writer->writeCharacters(m_value.toBase64());
+        writer->writeCharacters(QXmppBase64::encode(m_value));
     writer->writeEndElement();
 }
 
@@ -162,7 +164,7 @@ void QXmppSaslChallenge::setValue(const QByteArray &value)
 
 void QXmppSaslChallenge::parse(const QDomElement &element)
 {
-    m_value = QByteArray::fromBase64(element.text().toLatin1());
+    m_value = QXmppBase64::decode(element.text());
 }
 
 void QXmppSaslChallenge::toXml(QXmlStreamWriter *writer) const
@@ -170,7 +172,7 @@ void QXmppSaslChallenge::toXml(QXmlStreamWriter *writer) const
     writer->writeStartElement(QStringLiteral("challenge"));
     writer->writeDefaultNamespace(ns_xmpp_sasl);
     if (!m_value.isEmpty())
-        writer->writeCharacters(m_value.toBase64());
+        writer->writeCharacters(QXmppBase64::encode(m_value));
     writer->writeEndElement();
 }
 
@@ -220,7 +222,7 @@ void QXmppSaslResponse::setValue(const QByteArray &value)
 
 void QXmppSaslResponse::parse(const QDomElement &element)
 {
-    m_value = QByteArray::fromBase64(element.text().toLatin1());
+    m_value = QXmppBase64::decode(element.text());
 }
 
 void QXmppSaslResponse::toXml(QXmlStreamWriter *writer) const
@@ -228,7 +230,7 @@ void QXmppSaslResponse::toXml(QXmlStreamWriter *writer) const
     writer->writeStartElement(QStringLiteral("response"));
     writer->writeDefaultNamespace(ns_xmpp_sasl);
     if (!m_value.isEmpty())
-        writer->writeCharacters(m_value.toBase64());
+        writer->writeCharacters(QXmppBase64::encode(m_value));
     writer->writeEndElement();
 }
 
@@ -248,6 +250,370 @@ void QXmppSaslSuccess::toXml(QXmlStreamWriter *writer) const
     writer->writeEndElement();
 }
 
+QXmppSasl2Authenticate::QXmppSasl2Authenticate(const QString &mechanism, const QByteArray &initialResponse)
+    : m_mechanism(mechanism), m_initialResponse(initialResponse), m_bindRequested(false), m_resumeRequested(false)
+{
+}
+
+QString QXmppSasl2Authenticate::mechanism() const
+{
+    return m_mechanism;
+}
+
+void QXmppSasl2Authenticate::setMechanism(const QString &mechanism)
+{
+    m_mechanism = mechanism;
+}
+
+QByteArray QXmppSasl2Authenticate::initialResponse() const
+{
+    return m_initialResponse;
+}
+
+void QXmppSasl2Authenticate::setInitialResponse(const QByteArray &initialResponse)
+{
+    m_initialResponse = initialResponse;
+}
+
+bool QXmppSasl2Authenticate::bindRequested() const
+{
+    return m_bindRequested;
+}
+
+void QXmppSasl2Authenticate::setBindRequested(bool requested)
+{
+    m_bindRequested = requested;
+}
+
+QString QXmppSasl2Authenticate::bindTag() const
+{
+    return m_bindTag;
+}
+
+void QXmppSasl2Authenticate::setBindTag(const QString &tag)
+{
+    m_bindTag = tag;
+}
+
+QStringList QXmppSasl2Authenticate::bindFeatures() const
+{
+    return m_bindFeatures;
+}
+
+void QXmppSasl2Authenticate::setBindFeatures(const QStringList &features)
+{
+    m_bindFeatures = features;
+}
+
+bool QXmppSasl2Authenticate::resumeRequested() const
+{
+    return m_resumeRequested;
+}
+
+QXmppStreamManagementResume QXmppSasl2Authenticate::resume() const
+{
+    return m_resume;
+}
+
+void QXmppSasl2Authenticate::setResume(const QXmppStreamManagementResume &resume)
+{
+    m_resume = resume;
+    m_resumeRequested = !resume.prevId().isEmpty();
+}
+
+bool QXmppSasl2Authenticate::isSasl2Authenticate(const QDomElement &element)
+{
+    return element.tagName() == QStringLiteral("authenticate") &&
+        element.namespaceURI() == ns_sasl_2;
+}
+
+void QXmppSasl2Authenticate::parse(const QDomElement &element)
+{
+    m_mechanism = element.attribute(QStringLiteral("mechanism"));
+    m_initialResponse = QXmppBase64::decode(element.firstChildElement(QStringLiteral("initial-response")).text());
+
+    QDomElement resumeElement = element.firstChildElement(QStringLiteral("resume"));
+    m_resumeRequested = QXmppStreamManagementResume::isStreamManagementResume(resumeElement);
+    if (m_resumeRequested)
+        m_resume.parse(resumeElement);
+
+    QDomElement bindElement = element.firstChildElement(QStringLiteral("bind"));
+    m_bindRequested = bindElement.namespaceURI() == ns_bind2;
+    m_bindTag.clear();
+    m_bindFeatures.clear();
+    if (m_bindRequested) {
+        m_bindTag = bindElement.firstChildElement(QStringLiteral("tag")).text();
+
+        QDomElement enableElement = bindElement.firstChildElement(QStringLiteral("enable"));
+        while (!enableElement.isNull()) {
+            m_bindFeatures << enableElement.namespaceURI();
+            enableElement = enableElement.nextSiblingElement(QStringLiteral("enable"));
+        }
+    }
+}
+
+void QXmppSasl2Authenticate::toXml(QXmlStreamWriter *writer) const
+{
+    writer->writeStartElement(QStringLiteral("authenticate"));
+    writer->writeDefaultNamespace(ns_sasl_2);
+    writer->writeAttribute(QStringLiteral("mechanism"), m_mechanism);
+    if (!m_initialResponse.isEmpty())
+        writer->writeTextElement(QStringLiteral("initial-response"), QXmppBase64::encode(m_initialResponse));
+
+    if (m_resumeRequested)
+        m_resume.toXml(writer);
+
+    if (m_bindRequested) {
+        writer->writeStartElement(QStringLiteral("bind"));
+        writer->writeDefaultNamespace(ns_bind2);
+        if (!m_bindTag.isEmpty())
+            writer->writeTextElement(QStringLiteral("tag"), m_bindTag);
+        for (const auto &feature : m_bindFeatures) {
+            if (feature == ns_stream_management) {
+                QXmppStreamManagementEnable(true).toXml(writer);
+            } else {
+                writer->writeStartElement(QStringLiteral("enable"));
+                writer->writeDefaultNamespace(feature);
+                writer->writeEndElement();
+            }
+        }
+        writer->writeEndElement();
+    }
+    writer->writeEndElement();
+}
+
+QXmppSasl2Challenge::QXmppSasl2Challenge(const QByteArray &value)
+    : m_value(value)
+{
+}
+
+QByteArray QXmppSasl2Challenge::value() const
+{
+    return m_value;
+}
+
+void QXmppSasl2Challenge::setValue(const QByteArray &value)
+{
+    m_value = value;
+}
+
+void QXmppSasl2Challenge::parse(const QDomElement &element)
+{
+    m_value = QXmppBase64::decode(element.text());
+}
+
+void QXmppSasl2Challenge::toXml(QXmlStreamWriter *writer) const
+{
+    writer->writeStartElement(QStringLiteral("challenge"));
+    writer->writeDefaultNamespace(ns_sasl_2);
+    if (!m_value.isEmpty())
+        writer->writeCharacters(QXmppBase64::encode(m_value));
+    writer->writeEndElement();
+}
+
+QXmppSasl2Response::QXmppSasl2Response(const QByteArray &value)
+    : m_value(value)
+{
+}
+
+QByteArray QXmppSasl2Response::value() const
+{
+    return m_value;
+}
+
+void QXmppSasl2Response::setValue(const QByteArray &value)
+{
+    m_value = value;
+}
+
+void QXmppSasl2Response::parse(const QDomElement &element)
+{
+    m_value = QXmppBase64::decode(element.text());
+}
+
+void QXmppSasl2Response::toXml(QXmlStreamWriter *writer) const
+{
+    writer->writeStartElement(QStringLiteral("response"));
+    writer->writeDefaultNamespace(ns_sasl_2);
+    if (!m_value.isEmpty())
+        writer->writeCharacters(QXmppBase64::encode(m_value));
+    writer->writeEndElement();
+}
+
+QXmppSasl2Failure::QXmppSasl2Failure(const QString &condition, const QString &text)
+    : m_condition(condition), m_text(text)
+{
+}
+
+QString QXmppSasl2Failure::condition() const
+{
+    return m_condition;
+}
+
+void QXmppSasl2Failure::setCondition(const QString &condition)
+{
+    m_condition = condition;
+}
+
+QString QXmppSasl2Failure::text() const
+{
+    return m_text;
+}
+
+void QXmppSasl2Failure::setText(const QString &text)
+{
+    m_text = text;
+}
+
+void QXmppSasl2Failure::parse(const QDomElement &element)
+{
+    m_condition.clear();
+    for (QDomElement child = element.firstChildElement(); !child.isNull(); child = child.nextSiblingElement()) {
+        if (child.namespaceURI() == ns_xmpp_sasl) {
+            m_condition = child.tagName();
+            break;
+        }
+    }
+    m_text = element.firstChildElement(QStringLiteral("text")).text();
+}
+
+void QXmppSasl2Failure::toXml(QXmlStreamWriter *writer) const
+{
+    writer->writeStartElement(QStringLiteral("failure"));
+    writer->writeDefaultNamespace(ns_sasl_2);
+    if (!m_condition.isEmpty()) {
+        writer->writeStartElement(m_condition);
+        writer->writeDefaultNamespace(ns_xmpp_sasl);
+        writer->writeEndElement();
+    }
+    if (!m_text.isEmpty())
+        writer->writeTextElement(QStringLiteral("text"), m_text);
+    writer->writeEndElement();
+}
+
+QXmppSasl2Success::QXmppSasl2Success()
+    : m_bound(false), m_streamManagementEnabled(false), m_resumed(false), m_resumeFailed(false)
+{
+}
+
+QByteArray QXmppSasl2Success::additionalData() const
+{
+    return m_additionalData;
+}
+
+void QXmppSasl2Success::setAdditionalData(const QByteArray &data)
+{
+    m_additionalData = data;
+}
+
+QString QXmppSasl2Success::authorizationIdentifier() const
+{
+    return m_authorizationIdentifier;
+}
+
+void QXmppSasl2Success::setAuthorizationIdentifier(const QString &jid)
+{
+    m_authorizationIdentifier = jid;
+}
+
+bool QXmppSasl2Success::isBound() const
+{
+    return m_bound;
+}
+
+void QXmppSasl2Success::setBound(bool bound)
+{
+    m_bound = bound;
+}
+
+bool QXmppSasl2Success::isStreamManagementEnabled() const
+{
+    return m_streamManagementEnabled;
+}
+
+QXmppStreamManagementEnabled QXmppSasl2Success::streamManagementEnabled() const
+{
+    return m_enabled;
+}
+
+void QXmppSasl2Success::setStreamManagementEnabled(const QXmppStreamManagementEnabled &enabled)
+{
+    m_enabled = enabled;
+    m_streamManagementEnabled = true;
+}
+
+bool QXmppSasl2Success::isResumed() const
+{
+    return m_resumed;
+}
+
+QXmppStreamManagementResumed QXmppSasl2Success::resumed() const
+{
+    return m_resumedElement;
+}
+
+void QXmppSasl2Success::setResumed(const QXmppStreamManagementResumed &resumed)
+{
+    m_resumedElement = resumed;
+    m_resumed = true;
+}
+
+// Returns true if the client asked to resume a stream inline, but the
+// stream could not be resumed.
+
+bool QXmppSasl2Success::isResumeFailed() const
+{
+    return m_resumeFailed;
+}
+
+void QXmppSasl2Success::setResumeFailed(bool failed)
+{
+    m_resumeFailed = failed;
+}
+
+void QXmppSasl2Success::parse(const QDomElement &element)
+{
+    m_additionalData = QXmppBase64::decode(element.firstChildElement(QStringLiteral("additional-data")).text());
+    m_authorizationIdentifier = element.firstChildElement(QStringLiteral("authorization-identifier")).text();
+
+    QDomElement resumedElement = element.firstChildElement(QStringLiteral("resumed"));
+    m_resumed = QXmppStreamManagementResumed::isStreamManagementResumed(resumedElement);
+    if (m_resumed)
+        m_resumedElement.parse(resumedElement);
+    m_resumeFailed = QXmppStreamManagementFailed::isStreamManagementFailed(element.firstChildElement(QStringLiteral("failed")));
+
+    QDomElement boundElement = element.firstChildElement(QStringLiteral("bound"));
+    m_bound = boundElement.namespaceURI() == ns_bind2;
+    m_streamManagementEnabled = false;
+    if (m_bound) {
+        QDomElement enabledElement = boundElement.firstChildElement(QStringLiteral("enabled"));
+        m_streamManagementEnabled = QXmppStreamManagementEnabled::isStreamManagementEnabled(enabledElement);
+        if (m_streamManagementEnabled)
+            m_enabled.parse(enabledElement);
+    }
+}
+
+void QXmppSasl2Success::toXml(QXmlStreamWriter *writer) const
+{
+    writer->writeStartElement(QStringLiteral("success"));
+    writer->writeDefaultNamespace(ns_sasl_2);
+    if (!m_additionalData.isEmpty())
+        writer->writeTextElement(QStringLiteral("additional-data"), QXmppBase64::encode(m_additionalData));
+    writer->writeTextElement(QStringLiteral("authorization-identifier"), m_authorizationIdentifier);
+    if (m_resumed)
+        m_resumedElement.toXml(writer);
+    else if (m_resumeFailed)
+        QXmppStreamManagementFailed(QXmppStanza::Error::ItemNotFound).toXml(writer);
+    if (m_bound) {
+        writer->writeStartElement(QStringLiteral("bound"));
+        writer->writeDefaultNamespace(ns_bind2);
+        if (m_streamManagementEnabled)
+            m_enabled.toXml(writer);
+        writer->writeEndElement();
+    }
+    writer->writeEndElement();
+}
+
 class QXmppSaslClientPrivate
 {
 public:
@@ -28,6 +28,7 @@
 #include "QXmppGlobal.h"
 #include "QXmppLogger.h"
 #include "QXmppStanza.h"
+#include "QXmppStreamManagement_p.h"
 
 #include <QByteArray>
 #include <QCryptographicHash>
@@ -204,6 +205,149 @@ public:
     /// \endcond
 };
 
+// XEP-0388: Extensible SASL Profile
+
+class QXMPP_AUTOTEST_EXPORT QXmppSasl2Authenticate : public QXmppStanza
+{
+public:
+    QXmppSasl2Authenticate(const QString &mechanism = QString(), const QByteArray &initialResponse = QByteArray());
+
+    QString mechanism() const;
+    void setMechanism(const QString &mechanism);
+
+    QByteArray initialResponse() const;
+    void setInitialResponse(const QByteArray &initialResponse);
+
+    // XEP-0386: Bind 2
+    bool bindRequested() const;
+    void setBindRequested(bool requested);
+
+    QString bindTag() const;
+    void setBindTag(const QString &tag);
+
+    QStringList bindFeatures() const;
+    void setBindFeatures(const QStringList &features);
+
+    // XEP-0198: Stream Management
+    bool resumeRequested() const;
+    QXmppStreamManagementResume resume() const;
+    void setResume(const QXmppStreamManagementResume &resume);
+
+    static bool isSasl2Authenticate(const QDomElement &element);
+
+    /// \cond
+    void parse(const QDomElement &element) override;
+    void toXml(QXmlStreamWriter *writer) const override;
+    /// \endcond
+
+private:
+    QString m_mechanism;
+    QByteArray m_initialResponse;
+    bool m_bindRequested;
+    QString m_bindTag;
+    QStringList m_bindFeatures;
+    bool m_resumeRequested;
+    QXmppStreamManagementResume m_resume;
+};
+
+class QXMPP_AUTOTEST_EXPORT QXmppSasl2Challenge : public QXmppStanza
+{
+public:
+    QXmppSasl2Challenge(const QByteArray &value = QByteArray());
+
+    QByteArray value() const;
+    void setValue(const QByteArray &value);
+
+    /// \cond
+    void parse(const QDomElement &element) override;
+    void toXml(QXmlStreamWriter *writer) const override;
+    /// \endcond
+
+private:
+    QByteArray m_value;
+};
+
+class QXMPP_AUTOTEST_EXPORT QXmppSasl2Response : public QXmppStanza
+{
+public:
+    QXmppSasl2Response(const QByteArray &value = QByteArray());
+
+    QByteArray value() const;
+    void setValue(const QByteArray &value);
+
+    /// \cond
+    void parse(const QDomElement &element) override;
+    void toXml(QXmlStreamWriter *writer) const override;
+    /// \endcond
+
+private:
+    QByteArray m_value;
+};
+
+class QXMPP_AUTOTEST_EXPORT QXmppSasl2Failure : public QXmppStanza
+{
+public:
+    QXmppSasl2Failure(const QString &condition = QString(), const QString &text = QString());
+
+    QString condition() const;
+    void setCondition(const QString &condition);
+
+    QString text() const;
+    void setText(const QString &text);
+
+    /// \cond
+    void parse(const QDomElement &element) override;
+    void toXml(QXmlStreamWriter *writer) const override;
+    /// \endcond
+
+private:
+    QString m_condition;
+    QString m_text;
+};
+
+class QXMPP_AUTOTEST_EXPORT QXmppSasl2Success : public QXmppStanza
+{
+public:
+    QXmppSasl2Success();
+
+    QByteArray additionalData() const;
+    void setAdditionalData(const QByteArray &data);
+
+    QString authorizationIdentifier() const;
+    void setAuthorizationIdentifier(const QString &jid);
+
+    // XEP-0386: Bind 2
+    bool isBound() const;
+    void setBound(bool bound);
+
+    // XEP-0198: Stream Management
+    bool isStreamManagementEnabled() const;
+    QXmppStreamManagementEnabled streamManagementEnabled() const;
+    void setStreamManagementEnabled(const QXmppStreamManagementEnabled &enabled);
+
+    bool isResumed() const;
+    QXmppStreamManagementResumed resumed() const;
+    void setResumed(const QXmppStreamManagementResumed &resumed);
+
+    bool isResumeFailed() const;
+    void setResumeFailed(bool failed);
+
+    /// \cond
+    void parse(const QDomElement &element) override;
+    void toXml(QXmlStreamWriter *writer) const override;
+    /// \endcond
+
+private:
+    QByteArray m_additionalData;
+    QString m_authorizationIdentifier;
+    bool m_bound;
+    bool m_streamManagementEnabled;
+    QXmppStreamManagementEnabled m_enabled;
+    bool m_resumed;
+    QXmppStreamManagementResumed m_resumedElement;
+    bool m_resumeFailed;
+};
+
 class QXmppSaslClientAnonymous : public QXmppSaslClient
 {
 public:
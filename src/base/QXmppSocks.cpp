@@ -30,6 +30,10 @@
 
 const static char SocksVersion = 5;
 
+// time after which a connection which did not complete the handshake is
+// closed
+const static int HandshakeTimeout = 10000;
+
 enum AuthenticationMethod {
     NoAuthentication = 0,
     NoAcceptableMethod = 255
@@ -230,9 +234,27 @@ void QXmppSocksServer::slotNewConnection()
     if (!socket)
         return;
 
-    // register socket
+    // register socket, it is owned by the server until the handshake is
+    // complete
     m_states.insert(socket, ConnectState);
     connect(socket, &QIODevice::readyRead, this, &QXmppSocksServer::slotReadyRead);
+    connect(socket, &QAbstractSocket::disconnected, this, [this, socket]() {
+        m_states.remove(socket);
+        socket->deleteLater();
+    });
+    connect(socket, &QObject::destroyed, this, [this, socket]() {
+        m_states.remove(socket);
+    });
+
+    // do not keep connections which never complete the handshake
+    QTimer::singleShot(HandshakeTimeout, socket, [this, socket]() {
+        if (m_states.contains(socket)) {
+            qWarning("QXmppSocksServer handshake timed out");
+            m_states.remove(socket);
+            socket->abort();
+            socket->deleteLater();
+        }
+    });
 }
 
 void QXmppSocksServer::slotReadyRead()
@@ -307,8 +329,9 @@ void QXmppSocksServer::slotReadyRead()
             return;
         }
 
-        // notify of connection
-        m_states.insert(socket, ReadyState);
+        // hand the socket over to the receiver of newConnection()
+        m_states.remove(socket);
+        socket->disconnect(this);
         emit newConnection(socket, hostName, hostPort);
 
         // send response
@@ -24,6 +24,7 @@
 
 #include "QXmppStream.h"
 
+#include "QXmppCompression_p.h"
 #include "QXmppConstants_p.h"
 #include "QXmppLogger.h"
 #include "QXmppStanza.h"
@@ -49,6 +50,9 @@ class QXmppStreamPrivate
 {
 public:
     QXmppStreamPrivate();
+    ~QXmppStreamPrivate();
+    void reportCompression(QXmppStream *q);
+    void resetCompression();
 
     QByteArray dataBuffer;
     QSslSocket *socket;
@@ -60,11 +64,48 @@ public:
     QMap<unsigned, QByteArray> unacknowledgedStanzas;
     unsigned lastOutgoingSequenceNumber;
     unsigned lastIncomingSequenceNumber;
+
+    // XEP-0138: Stream Compression
+    QXmppStreamCompressor *compressor;
+    qint64 reportedCpuTime;
 };
 
 QXmppStreamPrivate::QXmppStreamPrivate()
-    : socket(nullptr), streamManagementEnabled(false), lastOutgoingSequenceNumber(0), lastIncomingSequenceNumber(0)
+    : socket(nullptr), streamManagementEnabled(false), lastOutgoingSequenceNumber(0), lastIncomingSequenceNumber(0), compressor(nullptr), reportedCpuTime(0)
+{
+}
+
+QXmppStreamPrivate::~QXmppStreamPrivate()
+{
+    delete compressor;
+}
+
+// Stops compression, which is negotiated for each connection.
+
+void QXmppStreamPrivate::resetCompression()
+{
+    delete compressor;
+    compressor = nullptr;
+    reportedCpuTime = 0;
+}
+
+// Updates the compression gauges and counters after data was compressed or
+// decompressed.
+
+void QXmppStreamPrivate::reportCompression(QXmppStream *q)
 {
+    const qint64 uncompressed = compressor->uncompressedBytesWritten() + compressor->uncompressedBytesRead();
+    const qint64 compressed = compressor->compressedBytesWritten() + compressor->compressedBytesRead();
+    if (compressed)
+        q->setGauge(QStringLiteral("stream.compression.ratio"), double(uncompressed) / double(compressed));
+
+    // the counter is in microseconds, report whole microseconds of the
+    // accumulated nanoseconds so that short calls are not lost to rounding
+    const qint64 cpuTime = compressor->cpuTime() / 1000;
+    if (cpuTime > reportedCpuTime) {
+        q->updateCounter(QStringLiteral("stream.compression.cpu-time"), cpuTime - reportedCpuTime);
+        reportedCpuTime = cpuTime;
+    }
 }
 
 ///
@@ -142,6 +183,16 @@ bool QXmppStream::sendData(const QByteArray &data)
     logSent(QString::fromUtf8(data));
     if (!d->socket || d->socket->state() != QAbstractSocket::ConnectedState)
         return false;
+
+    if (d->compressor) {
+        QByteArray compressed;
+        if (!d->compressor->compress(data, compressed)) {
+            warning(QStringLiteral("Could not compress outgoing data"));
+            return false;
+        }
+        d->reportCompression(this);
+        return d->socket->write(compressed) == compressed.size();
+    }
     return d->socket->write(data) == data.size();
 }
 
@@ -190,11 +241,24 @@ void QXmppStream::setSocket(QSslSocket *socket)
     connect(socket, &QSslSocket::encrypted, this, &QXmppStream::_q_socketEncrypted);
     connect(socket, QOverload<QAbstractSocket::SocketError>::of(&QSslSocket::error), this, &QXmppStream::_q_socketError);
     connect(socket, &QIODevice::readyRead, this, &QXmppStream::_q_socketReadyRead);
+
+    // a connection may be handed over without emitting connected(), so the
+    // compression of the previous one is dropped as soon as it ends
+    connect(socket, &QAbstractSocket::disconnected, this, [this]() {
+        d->resetCompression();
+    });
 }
 
 void QXmppStream::_q_socketConnected()
 {
     info(QStringLiteral("Socket connected to %1 %2").arg(d->socket->peerAddress().toString(), QString::number(d->socket->peerPort())));
+
+    d->resetCompression();
+
+    // for Direct TLS connections, the stream is started once the TLS
+    // handshake has completed
+    if (d->socket->mode() != QSslSocket::UnencryptedMode)
+        return;
     handleStart();
 }
 
@@ -212,7 +276,18 @@ void QXmppStream::_q_socketError(QAbstractSocket::SocketError socketError)
 
 void QXmppStream::_q_socketReadyRead()
 {
-    d->dataBuffer.append(d->socket->readAll());
+    if (d->compressor) {
+        QByteArray decompressed;
+        if (!d->compressor->decompress(d->socket->readAll(), decompressed)) {
+            warning(QStringLiteral("Could not decompress incoming data"));
+            d->socket->abort();
+            return;
+        }
+        d->reportCompression(this);
+        d->dataBuffer.append(decompressed);
+    } else {
+        d->dataBuffer.append(d->socket->readAll());
+    }
 
     // handle whitespace pings
     if (!d->dataBuffer.isEmpty() && d->dataBuffer.trimmed().isEmpty()) {
@@ -316,6 +391,45 @@ void QXmppStream::enableStreamManagement(bool resetSequenceNumber)
     }
 }
 
+///
+/// Returns true if the data exchanged on the stream is compressed
+/// (\xep{0138}).
+///
+/// \since QXmpp 1.4
+///
+bool QXmppStream::isCompressionEnabled() const
+{
+    return d->compressor != nullptr;
+}
+
+///
+/// Starts compressing and decompressing all data exchanged on the stream
+/// using zlib (\xep{0138}).
+///
+/// This must be called right after the compression negotiation packets were
+/// exchanged; the stream is then restarted.
+///
+/// \param level The zlib compression level, from 0 to 9 or -1 for the zlib
+/// default.
+///
+/// \return true if compression could be started.
+///
+/// \since QXmpp 1.4
+///
+bool QXmppStream::startCompression(int level)
+{
+    d->resetCompression();
+    d->compressor = new QXmppStreamCompressor(level);
+    if (!d->compressor->isValid()) {
+        warning(QStringLiteral("Could not start stream compression"));
+        delete d->compressor;
+        d->compressor = nullptr;
+        return false;
+    }
+    info(QStringLiteral("Stream compression started"));
+    return true;
+}
+
 ///
 /// Returns the sequence number of the last incoming stanza (\xep{0198}).
 ///
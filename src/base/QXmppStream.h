@@ -79,6 +79,10 @@ protected:
     unsigned lastIncomingSequenceNumber() const;
     void setAcknowledgedSequenceNumber(unsigned sequenceNumber);
 
+    // XEP-0138: Stream Compression
+    bool isCompressionEnabled() const;
+    bool startCompression(int level);
+
 private:
     // XEP-0198: Stream Management
     void handleAcknowledgement(QDomElement &element);
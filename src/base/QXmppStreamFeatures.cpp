@@ -43,6 +43,13 @@ public:
     bool rosterVersioningSupported;
     QStringList authMechanisms;
     QStringList compressionMethods;
+
+    // XEP-0388: Extensible SASL Profile
+    QStringList sasl2Mechanisms;
+    bool sasl2StreamManagementAvailable;
+    // XEP-0386: Bind 2
+    bool bind2Available;
+    QStringList bind2Features;
 };
 
 QXmppStreamFeaturesPrivate::QXmppStreamFeaturesPrivate()
@@ -53,7 +60,10 @@ QXmppStreamFeaturesPrivate::QXmppStreamFeaturesPrivate()
       streamManagementMode(QXmppStreamFeatures::Disabled),
       csiMode(QXmppStreamFeatures::Disabled),
       registerMode(QXmppStreamFeatures::Disabled),
-      preApprovedSubscriptionsSupported(false)
+      preApprovedSubscriptionsSupported(false),
+      rosterVersioningSupported(false),
+      sasl2StreamManagementAvailable(false),
+      bind2Available(false)
 {
 }
 
@@ -235,6 +245,94 @@ void QXmppStreamFeatures::setRosterVersioningSupported(bool supported)
     d->rosterVersioningSupported = supported;
 }
 
+///
+/// Returns the SASL mechanisms offered for \xep{0388}: Extensible SASL
+/// Profile.
+///
+/// \since QXmpp 1.4
+///
+QStringList QXmppStreamFeatures::sasl2Mechanisms() const
+{
+    return d->sasl2Mechanisms;
+}
+
+///
+/// Sets the SASL mechanisms offered for \xep{0388}: Extensible SASL Profile.
+///
+/// \since QXmpp 1.4
+///
+void QXmppStreamFeatures::setSasl2Mechanisms(const QStringList &mechanisms)
+{
+    d->sasl2Mechanisms = mechanisms;
+}
+
+///
+/// Returns whether \xep{0386}: Bind 2 can be used inline during SASL 2
+/// authentication.
+///
+/// \since QXmpp 1.4
+///
+bool QXmppStreamFeatures::bind2Available() const
+{
+    return d->bind2Available;
+}
+
+///
+/// Sets whether \xep{0386}: Bind 2 can be used inline during SASL 2
+/// authentication.
+///
+/// \since QXmpp 1.4
+///
+void QXmppStreamFeatures::setBind2Available(bool available)
+{
+    d->bind2Available = available;
+}
+
+///
+/// Returns the namespaces of the features that can be enabled inline during
+/// resource binding with \xep{0386}: Bind 2, e.g. message carbons or stream
+/// management.
+///
+/// \since QXmpp 1.4
+///
+QStringList QXmppStreamFeatures::bind2Features() const
+{
+    return d->bind2Features;
+}
+
+///
+/// Sets the namespaces of the features that can be enabled inline during
+/// resource binding with \xep{0386}: Bind 2.
+///
+/// \since QXmpp 1.4
+///
+void QXmppStreamFeatures::setBind2Features(const QStringList &features)
+{
+    d->bind2Features = features;
+}
+
+///
+/// Returns whether a \xep{0198}: Stream Management session can be resumed
+/// inline during SASL 2 authentication.
+///
+/// \since QXmpp 1.4
+///
+bool QXmppStreamFeatures::sasl2StreamManagementAvailable() const
+{
+    return d->sasl2StreamManagementAvailable;
+}
+
+///
+/// Sets whether a \xep{0198}: Stream Management session can be resumed
+/// inline during SASL 2 authentication.
+///
+/// \since QXmpp 1.4
+///
+void QXmppStreamFeatures::setSasl2StreamManagementAvailable(bool available)
+{
+    d->sasl2StreamManagementAvailable = available;
+}
+
 /// \cond
 bool QXmppStreamFeatures::isStreamFeatures(const QDomElement &element)
 {
@@ -301,6 +399,31 @@ void QXmppStreamFeatures::parse(const QDomElement &element)
             subElement = subElement.nextSiblingElement(QStringLiteral("mechanism"));
         }
     }
+
+    // parse XEP-0388: Extensible SASL Profile
+    QDomElement authentication = element.firstChildElement(QStringLiteral("authentication"));
+    if (authentication.namespaceURI() == ns_sasl_2) {
+        QDomElement subElement = authentication.firstChildElement(QStringLiteral("mechanism"));
+        while (!subElement.isNull()) {
+            d->sasl2Mechanisms << subElement.text();
+            subElement = subElement.nextSiblingElement(QStringLiteral("mechanism"));
+        }
+
+        QDomElement inlineElement = authentication.firstChildElement(QStringLiteral("inline"));
+        d->sasl2StreamManagementAvailable = readBooleanFeature(inlineElement, QStringLiteral("sm"), ns_stream_management);
+
+        // XEP-0386: Bind 2
+        QDomElement bind = inlineElement.firstChildElement(QStringLiteral("bind"));
+        if (bind.namespaceURI() == ns_bind2) {
+            d->bind2Available = true;
+
+            QDomElement feature = bind.firstChildElement(QStringLiteral("inline")).firstChildElement(QStringLiteral("feature"));
+            while (!feature.isNull()) {
+                d->bind2Features << feature.attribute(QStringLiteral("var"));
+                feature = feature.nextSiblingElement(QStringLiteral("feature"));
+            }
+        }
+    }
 }
 
 static void writeFeature(QXmlStreamWriter *writer, const char *tagName, const char *tagNs, QXmppStreamFeatures::Mode mode)
@@ -350,6 +473,33 @@ void QXmppStreamFeatures::toXml(QXmlStreamWriter *writer) const
             writer->writeTextElement(QStringLiteral("mechanism"), mechanism);
         writer->writeEndElement();
     }
+    if (!d->sasl2Mechanisms.isEmpty()) {
+        writer->writeStartElement(QStringLiteral("authentication"));
+        writer->writeDefaultNamespace(ns_sasl_2);
+        for (const auto &mechanism : qAsConst(d->sasl2Mechanisms))
+            writer->writeTextElement(QStringLiteral("mechanism"), mechanism);
+
+        if (d->bind2Available || d->sasl2StreamManagementAvailable) {
+            writer->writeStartElement(QStringLiteral("inline"));
+            if (d->bind2Available) {
+                writer->writeStartElement(QStringLiteral("bind"));
+                writer->writeDefaultNamespace(ns_bind2);
+                if (!d->bind2Features.isEmpty()) {
+                    writer->writeStartElement(QStringLiteral("inline"));
+                    for (const auto &feature : qAsConst(d->bind2Features)) {
+                        writer->writeStartElement(QStringLiteral("feature"));
+                        writer->writeAttribute(QStringLiteral("var"), feature);
+                        writer->writeEndElement();
+                    }
+                    writer->writeEndElement();
+                }
+                writer->writeEndElement();
+            }
+            writeBoolenFeature(writer, QStringLiteral("sm"), ns_stream_management, d->sasl2StreamManagementAvailable);
+            writer->writeEndElement();
+        }
+        writer->writeEndElement();
+    }
     writer->writeEndElement();
 }
 /// \endcond
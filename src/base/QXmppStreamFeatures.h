@@ -82,6 +82,18 @@ public:
     bool rosterVersioningSupported() const;
     void setRosterVersioningSupported(bool);
 
+    QStringList sasl2Mechanisms() const;
+    void setSasl2Mechanisms(const QStringList &mechanisms);
+
+    bool bind2Available() const;
+    void setBind2Available(bool available);
+
+    QStringList bind2Features() const;
+    void setBind2Features(const QStringList &features);
+
+    bool sasl2StreamManagementAvailable() const;
+    void setSasl2StreamManagementAvailable(bool available);
+
     /// \cond
     void parse(const QDomElement &element) override;
     void toXml(QXmlStreamWriter *writer) const override;
@@ -130,14 +130,17 @@ void QXmppStreamManagementEnabled::parse(const QDomElement &element)
 {
     QString resume = element.attribute(QStringLiteral("resume"));
     m_resume = resume == QStringLiteral("true") || resume == QStringLiteral("1");
+    m_id = element.attribute(QStringLiteral("id"));
     m_max = element.attribute(QStringLiteral("max")).toUInt();
     m_location = element.attribute(QStringLiteral("location"));
 }
 
 void QXmppStreamManagementEnabled::toXml(QXmlStreamWriter *writer) const
 {
-    writer->writeStartElement(QStringLiteral("enable"));
+    writer->writeStartElement(QStringLiteral("enabled"));
     writer->writeDefaultNamespace(ns_stream_management);
+    if (!m_id.isEmpty())
+        writer->writeAttribute(QStringLiteral("id"), m_id);
     if (m_resume)
         writer->writeAttribute(QStringLiteral("resume"), QStringLiteral("true"));
     if (m_max > 0)
@@ -187,6 +190,7 @@ void QXmppStreamManagementResume::parse(const QDomElement &element)
 void QXmppStreamManagementResume::toXml(QXmlStreamWriter *writer) const
 {
     writer->writeStartElement(QStringLiteral("resume"));
+    writer->writeDefaultNamespace(ns_stream_management);
     writer->writeAttribute(QStringLiteral("h"), QString::number(m_h));
     writer->writeAttribute(QStringLiteral("previd"), m_previd);
     writer->writeEndElement();
@@ -232,6 +236,7 @@ void QXmppStreamManagementResumed::parse(const QDomElement &element)
 void QXmppStreamManagementResumed::toXml(QXmlStreamWriter *writer) const
 {
     writer->writeStartElement(QStringLiteral("resumed"));
+    writer->writeDefaultNamespace(ns_stream_management);
     writer->writeAttribute(QStringLiteral("h"), QString::number(m_h));
     writer->writeAttribute(QStringLiteral("previd"), m_previd);
     writer->writeEndElement();
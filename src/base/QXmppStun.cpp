@@ -32,11 +32,29 @@
 #include <QNetworkInterface>
 #include <QTimer>
 #include <QUdpSocket>
+#include <QVarLengthArray>
+#include <QtEndian>
+
+#ifdef Q_OS_LINUX
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <string.h>
+#include <sys/socket.h>
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#endif
 
 #define STUN_ID_SIZE 12
 #define STUN_RTO_INTERVAL 500
 #define STUN_RTO_MAX 7
 
+// see RFC 8445 - 14.2. Ta: Pacing of ICE Connectivity Checks
+#define ICE_TA_INTERVAL 50
+// how long the controlling agent waits for better pairs before nominating
+#define ICE_NOMINATION_DELAY 200
+
 static const quint32 STUN_MAGIC = 0x2112A442;
 static const quint16 STUN_HEADER = 20;
 static const quint8 STUN_IPV4 = 0x01;
@@ -135,109 +153,471 @@ static bool isCompatibleAddress(const QHostAddress &a1, const QHostAddress &a2)
         isIPv6LinkLocalAddress(a1) == isIPv6LinkLocalAddress(a2);
 }
 
-static bool decodeAddress(QDataStream &stream, quint16 a_length, QHostAddress &address, quint16 &port, const QByteArray &xorId = QByteArray())
+static bool isXorAddress(quint16 type)
+{
+    return type == XorMappedAddress ||
+        type == XorPeerAddress ||
+        type == XorRelayedAddress;
+}
+
+static int paddedLength(int length)
+{
+    return (length + 3) & ~3;
+}
+
+// Computes the HMAC-SHA1 of a STUN message whose header announces the
+// given body length, the data following the header is read as is.
+static void stunHmacSha1(const QByteArray &key, const uchar *message, int size, quint16 bodyLength, char *digest)
+{
+    const int B = 64;
+    uchar ipad[B], opad[B];
+    memset(ipad, 0, B);
+    memcpy(ipad, key.constData(), qMin(key.size(), B));
+    memcpy(opad, ipad, B);
+    for (int i = 0; i < B; ++i) {
+        ipad[i] ^= 0x36;
+        opad[i] ^= 0x5c;
+    }
+
+    uchar header[4];
+    memcpy(header, message, 2);
+    qToBigEndian(bodyLength, header + 2);
+
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(reinterpret_cast<const char *>(ipad), B);
+    hash.addData(reinterpret_cast<const char *>(header), sizeof(header));
+    hash.addData(reinterpret_cast<const char *>(message + 4), size - 4);
+    const QByteArray inner = hash.result();
+
+    hash.reset();
+    hash.addData(reinterpret_cast<const char *>(opad), B);
+    hash.addData(inner);
+    memcpy(digest, hash.result().constData(), 20);
+}
+
+/// Constructs an empty QXmppStunMessageView.
+
+QXmppStunMessageView::QXmppStunMessageView()
+    : m_data(nullptr),
+      m_size(0),
+      m_integrityOffset(-1),
+      m_fingerprintOffset(-1),
+      m_error(NotStunError)
+{
+}
+
+/// Parses the STUN message contained in the given buffer, checking the
+/// header, the attributes' framing and the FINGERPRINT if present.
+///
+/// The MESSAGE-INTEGRITY is only checked by checkIntegrity().
+///
+/// \param data
+/// \param size
+
+bool QXmppStunMessageView::parse(const char *data, int size)
 {
-    if (a_length < 4)
+    m_data = reinterpret_cast<const uchar *>(data);
+    m_size = 0;
+    m_integrityOffset = -1;
+    m_fingerprintOffset = -1;
+
+    // the two most significant bits of a STUN message are zero, which
+    // tells it apart from channel data and media
+    if (size < STUN_HEADER || (m_data[0] & 0xc0) ||
+        qFromBigEndian<quint16>(m_data + 2) != size - STUN_HEADER) {
+        m_error = NotStunError;
         return false;
-    quint8 reserved, protocol;
-    quint16 rawPort;
-    stream >> reserved;
-    stream >> protocol;
-    stream >> rawPort;
-    if (xorId.isEmpty())
-        port = rawPort;
-    else
-        port = rawPort ^ (STUN_MAGIC >> 16);
-    if (protocol == STUN_IPV4) {
-        if (a_length != 8)
+    }
+    if (size % 4) {
+        m_error = InvalidError;
+        return false;
+    }
+
+    int offset = STUN_HEADER;
+    while (offset < size) {
+        if (size - offset < 4 || m_fingerprintOffset >= 0) {
+            m_error = InvalidError;
             return false;
-        quint32 addr;
-        stream >> addr;
-        if (xorId.isEmpty())
-            address = QHostAddress(addr);
-        else
-            address = QHostAddress(addr ^ STUN_MAGIC);
-    } else if (protocol == STUN_IPV6) {
-        if (a_length != 20)
+        }
+        const quint16 type = qFromBigEndian<quint16>(m_data + offset);
+        const quint16 length = qFromBigEndian<quint16>(m_data + offset + 2);
+        if (paddedLength(length) > size - offset - 4) {
+            m_error = InvalidError;
+            return false;
+        }
+
+        if (type == MessageIntegrity && m_integrityOffset < 0) {
+            if (length != 20) {
+                m_error = InvalidError;
+                return false;
+            }
+            m_integrityOffset = offset;
+        } else if (type == Fingerprint) {
+            if (length != 4) {
+                m_error = InvalidError;
+                return false;
+            }
+            m_fingerprintOffset = offset;
+        }
+        offset += 4 + paddedLength(length);
+    }
+
+    // FINGERPRINT is the last attribute, so the header's length covers it
+    if (m_fingerprintOffset >= 0) {
+        const quint32 expected = QXmppUtils::generateCrc32(data, m_fingerprintOffset) ^ 0x5354554eL;
+        if (qFromBigEndian<quint32>(m_data + m_fingerprintOffset + 4) != expected) {
+            m_error = FingerprintError;
+            return false;
+        }
+    }
+
+    m_size = size;
+    m_error = NoError;
+    return true;
+}
+
+/// Returns the reason why the last call to parse() failed.
+
+QXmppStunMessageView::Error QXmppStunMessageView::error() const
+{
+    return m_error;
+}
+
+/// Returns the message type.
+
+quint16 QXmppStunMessageView::type() const
+{
+    return m_size ? qFromBigEndian<quint16>(m_data) : 0;
+}
+
+/// Returns the message class.
+
+quint16 QXmppStunMessageView::messageClass() const
+{
+    return type() & 0x0110;
+}
+
+/// Returns the message method.
+
+quint16 QXmppStunMessageView::messageMethod() const
+{
+    return type() & 0x3eef;
+}
+
+/// Returns the magic cookie.
+
+quint32 QXmppStunMessageView::cookie() const
+{
+    return m_size ? qFromBigEndian<quint32>(m_data + 4) : 0;
+}
+
+/// Returns a pointer to the 12 bytes of the transaction ID.
+
+const char *QXmppStunMessageView::id() const
+{
+    return m_size ? reinterpret_cast<const char *>(m_data + 8) : nullptr;
+}
+
+/// Returns true if the message carries a valid FINGERPRINT.
+
+bool QXmppStunMessageView::hasFingerprint() const
+{
+    return m_size && m_fingerprintOffset >= 0;
+}
+
+/// Returns true if the message carries a MESSAGE-INTEGRITY attribute.
+
+bool QXmppStunMessageView::hasIntegrity() const
+{
+    return m_size && m_integrityOffset >= 0;
+}
+
+/// Checks the MESSAGE-INTEGRITY attribute using the given key, returns
+/// false if the message has none.
+///
+/// \param key
+
+bool QXmppStunMessageView::checkIntegrity(const QByteArray &key) const
+{
+    if (!hasIntegrity())
+        return false;
+
+    char digest[20];
+    stunHmacSha1(key, m_data, m_integrityOffset, m_integrityOffset - STUN_HEADER + 24, digest);
+    return !memcmp(digest, m_data + m_integrityOffset + 4, sizeof(digest));
+}
+
+/// Reads the attribute at the given offset, starting from 0, and moves the
+/// offset to the next attribute. Returns false after the last attribute.
+///
+/// \param offset
+/// \param attribute
+
+bool QXmppStunMessageView::nextAttribute(int &offset, Attribute &attribute) const
+{
+    const int position = STUN_HEADER + offset;
+    if (!m_size || offset < 0 || position >= m_size)
+        return false;
+
+    attribute.type = qFromBigEndian<quint16>(m_data + position);
+    attribute.length = qFromBigEndian<quint16>(m_data + position + 2);
+    attribute.value = reinterpret_cast<const char *>(m_data + position + 4);
+    offset += 4 + paddedLength(attribute.length);
+    return true;
+}
+
+/// Finds the first attribute of the given type which is covered by the
+/// MESSAGE-INTEGRITY, if any.
+///
+/// \param type
+/// \param attribute
+
+bool QXmppStunMessageView::findAttribute(quint16 type, Attribute &attribute) const
+{
+    const int end = m_integrityOffset >= 0 ? m_integrityOffset - STUN_HEADER : m_size;
+    int offset = 0;
+    while (offset < end && nextAttribute(offset, attribute)) {
+        if (attribute.type == type)
+            return true;
+    }
+    return false;
+}
+
+/// Decodes an address attribute, reverting the XOR applied to the
+/// XOR-MAPPED-ADDRESS, XOR-PEER-ADDRESS and XOR-RELAYED-ADDRESS.
+///
+/// \param attribute
+/// \param host
+/// \param port
+
+bool QXmppStunMessageView::decodeAddress(const Attribute &attribute, QHostAddress &host, quint16 &port) const
+{
+    if (!m_size || attribute.length < 4)
+        return false;
+
+    const uchar *value = reinterpret_cast<const uchar *>(attribute.value);
+    const bool xored = isXorAddress(attribute.type);
+    port = qFromBigEndian<quint16>(value + 2);
+    if (xored)
+        port ^= (STUN_MAGIC >> 16);
+
+    if (value[1] == STUN_IPV4) {
+        if (attribute.length != 8)
+            return false;
+        quint32 addr = qFromBigEndian<quint32>(value + 4);
+        if (xored)
+            addr ^= STUN_MAGIC;
+        host = QHostAddress(addr);
+    } else if (value[1] == STUN_IPV6) {
+        if (attribute.length != 20)
             return false;
         Q_IPV6ADDR addr;
-        stream.readRawData((char *)&addr, sizeof(addr));
-        if (!xorId.isEmpty()) {
-            QByteArray xpad;
-            QDataStream(&xpad, QIODevice::WriteOnly) << STUN_MAGIC;
-            xpad += xorId;
+        memcpy(&addr, value + 4, sizeof(addr));
+        if (xored) {
+            // the pad is the magic cookie followed by the transaction ID
+            uchar pad[16];
+            qToBigEndian(STUN_MAGIC, pad);
+            memcpy(pad + 4, m_data + 8, STUN_ID_SIZE);
             for (int i = 0; i < 16; i++)
-                addr[i] ^= xpad[i];
+                addr[i] ^= pad[i];
         }
-        address = QHostAddress(addr);
+        host = QHostAddress(addr);
     } else {
         return false;
     }
     return true;
 }
 
-static void encodeAddress(QDataStream &stream, quint16 type, const QHostAddress &address, quint16 port, const QByteArray &xorId = QByteArray())
+/// Constructs a writer which encodes a STUN message into the given buffer.
+///
+/// \param buffer
+/// \param capacity
+
+QXmppStunMessageWriter::QXmppStunMessageWriter(char *buffer, int capacity)
+    : m_data(reinterpret_cast<uchar *>(buffer)),
+      m_capacity(capacity),
+      m_size(0),
+      m_overflowed(false)
+{
+}
+
+/// Writes the message header, this must be done first.
+///
+/// \param type
+/// \param id The 12 bytes of the transaction ID.
+/// \param cookie
+
+bool QXmppStunMessageWriter::writeHeader(quint16 type, const char *id, quint32 cookie)
+{
+    if (m_overflowed || m_capacity < STUN_HEADER) {
+        m_overflowed = true;
+        return false;
+    }
+
+    qToBigEndian(type, m_data);
+    qToBigEndian(quint16(0), m_data + 2);
+    qToBigEndian(cookie, m_data + 4);
+    memcpy(m_data + 8, id, STUN_ID_SIZE);
+    m_size = STUN_HEADER;
+    return true;
+}
+
+/// Appends an attribute of the given length and returns a pointer to its
+/// value for the caller to fill in, or a null pointer if the buffer is too
+/// small. The padding is zeroed.
+///
+/// \param type
+/// \param length
+
+char *QXmppStunMessageWriter::reserveAttribute(quint16 type, int length)
+{
+    if (m_overflowed || !m_size || length < 0 || length > 0xffff ||
+        m_capacity - m_size < 4 + paddedLength(length)) {
+        m_overflowed = true;
+        return nullptr;
+    }
+
+    uchar *attribute = m_data + m_size;
+    qToBigEndian(type, attribute);
+    qToBigEndian(quint16(length), attribute + 2);
+    memset(attribute + 4 + length, 0, paddedLength(length) - length);
+
+    m_size += 4 + paddedLength(length);
+    setBodyLength(m_size - STUN_HEADER);
+    return reinterpret_cast<char *>(attribute + 4);
+}
+
+/// Appends an attribute with the given value.
+///
+/// \param type
+/// \param value
+/// \param length
+
+bool QXmppStunMessageWriter::addAttribute(quint16 type, const char *value, int length)
+{
+    char *data = reserveAttribute(type, length);
+    if (!data)
+        return false;
+    if (length)
+        memcpy(data, value, length);
+    return true;
+}
+
+/// Appends an attribute holding a 32-bit integer.
+///
+/// \param type
+/// \param value
+
+bool QXmppStunMessageWriter::addUInt32(quint16 type, quint32 value)
 {
-    const quint8 reserved = 0;
-    if (address.protocol() == QAbstractSocket::IPv4Protocol) {
-        stream << type;
-        stream << quint16(8);
-        stream << reserved;
-        stream << quint8(STUN_IPV4);
-        quint32 addr = address.toIPv4Address();
-        if (!xorId.isEmpty()) {
-            port ^= (STUN_MAGIC >> 16);
+    char *data = reserveAttribute(type, sizeof(value));
+    if (!data)
+        return false;
+    qToBigEndian(value, reinterpret_cast<uchar *>(data));
+    return true;
+}
+
+/// Appends an address attribute, applying the XOR required by the
+/// XOR-MAPPED-ADDRESS, XOR-PEER-ADDRESS and XOR-RELAYED-ADDRESS.
+///
+/// \param type
+/// \param host
+/// \param port
+
+bool QXmppStunMessageWriter::addAddress(quint16 type, const QHostAddress &host, quint16 port)
+{
+    const bool xored = isXorAddress(type);
+    if (xored)
+        port ^= (STUN_MAGIC >> 16);
+
+    if (host.protocol() == QAbstractSocket::IPv4Protocol) {
+        uchar *value = reinterpret_cast<uchar *>(reserveAttribute(type, 8));
+        if (!value)
+            return false;
+        quint32 addr = host.toIPv4Address();
+        if (xored)
             addr ^= STUN_MAGIC;
-        }
-        stream << port;
-        stream << addr;
-    } else if (address.protocol() == QAbstractSocket::IPv6Protocol) {
-        stream << type;
-        stream << quint16(20);
-        stream << reserved;
-        stream << quint8(STUN_IPV6);
-        Q_IPV6ADDR addr = address.toIPv6Address();
-        if (!xorId.isEmpty()) {
-            port ^= (STUN_MAGIC >> 16);
-            QByteArray xpad;
-            QDataStream(&xpad, QIODevice::WriteOnly) << STUN_MAGIC;
-            xpad += xorId;
+        value[0] = 0;
+        value[1] = STUN_IPV4;
+        qToBigEndian(port, value + 2);
+        qToBigEndian(addr, value + 4);
+        return true;
+    } else if (host.protocol() == QAbstractSocket::IPv6Protocol) {
+        uchar *value = reinterpret_cast<uchar *>(reserveAttribute(type, 20));
+        if (!value)
+            return false;
+        Q_IPV6ADDR addr = host.toIPv6Address();
+        if (xored) {
+            uchar pad[16];
+            qToBigEndian(STUN_MAGIC, pad);
+            memcpy(pad + 4, m_data + 8, STUN_ID_SIZE);
             for (int i = 0; i < 16; i++)
-                addr[i] ^= xpad[i];
+                addr[i] ^= pad[i];
         }
-        stream << port;
-        stream.writeRawData((char *)&addr, sizeof(addr));
-    } else {
-        qWarning("Cannot write STUN attribute for unknown IP version");
+        value[0] = 0;
+        value[1] = STUN_IPV6;
+        qToBigEndian(port, value + 2);
+        memcpy(value + 4, &addr, sizeof(addr));
+        return true;
     }
+
+    qWarning("Cannot write STUN attribute for unknown IP version");
+    return false;
 }
 
-static void addAddress(QDataStream &stream, quint16 type, const QHostAddress &host, quint16 port, const QByteArray &xorId = QByteArray())
+/// Appends the MESSAGE-INTEGRITY attribute, computed using the given key.
+///
+/// \param key
+
+bool QXmppStunMessageWriter::addIntegrity(const QByteArray &key)
 {
-    if (port && !host.isNull() &&
-        (host.protocol() == QAbstractSocket::IPv4Protocol ||
-         host.protocol() == QAbstractSocket::IPv6Protocol)) {
-        encodeAddress(stream, type, host, port, xorId);
-    }
+    const int offset = m_size;
+    char *value = reserveAttribute(MessageIntegrity, 20);
+    if (!value)
+        return false;
+    stunHmacSha1(key, m_data, offset, m_size - STUN_HEADER, value);
+    return true;
 }
 
-static void encodeString(QDataStream &stream, quint16 type, const QString &string)
+/// Appends the FINGERPRINT attribute, which must be the last one.
+
+bool QXmppStunMessageWriter::addFingerprint()
 {
-    const QByteArray utf8string = string.toUtf8();
-    stream << type;
-    stream << quint16(utf8string.size());
-    stream.writeRawData(utf8string.data(), utf8string.size());
-    if (utf8string.size() % 4) {
-        const QByteArray padding(4 - (utf8string.size() % 4), 0);
-        stream.writeRawData(padding.data(), padding.size());
-    }
+    const int offset = m_size;
+    uchar *value = reinterpret_cast<uchar *>(reserveAttribute(Fingerprint, 4));
+    if (!value)
+        return false;
+    const quint32 fingerprint = QXmppUtils::generateCrc32(reinterpret_cast<const char *>(m_data), offset) ^ 0x5354554eL;
+    qToBigEndian(fingerprint, value);
+    return true;
+}
+
+/// Returns the size of the message written so far.
+
+int QXmppStunMessageWriter::size() const
+{
+    return m_size;
+}
+
+/// Returns true if the buffer was too small for one of the writes.
+
+bool QXmppStunMessageWriter::hasOverflowed() const
+{
+    return m_overflowed;
+}
+
+void QXmppStunMessageWriter::setBodyLength(int length)
+{
+    qToBigEndian(quint16(length), m_data + 2);
 }
 
-static void setBodyLength(QByteArray &buffer, qint16 length)
+static void addAddress(QXmppStunMessageWriter &writer, quint16 type, const QHostAddress &host, quint16 port)
 {
-    QDataStream stream(&buffer, QIODevice::WriteOnly);
-    stream.device()->seek(2);
-    stream << length;
+    if (port && !host.isNull() &&
+        (host.protocol() == QAbstractSocket::IPv4Protocol ||
+         host.protocol() == QAbstractSocket::IPv6Protocol)) {
+        writer.addAddress(type, host, port);
+    }
 }
 
 /// Constructs a new QXmppStunMessage.
@@ -511,46 +891,50 @@ bool QXmppStunMessage::decode(const QByteArray &buffer, const QByteArray &key, Q
     if (!errors)
         errors = &silent;
 
-    if (buffer.size() < STUN_HEADER) {
-        *errors << QLatin1String("Received a truncated STUN packet");
+    QXmppStunMessageView view;
+    if (!view.parse(buffer.constData(), buffer.size())) {
+        if (view.error() == QXmppStunMessageView::FingerprintError)
+            *errors << QLatin1String("Bad fingerprint");
+        else if (buffer.size() < STUN_HEADER)
+            *errors << QLatin1String("Received a truncated STUN packet");
+        else
+            *errors << QLatin1String("Received an invalid STUN packet");
         return false;
     }
 
-    // parse STUN header
-    QDataStream stream(buffer);
-    quint16 length;
-    stream >> m_type;
-    stream >> length;
-    stream >> m_cookie;
-    stream.readRawData(m_id.data(), m_id.size());
-
-    if (length != buffer.size() - STUN_HEADER) {
-        *errors << QLatin1String("Received an invalid STUN packet");
+    // check HMAC-SHA1
+    if (!key.isEmpty() && view.hasIntegrity() && !view.checkIntegrity(key)) {
+        *errors << QLatin1String("Bad message integrity");
         return false;
     }
 
+    // parse STUN header
+    m_type = view.type();
+    m_cookie = view.cookie();
+    m_id = QByteArray(view.id(), STUN_ID_SIZE);
+
     // parse STUN attributes
-    int done = 0;
+    QXmppStunMessageView::Attribute attribute;
+    int offset = 0;
     bool after_integrity = false;
-    while (done < length) {
-        quint16 a_type, a_length;
-        stream >> a_type;
-        stream >> a_length;
-        const int pad_length = 4 * ((a_length + 3) / 4) - a_length;
+    while (view.nextAttribute(offset, attribute)) {
+        const quint16 a_type = attribute.type;
+        const quint16 a_length = attribute.length;
+        const char *value = attribute.value;
+        const uchar *uvalue = reinterpret_cast<const uchar *>(value);
 
         // only FINGERPRINT is allowed after MESSAGE-INTEGRITY
         if (after_integrity && a_type != Fingerprint) {
             *errors << QString("Skipping attribute %1 after MESSAGE-INTEGRITY").arg(QString::number(a_type));
-            stream.skipRawData(a_length + pad_length);
-            done += 4 + a_length + pad_length;
             continue;
         }
 
         if (a_type == Priority) {
+
             // PRIORITY
             if (a_length != sizeof(m_priority))
                 return false;
-            stream >> m_priority;
+            m_priority = qFromBigEndian<quint32>(uvalue);
             m_attributes << Priority;
 
         } else if (a_type == ErrorCode) {
@@ -558,15 +942,8 @@ bool QXmppStunMessage::decode(const QByteArray &buffer, const QByteArray &key, Q
             // ERROR-CODE
             if (a_length < 4)
                 return false;
-            quint16 reserved;
-            quint8 errorCodeHigh, errorCodeLow;
-            stream >> reserved;
-            stream >> errorCodeHigh;
-            stream >> errorCodeLow;
-            errorCode = errorCodeHigh * 100 + errorCodeLow;
-            QByteArray phrase(a_length - 4, 0);
-            stream.readRawData(phrase.data(), phrase.size());
-            errorPhrase = QString::fromUtf8(phrase);
+            errorCode = uvalue[2] * 100 + uvalue[3];
+            errorPhrase = QString::fromUtf8(value + 4, a_length - 4);
 
         } else if (a_type == UseCandidate) {
 
@@ -580,15 +957,13 @@ bool QXmppStunMessage::decode(const QByteArray &buffer, const QByteArray &key, Q
             // CHANNEL-NUMBER
             if (a_length != 4)
                 return false;
-            stream >> m_channelNumber;
-            stream.skipRawData(2);
+            m_channelNumber = qFromBigEndian<quint16>(uvalue);
             m_attributes << ChannelNumber;
 
         } else if (a_type == DataAttr) {
 
             // DATA
-            m_data.resize(a_length);
-            stream.readRawData(m_data.data(), m_data.size());
+            m_data = QByteArray(value, a_length);
             m_attributes << DataAttr;
 
         } else if (a_type == Lifetime) {
@@ -596,22 +971,19 @@ bool QXmppStunMessage::decode(const QByteArray &buffer, const QByteArray &key, Q
             // LIFETIME
             if (a_length != sizeof(m_lifetime))
                 return false;
-            stream >> m_lifetime;
+            m_lifetime = qFromBigEndian<quint32>(uvalue);
             m_attributes << Lifetime;
 
         } else if (a_type == Nonce) {
 
             // NONCE
-            m_nonce.resize(a_length);
-            stream.readRawData(m_nonce.data(), m_nonce.size());
+            m_nonce = QByteArray(value, a_length);
             m_attributes << Nonce;
 
         } else if (a_type == Realm) {
 
             // REALM
-            QByteArray utf8Realm(a_length, 0);
-            stream.readRawData(utf8Realm.data(), utf8Realm.size());
-            m_realm = QString::fromUtf8(utf8Realm);
+            m_realm = QString::fromUtf8(value, a_length);
             m_attributes << Realm;
 
         } else if (a_type == RequestedTransport) {
@@ -619,8 +991,7 @@ bool QXmppStunMessage::decode(const QByteArray &buffer, const QByteArray &key, Q
             // REQUESTED-TRANSPORT
             if (a_length != 4)
                 return false;
-            stream >> m_requestedTransport;
-            stream.skipRawData(3);
+            m_requestedTransport = uvalue[0];
             m_attributes << RequestedTransport;
 
         } else if (a_type == ReservationToken) {
@@ -628,30 +999,25 @@ bool QXmppStunMessage::decode(const QByteArray &buffer, const QByteArray &key, Q
             // RESERVATION-TOKEN
             if (a_length != 8)
                 return false;
-            m_reservationToken.resize(a_length);
-            stream.readRawData(m_reservationToken.data(), m_reservationToken.size());
+            m_reservationToken = QByteArray(value, a_length);
             m_attributes << ReservationToken;
 
         } else if (a_type == Software) {
 
             // SOFTWARE
-            QByteArray utf8Software(a_length, 0);
-            stream.readRawData(utf8Software.data(), utf8Software.size());
-            m_software = QString::fromUtf8(utf8Software);
+            m_software = QString::fromUtf8(value, a_length);
             m_attributes << Software;
 
         } else if (a_type == Username) {
 
             // USERNAME
-            QByteArray utf8Username(a_length, 0);
-            stream.readRawData(utf8Username.data(), utf8Username.size());
-            m_username = QString::fromUtf8(utf8Username);
+            m_username = QString::fromUtf8(value, a_length);
             m_attributes << Username;
 
         } else if (a_type == MappedAddress) {
 
             // MAPPED-ADDRESS
-            if (!decodeAddress(stream, a_length, mappedHost, mappedPort)) {
+            if (!view.decodeAddress(attribute, mappedHost, mappedPort)) {
                 *errors << QLatin1String("Bad MAPPED-ADDRESS");
                 return false;
             }
@@ -661,13 +1027,13 @@ bool QXmppStunMessage::decode(const QByteArray &buffer, const QByteArray &key, Q
             // CHANGE-REQUEST
             if (a_length != sizeof(m_changeRequest))
                 return false;
-            stream >> m_changeRequest;
+            m_changeRequest = qFromBigEndian<quint32>(uvalue);
             m_attributes << ChangeRequest;
 
         } else if (a_type == SourceAddress) {
 
             // SOURCE-ADDRESS
-            if (!decodeAddress(stream, a_length, sourceHost, sourcePort)) {
+            if (!view.decodeAddress(attribute, sourceHost, sourcePort)) {
                 *errors << QLatin1String("Bad SOURCE-ADDRESS");
                 return false;
             }
@@ -675,7 +1041,7 @@ bool QXmppStunMessage::decode(const QByteArray &buffer, const QByteArray &key, Q
         } else if (a_type == ChangedAddress) {
 
             // CHANGED-ADDRESS
-            if (!decodeAddress(stream, a_length, changedHost, changedPort)) {
+            if (!view.decodeAddress(attribute, changedHost, changedPort)) {
                 *errors << QLatin1String("Bad CHANGED-ADDRESS");
                 return false;
             }
@@ -683,7 +1049,7 @@ bool QXmppStunMessage::decode(const QByteArray &buffer, const QByteArray &key, Q
         } else if (a_type == OtherAddress) {
 
             // OTHER-ADDRESS
-            if (!decodeAddress(stream, a_length, otherHost, otherPort)) {
+            if (!view.decodeAddress(attribute, otherHost, otherPort)) {
                 *errors << QLatin1String("Bad OTHER-ADDRESS");
                 return false;
             }
@@ -691,7 +1057,7 @@ bool QXmppStunMessage::decode(const QByteArray &buffer, const QByteArray &key, Q
         } else if (a_type == XorMappedAddress) {
 
             // XOR-MAPPED-ADDRESS
-            if (!decodeAddress(stream, a_length, xorMappedHost, xorMappedPort, m_id)) {
+            if (!view.decodeAddress(attribute, xorMappedHost, xorMappedPort)) {
                 *errors << QLatin1String("Bad XOR-MAPPED-ADDRESS");
                 return false;
             }
@@ -699,7 +1065,7 @@ bool QXmppStunMessage::decode(const QByteArray &buffer, const QByteArray &key, Q
         } else if (a_type == XorPeerAddress) {
 
             // XOR-PEER-ADDRESS
-            if (!decodeAddress(stream, a_length, xorPeerHost, xorPeerPort, m_id)) {
+            if (!view.decodeAddress(attribute, xorPeerHost, xorPeerPort)) {
                 *errors << QLatin1String("Bad XOR-PEER-ADDRESS");
                 return false;
             }
@@ -707,49 +1073,20 @@ bool QXmppStunMessage::decode(const QByteArray &buffer, const QByteArray &key, Q
         } else if (a_type == XorRelayedAddress) {
 
             // XOR-RELAYED-ADDRESS
-            if (!decodeAddress(stream, a_length, xorRelayedHost, xorRelayedPort, m_id)) {
+            if (!view.decodeAddress(attribute, xorRelayedHost, xorRelayedPort)) {
                 *errors << QLatin1String("Bad XOR-RELAYED-ADDRESS");
                 return false;
             }
 
         } else if (a_type == MessageIntegrity) {
 
-            // MESSAGE-INTEGRITY
-            if (a_length != 20)
-                return false;
-            QByteArray integrity(20, 0);
-            stream.readRawData(integrity.data(), integrity.size());
-
-            // check HMAC-SHA1
-            if (!key.isEmpty()) {
-                QByteArray copy = buffer.left(STUN_HEADER + done);
-                setBodyLength(copy, done + 24);
-                if (integrity != QXmppUtils::generateHmacSha1(key, copy)) {
-                    *errors << QLatin1String("Bad message integrity");
-                    return false;
-                }
-            }
-
+            // MESSAGE-INTEGRITY, checked above
             // from here onwards, only FINGERPRINT is allowed
             after_integrity = true;
 
         } else if (a_type == Fingerprint) {
 
-            // FINGERPRINT
-            if (a_length != 4)
-                return false;
-            quint32 fingerprint;
-            stream >> fingerprint;
-
-            // check CRC32
-            QByteArray copy = buffer.left(STUN_HEADER + done);
-            setBodyLength(copy, done + 8);
-            const quint32 expected = QXmppUtils::generateCrc32(copy) ^ 0x5354554eL;
-            if (fingerprint != expected) {
-                *errors << QLatin1String("Bad fingerprint");
-                return false;
-            }
-
+            // FINGERPRINT, checked by the view
             // stop parsing, no more attributes are allowed
             return true;
 
@@ -758,25 +1095,20 @@ bool QXmppStunMessage::decode(const QByteArray &buffer, const QByteArray &key, Q
             /// ICE-CONTROLLING
             if (a_length != 8)
                 return false;
-            iceControlling.resize(a_length);
-            stream.readRawData(iceControlling.data(), iceControlling.size());
+            iceControlling = QByteArray(value, a_length);
 
         } else if (a_type == IceControlled) {
 
             /// ICE-CONTROLLED
             if (a_length != 8)
                 return false;
-            iceControlled.resize(a_length);
-            stream.readRawData(iceControlled.data(), iceControlled.size());
+            iceControlled = QByteArray(value, a_length);
 
         } else {
 
             // Unknown attribute
-            stream.skipRawData(a_length);
             *errors << QStringLiteral("Skipping unknown attribute %1").arg(QString::number(a_type));
         }
-        stream.skipRawData(pad_length);
-        done += 4 + a_length + pad_length;
     }
     return true;
 }
@@ -789,168 +1121,120 @@ bool QXmppStunMessage::decode(const QByteArray &buffer, const QByteArray &key, Q
 
 QByteArray QXmppStunMessage::encode(const QByteArray &key, bool addFingerprint) const
 {
-    QByteArray buffer;
-    QDataStream stream(&buffer, QIODevice::WriteOnly);
+    const QByteArray phrase = errorPhrase.toUtf8();
+    const QByteArray realm = m_realm.toUtf8();
+    const QByteArray software = m_software.toUtf8();
+    const QByteArray username = m_username.toUtf8();
+
+    // the fixed-size attributes and the padding of the others take less
+    // than 384 bytes
+    QByteArray buffer(384 + phrase.size() + m_data.size() + m_nonce.size() + realm.size() + m_reservationToken.size() + software.size() + username.size() + iceControlling.size() + iceControlled.size(), Qt::Uninitialized);
+    QXmppStunMessageWriter writer(buffer.data(), buffer.size());
 
     // encode STUN header
-    quint16 length = 0;
-    stream << m_type;
-    stream << length;
-    stream << m_cookie;
-    stream.writeRawData(m_id.data(), m_id.size());
+    const QByteArray id = m_id.size() == STUN_ID_SIZE ? m_id : m_id.leftJustified(STUN_ID_SIZE, '\0', true);
+    writer.writeHeader(m_type, id.constData(), m_cookie);
 
     // MAPPED-ADDRESS
-    addAddress(stream, MappedAddress, mappedHost, mappedPort);
+    addAddress(writer, MappedAddress, mappedHost, mappedPort);
 
     // CHANGE-REQUEST
-    if (m_attributes.contains(ChangeRequest)) {
-        stream << quint16(ChangeRequest);
-        stream << quint16(sizeof(m_changeRequest));
-        stream << m_changeRequest;
-    }
+    if (m_attributes.contains(ChangeRequest))
+        writer.addUInt32(ChangeRequest, m_changeRequest);
 
     // SOURCE-ADDRESS
-    addAddress(stream, SourceAddress, sourceHost, sourcePort);
+    addAddress(writer, SourceAddress, sourceHost, sourcePort);
 
     // CHANGED-ADDRESS
-    addAddress(stream, ChangedAddress, changedHost, changedPort);
+    addAddress(writer, ChangedAddress, changedHost, changedPort);
 
     // OTHER-ADDRESS
-    addAddress(stream, OtherAddress, otherHost, otherPort);
+    addAddress(writer, OtherAddress, otherHost, otherPort);
 
     // XOR-MAPPED-ADDRESS
-    addAddress(stream, XorMappedAddress, xorMappedHost, xorMappedPort, m_id);
+    addAddress(writer, XorMappedAddress, xorMappedHost, xorMappedPort);
 
     // XOR-PEER-ADDRESS
-    addAddress(stream, XorPeerAddress, xorPeerHost, xorPeerPort, m_id);
+    addAddress(writer, XorPeerAddress, xorPeerHost, xorPeerPort);
 
     // XOR-RELAYED-ADDRESS
-    addAddress(stream, XorRelayedAddress, xorRelayedHost, xorRelayedPort, m_id);
+    addAddress(writer, XorRelayedAddress, xorRelayedHost, xorRelayedPort);
 
     // ERROR-CODE
     if (errorCode) {
-        const quint16 reserved = 0;
-        const quint8 errorCodeHigh = errorCode / 100;
-        const quint8 errorCodeLow = errorCode % 100;
-        const QByteArray phrase = errorPhrase.toUtf8();
-        stream << quint16(ErrorCode);
-        stream << quint16(phrase.size() + 4);
-        stream << reserved;
-        stream << errorCodeHigh;
-        stream << errorCodeLow;
-        stream.writeRawData(phrase.data(), phrase.size());
-        if (phrase.size() % 4) {
-            const QByteArray padding(4 - (phrase.size() % 4), 0);
-            stream.writeRawData(padding.data(), padding.size());
+        char *value = writer.reserveAttribute(ErrorCode, phrase.size() + 4);
+        if (value) {
+            value[0] = 0;
+            value[1] = 0;
+            value[2] = char(errorCode / 100);
+            value[3] = char(errorCode % 100);
+            memcpy(value + 4, phrase.constData(), phrase.size());
         }
     }
 
     // PRIORITY
-    if (m_attributes.contains(Priority)) {
-        stream << quint16(Priority);
-        stream << quint16(sizeof(m_priority));
-        stream << m_priority;
-    }
+    if (m_attributes.contains(Priority))
+        writer.addUInt32(Priority, m_priority);
 
     // USE-CANDIDATE
-    if (useCandidate) {
-        stream << quint16(UseCandidate);
-        stream << quint16(0);
-    }
+    if (useCandidate)
+        writer.addAttribute(UseCandidate, nullptr, 0);
 
     // CHANNEL-NUMBER
-    if (m_attributes.contains(ChannelNumber)) {
-        stream << quint16(ChannelNumber);
-        stream << quint16(4);
-        stream << m_channelNumber;
-        stream << quint16(0);
-    }
+    if (m_attributes.contains(ChannelNumber))
+        writer.addUInt32(ChannelNumber, quint32(m_channelNumber) << 16);
 
     // DATA
-    if (m_attributes.contains(DataAttr)) {
-        stream << quint16(DataAttr);
-        stream << quint16(m_data.size());
-        stream.writeRawData(m_data.data(), m_data.size());
-        if (m_data.size() % 4) {
-            const QByteArray padding(4 - (m_data.size() % 4), 0);
-            stream.writeRawData(padding.data(), padding.size());
-        }
-    }
+    if (m_attributes.contains(DataAttr))
+        writer.addAttribute(DataAttr, m_data.constData(), m_data.size());
 
     // LIFETIME
-    if (m_attributes.contains(Lifetime)) {
-        stream << quint16(Lifetime);
-        stream << quint16(sizeof(m_lifetime));
-        stream << m_lifetime;
-    }
+    if (m_attributes.contains(Lifetime))
+        writer.addUInt32(Lifetime, m_lifetime);
 
     // NONCE
-    if (m_attributes.contains(Nonce)) {
-        stream << quint16(Nonce);
-        stream << quint16(m_nonce.size());
-        stream.writeRawData(m_nonce.data(), m_nonce.size());
-    }
+    if (m_attributes.contains(Nonce))
+        writer.addAttribute(Nonce, m_nonce.constData(), m_nonce.size());
 
     // REALM
     if (m_attributes.contains(Realm))
-        encodeString(stream, Realm, m_realm);
+        writer.addAttribute(Realm, realm.constData(), realm.size());
 
     // REQUESTED-TRANSPORT
-    if (m_attributes.contains(RequestedTransport)) {
-        const QByteArray reserved(3, 0);
-        stream << quint16(RequestedTransport);
-        stream << quint16(4);
-        stream << m_requestedTransport;
-        stream.writeRawData(reserved.data(), reserved.size());
-    }
+    if (m_attributes.contains(RequestedTransport))
+        writer.addUInt32(RequestedTransport, quint32(m_requestedTransport) << 24);
 
     // RESERVATION-TOKEN
-    if (m_attributes.contains(ReservationToken)) {
-        stream << quint16(ReservationToken);
-        stream << quint16(m_reservationToken.size());
-        stream.writeRawData(m_reservationToken.data(), m_reservationToken.size());
-    }
+    if (m_attributes.contains(ReservationToken))
+        writer.addAttribute(ReservationToken, m_reservationToken.constData(), m_reservationToken.size());
 
     // SOFTWARE
     if (m_attributes.contains(Software))
-        encodeString(stream, Software, m_software);
+        writer.addAttribute(Software, software.constData(), software.size());
 
     // USERNAME
     if (m_attributes.contains(Username))
-        encodeString(stream, Username, m_username);
+        writer.addAttribute(Username, username.constData(), username.size());
 
     // ICE-CONTROLLING or ICE-CONTROLLED
-    if (!iceControlling.isEmpty()) {
-        stream << quint16(IceControlling);
-        stream << quint16(iceControlling.size());
-        stream.writeRawData(iceControlling.data(), iceControlling.size());
-    } else if (!iceControlled.isEmpty()) {
-        stream << quint16(IceControlled);
-        stream << quint16(iceControlled.size());
-        stream.writeRawData(iceControlled.data(), iceControlled.size());
-    }
-
-    // set body length
-    setBodyLength(buffer, buffer.size() - STUN_HEADER);
+    if (!iceControlling.isEmpty())
+        writer.addAttribute(IceControlling, iceControlling.constData(), iceControlling.size());
+    else if (!iceControlled.isEmpty())
+        writer.addAttribute(IceControlled, iceControlled.constData(), iceControlled.size());
 
     // MESSAGE-INTEGRITY
-    if (!key.isEmpty()) {
-        setBodyLength(buffer, buffer.size() - STUN_HEADER + 24);
-        QByteArray integrity = QXmppUtils::generateHmacSha1(key, buffer);
-        stream << quint16(MessageIntegrity);
-        stream << quint16(integrity.size());
-        stream.writeRawData(integrity.data(), integrity.size());
-    }
+    if (!key.isEmpty())
+        writer.addIntegrity(key);
 
     // FINGERPRINT
-    if (addFingerprint) {
-        setBodyLength(buffer, buffer.size() - STUN_HEADER + 8);
-        quint32 fingerprint = QXmppUtils::generateCrc32(buffer) ^ 0x5354554eL;
-        stream << quint16(Fingerprint);
-        stream << quint16(sizeof(fingerprint));
-        stream << fingerprint;
-    }
+    if (addFingerprint)
+        writer.addFingerprint();
 
+    if (writer.hasOverflowed()) {
+        qWarning("Cannot encode STUN message, an attribute is too large");
+        return QByteArray();
+    }
+    buffer.resize(writer.size());
     return buffer;
 }
 
@@ -967,19 +1251,15 @@ quint16 QXmppStunMessage::peekType(const QByteArray &buffer, quint32 &cookie, QB
         return 0;
 
     // parse STUN header
-    QDataStream stream(buffer);
-    quint16 type;
-    quint16 length;
-    stream >> type;
-    stream >> length;
-    stream >> cookie;
+    const uchar *data = reinterpret_cast<const uchar *>(buffer.constData());
+    const quint16 length = qFromBigEndian<quint16>(data + 2);
+    cookie = qFromBigEndian<quint32>(data + 4);
 
     if (length != buffer.size() - STUN_HEADER)
         return 0;
 
-    id.resize(STUN_ID_SIZE);
-    stream.readRawData(id.data(), id.size());
-    return type;
+    id = buffer.mid(8, STUN_ID_SIZE);
+    return qFromBigEndian<quint16>(data);
 }
 
 QString QXmppStunMessage::toString() const
@@ -1164,6 +1444,361 @@ void QXmppStunTransaction::retry()
     m_tries++;
 }
 
+struct QXmppDatagramBatch::Headers
+{
+#ifdef Q_OS_LINUX
+    QVector<mmsghdr> messages;
+    QVector<iovec> iovecs;
+    QVector<sockaddr_storage> addresses;
+
+    // the last sender, most batches come from a single peer
+    sockaddr_storage lastAddress;
+    socklen_t lastAddressLength = 0;
+    QHostAddress lastHost;
+    quint16 lastPort = 0;
+#endif
+};
+
+#ifdef Q_OS_LINUX
+static void fromSockAddr(const sockaddr_storage &address, QHostAddress &host, quint16 &port)
+{
+    if (address.ss_family == AF_INET) {
+        const auto *in = reinterpret_cast<const sockaddr_in *>(&address);
+        host.setAddress(ntohl(in->sin_addr.s_addr));
+        port = ntohs(in->sin_port);
+    } else if (address.ss_family == AF_INET6) {
+        const auto *in6 = reinterpret_cast<const sockaddr_in6 *>(&address);
+        host.setAddress(reinterpret_cast<const quint8 *>(in6->sin6_addr.s6_addr));
+        if (in6->sin6_scope_id)
+            host.setScopeId(QNetworkInterface::interfaceNameFromIndex(int(in6->sin6_scope_id)));
+        port = ntohs(in6->sin6_port);
+    } else {
+        host.clear();
+        port = 0;
+    }
+}
+
+static bool toSockAddr(const QHostAddress &host, quint16 port, sockaddr_storage &address, socklen_t &length)
+{
+    memset(&address, 0, sizeof(address));
+    if (host.protocol() == QAbstractSocket::IPv4Protocol) {
+        auto *in = reinterpret_cast<sockaddr_in *>(&address);
+        in->sin_family = AF_INET;
+        in->sin_addr.s_addr = htonl(host.toIPv4Address());
+        in->sin_port = htons(port);
+        length = sizeof(sockaddr_in);
+        return true;
+    } else if (host.protocol() == QAbstractSocket::IPv6Protocol) {
+        auto *in6 = reinterpret_cast<sockaddr_in6 *>(&address);
+        const Q_IPV6ADDR addr = host.toIPv6Address();
+        in6->sin6_family = AF_INET6;
+        memcpy(in6->sin6_addr.s6_addr, addr.c, sizeof(addr.c));
+        in6->sin6_port = htons(port);
+        if (!host.scopeId().isEmpty()) {
+            bool ok = false;
+            int index = host.scopeId().toInt(&ok);
+            if (!ok)
+                index = QNetworkInterface::interfaceIndexFromName(host.scopeId());
+            if (index <= 0)
+                return false;
+            in6->sin6_scope_id = index;
+        }
+        length = sizeof(sockaddr_in6);
+        return true;
+    }
+    return false;
+}
+
+// largest segment which fits into an Ethernet frame over IPv6, larger
+// segments are rejected with EINVAL when they exceed the path MTU
+static const int maximumSegmentSize = 1452;
+
+// Sends datagrams of the same size as a single buffer which the kernel
+// splits into segments (UDP GSO), only the last datagram may be shorter.
+static bool writeSegmented(int fd, const QList<QByteArray> &datagrams, const sockaddr_storage &address, socklen_t addressLength)
+{
+    static QAtomicInt supported(1);
+    if (!supported.loadAcquire() || datagrams.size() > 64)
+        return false;
+
+    const int segmentSize = datagrams.first().size();
+    int totalSize = 0;
+    for (int i = 0; i < datagrams.size(); ++i) {
+        const int size = datagrams.at(i).size();
+        if (size > segmentSize || (size != segmentSize && i != datagrams.size() - 1))
+            return false;
+        totalSize += size;
+    }
+    if (!segmentSize || segmentSize > maximumSegmentSize || totalSize > 65000)
+        return false;
+
+    QByteArray buffer;
+    buffer.reserve(totalSize);
+    for (const auto &datagram : datagrams)
+        buffer.append(datagram);
+
+    iovec iov;
+    iov.iov_base = buffer.data();
+    iov.iov_len = size_t(buffer.size());
+
+    char control[CMSG_SPACE(sizeof(quint16))];
+    memset(control, 0, sizeof(control));
+
+    msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_name = const_cast<sockaddr_storage *>(&address);
+    message.msg_namelen = addressLength;
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+    cmsg->cmsg_level = IPPROTO_UDP;
+    cmsg->cmsg_type = UDP_SEGMENT;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(quint16));
+    const quint16 segment = quint16(segmentSize);
+    memcpy(CMSG_DATA(cmsg), &segment, sizeof(segment));
+
+    ssize_t sent;
+    do {
+        sent = ::sendmsg(fd, &message, 0);
+    } while (sent < 0 && errno == EINTR);
+
+    if (sent < 0) {
+        // the kernel or the device does not support segmentation offload,
+        // EINVAL only concerns this buffer, for instance its segment size
+        if (errno == EIO || errno == EOPNOTSUPP || errno == ENOPROTOOPT)
+            supported.storeRelease(0);
+        return false;
+    }
+    return sent == totalSize;
+}
+
+// Sends datagrams using sendmmsg(), returns the number of datagrams sent.
+static int writeMultiple(int fd, const QList<QByteArray> &datagrams, const sockaddr_storage &address, socklen_t addressLength, qint64 &bytes)
+{
+    const int count = datagrams.size();
+    QVarLengthArray<iovec, 32> iovecs(count);
+    QVarLengthArray<mmsghdr, 32> messages(count);
+    for (int i = 0; i < count; ++i) {
+        iovecs[i].iov_base = const_cast<char *>(datagrams.at(i).constData());
+        iovecs[i].iov_len = size_t(datagrams.at(i).size());
+        memset(&messages[i], 0, sizeof(mmsghdr));
+        messages[i].msg_hdr.msg_name = const_cast<sockaddr_storage *>(&address);
+        messages[i].msg_hdr.msg_namelen = addressLength;
+        messages[i].msg_hdr.msg_iov = &iovecs[i];
+        messages[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    int offset = 0;
+    while (offset < count) {
+        const int sent = ::sendmmsg(fd, messages.data() + offset, unsigned(count - offset), 0);
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent <= 0)
+            break;
+        for (int i = offset; i < offset + sent; ++i)
+            bytes += messages[i].msg_len;
+        offset += sent;
+    }
+    return offset;
+}
+#endif
+
+/// Constructs a batch which holds up to \a capacity datagrams of up to
+/// \a datagramSize bytes.
+///
+/// \param capacity
+/// \param datagramSize
+
+QXmppDatagramBatch::QXmppDatagramBatch(int capacity, int datagramSize)
+    : m_capacity(qMax(1, capacity)),
+      m_datagramSize(datagramSize),
+      m_dropped(0),
+      m_headers(new Headers)
+{
+    m_datagrams.reserve(m_capacity);
+}
+
+QXmppDatagramBatch::~QXmppDatagramBatch()
+{
+    delete m_headers;
+}
+
+/// Returns the maximum number of datagrams read at once.
+
+int QXmppDatagramBatch::capacity() const
+{
+    return m_capacity;
+}
+
+/// Reads the datagrams pending on \a socket and returns their number.
+///
+/// The datagrams remain valid until the next call. If the batch is full,
+/// more datagrams may be pending.
+///
+/// \param socket
+
+int QXmppDatagramBatch::read(QUdpSocket *socket)
+{
+    m_datagrams.clear();
+    m_dropped = 0;
+    if (!socket->hasPendingDatagrams())
+        return 0;
+
+    // the first datagram is read by Qt, which re-enables its read notifier
+    const qint64 pendingSize = socket->pendingDatagramSize();
+    if (pendingSize < 0)
+        return 0;
+    if (m_first.size() < pendingSize)
+        m_first.resize(int(pendingSize));
+
+    Datagram first;
+    first.data = m_first.constData();
+    first.port = 0;
+    const qint64 size = socket->readDatagram(m_first.data(), m_first.size(), &first.host, &first.port);
+    if (size < 0)
+        return 0;
+    first.size = int(size);
+    m_datagrams.append(first);
+
+    if (m_capacity < 2)
+        return m_datagrams.size();
+
+    const int count = m_capacity - 1;
+    if (m_buffer.isEmpty())
+        m_buffer.resize(count * m_datagramSize);
+
+#ifdef Q_OS_LINUX
+    const int fd = int(socket->socketDescriptor());
+    if (fd == -1)
+        return m_datagrams.size();
+
+    if (m_headers->messages.isEmpty()) {
+        m_headers->messages.resize(count);
+        m_headers->iovecs.resize(count);
+        m_headers->addresses.resize(count);
+        for (int i = 0; i < count; ++i) {
+            m_headers->iovecs[i].iov_base = m_buffer.data() + i * m_datagramSize;
+            m_headers->iovecs[i].iov_len = size_t(m_datagramSize);
+            memset(&m_headers->messages[i], 0, sizeof(mmsghdr));
+            m_headers->messages[i].msg_hdr.msg_name = &m_headers->addresses[i];
+            m_headers->messages[i].msg_hdr.msg_iov = &m_headers->iovecs[i];
+            m_headers->messages[i].msg_hdr.msg_iovlen = 1;
+        }
+    }
+    for (auto &message : m_headers->messages) {
+        message.msg_hdr.msg_namelen = sizeof(sockaddr_storage);
+        message.msg_hdr.msg_flags = 0;
+        message.msg_len = 0;
+    }
+
+    int received;
+    do {
+        received = ::recvmmsg(fd, m_headers->messages.data(), unsigned(count), MSG_DONTWAIT, nullptr);
+    } while (received < 0 && errno == EINTR);
+
+    for (int i = 0; i < received; ++i) {
+        const mmsghdr &message = m_headers->messages.at(i);
+        if (message.msg_hdr.msg_flags & MSG_TRUNC) {
+            m_dropped++;
+            continue;
+        }
+
+        const socklen_t addressLength = message.msg_hdr.msg_namelen;
+        if (addressLength != m_headers->lastAddressLength ||
+            memcmp(&m_headers->addresses.at(i), &m_headers->lastAddress, addressLength)) {
+            memcpy(&m_headers->lastAddress, &m_headers->addresses.at(i), addressLength);
+            m_headers->lastAddressLength = addressLength;
+            fromSockAddr(m_headers->addresses.at(i), m_headers->lastHost, m_headers->lastPort);
+        }
+
+        Datagram datagram;
+        datagram.data = m_buffer.constData() + i * m_datagramSize;
+        datagram.size = int(message.msg_len);
+        datagram.host = m_headers->lastHost;
+        datagram.port = m_headers->lastPort;
+        m_datagrams.append(datagram);
+    }
+#else
+    for (int i = 0; i < count && socket->hasPendingDatagrams(); ++i) {
+        // larger datagrams are left for the next batch
+        if (socket->pendingDatagramSize() > m_datagramSize)
+            break;
+
+        Datagram datagram;
+        datagram.data = m_buffer.constData() + i * m_datagramSize;
+        datagram.port = 0;
+        const qint64 size = socket->readDatagram(m_buffer.data() + i * m_datagramSize, m_datagramSize, &datagram.host, &datagram.port);
+        if (size < 0)
+            break;
+        datagram.size = int(size);
+        m_datagrams.append(datagram);
+    }
+#endif
+    return m_datagrams.size();
+}
+
+/// Returns the number of datagrams dropped by the last read() because they
+/// were larger than the buffers.
+///
+/// This can only happen if the batch was constructed with buffers smaller
+/// than the largest UDP datagram.
+
+int QXmppDatagramBatch::dropped() const
+{
+    return m_dropped;
+}
+
+/// Returns the datagram at \a index.
+///
+/// \param index
+
+const QXmppDatagramBatch::Datagram &QXmppDatagramBatch::datagram(int index) const
+{
+    return m_datagrams.at(index);
+}
+
+/// Sends \a datagrams to \a host and \a port, and returns the number of
+/// bytes sent or -1 if none could be sent.
+///
+/// \param socket
+/// \param datagrams
+/// \param host
+/// \param port
+
+qint64 QXmppDatagramBatch::write(QUdpSocket *socket, const QList<QByteArray> &datagrams, const QHostAddress &host, quint16 port)
+{
+    int sent = 0;
+    qint64 bytes = 0;
+
+#ifdef Q_OS_LINUX
+    const int fd = int(socket->socketDescriptor());
+    sockaddr_storage address;
+    socklen_t addressLength;
+    if (fd != -1 && datagrams.size() > 1 &&
+        host.protocol() == socket->localAddress().protocol() &&
+        toSockAddr(host, port, address, addressLength)) {
+        if (writeSegmented(fd, datagrams, address, addressLength)) {
+            for (const auto &datagram : datagrams)
+                bytes += datagram.size();
+            return bytes;
+        }
+        sent = writeMultiple(fd, datagrams, address, addressLength, bytes);
+    }
+#endif
+
+    for (int i = sent; i < datagrams.size(); ++i) {
+        const QByteArray &datagram = datagrams.at(i);
+        if (socket->writeDatagram(datagram, host, port) != datagram.size())
+            break;
+        bytes += datagram.size();
+        ++sent;
+    }
+    return sent ? bytes : -1;
+}
+
 /// Constructs a new QXmppTurnAllocation.
 ///
 /// \param parent
@@ -1278,15 +1913,17 @@ QXmppJingleCandidate QXmppTurnAllocation::localCandidate(int component) const
 
 void QXmppTurnAllocation::readyRead()
 {
-    QByteArray buffer;
-    QHostAddress remoteHost;
-    quint16 remotePort;
-    while (socket->hasPendingDatagrams()) {
-        const qint64 size = socket->pendingDatagramSize();
-        buffer.resize(size);
-        socket->readDatagram(buffer.data(), buffer.size(), &remoteHost, &remotePort);
-        handleDatagram(buffer, remoteHost, remotePort);
-    }
+    int count;
+    do {
+        count = m_batch.read(socket);
+        if (m_batch.dropped())
+            warning(QString("Dropped %1 oversized datagrams").arg(m_batch.dropped()));
+        for (int i = 0; i < count; ++i) {
+            // handleDatagram() copies whatever it keeps
+            const auto &datagram = m_batch.datagram(i);
+            handleDatagram(QByteArray::fromRawData(datagram.data, datagram.size), datagram.host, datagram.port);
+        }
+    } while (count == m_batch.capacity());
 }
 
 void QXmppTurnAllocation::handleDatagram(const QByteArray &buffer, const QHostAddress &remoteHost, quint16 remotePort)
@@ -1510,11 +2147,8 @@ void QXmppTurnAllocation::transactionFinished()
     }
 }
 
-qint64 QXmppTurnAllocation::writeDatagram(const QByteArray &data, const QHostAddress &host, quint16 port)
+quint16 QXmppTurnAllocation::bindChannel(const QHostAddress &host, quint16 port)
 {
-    if (m_state != ConnectedState)
-        return -1;
-
     const Address addr = qMakePair(host, port);
     quint16 channel = m_channels.key(addr);
 
@@ -1538,20 +2172,58 @@ qint64 QXmppTurnAllocation::writeDatagram(const QByteArray &data, const QHostAdd
         if (!m_channelTimer->isActive())
             m_channelTimer->start();
     }
+    return channel;
+}
 
-    // send data
+static QByteArray channelData(quint16 channel, const QByteArray &data)
+{
     QByteArray channelData;
     channelData.reserve(4 + data.size());
     QDataStream stream(&channelData, QIODevice::WriteOnly);
     stream << channel;
     stream << quint16(data.size());
     stream.writeRawData(data.data(), data.size());
-    if (socket->writeDatagram(channelData, m_turnHost, m_turnPort) == channelData.size())
+    return channelData;
+}
+
+qint64 QXmppTurnAllocation::writeDatagram(const QByteArray &data, const QHostAddress &host, quint16 port)
+{
+    if (m_state != ConnectedState)
+        return -1;
+
+    const QByteArray buffer = channelData(bindChannel(host, port), data);
+    if (socket->writeDatagram(buffer, m_turnHost, m_turnPort) == buffer.size())
         return data.size();
     else
         return -1;
 }
 
+qint64 QXmppTurnAllocation::writeDatagrams(const QList<QByteArray> &datagrams, const QHostAddress &host, quint16 port)
+{
+    if (m_state != ConnectedState)
+        return -1;
+
+    const quint16 channel = bindChannel(host, port);
+    QList<QByteArray> buffers;
+    buffers.reserve(datagrams.size());
+    for (const auto &datagram : datagrams)
+        buffers << channelData(channel, datagram);
+
+    qint64 sent = QXmppDatagramBatch::write(socket, buffers, m_turnHost, m_turnPort);
+    if (sent < 0)
+        return -1;
+
+    // strip the channel headers
+    qint64 bytes = 0;
+    for (const auto &datagram : datagrams) {
+        if (sent < 4 + datagram.size())
+            break;
+        sent -= 4 + datagram.size();
+        bytes += datagram.size();
+    }
+    return bytes;
+}
+
 void QXmppTurnAllocation::writeStun(const QXmppStunMessage &message)
 {
     socket->writeDatagram(message.encode(m_key), m_turnHost, m_turnPort);
@@ -1601,15 +2273,16 @@ QXmppJingleCandidate QXmppUdpTransport::localCandidate(int component) const
 
 void QXmppUdpTransport::readyRead()
 {
-    QByteArray buffer;
-    QHostAddress remoteHost;
-    quint16 remotePort;
-    while (m_socket->hasPendingDatagrams()) {
-        const qint64 size = m_socket->pendingDatagramSize();
-        buffer.resize(size);
-        m_socket->readDatagram(buffer.data(), buffer.size(), &remoteHost, &remotePort);
-        emit datagramReceived(buffer, remoteHost, remotePort);
-    }
+    int count;
+    do {
+        count = m_batch.read(m_socket);
+        if (m_batch.dropped())
+            warning(QString("Dropped %1 oversized datagrams").arg(m_batch.dropped()));
+        for (int i = 0; i < count; ++i) {
+            const auto &datagram = m_batch.datagram(i);
+            emit datagramReceived(QByteArray(datagram.data, datagram.size), datagram.host, datagram.port);
+        }
+    } while (count == m_batch.capacity());
 }
 
 qint64 QXmppUdpTransport::writeDatagram(const QByteArray &data, const QHostAddress &host, quint16 port)
@@ -1620,6 +2293,14 @@ qint64 QXmppUdpTransport::writeDatagram(const QByteArray &data, const QHostAddre
     return m_socket->writeDatagram(data, remoteHost, port);
 }
 
+qint64 QXmppUdpTransport::writeDatagrams(const QList<QByteArray> &datagrams, const QHostAddress &host, quint16 port)
+{
+    QHostAddress remoteHost = host;
+    if (isIPv6LinkLocalAddress(host))
+        remoteHost.setScopeId(m_socket->localAddress().scopeId());
+    return QXmppDatagramBatch::write(m_socket, datagrams, remoteHost, port);
+}
+
 class CandidatePair : public QXmppLoggable
 {
 public:
@@ -1630,7 +2311,8 @@ public:
         SucceededState,
         FailedState
     };
-    CandidatePair(int component, bool controlling, QObject *parent);
+    CandidatePair(int component, bool controlling, QXmppIceTransport *transport, const QXmppJingleCandidate &remote, QObject *parent);
+    QString foundation() const;
     quint64 priority() const;
     State state() const;
     void setState(State state);
@@ -1638,14 +2320,14 @@ public:
 
     bool nominated;
     bool nominating;
-    QXmppJingleCandidate remote;
+    const QXmppJingleCandidate remote;
     QXmppJingleCandidate reflexive;
-    QXmppIceTransport *transport;
+    QXmppIceTransport *const transport;
     QXmppStunTransaction *transaction;
 
 private:
-    int m_component;
-    bool m_controlling;
+    QXmppJingleCandidate m_local;
+    quint64 m_priority;
     State m_state;
 };
 
@@ -1654,19 +2336,26 @@ static bool candidatePairPtrLessThan(const CandidatePair *p1, const CandidatePai
     return p1->priority() > p2->priority();
 }
 
-CandidatePair::CandidatePair(int component, bool controlling, QObject *parent)
-    : QXmppLoggable(parent), nominated(false), nominating(false), transport(nullptr), transaction(nullptr), m_component(component), m_controlling(controlling), m_state(WaitingState)
+CandidatePair::CandidatePair(int component, bool controlling, QXmppIceTransport *transport_, const QXmppJingleCandidate &remote_, QObject *parent)
+    : QXmppLoggable(parent), nominated(false), nominating(false), remote(remote_), transport(transport_), transaction(nullptr), m_local(transport_->localCandidate(component)), m_state(WaitingState)
 {
+    // see RFC 8445 - 6.1.2.3. Computing Pair Priority and Ordering Pairs
+    const quint32 G = controlling ? m_local.priority() : remote.priority();
+    const quint32 D = controlling ? remote.priority() : m_local.priority();
+    m_priority = (quint64(1) << 32) * qMin(G, D) + 2 * qMax(G, D) + (G > D ? 1 : 0);
 }
 
-quint64 CandidatePair::priority() const
+/// Returns the pair's foundation, which groups the pairs whose checks are
+/// likely to have the same outcome.
+
+QString CandidatePair::foundation() const
 {
-    const QXmppJingleCandidate local = transport->localCandidate(m_component);
+    return m_local.foundation() + QLatin1Char(':') + remote.foundation();
+}
 
-    // see RFC 5245 - 5.7.2. Computing Pair Priority and Ordering Pairs
-    const quint32 G = m_controlling ? local.priority() : remote.priority();
-    const quint32 D = m_controlling ? remote.priority() : local.priority();
-    return (quint64(1) << 32) * qMin(G, D) + 2 * qMax(G, D) + (G > D ? 1 : 0);
+quint64 CandidatePair::priority() const
+{
+    return m_priority;
 }
 
 CandidatePair::State CandidatePair::state() const
@@ -1682,7 +2371,7 @@ void CandidatePair::setState(CandidatePair::State state)
 
 QString CandidatePair::toString() const
 {
-    const QXmppJingleCandidate candidate = transport->localCandidate(m_component);
+    const QXmppJingleCandidate &candidate = m_local;
     QString str = QStringLiteral("%1 port %2").arg(remote.host().toString(), QString::number(remote.port()));
     if (candidate.type() == QXmppJingleCandidate::HostType)
         str += QStringLiteral(" (local %1 port %2)").arg(candidate.host().toString(), QString::number(candidate.port()));
@@ -1698,6 +2387,7 @@ class QXmppIcePrivate
 public:
     QXmppIcePrivate();
 
+    bool aggressiveNomination;
     bool iceControlling;
     QString localUser;
     QString localPassword;
@@ -1708,7 +2398,7 @@ public:
 };
 
 QXmppIcePrivate::QXmppIcePrivate()
-    : iceControlling(false)
+    : aggressiveNomination(false), iceControlling(false)
 {
     localUser = QXmppUtils::generateStanzaHash(4);
     localPassword = QXmppUtils::generateStanzaHash(22);
@@ -1725,9 +2415,15 @@ class QXmppIceComponentPrivate
 {
 public:
     QXmppIceComponentPrivate(int component, QXmppIcePrivate *config, QXmppIceComponent *qq);
+    void addLocalCandidate(const QXmppJingleCandidate &candidate);
+    CandidatePair *addPair(QXmppIceTransport *transport, const QXmppJingleCandidate &remote);
     bool addRemoteCandidate(const QXmppJingleCandidate &candidate);
     CandidatePair *findPair(QXmppStunTransaction *transaction);
+    CandidatePair *findPair(QXmppIceTransport *transport, const QHostAddress &host, quint16 port);
+    void nominate();
     void performCheck(CandidatePair *pair, bool nominate);
+    void scheduleNomination(CandidatePair *pair);
+    void unfreeze(const QString &foundation);
     void setSockets(QList<QUdpSocket *> sockets);
     void setTurnServer(const QHostAddress &host, quint16 port);
     void setTurnUser(const QString &user);
@@ -1746,12 +2442,20 @@ public:
     quint32 peerReflexivePriority;
     QList<QXmppJingleCandidate> remoteCandidates;
 
+    // the check list, sorted by decreasing priority
     QList<CandidatePair *> pairs;
+    QHash<QPair<QXmppIceTransport *, QPair<QHostAddress, quint16>>, CandidatePair *> pairsByAddress;
+    QHash<QByteArray, CandidatePair *> pairsByTransactionId;
     QList<QXmppIceTransport *> transports;
     QTimer *timer;
 
+    // regular nomination
+    QTimer *nominationTimer;
+    bool nominationPending;
+
     // STUN server
     QMap<QXmppStunTransaction *, QXmppIceTransportDetails> stunTransactions;
+    QHash<QByteArray, QXmppStunTransaction *> stunTransactionIds;
 
     // TURN server
     QXmppTurnAllocation *turnAllocation;
@@ -1762,8 +2466,32 @@ private:
 };
 
 QXmppIceComponentPrivate::QXmppIceComponentPrivate(int component_, QXmppIcePrivate *config_, QXmppIceComponent *qq)
-    : activePair(nullptr), component(component_), config(config_), fallbackPair(nullptr), gatheringState(QXmppIceConnection::NewGatheringState), peerReflexivePriority(0), timer(nullptr), turnAllocation(nullptr), turnConfigured(false), q(qq)
+    : activePair(nullptr), component(component_), config(config_), fallbackPair(nullptr), gatheringState(QXmppIceConnection::NewGatheringState), peerReflexivePriority(0), timer(nullptr), nominationTimer(nullptr), nominationPending(false), turnAllocation(nullptr), turnConfigured(false), q(qq)
+{
+}
+
+void QXmppIceComponentPrivate::addLocalCandidate(const QXmppJingleCandidate &candidate)
 {
+    localCandidates << candidate;
+    emit q->localCandidateAdded(candidate);
+}
+
+CandidatePair *QXmppIceComponentPrivate::addPair(QXmppIceTransport *transport, const QXmppJingleCandidate &remote)
+{
+    auto *pair = new CandidatePair(component, config->iceControlling, transport, remote, q);
+
+    // only the first pair of each foundation is checked straight away
+    // see RFC 8445 - 6.1.2.6. Computing Candidate Pair States
+    for (const auto *other : pairs) {
+        if (other->state() != CandidatePair::FailedState && other->foundation() == pair->foundation()) {
+            pair->setState(CandidatePair::FrozenState);
+            break;
+        }
+    }
+
+    pairs.insert(std::upper_bound(pairs.begin(), pairs.end(), pair, candidatePairPtrLessThan), pair);
+    pairsByAddress.insert(qMakePair(transport, qMakePair(remote.host(), remote.port())), pair);
+    return pair;
 }
 
 bool QXmppIceComponentPrivate::addRemoteCandidate(const QXmppJingleCandidate &candidate)
@@ -1788,27 +2516,41 @@ bool QXmppIceComponentPrivate::addRemoteCandidate(const QXmppJingleCandidate &ca
         if (!isCompatibleAddress(local.host(), candidate.host()))
             continue;
 
-        auto *pair = new CandidatePair(component, config->iceControlling, q);
-        pair->remote = candidate;
-        pair->transport = transport;
-        pairs << pair;
-
+        auto *pair = addPair(transport, candidate);
         if (!fallbackPair && local.type() == QXmppJingleCandidate::HostType)
             fallbackPair = pair;
     }
 
-    std::sort(pairs.begin(), pairs.end(), candidatePairPtrLessThan);
-
     return true;
 }
 
 CandidatePair *QXmppIceComponentPrivate::findPair(QXmppStunTransaction *transaction)
 {
+    CandidatePair *pair = pairsByTransactionId.value(transaction->request().id());
+    return (pair && pair->transaction == transaction) ? pair : nullptr;
+}
+
+CandidatePair *QXmppIceComponentPrivate::findPair(QXmppIceTransport *transport, const QHostAddress &host, quint16 port)
+{
+    return pairsByAddress.value(qMakePair(transport, qMakePair(host, port)));
+}
+
+/// Nominates the best pair which succeeded.
+
+void QXmppIceComponentPrivate::nominate()
+{
+    if (activePair || nominationPending)
+        return;
+
     for (auto *pair : pairs) {
-        if (pair->transaction == transaction)
-            return pair;
+        if (pair->state() == CandidatePair::SucceededState) {
+            nominationTimer->stop();
+            nominationPending = true;
+            q->info(QStringLiteral("ICE nominating pair %1").arg(pair->toString()));
+            performCheck(pair, true);
+            return;
+        }
     }
-    return nullptr;
 }
 
 void QXmppIceComponentPrivate::performCheck(CandidatePair *pair, bool nominate)
@@ -1820,13 +2562,46 @@ void QXmppIceComponentPrivate::performCheck(CandidatePair *pair, bool nominate)
     message.setUsername(QStringLiteral("%1:%2").arg(config->remoteUser, config->localUser));
     if (config->iceControlling) {
         message.iceControlling = config->tieBreaker;
-        message.useCandidate = true;
+        message.useCandidate = nominate;
     } else {
         message.iceControlled = config->tieBreaker;
     }
     pair->nominating = nominate;
     pair->setState(CandidatePair::InProgressState);
     pair->transaction = new QXmppStunTransaction(message, q);
+    pairsByTransactionId.insert(message.id(), pair);
+}
+
+/// Decides when to nominate a pair, once \a pair succeeded.
+///
+/// The pair is nominated at once if no pair with a higher priority may
+/// still succeed, otherwise better pairs get a little time to complete.
+
+void QXmppIceComponentPrivate::scheduleNomination(CandidatePair *pair)
+{
+    if (!config->iceControlling || config->aggressiveNomination || activePair || nominationPending)
+        return;
+
+    for (const auto *other : pairs) {
+        if (other == pair)
+            break;
+        if (other->state() != CandidatePair::FailedState) {
+            if (!nominationTimer->isActive())
+                nominationTimer->start();
+            return;
+        }
+    }
+    nominate();
+}
+
+/// Unfreezes the pairs with the given \a foundation.
+
+void QXmppIceComponentPrivate::unfreeze(const QString &foundation)
+{
+    for (auto *pair : pairs) {
+        if (pair->state() == CandidatePair::FrozenState && pair->foundation() == foundation)
+            pair->setState(CandidatePair::WaitingState);
+    }
 }
 
 void QXmppIceComponentPrivate::setSockets(QList<QUdpSocket *> sockets)
@@ -1835,6 +2610,12 @@ void QXmppIceComponentPrivate::setSockets(QList<QUdpSocket *> sockets)
     // clear previous candidates and sockets
     localCandidates.clear();
     qDeleteAll(pairs);
+    pairs.clear();
+    pairsByAddress.clear();
+    pairsByTransactionId.clear();
+    activePair = nullptr;
+    fallbackPair = nullptr;
+    nominationPending = false;
     for (auto *transport : transports)
         if (transport != turnAllocation)
             delete transport;
@@ -1848,14 +2629,23 @@ void QXmppIceComponentPrivate::setSockets(QList<QUdpSocket *> sockets)
         QObject::connect(transport, &QXmppIceTransport::datagramReceived,
                          q, &QXmppIceComponent::handleDatagram);
 
-        QXmppJingleCandidate candidate = transport->localCandidate(component);
-
         transports << transport;
-        localCandidates << candidate;
+        const QXmppJingleCandidate local = transport->localCandidate(component);
+        addLocalCandidate(local);
+
+        // pair the remote candidates which are already known
+        for (const auto &candidate : remoteCandidates) {
+            if (!isCompatibleAddress(local.host(), candidate.host()))
+                continue;
+            auto *pair = addPair(transport, candidate);
+            if (!fallbackPair)
+                fallbackPair = pair;
+        }
     }
 
     // start STUN checks
     stunTransactions.clear();
+    stunTransactionIds.clear();
     for (auto &stunServer : config->stunServers) {
         QXmppStunMessage request;
         request.setType(QXmppStunMessage::Binding | QXmppStunMessage::Request);
@@ -1868,6 +2658,7 @@ void QXmppIceComponentPrivate::setSockets(QList<QUdpSocket *> sockets)
             request.setId(QXmppUtils::generateRandomBytes(STUN_ID_SIZE));
             auto *transaction = new QXmppStunTransaction(request, q);
             stunTransactions.insert(transaction, { transport, stunServer.first, stunServer.second });
+            stunTransactionIds.insert(request.id(), transaction);
         }
     }
 
@@ -1917,10 +2708,17 @@ QXmppIceComponent::QXmppIceComponent(int component, QXmppIcePrivate *config, QOb
     d = new QXmppIceComponentPrivate(component, config, this);
 
     d->timer = new QTimer(this);
-    d->timer->setInterval(500);
+    d->timer->setInterval(ICE_TA_INTERVAL);
     connect(d->timer, &QTimer::timeout,
             this, &QXmppIceComponent::checkCandidates);
 
+    d->nominationTimer = new QTimer(this);
+    d->nominationTimer->setInterval(ICE_NOMINATION_DELAY);
+    d->nominationTimer->setSingleShot(true);
+    connect(d->nominationTimer, &QTimer::timeout, this, [this]() {
+        d->nominate();
+    });
+
     d->turnAllocation = new QXmppTurnAllocation(this);
     connect(d->turnAllocation, &QXmppTurnAllocation::connected,
             this, &QXmppIceComponent::turnConnected);
@@ -1959,12 +2757,26 @@ void QXmppIceComponent::checkCandidates()
 {
     if (d->config->remoteUser.isEmpty())
         return;
-    debug(QStringLiteral("Checking remote candidates"));
+    const bool nominate = d->config->iceControlling && d->config->aggressiveNomination;
 
+    // see RFC 8445 - 6.1.4.2. Performing Connectivity Checks
     for (auto *pair : d->pairs) {
         if (pair->state() == CandidatePair::WaitingState) {
-            d->performCheck(pair, d->config->iceControlling);
-            break;
+            d->performCheck(pair, nominate);
+            return;
+        }
+    }
+
+    // no pair is waiting, unfreeze the best pair whose foundation is idle
+    QSet<QString> activeFoundations;
+    for (const auto *pair : d->pairs) {
+        if (pair->state() == CandidatePair::InProgressState)
+            activeFoundations << pair->foundation();
+    }
+    for (auto *pair : d->pairs) {
+        if (pair->state() == CandidatePair::FrozenState && !activeFoundations.contains(pair->foundation())) {
+            d->performCheck(pair, nominate);
+            return;
         }
     }
 }
@@ -1977,6 +2789,7 @@ void QXmppIceComponent::close()
         transport->disconnectFromHost();
     d->turnAllocation->disconnectFromHost();
     d->timer->stop();
+    d->nominationTimer->stop();
     d->activePair = nullptr;
 }
 
@@ -2012,36 +2825,32 @@ void QXmppIceComponent::handleDatagram(const QByteArray &buffer, const QHostAddr
         return;
 
     // if this is not a STUN message, emit it
-    quint32 messageCookie;
-    QByteArray messageId;
-    quint16 messageType = QXmppStunMessage::peekType(buffer, messageCookie, messageId);
-    if (!messageType || messageCookie != STUN_MAGIC) {
+    QXmppStunMessageView view;
+    const bool isStun = view.parse(buffer.constData(), buffer.size());
+    if (isStun ? (!view.type() || view.cookie() != STUN_MAGIC) : view.error() == QXmppStunMessageView::NotStunError) {
         // use this as an opportunity to flag a potential pair
-        for (auto *pair : d->pairs) {
-            if (pair->remote.host() == remoteHost &&
-                pair->remote.port() == remotePort) {
+        if (!d->activePair) {
+            CandidatePair *pair = d->findPair(transport, remoteHost, remotePort);
+            if (pair)
                 d->fallbackPair = pair;
-                break;
-            }
         }
         emit datagramReceived(buffer);
         return;
+    } else if (!isStun) {
+        warning(view.error() == QXmppStunMessageView::FingerprintError ? QStringLiteral("Bad fingerprint") : QStringLiteral("Received an invalid STUN packet"));
+        return;
     }
 
     // check if it's STUN
-    QXmppStunTransaction *stunTransaction = nullptr;
-    for (auto *t : d->stunTransactions.keys()) {
-        if (t->request().id() == messageId &&
-            d->stunTransactions.value(t).transport == transport) {
-            stunTransaction = t;
-            break;
-        }
-    }
+    const QByteArray id = QByteArray::fromRawData(view.id(), STUN_ID_SIZE);
+    QXmppStunTransaction *stunTransaction = d->stunTransactionIds.value(id);
+    if (stunTransaction && d->stunTransactions.value(stunTransaction).transport != transport)
+        stunTransaction = nullptr;
 
     // determine password to use
     QString messagePassword;
     if (!stunTransaction) {
-        messagePassword = (messageType & 0xFF00) ? d->config->remotePassword : d->config->localPassword;
+        messagePassword = (view.type() & 0xFF00) ? d->config->remotePassword : d->config->localPassword;
         if (messagePassword.isEmpty())
             return;
     }
@@ -2113,28 +2922,19 @@ void QXmppIceComponent::handleDatagram(const QByteArray &buffer, const QHostAddr
         }
 
         // construct pair
-        for (auto *ptr : d->pairs) {
-            if (ptr->transport == transport && ptr->remote.host() == remoteHost && ptr->remote.port() == remotePort) {
-                pair = ptr;
-                break;
-            }
-        }
-        if (!pair) {
-            pair = new CandidatePair(d->component, d->config->iceControlling, this);
-            pair->remote = remoteCandidate;
-            pair->transport = transport;
-            d->pairs << pair;
-
-            std::sort(d->pairs.begin(), d->pairs.end(), candidatePairPtrLessThan);
-        }
+        pair = d->findPair(transport, remoteHost, remotePort);
+        if (!pair)
+            pair = d->addPair(transport, remoteCandidate);
 
         switch (pair->state()) {
         case CandidatePair::FrozenState:
         case CandidatePair::WaitingState:
         case CandidatePair::FailedState:
             // send a triggered connectivity test
-            if (!d->config->remoteUser.isEmpty())
-                d->performCheck(pair, pair->nominating || d->config->iceControlling || message.useCandidate);
+            if (!d->config->remoteUser.isEmpty()) {
+                const bool nominate = d->config->iceControlling ? d->config->aggressiveNomination : message.useCandidate;
+                d->performCheck(pair, pair->nominating || nominate);
+            }
             break;
         case CandidatePair::InProgressState:
             // FIXME: force retransmit now
@@ -2149,13 +2949,8 @@ void QXmppIceComponent::handleDatagram(const QByteArray &buffer, const QHostAddr
     } else if (message.messageClass() == QXmppStunMessage::Response || message.messageClass() == QXmppStunMessage::Error) {
 
         // find the pair for this transaction
-        for (auto *ptr : d->pairs) {
-            if (ptr->transaction && ptr->transaction->request().id() == message.id()) {
-                pair = ptr;
-                break;
-            }
-        }
-        if (!pair)
+        pair = d->pairsByTransactionId.value(message.id());
+        if (!pair || !pair->transaction)
             return;
 
         // check remote host and port
@@ -2173,6 +2968,7 @@ void QXmppIceComponent::handleDatagram(const QByteArray &buffer, const QHostAddr
     // signal completion
     if (pair && pair->nominated) {
         d->timer->stop();
+        d->nominationTimer->stop();
         if (!d->activePair || pair->priority() > d->activePair->priority()) {
             info(QStringLiteral("ICE pair selected %1 (priority: %2)").arg(pair->toString(), QString::number(pair->priority())));
             const bool wasConnected = (d->activePair != nullptr);
@@ -2191,6 +2987,9 @@ void QXmppIceComponent::transactionFinished()
     // ICE checks
     CandidatePair *pair = d->findPair(transaction);
     if (pair) {
+        d->pairsByTransactionId.remove(transaction->request().id());
+        pair->transaction = nullptr;
+
         const QXmppStunMessage response = transaction->response();
         if (response.messageClass() == QXmppStunMessage::Response) {
             // store peer-reflexive address
@@ -2200,15 +2999,22 @@ void QXmppIceComponent::transactionFinished()
             }
 
             pair->setState(CandidatePair::SucceededState);
+            d->unfreeze(pair->foundation());
             if (pair->nominating) {
                 // outgoing media can flow
                 pair->nominated = true;
+            } else {
+                d->scheduleNomination(pair);
             }
         } else {
             debug(QStringLiteral("ICE forward check failed %1 (error %2)").arg(pair->toString(), transaction->response().errorPhrase));
             pair->setState(CandidatePair::FailedState);
+            if (pair->nominating && d->nominationPending) {
+                // try the next best pair
+                d->nominationPending = false;
+                d->nominate();
+            }
         }
-        pair->transaction = nullptr;
         return;
     }
 
@@ -2254,13 +3060,13 @@ void QXmppIceComponent::transactionFinished()
                 candidate.protocol(),
                 transport->localCandidate(d->component).host()));
 
-            d->localCandidates << candidate;
-
+            d->addLocalCandidate(candidate);
             emit localCandidatesChanged();
         } else {
             debug(QStringLiteral("STUN test failed (error %1)").arg(transaction->response().errorPhrase));
         }
         d->stunTransactions.remove(transaction);
+        d->stunTransactionIds.remove(transaction->request().id());
         updateGatheringState();
         return;
     }
@@ -2272,9 +3078,15 @@ void QXmppIceComponent::turnConnected()
 
     // add the new local candidate
     debug(QStringLiteral("Adding relayed candidate %1 port %2").arg(candidate.host().toString(), QString::number(candidate.port())));
-    d->localCandidates << candidate;
-
+    d->addLocalCandidate(candidate);
     emit localCandidatesChanged();
+
+    // pair the remote candidates which are already known
+    for (const auto &remote : d->remoteCandidates) {
+        if (isCompatibleAddress(candidate.host(), remote.host()) && !d->findPair(d->turnAllocation, remote.host(), remote.port()))
+            d->addPair(d->turnAllocation, remote);
+    }
+
     updateGatheringState();
 }
 
@@ -2388,6 +3200,25 @@ qint64 QXmppIceComponent::sendDatagram(const QByteArray &datagram)
     return pair->transport->writeDatagram(datagram, pair->remote.host(), pair->remote.port());
 }
 
+/// Sends several data packets to the remote party, and returns the number
+/// of bytes sent or -1 if none could be sent.
+///
+/// On Linux, the packets are handed to the kernel in a single system call.
+///
+/// \param datagrams
+///
+/// \since QXmpp 1.4
+
+qint64 QXmppIceComponent::sendDatagrams(const QList<QByteArray> &datagrams)
+{
+    CandidatePair *pair = d->activePair ? d->activePair : d->fallbackPair;
+    if (!pair)
+        return -1;
+    if (datagrams.isEmpty())
+        return 0;
+    return pair->transport->writeDatagrams(datagrams, pair->remote.host(), pair->remote.port());
+}
+
 void QXmppIceComponent::updateGatheringState()
 {
     QXmppIceConnection::GatheringState newGatheringState;
@@ -2496,6 +3327,9 @@ void QXmppIceConnection::addComponent(int component)
     socket->d->setTurnUser(d->turnUser);
     socket->d->setTurnPassword(d->turnPassword);
 
+    connect(socket, &QXmppIceComponent::localCandidateAdded,
+            this, &QXmppIceConnection::localCandidateAdded);
+
     connect(socket, &QXmppIceComponent::localCandidatesChanged,
             this, &QXmppIceConnection::localCandidatesChanged);
 
@@ -2506,6 +3340,10 @@ void QXmppIceConnection::addComponent(int component)
             this, &QXmppIceConnection::slotGatheringStateChanged);
 
     d->components[component] = socket;
+
+    // pace the checks of all components, see RFC 8445 - 14.2
+    for (auto *c : d->components.values())
+        c->d->timer->setInterval(ICE_TA_INTERVAL * d->components.size());
 }
 
 /// Adds a candidate for one of the remote components.
@@ -2591,6 +3429,31 @@ void QXmppIceConnection::setIceControlling(bool controlling)
     d->iceControlling = controlling;
 }
 
+/// Returns whether the controlling agent nominates pairs aggressively.
+///
+/// \since QXmpp 1.4
+
+bool QXmppIceConnection::aggressiveNomination() const
+{
+    return d->aggressiveNomination;
+}
+
+/// Sets whether the controlling agent nominates pairs aggressively, that is
+/// by flagging every connectivity check with USE-CANDIDATE.
+///
+/// Aggressive nomination connects a round trip sooner, but the selected pair
+/// is not necessarily the best one. By default, the controlling agent waits
+/// for the checks to succeed and then nominates the best valid pair.
+///
+/// \note This must be called before connectToHost().
+///
+/// \since QXmpp 1.4
+
+void QXmppIceConnection::setAggressiveNomination(bool aggressive)
+{
+    d->aggressiveNomination = aggressive;
+}
+
 /// Returns the list of local HOST CANDIDATES candidates by iterating
 /// over the available network interfaces.
 
@@ -2754,3 +3617,26 @@ QXmppIceTransport::QXmppIceTransport(QObject *parent)
 QXmppIceTransport::~QXmppIceTransport()
 {
 }
+
+/// Sends several data packets to \a host and \a port, and returns the
+/// number of bytes sent or -1 if none could be sent.
+///
+/// The default implementation calls writeDatagram() for each packet.
+///
+/// \param datagrams
+/// \param host
+/// \param port
+
+qint64 QXmppIceTransport::writeDatagrams(const QList<QByteArray> &datagrams, const QHostAddress &host, quint16 port)
+{
+    qint64 bytes = 0;
+    int sent = 0;
+    for (const auto &datagram : datagrams) {
+        const qint64 written = writeDatagram(datagram, host, port);
+        if (written < 0)
+            break;
+        bytes += written;
+        ++sent;
+    }
+    return sent ? bytes : -1;
+}
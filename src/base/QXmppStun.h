@@ -180,6 +180,7 @@ public Q_SLOTS:
     void close();
     void connectToHost();
     qint64 sendDatagram(const QByteArray &datagram);
+    qint64 sendDatagrams(const QList<QByteArray> &datagrams);
 
 private Q_SLOTS:
     void checkCandidates();
@@ -199,6 +200,11 @@ Q_SIGNALS:
     /// \internal This signal is emitted when the gathering state of local candidates changes.
     void gatheringStateChanged();
 
+    /// \brief This signal is emitted when a local candidate is gathered.
+    ///
+    /// \since QXmpp 1.4
+    void localCandidateAdded(const QXmppJingleCandidate &candidate);
+
     /// \brief This signal is emitted when the list of local candidates changes.
     void localCandidatesChanged();
 
@@ -269,6 +275,9 @@ public:
     void addComponent(int component);
     void setIceControlling(bool controlling);
 
+    bool aggressiveNomination() const;
+    void setAggressiveNomination(bool aggressive);
+
     QList<QXmppJingleCandidate> localCandidates() const;
     QString localUser() const;
     QString localPassword() const;
@@ -309,6 +318,14 @@ Q_SIGNALS:
     ///
     void gatheringStateChanged();
 
+    ///
+    /// \brief This signal is emitted when a local candidate is gathered, so
+    /// that it can be sent to the remote party right away ("trickle ICE").
+    ///
+    /// \since QXmpp 1.4
+    ///
+    void localCandidateAdded(const QXmppJingleCandidate &candidate);
+
     /// \brief This signal is emitted when the list of local candidates changes.
     void localCandidatesChanged();
 
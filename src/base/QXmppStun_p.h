@@ -26,6 +26,8 @@
 
 #include "QXmppStun.h"
 
+#include <QVector>
+
 class QUdpSocket;
 class QTimer;
 
@@ -41,6 +43,93 @@ class QTimer;
 // We mean it.
 //
 
+/// \internal
+///
+/// The QXmppStunMessageView class validates a STUN message in place and
+/// gives access to its attributes without copying them.
+///
+/// The view borrows the buffer it was parsed from, which must outlive it.
+///
+
+class QXMPP_EXPORT QXmppStunMessageView
+{
+public:
+    enum Error {
+        NoError,
+        NotStunError,
+        InvalidError,
+        FingerprintError
+    };
+
+    struct Attribute
+    {
+        quint16 type;
+        quint16 length;
+        const char *value;
+    };
+
+    QXmppStunMessageView();
+
+    bool parse(const char *data, int size);
+    Error error() const;
+
+    quint16 type() const;
+    quint16 messageClass() const;
+    quint16 messageMethod() const;
+    quint32 cookie() const;
+    const char *id() const;
+
+    bool hasFingerprint() const;
+    bool hasIntegrity() const;
+    bool checkIntegrity(const QByteArray &key) const;
+
+    bool nextAttribute(int &offset, Attribute &attribute) const;
+    bool findAttribute(quint16 type, Attribute &attribute) const;
+    bool decodeAddress(const Attribute &attribute, QHostAddress &host, quint16 &port) const;
+
+private:
+    const uchar *m_data;
+    int m_size;
+    int m_integrityOffset;
+    int m_fingerprintOffset;
+    Error m_error;
+};
+
+/// \internal
+///
+/// The QXmppStunMessageWriter class encodes a STUN message into a buffer
+/// supplied by the caller.
+///
+/// Attributes are appended in order, the header's length always covers
+/// the attributes written so far. Once the buffer is too small, all
+/// further writes fail.
+///
+
+class QXMPP_EXPORT QXmppStunMessageWriter
+{
+public:
+    QXmppStunMessageWriter(char *buffer, int capacity);
+
+    bool writeHeader(quint16 type, const char *id, quint32 cookie = 0x2112A442);
+    char *reserveAttribute(quint16 type, int length);
+    bool addAttribute(quint16 type, const char *value, int length);
+    bool addUInt32(quint16 type, quint32 value);
+    bool addAddress(quint16 type, const QHostAddress &host, quint16 port);
+    bool addIntegrity(const QByteArray &key);
+    bool addFingerprint();
+
+    int size() const;
+    bool hasOverflowed() const;
+
+private:
+    void setBodyLength(int length);
+
+    uchar *m_data;
+    int m_capacity;
+    int m_size;
+    bool m_overflowed;
+};
+
 /// \internal
 ///
 /// The QXmppStunTransaction class represents a STUN transaction.
@@ -72,6 +161,53 @@ private:
     int m_tries;
 };
 
+/// \internal
+///
+/// The QXmppDatagramBatch class reads the datagrams pending on a QUdpSocket
+/// into reusable buffers and writes bursts of datagrams.
+///
+/// On Linux, datagrams are received using a single recvmmsg() call per
+/// batch and sent using UDP segmentation offload or sendmmsg().
+///
+/// By default each buffer holds the largest possible UDP datagram. The
+/// buffers are allocated once and only the pages which datagrams are
+/// written to are used.
+///
+
+class QXMPP_EXPORT QXmppDatagramBatch
+{
+public:
+    struct Datagram
+    {
+        const char *data;
+        int size;
+        QHostAddress host;
+        quint16 port;
+    };
+
+    QXmppDatagramBatch(int capacity = 16, int datagramSize = 65535);
+    ~QXmppDatagramBatch();
+
+    int capacity() const;
+    int read(QUdpSocket *socket);
+    int dropped() const;
+    const Datagram &datagram(int index) const;
+
+    static qint64 write(QUdpSocket *socket, const QList<QByteArray> &datagrams, const QHostAddress &host, quint16 port);
+
+private:
+    Q_DISABLE_COPY(QXmppDatagramBatch)
+
+    int m_capacity;
+    int m_datagramSize;
+    int m_dropped;
+    QByteArray m_first;
+    QByteArray m_buffer;
+    QVector<Datagram> m_datagrams;
+    struct Headers;
+    Headers *m_headers;
+};
+
 class QXMPP_EXPORT QXmppIceTransport : public QXmppLoggable
 {
     Q_OBJECT
@@ -82,6 +218,7 @@ public:
 
     virtual QXmppJingleCandidate localCandidate(int component) const = 0;
     virtual qint64 writeDatagram(const QByteArray &data, const QHostAddress &host, quint16 port) = 0;
+    virtual qint64 writeDatagrams(const QList<QByteArray> &datagrams, const QHostAddress &host, quint16 port);
 
 public Q_SLOTS:
     virtual void disconnectFromHost() = 0;
@@ -122,6 +259,7 @@ public:
 
     QXmppJingleCandidate localCandidate(int component) const override;
     qint64 writeDatagram(const QByteArray &data, const QHostAddress &host, quint16 port) override;
+    qint64 writeDatagrams(const QList<QByteArray> &datagrams, const QHostAddress &host, quint16 port) override;
 
 Q_SIGNALS:
     /// \brief This signal is emitted once TURN allocation succeeds.
@@ -142,10 +280,12 @@ private Q_SLOTS:
     void writeStun(const QXmppStunMessage &message);
 
 private:
+    quint16 bindChannel(const QHostAddress &host, quint16 port);
     void handleDatagram(const QByteArray &datagram, const QHostAddress &host, quint16 port);
     void setState(AllocationState state);
 
     QUdpSocket *socket;
+    QXmppDatagramBatch m_batch;
     QTimer *m_timer;
     QTimer *m_channelTimer;
     QString m_password;
@@ -184,6 +324,7 @@ public:
 
     QXmppJingleCandidate localCandidate(int component) const override;
     qint64 writeDatagram(const QByteArray &data, const QHostAddress &host, quint16 port) override;
+    qint64 writeDatagrams(const QList<QByteArray> &datagrams, const QHostAddress &host, quint16 port) override;
 
 public Q_SLOTS:
     void disconnectFromHost() override;
@@ -193,6 +334,7 @@ private Q_SLOTS:
 
 private:
     QUdpSocket *m_socket;
+    QXmppDatagramBatch m_batch;
 };
 
 #endif
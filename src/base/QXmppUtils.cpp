@@ -231,10 +231,19 @@ QString QXmppUtils::jidToBareJid(const QString &jid)
 /// Calculates the CRC32 checksum for the given input.
 
 quint32 QXmppUtils::generateCrc32(const QByteArray &in)
+{
+    return generateCrc32(in.constData(), in.size());
+}
+
+/// Calculates the CRC32 checksum for the given data.
+///
+/// \since QXmpp 1.4
+
+quint32 QXmppUtils::generateCrc32(const char *data, int size)
 {
     quint32 result = 0xffffffff;
-    for (char n : in)
-        result = (result >> 8) ^ (crctable[(result & 0xff) ^ (quint8)n]);
+    for (int i = 0; i < size; ++i)
+        result = (result >> 8) ^ (crctable[(result & 0xff) ^ (quint8)data[i]]);
     return result ^= 0xffffffff;
 }
 
@@ -23,6 +23,7 @@
 
 #include "QXmppVCardIq.h"
 
+#include "QXmppBase64_p.h"
 #include "QXmppConstants_p.h"
 #include "QXmppUtils.h"
 
@@ -634,8 +635,8 @@ public:
     QString nickName;
     QString url;
 
-    // not as 64 base
-    QByteArray photo;
+    // not as 64 base, the parsed base64 data is only decoded on first use
+    QXmppLazyBase64 photo;
     QString photoType;
 
     QList<QXmppVCardAddress> addresses;
@@ -873,17 +874,19 @@ void QXmppVCardIq::setUrl(const QString &url)
 /// QImageReader imageReader(&buffer);
 /// QImage myImage = imageReader.read();
 /// \endcode
+///
+/// A parsed photo is only decoded the first time it is accessed.
 
 QByteArray QXmppVCardIq::photo() const
 {
-    return d->photo;
+    return d->photo.data();
 }
 
 /// Sets the photo's binary contents.
 
 void QXmppVCardIq::setPhoto(const QByteArray &photo)
 {
-    d->photo = photo;
+    d->photo.setData(photo);
 }
 
 /// Returns the photo's MIME type.
@@ -976,8 +979,7 @@ void QXmppVCardIq::parseElementFromChild(const QDomElement &nodeRecv)
     d->middleName = nameElement.firstChildElement(QStringLiteral("MIDDLE")).text();
     d->url = cardElement.firstChildElement(QStringLiteral("URL")).text();
     QDomElement photoElement = cardElement.firstChildElement(QStringLiteral("PHOTO"));
-    QByteArray base64data = photoElement.firstChildElement(QStringLiteral("BINVAL")).text().toLatin1();
-    d->photo = QByteArray::fromBase64(base64data);
+    d->photo.setBase64(photoElement.firstChildElement(QStringLiteral("BINVAL")).text().toLatin1());
     d->photoType = photoElement.firstChildElement(QStringLiteral("TYPE")).text();
 
     QDomElement child = cardElement.firstChildElement();
@@ -1032,11 +1034,13 @@ void QXmppVCardIq::toXmlElementFromChild(QXmlStreamWriter *writer) const
 
     for (const QXmppVCardPhone &phone : d->phones)
         phone.toXml(writer);
-    if (!photo().isEmpty()) {
+    // a received BINVAL may only contain whitespace, so check the decoded size
+    const QByteArray photo = d->photo.isEmpty() ? QByteArray() : d->photo.data();
+    if (!photo.isEmpty()) {
         writer->writeStartElement(QStringLiteral("PHOTO"));
         QString photoType = d->photoType;
         if (photoType.isEmpty())
-            photoType = getImageType(d->photo);
+            photoType = getImageType(photo);
         helperToXmlAddTextElement(writer, QStringLiteral("TYPE"), photoType);
         helperToXmlAddTextElement(writer, QStringLiteral("BINVAL"), d->photo.toBase64());
         writer->writeEndElement();
@@ -0,0 +1,552 @@
+/*
+ * Copyright (C) 2008-2020 The QXmpp developers
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "QXmppBitsOfBinaryManager.h"
+
+#include "QXmppBitsOfBinaryContentId.h"
+#include "QXmppBitsOfBinaryDataList.h"
+#include "QXmppBitsOfBinaryIq.h"
+#include "QXmppClient.h"
+#include "QXmppConstants_p.h"
+#include "QXmppMessage.h"
+#include "QXmppUtils.h"
+
+#include <QCache>
+#include <QDateTime>
+#include <QDir>
+#include <QDomDocument>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QTimer>
+#include <QXmlStreamReader>
+#include <QXmlStreamWriter>
+
+// default number of bytes kept in memory
+static const int DEFAULT_CACHE_SIZE = 4 * 1024 * 1024;
+
+// default number of bytes kept on disk
+static const qint64 DEFAULT_DISK_CACHE_SIZE = 64 * 1024 * 1024;
+
+// Returns true if the data matches the hash of its content id.
+static bool matchesContentId(const QXmppBitsOfBinaryData &data)
+{
+    const QXmppBitsOfBinaryContentId cid = data.cid();
+    return cid.isValid() && QCryptographicHash::hash(data.data(), cid.algorithm()) == cid.hash();
+}
+
+class QXmppBitsOfBinaryManagerPrivate
+{
+public:
+    struct CacheEntry
+    {
+        QXmppBitsOfBinaryData data;
+        // expiry in milliseconds since the epoch, or -1
+        qint64 expiry;
+        // whether the data was inserted by the local user
+        bool published;
+    };
+
+    QString cacheFileName(const QString &key) const;
+    bool store(const QXmppBitsOfBinaryData &data, bool published);
+    bool lookup(const QString &key, CacheEntry &entry);
+    bool load(const QString &key, CacheEntry &entry) const;
+    void remove(const QString &key);
+    void trimDirectory(const QString &keep);
+
+    static QXmppBitsOfBinaryData entryData(const CacheEntry &entry);
+
+    // in-memory LRU cache and on-disk cache, by content id
+    QCache<QString, CacheEntry> cache;
+    QString cacheDirectory;
+    qint64 diskCacheSize;
+    // number of bytes in the cache directory, or -1 if it was not counted yet
+    qint64 diskUsage;
+    bool answersRequests;
+
+    // pending requests by content id and by IQ id
+    QHash<QString, QString> pendingIds;
+    QHash<QString, QXmppBitsOfBinaryContentId> pendingCids;
+};
+
+QString QXmppBitsOfBinaryManagerPrivate::cacheFileName(const QString &key) const
+{
+    // strip the "@bob.xmpp.org" suffix of the content id
+    return QDir(cacheDirectory).filePath(key.section(QLatin1Char('@'), 0, 0) + QStringLiteral(".bob.xml"));
+}
+
+bool QXmppBitsOfBinaryManagerPrivate::store(const QXmppBitsOfBinaryData &data, bool published)
+{
+    if (data.maxAge() == 0 || !matchesContentId(data))
+        return false;
+
+    const QString key = data.cid().toContentId();
+
+    // data published by the local user stays published when received again
+    CacheEntry existing;
+    if (!published && lookup(key, existing) && existing.published)
+        return true;
+
+    CacheEntry entry { data, -1, published };
+    if (data.maxAge() > 0)
+        entry.expiry = QDateTime::currentMSecsSinceEpoch() + qint64(data.maxAge()) * 1000;
+
+    if (!cacheDirectory.isEmpty()) {
+        const QString fileName = cacheFileName(key);
+        const qint64 previousSize = QFileInfo(fileName).size();
+        QSaveFile file(fileName);
+        if (file.open(QIODevice::WriteOnly)) {
+            QXmlStreamWriter writer(&file);
+            writer.writeStartElement(QStringLiteral("bob"));
+            if (entry.expiry >= 0)
+                writer.writeAttribute(QStringLiteral("expiry"), QString::number(entry.expiry));
+            if (published)
+                writer.writeAttribute(QStringLiteral("published"), QStringLiteral("true"));
+            data.toXmlElementFromChild(&writer);
+            writer.writeEndElement();
+            if (file.commit() && diskUsage >= 0)
+                diskUsage += QFileInfo(fileName).size() - previousSize;
+        }
+        if (diskUsage < 0 || diskUsage > diskCacheSize)
+            trimDirectory(key);
+    }
+
+    cache.insert(key, new CacheEntry(entry), data.data().size());
+    return true;
+}
+
+// Returns the cached data for the content id, unless it has expired.
+
+bool QXmppBitsOfBinaryManagerPrivate::lookup(const QString &key, CacheEntry &entry)
+{
+    if (const auto *cached = cache.object(key)) {
+        entry = *cached;
+    } else if (load(key, entry)) {
+        cache.insert(key, new CacheEntry(entry), entry.data.data().size());
+    } else {
+        return false;
+    }
+
+    if (entry.expiry >= 0 && entry.expiry <= QDateTime::currentMSecsSinceEpoch()) {
+        remove(key);
+        return false;
+    }
+    return true;
+}
+
+bool QXmppBitsOfBinaryManagerPrivate::load(const QString &key, CacheEntry &entry) const
+{
+    if (cacheDirectory.isEmpty())
+        return false;
+
+    QFile file(cacheFileName(key));
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    QDomDocument doc;
+    if (!doc.setContent(&file, true))
+        return false;
+
+    const QDomElement dataElement = doc.documentElement().firstChildElement(QStringLiteral("data"));
+    if (!QXmppBitsOfBinaryData::isBitsOfBinaryData(dataElement))
+        return false;
+
+    entry.data.parseElementFromChild(dataElement);
+    entry.expiry = doc.documentElement().attribute(QStringLiteral("expiry"), QStringLiteral("-1")).toLongLong();
+    entry.published = doc.documentElement().attribute(QStringLiteral("published")) == QStringLiteral("true");
+
+    // the file may have been corrupted or tampered with
+    if (entry.data.cid().toContentId() != key || !matchesContentId(entry.data))
+        return false;
+
+#if QT_VERSION >= QT_VERSION_CHECK(5, 10, 0)
+    // the modification time orders the files by last use
+    file.setFileTime(QDateTime::currentDateTimeUtc(), QFileDevice::FileModificationTime);
+#endif
+    return true;
+}
+
+void QXmppBitsOfBinaryManagerPrivate::remove(const QString &key)
+{
+    cache.remove(key);
+    if (!cacheDirectory.isEmpty()) {
+        const QString fileName = cacheFileName(key);
+        const qint64 size = QFileInfo(fileName).size();
+        if (QFile::remove(fileName) && diskUsage >= 0)
+            diskUsage -= size;
+    }
+}
+
+// Removes the least recently used data received from other entities from
+// the cache directory until it fits into diskCacheSize. Published data and
+// the data for keep are not removed.
+
+void QXmppBitsOfBinaryManagerPrivate::trimDirectory(const QString &keep)
+{
+    const QFileInfoList files = QDir(cacheDirectory).entryInfoList(QStringList() << QStringLiteral("*.bob.xml"), QDir::Files, QDir::Time | QDir::Reversed);
+
+    diskUsage = 0;
+    for (const auto &info : files)
+        diskUsage += info.size();
+
+    const QString keepFileName = cacheFileName(keep);
+    for (const auto &info : files) {
+        if (diskUsage <= diskCacheSize)
+            break;
+        if (info.filePath() == keepFileName)
+            continue;
+
+        QFile file(info.filePath());
+        if (!file.open(QIODevice::ReadOnly))
+            continue;
+        QXmlStreamReader reader(&file);
+        const bool published = reader.readNextStartElement() &&
+            reader.attributes().value(QStringLiteral("published")) == QStringLiteral("true");
+        file.close();
+
+        if (!published && file.remove())
+            diskUsage -= info.size();
+    }
+}
+
+// Returns the data of a cache entry, with the remaining time for which it
+// may be cached as its max-age.
+
+QXmppBitsOfBinaryData QXmppBitsOfBinaryManagerPrivate::entryData(const CacheEntry &entry)
+{
+    QXmppBitsOfBinaryData data = entry.data;
+    if (entry.expiry >= 0)
+        data.setMaxAge(int(qMax(qint64(1), (entry.expiry - QDateTime::currentMSecsSinceEpoch()) / 1000)));
+    return data;
+}
+
+QXmppBitsOfBinaryManager::QXmppBitsOfBinaryManager()
+    : d(new QXmppBitsOfBinaryManagerPrivate)
+{
+    d->cache.setMaxCost(DEFAULT_CACHE_SIZE);
+    d->diskCacheSize = DEFAULT_DISK_CACHE_SIZE;
+    d->diskUsage = -1;
+    d->answersRequests = true;
+}
+
+QXmppBitsOfBinaryManager::~QXmppBitsOfBinaryManager()
+{
+    delete d;
+}
+
+///
+/// Returns the maximum number of bytes of data kept in memory.
+///
+int QXmppBitsOfBinaryManager::cacheSize() const
+{
+    return d->cache.maxCost();
+}
+
+///
+/// Sets the maximum number of bytes of data kept in memory. When the limit
+/// is reached, the least recently used data is dropped.
+///
+/// The default is 4 MiB, 0 disables the in-memory cache.
+///
+/// \param bytes
+///
+void QXmppBitsOfBinaryManager::setCacheSize(int bytes)
+{
+    d->cache.setMaxCost(bytes);
+}
+
+///
+/// Returns the directory in which data is cached.
+///
+QString QXmppBitsOfBinaryManager::cacheDirectory() const
+{
+    return d->cacheDirectory;
+}
+
+///
+/// Sets the directory in which data is cached, so that it is kept across
+/// sessions. The directory is created if needed.
+///
+/// By default data is not cached on disk.
+///
+/// \param path
+///
+void QXmppBitsOfBinaryManager::setCacheDirectory(const QString &path)
+{
+    d->cacheDirectory = path;
+    d->diskUsage = -1;
+    if (!path.isEmpty())
+        QDir().mkpath(path);
+}
+
+///
+/// Returns the maximum number of bytes of data kept in the cache directory.
+///
+qint64 QXmppBitsOfBinaryManager::diskCacheSize() const
+{
+    return d->diskCacheSize;
+}
+
+///
+/// Sets the maximum number of bytes of data kept in the cache directory.
+/// When the limit is reached, the least recently used data received from
+/// other entities is removed. Data published using insert() is kept.
+///
+/// The default is 64 MiB.
+///
+/// \param bytes
+///
+void QXmppBitsOfBinaryManager::setDiskCacheSize(qint64 bytes)
+{
+    d->diskCacheSize = bytes;
+}
+
+///
+/// Returns true if Bits of Binary requests from other entities are answered
+/// with the data published using insert().
+///
+bool QXmppBitsOfBinaryManager::answersRequests() const
+{
+    return d->answersRequests;
+}
+
+///
+/// Sets whether Bits of Binary requests from other entities are answered
+/// with the data published using insert(). Requests for any other data,
+/// including data which was cached from other entities, are answered with
+/// an item-not-found error.
+///
+/// The default is true.
+///
+/// \param answer
+///
+void QXmppBitsOfBinaryManager::setAnswersRequests(bool answer)
+{
+    d->answersRequests = answer;
+}
+
+///
+/// Inserts \a data into the cache and publishes it, so that it is offered
+/// to other entities requesting it.
+///
+/// Returns false if the data does not match the hash of its content id or
+/// if its max-age is 0.
+///
+/// \param data
+///
+bool QXmppBitsOfBinaryManager::insert(const QXmppBitsOfBinaryData &data)
+{
+    return d->store(data, true);
+}
+
+///
+/// Returns true if the data for \a cid is cached and has not expired.
+///
+/// \param cid
+///
+bool QXmppBitsOfBinaryManager::contains(const QXmppBitsOfBinaryContentId &cid) const
+{
+    QXmppBitsOfBinaryManagerPrivate::CacheEntry entry;
+    return d->lookup(cid.toContentId(), entry);
+}
+
+///
+/// Looks up the cached data for \a cid.
+///
+/// The max-age of the returned data is the remaining time for which it may
+/// be cached.
+///
+/// Returns false if the data is not cached or has expired.
+///
+/// \param cid
+/// \param data
+///
+bool QXmppBitsOfBinaryManager::cachedData(const QXmppBitsOfBinaryContentId &cid, QXmppBitsOfBinaryData &data) const
+{
+    QXmppBitsOfBinaryManagerPrivate::CacheEntry entry;
+    if (!d->lookup(cid.toContentId(), entry))
+        return false;
+
+    data = QXmppBitsOfBinaryManagerPrivate::entryData(entry);
+    return true;
+}
+
+///
+/// Removes the data for \a cid from the memory and disk caches.
+///
+/// \param cid
+///
+void QXmppBitsOfBinaryManager::remove(const QXmppBitsOfBinaryContentId &cid)
+{
+    d->remove(cid.toContentId());
+}
+
+///
+/// Removes all data from the memory and disk caches.
+///
+void QXmppBitsOfBinaryManager::clearCache()
+{
+    d->cache.clear();
+    d->diskUsage = -1;
+    if (!d->cacheDirectory.isEmpty()) {
+        QDir dir(d->cacheDirectory);
+        const auto fileNames = dir.entryList(QStringList() << QStringLiteral("*.bob.xml"), QDir::Files);
+        for (const auto &fileName : fileNames)
+            dir.remove(fileName);
+    }
+}
+
+///
+/// Requests the data for \a cid from \a jid. Once received, the
+/// dataReceived() signal is emitted.
+///
+/// If the data is cached, the signal is emitted without sending a request.
+/// If a request for the same content id is already pending, its id is
+/// returned.
+///
+/// \param jid
+/// \param cid
+///
+/// \return the id of the request, or an empty string if it could not be
+/// sent
+///
+QString QXmppBitsOfBinaryManager::requestData(const QString &jid, const QXmppBitsOfBinaryContentId &cid)
+{
+    const QString key = cid.toContentId();
+
+    QXmppBitsOfBinaryData data;
+    if (cachedData(cid, data)) {
+        QTimer::singleShot(0, this, [this, data]() {
+            emit dataReceived(data);
+        });
+        return QXmppUtils::generateStanzaHash();
+    }
+
+    // wait for the response to the pending request
+    const auto pending = d->pendingIds.constFind(key);
+    if (pending != d->pendingIds.constEnd())
+        return *pending;
+
+    QXmppBitsOfBinaryIq request;
+    request.setType(QXmppIq::Get);
+    request.setTo(jid);
+    request.setCid(cid);
+    if (!client()->sendPacket(request))
+        return QString();
+
+    d->pendingIds.insert(key, request.id());
+    d->pendingCids.insert(request.id(), cid);
+    return request.id();
+}
+
+/// \cond
+QStringList QXmppBitsOfBinaryManager::discoveryFeatures() const
+{
+    // XEP-0231: Bits of Binary
+    return QStringList() << ns_bob;
+}
+
+bool QXmppBitsOfBinaryManager::handleStanza(const QDomElement &element)
+{
+    if (element.tagName() != QStringLiteral("iq"))
+        return false;
+
+    const QString type = element.attribute(QStringLiteral("type"));
+
+    // answer requests with published data only, so that other entities
+    // cannot find out which data the user has received
+    if (type == QStringLiteral("get") && QXmppBitsOfBinaryIq::isBitsOfBinaryIq(element)) {
+        if (!d->answersRequests)
+            return false;
+
+        QXmppBitsOfBinaryIq request;
+        request.parse(element);
+
+        QXmppBitsOfBinaryIq response;
+        response.setId(request.id());
+        response.setTo(request.from());
+
+        QXmppBitsOfBinaryManagerPrivate::CacheEntry entry;
+        if (d->lookup(request.cid().toContentId(), entry) && entry.published) {
+            response.setType(QXmppIq::Result);
+            static_cast<QXmppBitsOfBinaryData &>(response) = QXmppBitsOfBinaryManagerPrivate::entryData(entry);
+        } else {
+            response.setType(QXmppIq::Error);
+            response.setError(QXmppStanza::Error(QXmppStanza::Error::Cancel, QXmppStanza::Error::ItemNotFound));
+        }
+        client()->sendPacket(response);
+        return true;
+    }
+
+    // complete pending requests, errors may be returned without data
+    if (type != QStringLiteral("result") && type != QStringLiteral("error"))
+        return false;
+
+    const auto pending = d->pendingCids.find(element.attribute(QStringLiteral("id")));
+    if (pending == d->pendingCids.end())
+        return false;
+
+    const QXmppBitsOfBinaryContentId cid = *pending;
+    d->pendingCids.erase(pending);
+    d->pendingIds.remove(cid.toContentId());
+
+    QXmppBitsOfBinaryIq response;
+    response.parse(element);
+    if (response.type() == QXmppIq::Error) {
+        emit requestFailed(cid, response.error());
+    } else if (!(response.cid() == cid) || !matchesContentId(response)) {
+        warning(QStringLiteral("Received Bits of Binary data from %1 which does not match %2").arg(response.from(), cid.toContentId()));
+        emit requestFailed(cid, QXmppStanza::Error(QXmppStanza::Error::Modify, QXmppStanza::Error::NotAcceptable,
+                                                   QStringLiteral("The data does not match its content id")));
+    } else {
+        const QXmppBitsOfBinaryData data = response;
+        d->store(data, false);
+        emit dataReceived(data);
+    }
+    return true;
+}
+
+void QXmppBitsOfBinaryManager::setClient(QXmppClient *client)
+{
+    QXmppClientExtension::setClient(client);
+
+    connect(client, &QXmppClient::messageReceived,
+            this, &QXmppBitsOfBinaryManager::_q_messageReceived);
+
+    // responses to pending requests will not arrive anymore
+    connect(client, &QXmppClient::disconnected, this, [this]() {
+        const auto pendingCids = d->pendingCids;
+        d->pendingIds.clear();
+        d->pendingCids.clear();
+
+        const QXmppStanza::Error error(QXmppStanza::Error::Wait, QXmppStanza::Error::ServiceUnavailable,
+                                       QStringLiteral("The connection was closed before a response was received"));
+        for (const auto &cid : pendingCids)
+            emit requestFailed(cid, error);
+    });
+}
+/// \endcond
+
+void QXmppBitsOfBinaryManager::_q_messageReceived(const QXmppMessage &message)
+{
+    const auto dataList = message.bitsOfBinaryData();
+    for (const auto &data : dataList)
+        d->store(data, false);
+}
@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) 2008-2020 The QXmpp developers
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPBITSOFBINARYMANAGER_H
+#define QXMPPBITSOFBINARYMANAGER_H
+
+#include "QXmppClientExtension.h"
+#include "QXmppStanza.h"
+
+class QXmppBitsOfBinaryContentId;
+class QXmppBitsOfBinaryData;
+class QXmppBitsOfBinaryManagerPrivate;
+class QXmppMessage;
+
+///
+/// \brief The QXmppBitsOfBinaryManager class caches and retrieves data
+/// referenced by \xep{0231}: Bits of Binary content ids.
+///
+/// As the data is addressed by its hash, it can be shared between all
+/// messages, data forms and contacts referencing it. The cache keeps the
+/// most recently used data in memory, up to cacheSize() bytes, and can
+/// additionally store it on disk, up to diskCacheSize() bytes, see
+/// setCacheDirectory(). Data is only inserted if it matches the hash of its
+/// content id, and is dropped once its max-age has expired. Data with a
+/// max-age of 0 is never cached.
+///
+/// Data attached to received messages is cached automatically. Other data
+/// can be retrieved using requestData(), which answers from the cache when
+/// possible. Bits of Binary requests from other entities are only answered
+/// with data the user published using insert(), unless disabled using
+/// setAnswersRequests(). Data cached from other entities is never revealed.
+///
+/// To make use of this manager, you need to instantiate it and load it into
+/// the QXmppClient instance as follows:
+///
+/// \code
+/// auto *manager = new QXmppBitsOfBinaryManager;
+/// client->addExtension(manager);
+/// \endcode
+///
+/// \ingroup Managers
+///
+/// \since QXmpp 1.4
+///
+class QXMPP_EXPORT QXmppBitsOfBinaryManager : public QXmppClientExtension
+{
+    Q_OBJECT
+
+public:
+    QXmppBitsOfBinaryManager();
+    ~QXmppBitsOfBinaryManager() override;
+
+    int cacheSize() const;
+    void setCacheSize(int bytes);
+
+    QString cacheDirectory() const;
+    void setCacheDirectory(const QString &path);
+
+    qint64 diskCacheSize() const;
+    void setDiskCacheSize(qint64 bytes);
+
+    bool answersRequests() const;
+    void setAnswersRequests(bool answer);
+
+    bool insert(const QXmppBitsOfBinaryData &data);
+    bool contains(const QXmppBitsOfBinaryContentId &cid) const;
+    bool cachedData(const QXmppBitsOfBinaryContentId &cid, QXmppBitsOfBinaryData &data) const;
+    void remove(const QXmppBitsOfBinaryContentId &cid);
+    void clearCache();
+
+    QString requestData(const QString &jid, const QXmppBitsOfBinaryContentId &cid);
+
+    /// \cond
+    QStringList discoveryFeatures() const override;
+    bool handleStanza(const QDomElement &element) override;
+    /// \endcond
+
+Q_SIGNALS:
+    /// This signal is emitted when data requested using requestData() is
+    /// available, either from the cache or from the remote entity.
+    void dataReceived(const QXmppBitsOfBinaryData &data);
+
+    /// This signal is emitted when data requested using requestData() could
+    /// not be retrieved or did not match its content id, including when the
+    /// connection was closed before a response was received.
+    void requestFailed(const QXmppBitsOfBinaryContentId &cid, const QXmppStanza::Error &error);
+
+protected:
+    /// \cond
+    void setClient(QXmppClient *client) override;
+    /// \endcond
+
+private Q_SLOTS:
+    void _q_messageReceived(const QXmppMessage &message);
+
+private:
+    QXmppBitsOfBinaryManagerPrivate *const d;
+};
+
+#endif
@@ -53,7 +53,7 @@ void QXmppClientPrivate::addProperCapability(QXmppPresence& presence)
     if (ext) {
         presence.setCapabilityHash("sha-1");
         presence.setCapabilityNode(ext->clientCapabilitiesNode());
-        presence.setCapabilityVer(ext->capabilities().verificationString());
+        presence.setCapabilityVer(ext->capabilitiesVerificationString());
     }
 }
 
@@ -196,6 +196,10 @@ bool QXmppClient::insertExtension(int index, QXmppClientExtension* extension)
     extension->setParent(this);
     extension->setClient(this);
     d->extensions.insert(index, extension);
+
+    // the features of the client changed
+    if (auto* discoveryManager = findExtension<QXmppDiscoveryManager>())
+        discoveryManager->resetCapabilities();
     return true;
 }
 
@@ -209,6 +213,10 @@ bool QXmppClient::removeExtension(QXmppClientExtension* extension)
     if (d->extensions.contains(extension)) {
         d->extensions.removeAll(extension);
         delete extension;
+
+        // the features of the client changed
+        if (auto* discoveryManager = findExtension<QXmppDiscoveryManager>())
+            discoveryManager->resetCapabilities();
         return true;
     } else {
         qWarning("Cannot remove extension, it was never added");
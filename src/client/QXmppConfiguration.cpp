@@ -64,11 +64,16 @@ public:
     bool autoReconnectionEnabled;
     // which authentication systems to use (if any)
     bool useSASLAuthentication;
+    bool useSASL2Authentication;
     bool useNonSASLAuthentication;
     // default is false
     bool ignoreSslErrors;
 
     QXmppConfiguration::StreamSecurityMode streamSecurityMode;
+    // XEP-0138: Stream Compression
+    bool streamCompressionEnabled;
+    int streamCompressionLevel;
+
     QXmppConfiguration::NonSASLAuthMechanism nonSASLAuthMechanism;
     QString saslAuthMechanism;
 
@@ -78,7 +83,7 @@ public:
 };
 
 QXmppConfigurationPrivate::QXmppConfigurationPrivate()
-    : port(5222), resource("QXmpp"), autoAcceptSubscriptions(false), sendIntialPresence(true), sendRosterRequest(true), keepAliveInterval(60), keepAliveTimeout(20), autoReconnectionEnabled(true), useSASLAuthentication(true), useNonSASLAuthentication(true), ignoreSslErrors(false), streamSecurityMode(QXmppConfiguration::TLSEnabled), nonSASLAuthMechanism(QXmppConfiguration::NonSASLDigest)
+    : port(5222), resource("QXmpp"), autoAcceptSubscriptions(false), sendIntialPresence(true), sendRosterRequest(true), keepAliveInterval(60), keepAliveTimeout(20), autoReconnectionEnabled(true), useSASLAuthentication(true), useSASL2Authentication(true), useNonSASLAuthentication(true), ignoreSslErrors(false), streamSecurityMode(QXmppConfiguration::TLSEnabled), streamCompressionEnabled(false), streamCompressionLevel(-1), nonSASLAuthMechanism(QXmppConfiguration::NonSASLDigest)
 {
 }
 
@@ -434,6 +439,34 @@ void QXmppConfiguration::setUseSASLAuthentication(bool useSASL)
     d->useSASLAuthentication = useSASL;
 }
 
+///
+/// Returns whether to make use of \xep{0388}: Extensible SASL Profile when
+/// the server supports it.
+///
+/// SASL 2 allows authentication, resource binding (\xep{0386}: Bind 2),
+/// stream management and message carbons to be negotiated without a stream
+/// restart, which saves several round trips during login.
+///
+/// The default value is true.
+///
+/// \since QXmpp 1.4
+///
+bool QXmppConfiguration::useSASL2Authentication() const
+{
+    return d->useSASL2Authentication;
+}
+
+///
+/// Sets whether to make use of \xep{0388}: Extensible SASL Profile when
+/// the server supports it.
+///
+/// \since QXmpp 1.4
+///
+void QXmppConfiguration::setUseSASL2Authentication(bool useSASL2)
+{
+    d->useSASL2Authentication = useSASL2;
+}
+
 /// Returns whether to make use of non-SASL authentication.
 
 bool QXmppConfiguration::useNonSASLAuthentication() const
@@ -467,6 +500,58 @@ void QXmppConfiguration::setStreamSecurityMode(
     d->streamSecurityMode = mode;
 }
 
+///
+/// Returns whether \xep{0138}: Stream Compression is used when the server
+/// offers zlib compression after authentication.
+///
+/// Compression saves bandwidth on slow links, but costs CPU time. As SASL 2
+/// does not restart the stream, resource binding is not requested inline
+/// when compression is enabled.
+///
+/// The default value is false.
+///
+/// \since QXmpp 1.4
+///
+bool QXmppConfiguration::streamCompressionEnabled() const
+{
+    return d->streamCompressionEnabled;
+}
+
+///
+/// Sets whether \xep{0138}: Stream Compression is used when the server
+/// offers zlib compression after authentication.
+///
+/// \since QXmpp 1.4
+///
+void QXmppConfiguration::setStreamCompressionEnabled(bool enabled)
+{
+    d->streamCompressionEnabled = enabled;
+}
+
+///
+/// Returns the zlib level used for stream compression, from 0 (no
+/// compression) to 9 (best compression).
+///
+/// The default value is -1, which selects the zlib default level.
+///
+/// \since QXmpp 1.4
+///
+int QXmppConfiguration::streamCompressionLevel() const
+{
+    return d->streamCompressionLevel;
+}
+
+///
+/// Sets the zlib level used for stream compression, from 0 (no compression)
+/// to 9 (best compression), or -1 for the zlib default level.
+///
+/// \since QXmpp 1.4
+///
+void QXmppConfiguration::setStreamCompressionLevel(int level)
+{
+    d->streamCompressionLevel = level;
+}
+
 /// Returns the Non-SASL authentication mechanism configuration.
 ///
 /// \return QXmppConfiguration::NonSASLAuthMechanism
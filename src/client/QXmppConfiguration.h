@@ -120,6 +120,9 @@ public:
     bool useSASLAuthentication() const;
     void setUseSASLAuthentication(bool);
 
+    bool useSASL2Authentication() const;
+    void setUseSASL2Authentication(bool);
+
     bool useNonSASLAuthentication() const;
     void setUseNonSASLAuthentication(bool);
 
@@ -129,6 +132,12 @@ public:
     QXmppConfiguration::StreamSecurityMode streamSecurityMode() const;
     void setStreamSecurityMode(QXmppConfiguration::StreamSecurityMode mode);
 
+    bool streamCompressionEnabled() const;
+    void setStreamCompressionEnabled(bool enabled);
+
+    int streamCompressionLevel() const;
+    void setStreamCompressionLevel(int level);
+
     QXmppConfiguration::NonSASLAuthMechanism nonSASLAuthMechanism() const;
     void setNonSASLAuthMechanism(QXmppConfiguration::NonSASLAuthMechanism);
 
@@ -29,21 +29,199 @@
 #include "QXmppDataForm.h"
 #include "QXmppDiscoveryIq.h"
 #include "QXmppGlobal.h"
+#include "QXmppPresence.h"
 #include "QXmppStream.h"
+#include "QXmppUtils.h"
 
 #include <QCoreApplication>
+#include <QDomDocument>
 #include <QDomElement>
+#include <QFile>
+#include <QHash>
+#include <QSaveFile>
+#include <QTimer>
+#include <QXmlStreamWriter>
+
+static QString discoveryCacheKey(int queryType, const QString& jid, const QString& node)
+{
+    return QString::number(queryType) + QLatin1Char('\n') + jid + QLatin1Char('\n') + node;
+}
 
 class QXmppDiscoveryManagerPrivate
 {
 public:
+    QXmppDiscoveryManagerPrivate();
+
+    void loadCapabilitiesCache();
+    void saveCapabilitiesCache();
+    void loadDiscoveryCache();
+    void saveDiscoveryCache();
+
     QString clientCapabilitiesNode;
     QString clientCategory;
     QString clientType;
     QString clientName;
     QXmppDataForm clientInfoForm;
+
+    // XEP-0115: Entity Capabilities, the capabilities of the local client
+    // are only computed again when they changed
+    bool capabilitiesValid;
+    QXmppDiscoveryIq capabilities;
+    QByteArray verificationString;
+
+    // verified information for each SHA-1 capabilities hash
+    QHash<QByteArray, QXmppDiscoveryIq> capabilitiesCache;
+    QString capabilitiesCacheFileName;
+
+    // capabilities hash announced by each full JID
+    QHash<QString, QByteArray> entityCapabilities;
+
+    // responses to info and items queries
+    struct CacheEntry
+    {
+        QXmppDiscoveryIq iq;
+        QDateTime expiry;
+    };
+    QHash<QString, CacheEntry> discoveryCache;
+    QString discoveryCacheFileName;
+    int discoveryCacheTtl;
+
+    // pending requests by cache key and by IQ id
+    QHash<QString, QString> pendingIds;
+    QHash<QString, QXmppDiscoveryIq> pendingRequests;
+    int requestTimeout;
+
+    void failRequest(QXmppDiscoveryManager *q, const QString &id, const QXmppStanza::Error &error);
 };
 
+QXmppDiscoveryManagerPrivate::QXmppDiscoveryManagerPrivate()
+    : capabilitiesValid(false),
+      discoveryCacheTtl(0),
+      requestTimeout(30000)
+{
+}
+
+// Completes the pending request with the given \a id with an error
+// response, so that identical requests are sent again.
+
+void QXmppDiscoveryManagerPrivate::failRequest(QXmppDiscoveryManager *q, const QString &id, const QXmppStanza::Error &error)
+{
+    const auto pending = pendingRequests.find(id);
+    if (pending == pendingRequests.end())
+        return;
+
+    const QXmppDiscoveryIq request = *pending;
+    pendingRequests.erase(pending);
+    pendingIds.remove(discoveryCacheKey(request.queryType(), request.to(), request.queryNode()));
+
+    QXmppDiscoveryIq response;
+    response.setType(QXmppIq::Error);
+    response.setId(request.id());
+    response.setFrom(request.to());
+    response.setQueryType(request.queryType());
+    response.setQueryNode(request.queryNode());
+    response.setError(error);
+    if (response.queryType() == QXmppDiscoveryIq::InfoQuery)
+        emit q->infoReceived(response);
+    else
+        emit q->itemsReceived(response);
+}
+
+void QXmppDiscoveryManagerPrivate::loadDiscoveryCache()
+{
+    QFile file(discoveryCacheFileName);
+    if (!file.open(QIODevice::ReadOnly))
+        return;
+
+    QDomDocument doc;
+    if (!doc.setContent(&file, true))
+        return;
+
+    const QDateTime now = QDateTime::currentDateTimeUtc();
+    QDomElement entryElement = doc.documentElement().firstChildElement(QStringLiteral("entry"));
+    while (!entryElement.isNull()) {
+        CacheEntry entry;
+        entry.expiry = QXmppUtils::datetimeFromString(entryElement.attribute(QStringLiteral("expiry")));
+        entry.iq.parse(entryElement.firstChildElement(QStringLiteral("iq")));
+
+        if (entry.expiry.isValid() && entry.expiry > now) {
+            const QString key = discoveryCacheKey(entry.iq.queryType(), entryElement.attribute(QStringLiteral("jid")), entry.iq.queryNode());
+            discoveryCache.insert(key, entry);
+        }
+
+        entryElement = entryElement.nextSiblingElement(QStringLiteral("entry"));
+    }
+}
+
+void QXmppDiscoveryManagerPrivate::saveDiscoveryCache()
+{
+    if (discoveryCacheFileName.isEmpty())
+        return;
+
+    QSaveFile file(discoveryCacheFileName);
+    if (!file.open(QIODevice::WriteOnly))
+        return;
+
+    QXmlStreamWriter writer(&file);
+    writer.writeStartElement(QStringLiteral("discovery"));
+    for (auto itr = discoveryCache.cbegin(); itr != discoveryCache.cend(); ++itr) {
+        writer.writeStartElement(QStringLiteral("entry"));
+        writer.writeAttribute(QStringLiteral("jid"), itr.key().section(QLatin1Char('\n'), 1, 1));
+        writer.writeAttribute(QStringLiteral("expiry"), QXmppUtils::datetimeToString(itr->expiry));
+        itr->iq.toXml(&writer);
+        writer.writeEndElement();
+    }
+    writer.writeEndElement();
+    file.commit();
+}
+
+void QXmppDiscoveryManagerPrivate::loadCapabilitiesCache()
+{
+    QFile file(capabilitiesCacheFileName);
+    if (!file.open(QIODevice::ReadOnly))
+        return;
+
+    QDomDocument doc;
+    if (!doc.setContent(&file, true))
+        return;
+
+    // each entry is an information response whose node is the hash
+    QDomElement iqElement = doc.documentElement().firstChildElement(QStringLiteral("iq"));
+    while (!iqElement.isNull()) {
+        QXmppDiscoveryIq info;
+        info.parse(iqElement);
+
+        const QByteArray ver = QByteArray::fromBase64(info.queryNode().toLatin1());
+        if (info.verificationString() == ver)
+            capabilitiesCache.insert(ver, info);
+
+        iqElement = iqElement.nextSiblingElement(QStringLiteral("iq"));
+    }
+}
+
+void QXmppDiscoveryManagerPrivate::saveCapabilitiesCache()
+{
+    if (capabilitiesCacheFileName.isEmpty())
+        return;
+
+    QSaveFile file(capabilitiesCacheFileName);
+    if (!file.open(QIODevice::WriteOnly))
+        return;
+
+    QXmlStreamWriter writer(&file);
+    writer.writeStartElement(QStringLiteral("capabilities"));
+    for (auto itr = capabilitiesCache.cbegin(); itr != capabilitiesCache.cend(); ++itr) {
+        QXmppDiscoveryIq info = itr.value();
+        info.setId(QString());
+        info.setFrom(QString());
+        info.setTo(QString());
+        info.setQueryNode(QString::fromLatin1(itr.key().toBase64()));
+        info.toXml(&writer);
+    }
+    writer.writeEndElement();
+    file.commit();
+}
+
 QXmppDiscoveryManager::QXmppDiscoveryManager()
     : d(new QXmppDiscoveryManagerPrivate)
 {
@@ -72,16 +250,7 @@ QXmppDiscoveryManager::~QXmppDiscoveryManager()
 
 QString QXmppDiscoveryManager::requestInfo(const QString& jid, const QString& node)
 {
-    QXmppDiscoveryIq request;
-    request.setType(QXmppIq::Get);
-    request.setQueryType(QXmppDiscoveryIq::InfoQuery);
-    request.setTo(jid);
-    if (!node.isEmpty())
-        request.setQueryNode(node);
-    if (client()->sendPacket(request))
-        return request.id();
-    else
-        return QString();
+    return request(QXmppDiscoveryIq::InfoQuery, jid, node);
 }
 
 /// Requests items from the specified XMPP entity.
@@ -91,23 +260,65 @@ QString QXmppDiscoveryManager::requestInfo(const QString& jid, const QString& no
 
 QString QXmppDiscoveryManager::requestItems(const QString& jid, const QString& node)
 {
+    return request(QXmppDiscoveryIq::ItemsQuery, jid, node);
+}
+
+QString QXmppDiscoveryManager::request(int queryType, const QString& jid, const QString& node)
+{
+    const QString key = discoveryCacheKey(queryType, jid, node);
+
+    // answer from the cache
+    const auto cached = d->discoveryCache.constFind(key);
+    if (cached != d->discoveryCache.constEnd()) {
+        if (cached->expiry > QDateTime::currentDateTimeUtc()) {
+            QXmppDiscoveryIq response = cached->iq;
+            response.setId(QXmppUtils::generateStanzaHash());
+            QTimer::singleShot(0, this, [this, response]() {
+                if (response.queryType() == QXmppDiscoveryIq::InfoQuery)
+                    emit infoReceived(response);
+                else
+                    emit itemsReceived(response);
+            });
+            return response.id();
+        }
+        d->discoveryCache.remove(key);
+    }
+
+    // wait for the response to the identical pending request
+    const auto pending = d->pendingIds.constFind(key);
+    if (pending != d->pendingIds.constEnd())
+        return *pending;
+
     QXmppDiscoveryIq request;
     request.setType(QXmppIq::Get);
-    request.setQueryType(QXmppDiscoveryIq::ItemsQuery);
+    request.setQueryType(QXmppDiscoveryIq::QueryType(queryType));
     request.setTo(jid);
     if (!node.isEmpty())
         request.setQueryNode(node);
-    if (client()->sendPacket(request))
-        return request.id();
-    else
+    if (!client()->sendPacket(request))
         return QString();
+
+    d->pendingIds.insert(key, request.id());
+    d->pendingRequests.insert(request.id(), request);
+
+    const QString id = request.id();
+    QTimer::singleShot(d->requestTimeout, this, [this, id]() {
+        d->failRequest(this, id, QXmppStanza::Error(QXmppStanza::Error::Wait, QXmppStanza::Error::RemoteServerTimeout, QStringLiteral("No response was received in time")));
+    });
+    return id;
 }
 
 ///
 /// Returns the client's full capabilities.
 ///
+/// The capabilities are computed once and cached until resetCapabilities()
+/// is called or the client's identity changes.
+///
 QXmppDiscoveryIq QXmppDiscoveryManager::capabilities()
 {
+    if (d->capabilitiesValid)
+        return d->capabilities;
+
     QXmppDiscoveryIq iq;
     iq.setType(QXmppIq::Result);
     iq.setQueryType(QXmppDiscoveryIq::InfoQuery);
@@ -146,9 +357,42 @@ QXmppDiscoveryIq QXmppDiscoveryManager::capabilities()
     if (!d->clientInfoForm.isNull())
         iq.setForm(d->clientInfoForm);
 
+    d->capabilities = iq;
+    d->verificationString = iq.verificationString();
+    d->capabilitiesValid = true;
     return iq;
 }
 
+///
+/// Returns the \xep{0115}: Entity Capabilities verification string of the
+/// client's capabilities.
+///
+/// \since QXmpp 1.4
+///
+QByteArray QXmppDiscoveryManager::capabilitiesVerificationString()
+{
+    if (!d->capabilitiesValid)
+        capabilities();
+    return d->verificationString;
+}
+
+///
+/// Discards the cached capabilities of the client.
+///
+/// This is done automatically when an extension is added to or removed from
+/// the client and when the client's identity or information form changes.
+/// It needs to be called if the features or identities reported by an
+/// extension changed.
+///
+/// \since QXmpp 1.4
+///
+void QXmppDiscoveryManager::resetCapabilities()
+{
+    d->capabilitiesValid = false;
+    d->capabilities = QXmppDiscoveryIq();
+    d->verificationString.clear();
+}
+
 /// Sets the capabilities node of the local XMPP client.
 ///
 /// \param node
@@ -168,6 +412,7 @@ void QXmppDiscoveryManager::setClientCapabilitiesNode(const QString& node)
 void QXmppDiscoveryManager::setClientCategory(const QString& category)
 {
     d->clientCategory = category;
+    resetCapabilities();
 }
 
 /// Sets the type of the local XMPP client.
@@ -180,6 +425,7 @@ void QXmppDiscoveryManager::setClientCategory(const QString& category)
 void QXmppDiscoveryManager::setClientType(const QString& type)
 {
     d->clientType = type;
+    resetCapabilities();
 }
 
 /// Sets the name of the local XMPP client.
@@ -189,6 +435,7 @@ void QXmppDiscoveryManager::setClientType(const QString& type)
 void QXmppDiscoveryManager::setClientName(const QString& name)
 {
     d->clientName = name;
+    resetCapabilities();
 }
 
 /// Returns the capabilities node of the local XMPP client.
@@ -242,6 +489,157 @@ QXmppDataForm QXmppDiscoveryManager::clientInfoForm() const
 void QXmppDiscoveryManager::setClientInfoForm(const QXmppDataForm& form)
 {
     d->clientInfoForm = form;
+    resetCapabilities();
+}
+
+///
+/// Looks up the information of the given entity in the \xep{0115}: Entity
+/// Capabilities cache.
+///
+/// This succeeds if the last presence received from \a jid announced a
+/// capabilities hash for which an information response was received before.
+///
+/// \param jid The full JID of the entity.
+/// \param info The cached information, if any.
+///
+/// \return true if the information was found.
+///
+/// \since QXmpp 1.4
+///
+bool QXmppDiscoveryManager::cachedInfo(const QString& jid, QXmppDiscoveryIq& info) const
+{
+    const auto ver = d->entityCapabilities.constFind(jid);
+    if (ver == d->entityCapabilities.constEnd())
+        return false;
+
+    const auto itr = d->capabilitiesCache.constFind(*ver);
+    if (itr == d->capabilitiesCache.constEnd())
+        return false;
+
+    info = *itr;
+    info.setFrom(jid);
+    return true;
+}
+
+///
+/// Returns the number of seconds for which responses to info and items
+/// queries are cached.
+///
+/// \since QXmpp 1.4
+///
+int QXmppDiscoveryManager::discoveryCacheTtl() const
+{
+    return d->discoveryCacheTtl;
+}
+
+///
+/// Sets the number of seconds for which responses to info and items queries
+/// are cached.
+///
+/// The default value is 0, which disables the cache. Identical pending
+/// requests are collapsed in any case.
+///
+/// \param secs
+///
+/// \since QXmpp 1.4
+///
+void QXmppDiscoveryManager::setDiscoveryCacheTtl(int secs)
+{
+    d->discoveryCacheTtl = secs;
+}
+
+///
+/// Returns the number of milliseconds after which a request without a
+/// response fails.
+///
+/// \since QXmpp 1.4
+///
+int QXmppDiscoveryManager::requestTimeout() const
+{
+    return d->requestTimeout;
+}
+
+///
+/// Sets the number of milliseconds after which a request without a response
+/// fails, so that identical requests are sent again.
+///
+/// The default value is 30000.
+///
+/// \param msecs
+///
+/// \since QXmpp 1.4
+///
+void QXmppDiscoveryManager::setRequestTimeout(int msecs)
+{
+    d->requestTimeout = msecs;
+}
+
+///
+/// Returns the name of the file in which cached responses to info and items
+/// queries are stored.
+///
+/// \since QXmpp 1.4
+///
+QString QXmppDiscoveryManager::discoveryCacheFileName() const
+{
+    return d->discoveryCacheFileName;
+}
+
+///
+/// Sets the name of the file in which cached responses to info and items
+/// queries are stored and loads the entries which did not expire yet.
+///
+/// This allows to skip service discovery at login if nothing changed since
+/// the previous session.
+///
+/// \param fileName
+///
+/// \since QXmpp 1.4
+///
+void QXmppDiscoveryManager::setDiscoveryCacheFileName(const QString& fileName)
+{
+    d->discoveryCacheFileName = fileName;
+    if (!fileName.isEmpty())
+        d->loadDiscoveryCache();
+}
+
+///
+/// Removes all cached responses to info and items queries.
+///
+/// \since QXmpp 1.4
+///
+void QXmppDiscoveryManager::clearDiscoveryCache()
+{
+    d->discoveryCache.clear();
+    d->saveDiscoveryCache();
+}
+
+///
+/// Returns the name of the file in which the capabilities cache is stored.
+///
+/// \since QXmpp 1.4
+///
+QString QXmppDiscoveryManager::capabilitiesCacheFileName() const
+{
+    return d->capabilitiesCacheFileName;
+}
+
+///
+/// Sets the name of the file in which the capabilities cache is stored and
+/// loads the entries it contains.
+///
+/// The file is updated whenever new capabilities are received. By default
+/// the cache is only kept in memory.
+///
+/// \param fileName
+///
+/// \since QXmpp 1.4
+///
+void QXmppDiscoveryManager::setCapabilitiesCacheFileName(const QString& fileName)
+{
+    d->capabilitiesCacheFileName = fileName;
+    if (!fileName.isEmpty())
+        d->loadCapabilitiesCache();
 }
 
 /// \cond
@@ -252,6 +650,23 @@ QStringList QXmppDiscoveryManager::discoveryFeatures() const
 
 bool QXmppDiscoveryManager::handleStanza(const QDomElement& element)
 {
+    // errors may be returned without a query, results without one are
+    // invalid
+    if (element.tagName() == "iq" && !QXmppDiscoveryIq::isDiscoveryIq(element)) {
+        const QString id = element.attribute(QStringLiteral("id"));
+        const QString type = element.attribute(QStringLiteral("type"));
+        if (!d->pendingRequests.contains(id) || (type != QStringLiteral("error") && type != QStringLiteral("result")))
+            return false;
+
+        QXmppIq response;
+        response.parse(element);
+        if (response.type() == QXmppIq::Error)
+            d->failRequest(this, id, response.error());
+        else
+            d->failRequest(this, id, QXmppStanza::Error(QXmppStanza::Error::Cancel, QXmppStanza::Error::UndefinedCondition, QStringLiteral("The response did not contain a query")));
+        return true;
+    }
+
     if (element.tagName() == "iq" && QXmppDiscoveryIq::isDiscoveryIq(element)) {
         QXmppDiscoveryIq receivedIq;
         receivedIq.parse(element);
@@ -275,14 +690,42 @@ bool QXmppDiscoveryManager::handleStanza(const QDomElement& element)
             }
 
         case QXmppIq::Result:
-        case QXmppIq::Error:
+        case QXmppIq::Error: {
+            // complete the pending request and cache the response
+            const auto pending = d->pendingRequests.find(receivedIq.id());
+            if (pending != d->pendingRequests.end()) {
+                const QString key = discoveryCacheKey(pending->queryType(), pending->to(), pending->queryNode());
+                d->pendingRequests.erase(pending);
+                d->pendingIds.remove(key);
+                if (receivedIq.type() == QXmppIq::Result && d->discoveryCacheTtl > 0) {
+                    d->discoveryCache.insert(key, { receivedIq, QDateTime::currentDateTimeUtc().addSecs(d->discoveryCacheTtl) });
+                    d->saveDiscoveryCache();
+                }
+            }
+
             // handle all replies
             if (receivedIq.queryType() == QXmppDiscoveryIq::InfoQuery) {
+                // XEP-0115: Entity Capabilities, cache the information if it
+                // matches the hash given in the node
+                const int hashIndex = receivedIq.queryNode().lastIndexOf(QLatin1Char('#'));
+                if (receivedIq.type() == QXmppIq::Result && hashIndex >= 0) {
+                    const QByteArray ver = QByteArray::fromBase64(receivedIq.queryNode().mid(hashIndex + 1).toLatin1());
+                    if (!d->capabilitiesCache.contains(ver)) {
+                        if (receivedIq.verificationString() == ver) {
+                            d->capabilitiesCache.insert(ver, receivedIq);
+                            d->saveCapabilitiesCache();
+                        } else {
+                            warning(QStringLiteral("Capabilities of %1 do not match their hash").arg(receivedIq.from()));
+                        }
+                    }
+                }
+
                 emit infoReceived(receivedIq);
             } else if (receivedIq.queryType() == QXmppDiscoveryIq::ItemsQuery) {
                 emit itemsReceived(receivedIq);
             }
             return true;
+        }
 
         case QXmppIq::Set:
             // let other manager handle "set" IQs
@@ -291,4 +734,35 @@ bool QXmppDiscoveryManager::handleStanza(const QDomElement& element)
     }
     return false;
 }
+
+void QXmppDiscoveryManager::setClient(QXmppClient* client)
+{
+    QXmppClientExtension::setClient(client);
+
+    connect(client, &QXmppClient::presenceReceived,
+            this, &QXmppDiscoveryManager::_q_presenceReceived);
+
+    // responses to pending requests will not arrive anymore and the
+    // entities announce their capabilities again after reconnecting
+    connect(client, &QXmppClient::disconnected, this, [this]() {
+        d->entityCapabilities.clear();
+
+        const QXmppStanza::Error error(QXmppStanza::Error::Wait, QXmppStanza::Error::ServiceUnavailable,
+                                       QStringLiteral("The connection was closed before a response was received"));
+        const auto ids = d->pendingRequests.keys();
+        for (const auto &id : ids)
+            d->failRequest(this, id, error);
+    });
+}
 /// \endcond
+
+void QXmppDiscoveryManager::_q_presenceReceived(const QXmppPresence& presence)
+{
+    // only SHA-1 hashes are supported
+    if (presence.type() == QXmppPresence::Available &&
+        presence.capabilityHash() == QLatin1String("sha-1") &&
+        !presence.capabilityVer().isEmpty())
+        d->entityCapabilities.insert(presence.from(), presence.capabilityVer());
+    else
+        d->entityCapabilities.remove(presence.from());
+}
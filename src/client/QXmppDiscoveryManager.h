@@ -29,10 +29,24 @@
 class QXmppDataForm;
 class QXmppDiscoveryIq;
 class QXmppDiscoveryManagerPrivate;
+class QXmppPresence;
 
 /// \brief The QXmppDiscoveryManager class makes it possible to discover information
 /// about other entities as defined by \xep{0030}: Service Discovery.
 ///
+/// The information advertised by other entities using \xep{0115}: Entity
+/// Capabilities is cached: once an information response for a capabilities
+/// hash was received and verified, cachedInfo() returns it for every entity
+/// which announces the same hash in its presence, without any network
+/// traffic. The cache can be kept across runs using
+/// setCapabilitiesCacheFileName().
+///
+/// Identical requests which are sent while a previous one is still pending
+/// are collapsed into a single query. Responses can also be cached for a
+/// given time, see setDiscoveryCacheTtl(). Cached responses are reported
+/// using the infoReceived() and itemsReceived() signals like any other
+/// response. Requests which are not answered within requestTimeout() fail.
+///
 /// \ingroup Managers
 
 class QXMPP_EXPORT QXmppDiscoveryManager : public QXmppClientExtension
@@ -44,6 +58,8 @@ public:
     ~QXmppDiscoveryManager() override;
 
     QXmppDiscoveryIq capabilities();
+    QByteArray capabilitiesVerificationString();
+    void resetCapabilities();
 
     QString requestInfo(const QString& jid, const QString& node = QString());
     QString requestItems(const QString& jid, const QString& node = QString());
@@ -64,6 +80,23 @@ public:
     QXmppDataForm clientInfoForm() const;
     void setClientInfoForm(const QXmppDataForm& form);
 
+    // XEP-0115: Entity Capabilities
+    bool cachedInfo(const QString& jid, QXmppDiscoveryIq& info) const;
+
+    QString capabilitiesCacheFileName() const;
+    void setCapabilitiesCacheFileName(const QString& fileName);
+
+    int discoveryCacheTtl() const;
+    void setDiscoveryCacheTtl(int secs);
+
+    QString discoveryCacheFileName() const;
+    void setDiscoveryCacheFileName(const QString& fileName);
+
+    void clearDiscoveryCache();
+
+    int requestTimeout() const;
+    void setRequestTimeout(int msecs);
+
     /// \cond
     QStringList discoveryFeatures() const override;
     bool handleStanza(const QDomElement& element) override;
@@ -71,12 +104,28 @@ public:
 
 Q_SIGNALS:
     /// This signal is emitted when an information response is received.
+    ///
+    /// If a request failed, timed out or the connection was closed before a
+    /// response was received, an IQ of type error is emitted.
     void infoReceived(const QXmppDiscoveryIq&);
 
     /// This signal is emitted when an items response is received.
+    ///
+    /// If a request failed, timed out or the connection was closed before a
+    /// response was received, an IQ of type error is emitted.
     void itemsReceived(const QXmppDiscoveryIq&);
 
+protected:
+    /// \cond
+    void setClient(QXmppClient* client) override;
+    /// \endcond
+
+private Q_SLOTS:
+    void _q_presenceReceived(const QXmppPresence& presence);
+
 private:
+    QString request(int queryType, const QString& jid, const QString& node);
+
     QXmppDiscoveryManagerPrivate* d;
 };
 
@@ -0,0 +1,453 @@
+/*
+ * Copyright (C) 2008-2020 The QXmpp developers
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "QXmppMamIterator.h"
+
+#include "QXmppClient.h"
+#include "QXmppIq.h"
+#include "QXmppMamManager.h"
+
+#include <QPointer>
+
+// default number of messages requested per page
+static const int DEFAULT_PAGE_SIZE = 100;
+
+// default number of messages which may wait to be taken
+static const int DEFAULT_MAXIMUM_BUFFERED = 1000;
+
+class QXmppMamIteratorPrivate
+{
+public:
+    QXmppMamIteratorPrivate(QXmppMamIterator *qq);
+
+    // A part of the time range which is paged through independently.
+    struct Window
+    {
+        QDateTime start;
+        QDateTime end;
+        QString queryId;
+        QString last;
+        bool complete;
+        QList<QXmppMessage> messages;
+    };
+
+    int availableMessages() const;
+    int findWindow(const QString &queryId) const;
+    void fetchMore();
+    bool checkFinished();
+
+    QPointer<QXmppMamManager> manager;
+    QString to;
+    QString node;
+    QString with;
+    QDateTime start;
+    QDateTime end;
+    int pageSize;
+    int windowCount;
+    int maximumBuffered;
+
+    bool running;
+    QList<Window> windows;
+
+private:
+    QXmppMamIterator *q;
+};
+
+QXmppMamIteratorPrivate::QXmppMamIteratorPrivate(QXmppMamIterator *qq)
+    : pageSize(DEFAULT_PAGE_SIZE),
+      windowCount(1),
+      maximumBuffered(DEFAULT_MAXIMUM_BUFFERED),
+      running(false),
+      q(qq)
+{
+}
+
+// Returns the number of messages which can be taken, that is the messages of
+// the windows which are only preceded by exhausted windows.
+
+int QXmppMamIteratorPrivate::availableMessages() const
+{
+    int count = 0;
+    for (const auto &window : windows) {
+        count += window.messages.size();
+        if (!window.complete)
+            break;
+    }
+    return count;
+}
+
+int QXmppMamIteratorPrivate::findWindow(const QString &queryId) const
+{
+    if (queryId.isEmpty())
+        return -1;
+
+    for (int i = 0; i < windows.size(); ++i) {
+        if (windows.at(i).queryId == queryId)
+            return i;
+    }
+    return -1;
+}
+
+// Requests the next page of every window, unless too many messages are
+// waiting to be taken.
+
+void QXmppMamIteratorPrivate::fetchMore()
+{
+    if (!running || !manager)
+        return;
+
+    for (auto &window : windows) {
+        if (window.complete || !window.queryId.isEmpty())
+            continue;
+        if (q->bufferedMessages() >= maximumBuffered)
+            return;
+
+        QXmppResultSetQuery resultSetQuery;
+        resultSetQuery.setMax(pageSize);
+        resultSetQuery.setAfter(window.last);
+        window.queryId = manager->retrieveArchivedMessages(to, node, with, window.start, window.end, resultSetQuery);
+    }
+}
+
+// Emits finished() once all windows are exhausted.
+
+bool QXmppMamIteratorPrivate::checkFinished()
+{
+    if (!running)
+        return false;
+
+    for (const auto &window : qAsConst(windows)) {
+        if (!window.complete || !window.messages.isEmpty())
+            return false;
+    }
+
+    running = false;
+    windows.clear();
+    emit q->finished();
+    return true;
+}
+
+///
+/// Constructs an iterator which uses the QXmppMamManager of \a client.
+///
+/// \param client
+/// \param parent
+///
+QXmppMamIterator::QXmppMamIterator(QXmppClient *client, QObject *parent)
+    : QObject(parent),
+      d(new QXmppMamIteratorPrivate(this))
+{
+    d->manager = client->findExtension<QXmppMamManager>();
+    if (!d->manager) {
+        qWarning("QXmppMamIterator requires a QXmppMamManager");
+        return;
+    }
+
+    connect(d->manager, &QXmppMamManager::archivedMessageReceived,
+            this, &QXmppMamIterator::_q_archivedMessageReceived);
+    connect(d->manager, &QXmppMamManager::resultsRecieved,
+            this, &QXmppMamIterator::_q_resultsReceived);
+    connect(client, &QXmppClient::iqReceived,
+            this, &QXmppMamIterator::_q_iqReceived);
+}
+
+QXmppMamIterator::~QXmppMamIterator()
+{
+    delete d;
+}
+
+///
+/// Returns the entity whose archive is queried. An empty value designates
+/// the archive of the local account.
+///
+QString QXmppMamIterator::to() const
+{
+    return d->to;
+}
+
+///
+/// Sets the entity whose archive is queried.
+///
+/// \param to
+///
+void QXmppMamIterator::setTo(const QString &to)
+{
+    d->to = to;
+}
+
+///
+/// Returns the pubsub node which is queried.
+///
+QString QXmppMamIterator::node() const
+{
+    return d->node;
+}
+
+///
+/// Sets the pubsub node which is queried.
+///
+/// \param node
+///
+void QXmppMamIterator::setNode(const QString &node)
+{
+    d->node = node;
+}
+
+///
+/// Returns the JID the messages are filtered by.
+///
+QString QXmppMamIterator::with() const
+{
+    return d->with;
+}
+
+///
+/// Sets the JID the messages are filtered by.
+///
+/// \param jid
+///
+void QXmppMamIterator::setWith(const QString &jid)
+{
+    d->with = jid;
+}
+
+///
+/// Returns the start of the retrieved time range.
+///
+QDateTime QXmppMamIterator::start() const
+{
+    return d->start;
+}
+
+///
+/// Sets the start of the retrieved time range.
+///
+/// \param start
+///
+void QXmppMamIterator::setStart(const QDateTime &start)
+{
+    d->start = start;
+}
+
+///
+/// Returns the end of the retrieved time range.
+///
+QDateTime QXmppMamIterator::end() const
+{
+    return d->end;
+}
+
+///
+/// Sets the end of the retrieved time range.
+///
+/// \param end
+///
+void QXmppMamIterator::setEnd(const QDateTime &end)
+{
+    d->end = end;
+}
+
+///
+/// Returns the number of messages requested per page.
+///
+/// The default value is 100.
+///
+int QXmppMamIterator::pageSize() const
+{
+    return d->pageSize;
+}
+
+///
+/// Sets the number of messages requested per page.
+///
+/// \param pageSize
+///
+void QXmppMamIterator::setPageSize(int pageSize)
+{
+    d->pageSize = pageSize;
+}
+
+///
+/// Returns the number of windows the time range is split into.
+///
+/// The default value is 1.
+///
+int QXmppMamIterator::windowCount() const
+{
+    return d->windowCount;
+}
+
+///
+/// Sets the number of windows the time range is split into, which are
+/// retrieved in parallel.
+///
+/// This only has an effect if both a start and an end are set.
+///
+/// \param count
+///
+void QXmppMamIterator::setWindowCount(int count)
+{
+    d->windowCount = qMax(1, count);
+}
+
+///
+/// Returns the number of buffered messages above which no further pages are
+/// requested.
+///
+/// The default value is 1000.
+///
+int QXmppMamIterator::maximumBufferedMessages() const
+{
+    return d->maximumBuffered;
+}
+
+///
+/// Sets the number of buffered messages above which no further pages are
+/// requested.
+///
+/// As pages which were already requested are still received, up to
+/// windowCount() times pageSize() more messages may be buffered.
+///
+/// \param count
+///
+void QXmppMamIterator::setMaximumBufferedMessages(int count)
+{
+    d->maximumBuffered = count;
+}
+
+///
+/// Returns true if messages are being retrieved or waiting to be taken.
+///
+bool QXmppMamIterator::isRunning() const
+{
+    return d->running;
+}
+
+///
+/// Returns the number of received messages which were not taken yet.
+///
+int QXmppMamIterator::bufferedMessages() const
+{
+    int count = 0;
+    for (const auto &window : d->windows)
+        count += window.messages.size();
+    return count;
+}
+
+///
+/// Takes up to \a max of the available messages, in chronological order.
+///
+/// Taking messages allows further pages to be requested.
+///
+/// \param max The maximum number of messages to take, or -1 for all.
+///
+QList<QXmppMessage> QXmppMamIterator::takeMessages(int max)
+{
+    QList<QXmppMessage> messages;
+    for (auto &window : d->windows) {
+        while (!window.messages.isEmpty() && (max < 0 || messages.size() < max))
+            messages << window.messages.takeFirst();
+        if (!window.complete || !window.messages.isEmpty())
+            break;
+    }
+
+    if (!d->checkFinished())
+        d->fetchMore();
+    return messages;
+}
+
+///
+/// Starts retrieving the messages.
+///
+void QXmppMamIterator::start()
+{
+    abort();
+    if (!d->manager)
+        return;
+
+    // split the time range into windows of equal duration
+    int windowCount = 1;
+    qint64 duration = 0;
+    if (d->start.isValid() && d->end.isValid() && d->start < d->end) {
+        duration = d->start.msecsTo(d->end);
+        windowCount = int(qMin(qint64(d->windowCount), duration));
+    }
+
+    for (int i = 0; i < windowCount; ++i) {
+        QXmppMamIteratorPrivate::Window window;
+        window.complete = false;
+        if (windowCount > 1) {
+            window.start = d->start.addMSecs(duration * i / windowCount);
+            window.end = (i == windowCount - 1) ? d->end : d->start.addMSecs(duration * (i + 1) / windowCount - 1);
+        } else {
+            window.start = d->start;
+            window.end = d->end;
+        }
+        d->windows << window;
+    }
+
+    d->running = true;
+    d->fetchMore();
+}
+
+///
+/// Stops retrieving messages and discards the buffered ones.
+///
+void QXmppMamIterator::abort()
+{
+    d->running = false;
+    d->windows.clear();
+}
+
+void QXmppMamIterator::_q_archivedMessageReceived(const QString &queryId, const QXmppMessage &message)
+{
+    const int index = d->findWindow(queryId);
+    if (index >= 0)
+        d->windows[index].messages << message;
+}
+
+void QXmppMamIterator::_q_resultsReceived(const QString &queryId, const QXmppResultSetReply &resultSetReply, bool complete)
+{
+    const int index = d->findWindow(queryId);
+    if (index < 0)
+        return;
+
+    auto &window = d->windows[index];
+    window.queryId.clear();
+    window.last = resultSetReply.last();
+    window.complete = complete || window.last.isEmpty();
+
+    // request the next page right away
+    d->fetchMore();
+
+    if (d->availableMessages())
+        emit messagesAvailable();
+    else
+        d->checkFinished();
+}
+
+void QXmppMamIterator::_q_iqReceived(const QXmppIq &iq)
+{
+    if (iq.type() != QXmppIq::Error || d->findWindow(iq.id()) < 0)
+        return;
+
+    abort();
+    emit failed(iq.error());
+}
@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2008-2020 The QXmpp developers
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPMAMITERATOR_H
+#define QXMPPMAMITERATOR_H
+
+#include "QXmppMessage.h"
+#include "QXmppResultSet.h"
+
+#include <QDateTime>
+#include <QObject>
+
+class QXmppClient;
+class QXmppIq;
+class QXmppMamManager;
+class QXmppMamIteratorPrivate;
+
+///
+/// \brief The QXmppMamIterator class retrieves a whole range of a message
+/// archive (\xep{0313}: Message Archive Management), paging through it
+/// automatically.
+///
+/// As soon as a page has been received, the next one is requested while the
+/// messages are being processed. If both a start and an end are set, the
+/// time range can be split into several windows which are retrieved in
+/// parallel.
+///
+/// The messages are delivered in chronological order by takeMessages(). To
+/// avoid buffering an unbounded number of messages when they are not taken
+/// fast enough, no further pages are requested while more than
+/// maximumBufferedMessages() messages are waiting.
+///
+/// \code
+/// auto *iterator = new QXmppMamIterator(client);
+/// iterator->setStart(QDateTime::currentDateTimeUtc().addMonths(-3));
+/// iterator->setEnd(QDateTime::currentDateTimeUtc());
+/// iterator->setWindowCount(4);
+/// connect(iterator, &QXmppMamIterator::messagesAvailable, [=]() {
+///     for (const auto &message : iterator->takeMessages())
+///         store(message);
+/// });
+/// iterator->start();
+/// \endcode
+///
+/// \since QXmpp 1.4
+///
+class QXMPP_EXPORT QXmppMamIterator : public QObject
+{
+    Q_OBJECT
+
+public:
+    QXmppMamIterator(QXmppClient *client, QObject *parent = nullptr);
+    ~QXmppMamIterator() override;
+
+    QString to() const;
+    void setTo(const QString &to);
+
+    QString node() const;
+    void setNode(const QString &node);
+
+    QString with() const;
+    void setWith(const QString &jid);
+
+    QDateTime start() const;
+    void setStart(const QDateTime &start);
+
+    QDateTime end() const;
+    void setEnd(const QDateTime &end);
+
+    int pageSize() const;
+    void setPageSize(int pageSize);
+
+    int windowCount() const;
+    void setWindowCount(int count);
+
+    int maximumBufferedMessages() const;
+    void setMaximumBufferedMessages(int count);
+
+    bool isRunning() const;
+    int bufferedMessages() const;
+    QList<QXmppMessage> takeMessages(int max = -1);
+
+public Q_SLOTS:
+    void start();
+    void abort();
+
+Q_SIGNALS:
+    /// This signal is emitted when messages can be taken using
+    /// takeMessages().
+    void messagesAvailable();
+
+    /// This signal is emitted once all messages of the range have been
+    /// received and taken.
+    void finished();
+
+    /// This signal is emitted when the archive returned an error. The
+    /// retrieval is aborted.
+    void failed(const QXmppStanza::Error &error);
+
+private Q_SLOTS:
+    void _q_archivedMessageReceived(const QString &queryId, const QXmppMessage &message);
+    void _q_resultsReceived(const QString &queryId, const QXmppResultSetReply &resultSetReply, bool complete);
+    void _q_iqReceived(const QXmppIq &iq);
+
+private:
+    QXmppMamIteratorPrivate *const d;
+};
+
+#endif
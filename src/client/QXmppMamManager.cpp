@@ -56,6 +56,11 @@ bool QXmppMamManager::handleStanza(const QDomElement &element)
                         const QString stamp = delayElement.attribute("stamp");
                         message.setStamp(QXmppUtils::datetimeFromString(stamp));
                     }
+                    // the result id is the stanza-id assigned by the archive
+                    if (message.stanzaId().isEmpty() && resultElement.hasAttribute("id")) {
+                        message.setStanzaId(resultElement.attribute("id"));
+                        message.setStanzaIdBy(element.attribute("from"));
+                    }
                     emit archivedMessageReceived(queryId, message);
                 }
             }
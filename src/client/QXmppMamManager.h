@@ -43,6 +43,9 @@ class QXmppMessage;
 /// client->addExtension(manager);
 /// \endcode
 ///
+/// To retrieve a whole range of the archive without handling the paging
+/// yourself, use a QXmppMamIterator.
+///
 /// \ingroup Managers
 ///
 /// \since QXmpp 1.0
@@ -65,7 +68,10 @@ public:
     /// \endcond
 
 Q_SIGNALS:
-    /// This signal is emitted when an archived message is received
+    /// This signal is emitted when an archived message is received.
+    ///
+    /// Unless the message already carries one, its stanza-id is set to the
+    /// id under which the archive stores it.
     void archivedMessageReceived(const QString &queryId,
                                  const QXmppMessage &message);
 
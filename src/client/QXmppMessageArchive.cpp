@@ -0,0 +1,829 @@
+/*
+ * Copyright (C) 2008-2020 The QXmpp developers
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "QXmppMessageArchive.h"
+
+#include "QXmppClient.h"
+#include "QXmppIq.h"
+#include "QXmppMamManager.h"
+#include "QXmppUtils.h"
+
+#include <QDomDocument>
+#include <QFile>
+#include <QPointer>
+#include <QSet>
+#include <QXmlStreamWriter>
+#include <QtEndian>
+
+#include <algorithm>
+#include <cstring>
+
+// The archive file starts with a magic and a format version, followed by
+// the records. Each record is laid out as follows, integers are stored in
+// little-endian byte order:
+//
+//  quint32  size of the rest of the record
+//  qint64   timestamp, in milliseconds since the epoch
+//  5 times  quint32 length followed by UTF-8 data, for the stanza-id, the
+//           conversation JID, the body, the XML of the message and its
+//           origin-id or id attribute
+//
+// A record without XML and without conversation is a checkpoint, its
+// stanza-id is the id of the last result retrieved from the server archive.
+//
+// A record without XML but with a conversation is an alias, it gives the
+// stanza-id the server assigned to a message which was archived live under
+// the origin-id or id stored in the record.
+//
+static const char ARCHIVE_MAGIC[] = "QXMA";
+static const quint32 ARCHIVE_VERSION = 3;
+static const qint64 HEADER_SIZE = 8;
+static const qint64 RECORD_HEADER_SIZE = 12;
+
+enum RecordField {
+    StanzaIdField = 0,
+    ConversationField,
+    BodyField,
+    XmlField,
+    MessageIdField,
+    FieldCount
+};
+
+// default number of messages requested per page when synchronizing
+static const int DEFAULT_PAGE_SIZE = 250;
+
+// number of appended bytes which are kept in memory before the file is
+// mapped again
+static const int MAXIMUM_TAIL_SIZE = 1024 * 1024;
+
+static void appendInteger(QByteArray &data, quint32 value)
+{
+    uchar buffer[4];
+    qToLittleEndian(value, buffer);
+    data.append(reinterpret_cast<const char *>(buffer), 4);
+}
+
+static void appendField(QByteArray &data, const QByteArray &field)
+{
+    appendInteger(data, quint32(field.size()));
+    data.append(field);
+}
+
+// Appends a record with the given timestamp to buffer.
+static void appendRecord(QByteArray &buffer, qint64 stamp, const QByteArray &record)
+{
+    uchar header[RECORD_HEADER_SIZE];
+    qToLittleEndian(quint32(8 + record.size()), header);
+    qToLittleEndian(stamp, header + 4);
+    buffer.append(reinterpret_cast<const char *>(header), RECORD_HEADER_SIZE);
+    buffer.append(record);
+}
+
+// Returns the given field of the record at ptr, without copying it.
+static QByteArray recordField(const uchar *ptr, RecordField field)
+{
+    ptr += RECORD_HEADER_SIZE;
+    for (int i = 0; i < field; ++i)
+        ptr += 4 + qFromLittleEndian<quint32>(ptr);
+    return QByteArray::fromRawData(reinterpret_cast<const char *>(ptr + 4), int(qFromLittleEndian<quint32>(ptr)));
+}
+
+// Returns the key used to match messages which have no stanza-id.
+static QString messageKey(const QString &conversation, const QString &messageId)
+{
+    return conversation + QLatin1Char('\n') + messageId;
+}
+
+// Returns the origin-id of a message, or its id attribute.
+static QString messageId(const QXmppMessage &message)
+{
+    return message.originId().isEmpty() ? message.id() : message.originId();
+}
+
+class QXmppMessageArchivePrivate
+{
+public:
+    QXmppMessageArchivePrivate();
+
+    struct Record
+    {
+        qint64 offset;
+        qint64 stamp;
+    };
+
+    QString conversationJid(const QXmppMessage &message) const;
+    const uchar *recordData(int index) const;
+    QByteArray field(int index, RecordField field) const;
+    int findDuplicate(const QXmppMessage &message, const QString &conversation) const;
+    QXmppMessage decode(int index) const;
+    QList<QXmppMessage> decode(QVector<int>::const_iterator first, QVector<int>::const_iterator last) const;
+    const QVector<int> *indexFor(const QString &jid) const;
+
+    int append(const QList<QXmppMessage> &messages, const QString &resumeId = QString());
+    void addToIndexes(int index);
+    void insertSorted(QVector<int> &list, int index);
+    bool remap();
+    void scan();
+    void requestPage(const QString &after);
+
+    QFile file;
+    uchar *data;
+    qint64 mappedSize;
+    // records appended since the file was last mapped
+    QByteArray tail;
+    QString accountJid;
+    int pageSize;
+
+    // indexes, the conversation and timeline lists are sorted by timestamp
+    QVector<Record> records;
+    QHash<QString, int> stanzaIds;
+    QHash<QString, int> messageIds;
+    QHash<QString, QVector<int>> conversations;
+    QVector<int> timeline;
+    QString lastStanzaId;
+
+    // synchronization
+    QPointer<QXmppClient> client;
+    QPointer<QXmppMamManager> manager;
+    QString queryId;
+    QList<QXmppMessage> page;
+    int synchronizedCount;
+};
+
+QXmppMessageArchivePrivate::QXmppMessageArchivePrivate()
+    : data(nullptr),
+      mappedSize(0),
+      pageSize(DEFAULT_PAGE_SIZE),
+      synchronizedCount(0)
+{
+}
+
+// Returns the bare JID of the contact or room the message was exchanged with.
+
+QString QXmppMessageArchivePrivate::conversationJid(const QXmppMessage &message) const
+{
+    const QString from = QXmppUtils::jidToBareJid(message.from());
+    if (from.isEmpty() || (!accountJid.isEmpty() && from == accountJid))
+        return QXmppUtils::jidToBareJid(message.to());
+    return from;
+}
+
+// Returns the start of a record, either in the mapping or in the tail.
+
+const uchar *QXmppMessageArchivePrivate::recordData(int index) const
+{
+    const qint64 offset = records.at(index).offset;
+    if (offset < mappedSize)
+        return data + offset;
+    return reinterpret_cast<const uchar *>(tail.constData()) + (offset - mappedSize);
+}
+
+// Returns the given field of a record, without copying it.
+
+QByteArray QXmppMessageArchivePrivate::field(int index, RecordField field) const
+{
+    return recordField(recordData(index), field);
+}
+
+// Returns the record of a message without stanza-id which was archived
+// under the same origin-id or id, or -1 if there is none. This catches
+// messages which were added live and are then retrieved from the server
+// archive under the id the server assigned.
+
+int QXmppMessageArchivePrivate::findDuplicate(const QXmppMessage &message, const QString &conversation) const
+{
+    const QString id = messageId(message);
+    if (id.isEmpty())
+        return -1;
+
+    const int index = messageIds.value(messageKey(conversation, id), -1);
+    if (index < 0 || field(index, BodyField) != message.body().toUtf8())
+        return -1;
+    return index;
+}
+
+QXmppMessage QXmppMessageArchivePrivate::decode(int index) const
+{
+    QXmppMessage message;
+    QDomDocument doc;
+    if (doc.setContent(field(index, XmlField), true))
+        message.parse(doc.documentElement());
+    return message;
+}
+
+QList<QXmppMessage> QXmppMessageArchivePrivate::decode(QVector<int>::const_iterator first, QVector<int>::const_iterator last) const
+{
+    QList<QXmppMessage> messages;
+    messages.reserve(int(last - first));
+    for (auto itr = first; itr != last; ++itr)
+        messages << decode(*itr);
+    return messages;
+}
+
+// Returns the records of a conversation, or of the whole archive if jid is
+// empty.
+
+const QVector<int> *QXmppMessageArchivePrivate::indexFor(const QString &jid) const
+{
+    if (jid.isEmpty())
+        return &timeline;
+
+    const auto itr = conversations.constFind(QXmppUtils::jidToBareJid(jid));
+    return itr != conversations.constEnd() ? &itr.value() : nullptr;
+}
+
+// Appends the messages which are not archived yet to the log, followed by a
+// checkpoint for resumeId if it is not empty, and returns the number of
+// added messages or -1 if the file could not be written.
+
+int QXmppMessageArchivePrivate::append(const QList<QXmppMessage> &messages, const QString &resumeId)
+{
+    const qint64 offset = file.size();
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+
+    QByteArray buffer;
+    QVector<Record> added;
+    QSet<QString> addedIds;
+    QSet<QString> addedKeys;
+    QHash<QString, int> aliases;
+    for (const auto &message : messages) {
+        const QString stanzaId = message.stanzaId();
+        const QString conversation = conversationJid(message);
+        const QString id = messageId(message);
+        if (!stanzaId.isEmpty()) {
+            if (stanzaIds.contains(stanzaId) || addedIds.contains(stanzaId))
+                continue;
+
+            addedIds.insert(stanzaId);
+
+            // the message was archived live, remember the stanza-id the
+            // server assigned to it
+            const int duplicate = findDuplicate(message, conversation);
+            if (duplicate >= 0) {
+                QByteArray record;
+                appendField(record, stanzaId.toUtf8());
+                appendField(record, conversation.toUtf8());
+                appendField(record, QByteArray());
+                appendField(record, QByteArray());
+                appendField(record, id.toUtf8());
+                appendRecord(buffer, now, record);
+                aliases.insert(stanzaId, duplicate);
+                continue;
+            }
+        } else if (!id.isEmpty()) {
+            const QString key = messageKey(conversation, id);
+            if (addedKeys.contains(key) || findDuplicate(message, conversation) >= 0)
+                continue;
+            addedKeys.insert(key);
+        }
+
+        // keep the time at which the message was archived
+        QXmppMessage copy = message;
+        if (!copy.stamp().isValid())
+            copy.setStamp(QDateTime::fromMSecsSinceEpoch(now, Qt::UTC));
+
+        QByteArray xml;
+        QXmlStreamWriter writer(&xml);
+        copy.toXml(&writer);
+
+        QByteArray record;
+        appendField(record, stanzaId.toUtf8());
+        appendField(record, conversation.toUtf8());
+        appendField(record, message.body().toUtf8());
+        appendField(record, xml);
+        appendField(record, id.toUtf8());
+
+        const qint64 stamp = copy.stamp().toMSecsSinceEpoch();
+        added << Record { offset + buffer.size(), stamp };
+        appendRecord(buffer, stamp, record);
+    }
+
+    const bool checkpoint = !resumeId.isEmpty() && resumeId != lastStanzaId;
+    if (checkpoint) {
+        QByteArray record;
+        appendField(record, resumeId.toUtf8());
+        for (int i = ConversationField; i < FieldCount; ++i)
+            appendField(record, QByteArray());
+        appendRecord(buffer, now, record);
+    }
+
+    if (buffer.isEmpty())
+        return 0;
+
+    if (!file.seek(offset) || file.write(buffer) != buffer.size() || !file.flush()) {
+        file.resize(offset);
+        return -1;
+    }
+
+    // the records are read from memory until enough data was appended to
+    // make mapping the file again worthwhile, if mapping fails they stay in
+    // memory until the next attempt
+    tail.append(buffer);
+    if (tail.size() > MAXIMUM_TAIL_SIZE)
+        remap();
+
+    for (const auto &record : qAsConst(added)) {
+        records << record;
+        addToIndexes(records.size() - 1);
+    }
+    for (auto itr = aliases.constBegin(); itr != aliases.constEnd(); ++itr)
+        stanzaIds.insert(itr.key(), itr.value());
+    if (checkpoint)
+        lastStanzaId = resumeId;
+    return added.size();
+}
+
+void QXmppMessageArchivePrivate::addToIndexes(int index)
+{
+    const QString stanzaId = QString::fromUtf8(field(index, StanzaIdField));
+    const QString conversation = QString::fromUtf8(field(index, ConversationField));
+    if (!stanzaId.isEmpty()) {
+        stanzaIds.insert(stanzaId, index);
+    } else {
+        const QByteArray id = field(index, MessageIdField);
+        if (!id.isEmpty())
+            messageIds.insert(messageKey(conversation, QString::fromUtf8(id)), index);
+    }
+
+    insertSorted(conversations[conversation], index);
+    insertSorted(timeline, index);
+}
+
+// Inserts a record after all records with the same or an earlier timestamp.
+// Messages mostly arrive in chronological order, so this is usually an append.
+
+void QXmppMessageArchivePrivate::insertSorted(QVector<int> &list, int index)
+{
+    const qint64 stamp = records.at(index).stamp;
+    if (list.isEmpty() || records.at(list.last()).stamp <= stamp) {
+        list.append(index);
+        return;
+    }
+
+    const auto itr = std::upper_bound(list.begin(), list.end(), stamp, [this](qint64 stamp, int other) {
+        return stamp < records.at(other).stamp;
+    });
+    list.insert(itr, index);
+}
+
+// Maps the whole file. If this fails, the previous mapping and the tail are
+// kept so that the records stay readable.
+
+bool QXmppMessageArchivePrivate::remap()
+{
+    const qint64 size = file.size();
+    uchar *mapped = file.map(0, size);
+    if (!mapped)
+        return false;
+
+    if (data)
+        file.unmap(data);
+    data = mapped;
+    mappedSize = size;
+    tail.clear();
+    return true;
+}
+
+// Rebuilds the indexes from the log. A record which was only partially
+// written, for instance because the application crashed, is discarded.
+
+void QXmppMessageArchivePrivate::scan()
+{
+    const qint64 size = file.size();
+    qint64 pos = HEADER_SIZE;
+    while (size - pos >= RECORD_HEADER_SIZE) {
+        const qint64 length = qFromLittleEndian<quint32>(data + pos);
+        if (length < RECORD_HEADER_SIZE - 4 + 4 * FieldCount || size - pos - 4 < length)
+            break;
+
+        // check that the fields fit into the record
+        const uchar *ptr = data + pos + RECORD_HEADER_SIZE;
+        const uchar *end = data + pos + 4 + length;
+        bool valid = true;
+        for (int i = 0; valid && i < FieldCount; ++i) {
+            valid = (end - ptr >= 4) && (end - ptr - 4 >= qint64(qFromLittleEndian<quint32>(ptr)));
+            if (valid)
+                ptr += 4 + qFromLittleEndian<quint32>(ptr);
+        }
+        if (!valid || ptr != end)
+            break;
+
+        if (!recordField(data + pos, XmlField).isEmpty()) {
+            records << Record { pos, qFromLittleEndian<qint64>(data + pos + 4) };
+            addToIndexes(records.size() - 1);
+        } else if (recordField(data + pos, ConversationField).isEmpty()) {
+            // checkpoint
+            lastStanzaId = QString::fromUtf8(recordField(data + pos, StanzaIdField));
+        } else {
+            // alias
+            const QString conversation = QString::fromUtf8(recordField(data + pos, ConversationField));
+            const QString id = QString::fromUtf8(recordField(data + pos, MessageIdField));
+            const int index = messageIds.value(messageKey(conversation, id), -1);
+            if (index >= 0)
+                stanzaIds.insert(QString::fromUtf8(recordField(data + pos, StanzaIdField)), index);
+        }
+        pos += 4 + length;
+    }
+
+    if (pos < size) {
+        qWarning("QXmppMessageArchive discarded %lld bytes of incomplete data", size - pos);
+        file.unmap(data);
+        data = nullptr;
+        file.resize(pos);
+        remap();
+    }
+}
+
+void QXmppMessageArchivePrivate::requestPage(const QString &after)
+{
+    QXmppResultSetQuery resultSetQuery;
+    resultSetQuery.setMax(pageSize);
+    resultSetQuery.setAfter(after);
+    queryId = manager->retrieveArchivedMessages(QString(), QString(), QString(), QDateTime(), QDateTime(), resultSetQuery);
+}
+
+///
+/// Constructs an archive. Call open() to load or create the archive file.
+///
+/// \param parent
+///
+QXmppMessageArchive::QXmppMessageArchive(QObject *parent)
+    : QObject(parent),
+      d(new QXmppMessageArchivePrivate)
+{
+}
+
+QXmppMessageArchive::~QXmppMessageArchive()
+{
+    close();
+    delete d;
+}
+
+///
+/// Opens the archive stored in \a fileName, creating it if needed, and
+/// builds the indexes.
+///
+/// Returns false if the file could not be opened or is not an archive.
+///
+/// \param fileName
+///
+bool QXmppMessageArchive::open(const QString &fileName)
+{
+    close();
+
+    d->file.setFileName(fileName);
+    if (!d->file.open(QIODevice::ReadWrite)) {
+        qWarning("QXmppMessageArchive could not open %s", qPrintable(fileName));
+        return false;
+    }
+
+    if (d->file.size() == 0) {
+        QByteArray header(ARCHIVE_MAGIC, 4);
+        appendInteger(header, ARCHIVE_VERSION);
+        if (d->file.write(header) != header.size() || !d->file.flush()) {
+            qWarning("QXmppMessageArchive could not write to %s", qPrintable(fileName));
+            close();
+            return false;
+        }
+    }
+
+    if (d->file.size() < HEADER_SIZE || !d->remap() ||
+        std::memcmp(d->data, ARCHIVE_MAGIC, 4) != 0 ||
+        qFromLittleEndian<quint32>(d->data + 4) != ARCHIVE_VERSION) {
+        qWarning("QXmppMessageArchive %s is not a valid archive", qPrintable(fileName));
+        close();
+        return false;
+    }
+
+    d->scan();
+    return true;
+}
+
+///
+/// Closes the archive file and aborts a running synchronization.
+///
+void QXmppMessageArchive::close()
+{
+    if (d->data) {
+        d->file.unmap(d->data);
+        d->data = nullptr;
+    }
+    d->file.close();
+    d->mappedSize = 0;
+    d->tail.clear();
+
+    d->records.clear();
+    d->stanzaIds.clear();
+    d->messageIds.clear();
+    d->conversations.clear();
+    d->timeline.clear();
+    d->lastStanzaId.clear();
+    d->queryId.clear();
+    d->page.clear();
+}
+
+///
+/// Returns true if the archive file is open.
+///
+bool QXmppMessageArchive::isOpen() const
+{
+    return d->data != nullptr;
+}
+
+///
+/// Returns the name of the archive file.
+///
+QString QXmppMessageArchive::fileName() const
+{
+    return d->file.fileName();
+}
+
+///
+/// Returns the bare JID of the account the archive belongs to.
+///
+/// It is used to file the messages sent by the account under the conversation
+/// with their recipient.
+///
+QString QXmppMessageArchive::accountJid() const
+{
+    return d->accountJid;
+}
+
+///
+/// Sets the bare JID of the account the archive belongs to.
+///
+/// If it is not set, synchronize() uses the JID of the client.
+///
+/// \param jid
+///
+void QXmppMessageArchive::setAccountJid(const QString &jid)
+{
+    d->accountJid = QXmppUtils::jidToBareJid(jid);
+}
+
+///
+/// Returns the number of messages requested per page when synchronizing.
+///
+int QXmppMessageArchive::pageSize() const
+{
+    return d->pageSize;
+}
+
+///
+/// Sets the number of messages requested per page when synchronizing.
+///
+/// \param pageSize
+///
+void QXmppMessageArchive::setPageSize(int pageSize)
+{
+    d->pageSize = pageSize;
+}
+
+///
+/// Returns the number of archived messages.
+///
+int QXmppMessageArchive::count() const
+{
+    return d->records.size();
+}
+
+///
+/// Returns the id of the last result retrieved from the server archive.
+///
+/// The next synchronization starts after this result. Messages which were
+/// added using addMessage() do not move it.
+///
+QString QXmppMessageArchive::lastStanzaId() const
+{
+    return d->lastStanzaId;
+}
+
+///
+/// Returns the bare JIDs of all conversations in the archive.
+///
+QStringList QXmppMessageArchive::conversations() const
+{
+    QStringList jids = d->conversations.keys();
+    std::sort(jids.begin(), jids.end());
+    return jids;
+}
+
+///
+/// Adds a \a message to the archive, for instance a message which was
+/// received or sent live.
+///
+/// Returns false if the archive already contains a message with the same
+/// stanza-id or if the message could not be written. Messages without a
+/// stanza-id are matched by their origin-id or id and their body instead, so
+/// that they are not archived again when they are retrieved from the server.
+///
+/// \param message
+///
+bool QXmppMessageArchive::addMessage(const QXmppMessage &message)
+{
+    if (!isOpen())
+        return false;
+
+    return d->append(QList<QXmppMessage>() << message) > 0;
+}
+
+///
+/// Returns true if the archive contains a message with the given \a stanzaId.
+///
+/// \param stanzaId
+///
+bool QXmppMessageArchive::contains(const QString &stanzaId) const
+{
+    return d->stanzaIds.contains(stanzaId);
+}
+
+///
+/// Returns the message with the given \a stanzaId, or an empty message if
+/// there is none.
+///
+/// \param stanzaId
+///
+QXmppMessage QXmppMessageArchive::message(const QString &stanzaId) const
+{
+    const auto itr = d->stanzaIds.constFind(stanzaId);
+    if (itr == d->stanzaIds.constEnd())
+        return QXmppMessage();
+    return d->decode(itr.value());
+}
+
+///
+/// Returns the archived messages in chronological order.
+///
+/// \param jid Optional JID of a conversation. Leave this empty to return the
+///            messages of all conversations.
+/// \param start Optional start time to filter the results.
+/// \param end Optional end time to filter the results.
+/// \param max Optional maximum number of messages. If more messages match,
+///            the most recent ones are returned.
+///
+QList<QXmppMessage> QXmppMessageArchive::messages(const QString &jid, const QDateTime &start, const QDateTime &end, int max) const
+{
+    const QVector<int> *index = d->indexFor(jid);
+    if (!index)
+        return QList<QXmppMessage>();
+
+    const auto &records = d->records;
+    auto first = index->constBegin();
+    auto last = index->constEnd();
+    if (start.isValid()) {
+        first = std::lower_bound(first, last, start.toMSecsSinceEpoch(), [&records](int record, qint64 stamp) {
+            return records.at(record).stamp < stamp;
+        });
+    }
+    if (end.isValid()) {
+        last = std::upper_bound(first, last, end.toMSecsSinceEpoch(), [&records](qint64 stamp, int record) {
+            return stamp < records.at(record).stamp;
+        });
+    }
+    if (max >= 0 && last - first > max)
+        first = last - max;
+
+    return d->decode(first, last);
+}
+
+///
+/// Returns the messages whose body contains \a text, in chronological order.
+///
+/// The comparison is case insensitive.
+///
+/// \param text
+/// \param jid Optional JID of a conversation. Leave this empty to search all
+///            conversations.
+/// \param max Optional maximum number of messages. If more messages match,
+///            the most recent ones are returned.
+///
+QList<QXmppMessage> QXmppMessageArchive::search(const QString &text, const QString &jid, int max) const
+{
+    QList<QXmppMessage> messages;
+    const QVector<int> *index = d->indexFor(jid);
+    if (!index)
+        return messages;
+
+    // only the bodies are compared, the matching messages are decoded
+    for (auto itr = index->crbegin(); itr != index->crend(); ++itr) {
+        if (max >= 0 && messages.size() >= max)
+            break;
+        if (QString::fromUtf8(d->field(*itr, BodyField)).contains(text, Qt::CaseInsensitive))
+            messages.prepend(d->decode(*itr));
+    }
+    return messages;
+}
+
+///
+/// Returns true if a synchronization is running.
+///
+bool QXmppMessageArchive::isSynchronizing() const
+{
+    return !d->queryId.isEmpty();
+}
+
+///
+/// Retrieves the messages which were archived by the server after
+/// lastStanzaId(), using the QXmppMamManager of \a client. If the local
+/// archive is empty, the whole server archive is retrieved.
+///
+/// Once all pages have been retrieved, the synchronized() signal is emitted.
+///
+/// Returns false if the archive is not open, a synchronization is already
+/// running or the client has no QXmppMamManager.
+///
+/// \param client
+///
+bool QXmppMessageArchive::synchronize(QXmppClient *client)
+{
+    if (!isOpen() || isSynchronizing())
+        return false;
+
+    auto *manager = client->findExtension<QXmppMamManager>();
+    if (!manager) {
+        qWarning("QXmppMessageArchive requires a QXmppMamManager");
+        return false;
+    }
+
+    if (d->manager != manager) {
+        if (d->manager)
+            d->manager->disconnect(this);
+        d->manager = manager;
+        connect(manager, &QXmppMamManager::archivedMessageReceived,
+                this, &QXmppMessageArchive::_q_archivedMessageReceived);
+        connect(manager, &QXmppMamManager::resultsRecieved,
+                this, &QXmppMessageArchive::_q_resultsReceived);
+    }
+    if (d->client != client) {
+        if (d->client)
+            d->client->disconnect(this);
+        d->client = client;
+        connect(client, &QXmppClient::iqReceived,
+                this, &QXmppMessageArchive::_q_iqReceived);
+    }
+
+    if (d->accountJid.isEmpty())
+        d->accountJid = client->configuration().jidBare();
+
+    d->synchronizedCount = 0;
+    d->requestPage(d->lastStanzaId);
+    return true;
+}
+
+void QXmppMessageArchive::_q_archivedMessageReceived(const QString &queryId, const QXmppMessage &message)
+{
+    if (!queryId.isEmpty() && queryId == d->queryId)
+        d->page << message;
+}
+
+void QXmppMessageArchive::_q_resultsReceived(const QString &queryId, const QXmppResultSetReply &resultSetReply, bool complete)
+{
+    if (queryId.isEmpty() || queryId != d->queryId)
+        return;
+
+    // write each page at once, the resume point only advances once the
+    // page is stored
+    const QString last = resultSetReply.last();
+    d->queryId.clear();
+    const int added = d->append(d->page, last);
+    d->page.clear();
+    if (added < 0) {
+        qWarning("QXmppMessageArchive could not write to %s", qPrintable(d->file.fileName()));
+        emit synchronizationFailed(QXmppStanza::Error(QXmppStanza::Error::Wait, QXmppStanza::Error::ResourceConstraint,
+                                                      QStringLiteral("The archive could not be written")));
+        return;
+    }
+    d->synchronizedCount += added;
+
+    if (complete || last.isEmpty())
+        emit synchronized(d->synchronizedCount);
+    else
+        d->requestPage(last);
+}
+
+void QXmppMessageArchive::_q_iqReceived(const QXmppIq &iq)
+{
+    if (iq.type() != QXmppIq::Error || d->queryId.isEmpty() || iq.id() != d->queryId)
+        return;
+
+    d->queryId.clear();
+    d->page.clear();
+    emit synchronizationFailed(iq.error());
+}
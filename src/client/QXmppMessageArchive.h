@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2008-2020 The QXmpp developers
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPMESSAGEARCHIVE_H
+#define QXMPPMESSAGEARCHIVE_H
+
+#include "QXmppMessage.h"
+#include "QXmppResultSet.h"
+
+#include <QDateTime>
+#include <QObject>
+
+class QXmppClient;
+class QXmppIq;
+class QXmppMessageArchivePrivate;
+
+///
+/// \brief The QXmppMessageArchive class keeps a local copy of the message
+/// archive of an account, which is kept up to date using \xep{0313}: Message
+/// Archive Management.
+///
+/// The messages are stored in an append-only log file which is memory-mapped,
+/// and indexed by conversation, timestamp and stanza-id. History and search
+/// queries are answered locally, only the matching messages are decoded.
+///
+/// synchronize() only requests the messages which were archived after the
+/// last result retrieved from the server, so that the history does not need
+/// to be downloaded again each time the application starts.
+///
+/// \code
+/// auto *archive = new QXmppMessageArchive(this);
+/// archive->open(QStringLiteral("juliet.archive"));
+/// connect(client, &QXmppClient::connected, archive, [=]() {
+///     archive->synchronize(client);
+/// });
+///
+/// const auto history = archive->messages(QStringLiteral("romeo@montague.lit"),
+///                                        QDateTime(), QDateTime(), 50);
+/// \endcode
+///
+/// \since QXmpp 1.4
+///
+class QXMPP_EXPORT QXmppMessageArchive : public QObject
+{
+    Q_OBJECT
+
+public:
+    QXmppMessageArchive(QObject *parent = nullptr);
+    ~QXmppMessageArchive() override;
+
+    bool open(const QString &fileName);
+    void close();
+    bool isOpen() const;
+    QString fileName() const;
+
+    QString accountJid() const;
+    void setAccountJid(const QString &jid);
+
+    int pageSize() const;
+    void setPageSize(int pageSize);
+
+    int count() const;
+    QString lastStanzaId() const;
+    QStringList conversations() const;
+
+    bool addMessage(const QXmppMessage &message);
+    bool contains(const QString &stanzaId) const;
+    QXmppMessage message(const QString &stanzaId) const;
+    QList<QXmppMessage> messages(const QString &jid = QString(),
+                                 const QDateTime &start = QDateTime(),
+                                 const QDateTime &end = QDateTime(),
+                                 int max = -1) const;
+    QList<QXmppMessage> search(const QString &text,
+                               const QString &jid = QString(),
+                               int max = -1) const;
+
+    bool isSynchronizing() const;
+    bool synchronize(QXmppClient *client);
+
+Q_SIGNALS:
+    /// This signal is emitted when a synchronization has completed. \a count
+    /// is the number of messages which were added to the archive.
+    void synchronized(int count);
+
+    /// This signal is emitted when the server returned an error during a
+    /// synchronization.
+    void synchronizationFailed(const QXmppStanza::Error &error);
+
+private Q_SLOTS:
+    void _q_archivedMessageReceived(const QString &queryId, const QXmppMessage &message);
+    void _q_resultsReceived(const QString &queryId, const QXmppResultSetReply &resultSetReply, bool complete);
+    void _q_iqReceived(const QXmppIq &iq);
+
+private:
+    QXmppMessageArchivePrivate *const d;
+};
+
+#endif
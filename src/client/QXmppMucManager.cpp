@@ -551,7 +551,8 @@ void QXmppMucRoom::_q_disconnected()
 
 void QXmppMucRoom::_q_discoveryInfoReceived(const QXmppDiscoveryIq &iq)
 {
-    if (iq.from() == d->jid) {
+    // failed requests tell nothing about the room
+    if (iq.type() == QXmppIq::Result && iq.from() == d->jid) {
         QString name;
         const auto &identities = iq.identities();
         for (const auto &identity : identities) {
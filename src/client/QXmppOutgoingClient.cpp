@@ -24,7 +24,10 @@
 
 #include "QXmppOutgoingClient.h"
 
+#include "QXmppCarbonManager.h"
+#include "QXmppCompression_p.h"
 #include "QXmppConfiguration.h"
+#include "QXmppConnectionRacer_p.h"
 #include "QXmppConstants_p.h"
 #include "QXmppIq.h"
 #include "QXmppLogger.h"
@@ -37,7 +40,6 @@
 #include "QXmppUtils.h"
 
 #include <QCryptographicHash>
-#include <QDnsLookup>
 #include <QNetworkProxy>
 #include <QSslConfiguration>
 #include <QSslSocket>
@@ -57,12 +59,31 @@
 #include <QTimer>
 #include <QXmlStreamWriter>
 
+// Returns true if connections made using the given proxy do not reach the
+// server directly, in which case racing connections is pointless.
+static bool isProxied(const QNetworkProxy &proxy)
+{
+    if (proxy.type() == QNetworkProxy::DefaultProxy) {
+        const auto type = QNetworkProxy::applicationProxy().type();
+        return type != QNetworkProxy::NoProxy && type != QNetworkProxy::DefaultProxy;
+    }
+    return proxy.type() != QNetworkProxy::NoProxy;
+}
+
 class QXmppOutgoingClientPrivate
 {
 public:
     QXmppOutgoingClientPrivate(QXmppOutgoingClient *q);
-    void connectToHost(const QString &host, quint16 port);
+    void connectToHost(const QString &host, quint16 port, bool directTls = false);
+    void connectToDescriptor(qintptr socketDescriptor, const QXmppServiceRecord &record, const QHostAddress &address);
+    void prepareSocket(bool directTls);
     void connectToNextDNSHost();
+    void collectServiceRecords(const QXmppDnsResult &result, bool directTls);
+
+    bool createSaslClient(const QStringList &availableMechanisms);
+    bool carbonsRequested() const;
+    void handleStreamManagementEnabled(const QXmppStreamManagementEnabled &enabled);
+    void handleBoundJid(const QString &jid);
 
     void sendNonSASLAuth(bool plaintext);
     void sendNonSASLAuthQuery();
@@ -76,8 +97,13 @@ public:
     QXmppStanza::Error::Condition xmppStreamError;
 
     // DNS
-    QDnsLookup dns;
+    QString dnsName;
+    QString directTlsDnsName;
+    QString dnsErrorString;
+    int pendingDnsLookups;
+    QList<QXmppServiceRecord> serviceRecords;
     int nextSrvRecordIdx;
+    QXmppConnectionRacer *racer;
 
     // Stream
     QString streamId;
@@ -100,6 +126,14 @@ public:
     QString nonSASLAuthId;
     QXmppSaslClient *saslClient;
 
+    // XEP-0388: Extensible SASL Profile
+    bool isSasl2;
+    bool inlineStreamManagementRequested;
+
+    // XEP-0138: Stream Compression
+    bool compressionFailed;
+    QDomElement compressionFeatures;
+
     // Stream Management
     bool streamManagementAvailable;
     QString smId;
@@ -120,46 +154,198 @@ private:
 };
 
 QXmppOutgoingClientPrivate::QXmppOutgoingClientPrivate(QXmppOutgoingClient *qq)
-    : nextSrvRecordIdx(0), redirectPort(0), bindModeAvailable(false), sessionAvailable(false), sessionStarted(false), isAuthenticated(false), saslClient(nullptr), streamManagementAvailable(false), canResume(false), isResuming(false), resumePort(0), clientStateIndicationEnabled(false), pingTimer(nullptr), timeoutTimer(nullptr), q(qq)
+    : pendingDnsLookups(0), nextSrvRecordIdx(0), racer(nullptr), redirectPort(0), bindModeAvailable(false), sessionAvailable(false), sessionStarted(false), isAuthenticated(false), saslClient(nullptr), isSasl2(false), inlineStreamManagementRequested(false), compressionFailed(false), streamManagementAvailable(false), canResume(false), isResuming(false), resumePort(0), clientStateIndicationEnabled(false), pingTimer(nullptr), timeoutTimer(nullptr), q(qq)
 {
 }
 
-void QXmppOutgoingClientPrivate::connectToHost(const QString &host, quint16 port)
+void QXmppOutgoingClientPrivate::connectToHost(const QString &host, quint16 port, bool directTls)
 {
-    q->info(QString("Connecting to %1:%2").arg(host, QString::number(port)));
+    q->info(QString("Connecting to %1:%2%3").arg(host, QString::number(port), directTls ? QStringLiteral(" (Direct TLS)") : QString()));
 
-    // override CA certificates if requested
-    if (!config.caCertificates().isEmpty()) {
-        QSslConfiguration newSslConfig;
-        newSslConfig.setCaCertificates(config.caCertificates());
-        q->socket()->setSslConfiguration(newSslConfig);
+    prepareSocket(directTls);
+
+    // connect to host
+    const QXmppConfiguration::StreamSecurityMode localSecurity = q->configuration().streamSecurityMode();
+    if (localSecurity == QXmppConfiguration::LegacySSL || directTls) {
+        if (!q->socket()->supportsSsl()) {
+            q->warning("Not connecting as legacy SSL was requested, but SSL support is not available");
+            return;
+        }
+        q->socket()->connectToHostEncrypted(host, port, config.domain());
+    } else {
+        q->socket()->connectToHost(host, port);
     }
+}
 
-    // respect proxy
-    q->socket()->setProxy(config.networkProxy());
+// Takes over a connection established by the connection racer.
 
-    // set the name the SSL certificate should match
-    q->socket()->setPeerVerifyName(config.domain());
+void QXmppOutgoingClientPrivate::connectToDescriptor(qintptr socketDescriptor, const QXmppServiceRecord &record, const QHostAddress &address)
+{
+    q->info(QString("Using connection to %1:%2%3").arg(record.host, QString::number(record.port), record.directTls ? QStringLiteral(" (Direct TLS)") : QString()));
 
-    // connect to host
+    prepareSocket(record.directTls);
+
+    if (!q->socket()->setSocketDescriptor(socketDescriptor)) {
+        q->warning(QStringLiteral("Could not take over connection: ") + q->socket()->errorString());
+        connectToHost(address.toString(), record.port, record.directTls);
+        return;
+    }
+
+    // setting the descriptor does not emit connected()
     const QXmppConfiguration::StreamSecurityMode localSecurity = q->configuration().streamSecurityMode();
-    if (localSecurity == QXmppConfiguration::LegacySSL) {
+    if (localSecurity == QXmppConfiguration::LegacySSL || record.directTls) {
         if (!q->socket()->supportsSsl()) {
             q->warning("Not connecting as legacy SSL was requested, but SSL support is not available");
+            q->socket()->abort();
             return;
         }
-        q->socket()->connectToHostEncrypted(host, port);
+        q->socket()->startClientEncryption();
     } else {
-        q->socket()->connectToHost(host, port);
+        QMetaObject::invokeMethod(q, "_q_socketConnected");
     }
 }
 
+// Configures the socket for a new connection.
+
+void QXmppOutgoingClientPrivate::prepareSocket(bool directTls)
+{
+    // override CA certificates if requested
+    QSslConfiguration newSslConfig = q->socket()->sslConfiguration();
+    if (!config.caCertificates().isEmpty())
+        newSslConfig.setCaCertificates(config.caCertificates());
+
+    // XEP-0368: the ALPN protocol must be set for Direct TLS connections
+    if (directTls)
+        newSslConfig.setAllowedNextProtocols({ QByteArrayLiteral("xmpp-client") });
+    else
+        newSslConfig.setAllowedNextProtocols({});
+    q->socket()->setSslConfiguration(newSslConfig);
+
+    // respect proxy
+    q->socket()->setProxy(config.networkProxy());
+
+    // set the name the SSL certificate should match
+    q->socket()->setPeerVerifyName(config.domain());
+}
+
 void QXmppOutgoingClientPrivate::connectToNextDNSHost()
 {
-    auto curIdx = nextSrvRecordIdx++;
-    connectToHost(
-        dns.serviceRecords().at(curIdx).target(),
-        dns.serviceRecords().at(curIdx).port());
+    const auto &record = serviceRecords.at(nextSrvRecordIdx++);
+    connectToHost(record.host, record.port, record.directTls);
+}
+
+void QXmppOutgoingClientPrivate::collectServiceRecords(const QXmppDnsResult &result, bool directTls)
+{
+    if (result.error != QDnsLookup::NoError) {
+        if (!directTls)
+            dnsErrorString = result.errorString;
+        return;
+    }
+
+    for (auto record : result.serviceRecords) {
+        // a target of "." means the service is decidedly not available
+        if (record.host.isEmpty() || record.host == QStringLiteral("."))
+            continue;
+
+        record.directTls = directTls;
+        serviceRecords << record;
+    }
+}
+
+bool QXmppOutgoingClientPrivate::createSaslClient(const QStringList &availableMechanisms)
+{
+    // supported and preferred SASL auth mechanisms
+    const QString preferredMechanism = config.saslAuthMechanism();
+    QStringList supportedMechanisms = QXmppSaslClient::availableMechanisms();
+    if (supportedMechanisms.contains(preferredMechanism)) {
+        supportedMechanisms.removeAll(preferredMechanism);
+        supportedMechanisms.prepend(preferredMechanism);
+    }
+    if (config.facebookAppId().isEmpty() || config.facebookAccessToken().isEmpty())
+        supportedMechanisms.removeAll("X-FACEBOOK-PLATFORM");
+    if (config.windowsLiveAccessToken().isEmpty())
+        supportedMechanisms.removeAll("X-MESSENGER-OAUTH2");
+    if (config.googleAccessToken().isEmpty())
+        supportedMechanisms.removeAll("X-OAUTH2");
+
+    // determine SASL Authentication mechanism to use
+    QStringList commonMechanisms;
+    for (const auto &mechanism : qAsConst(supportedMechanisms)) {
+        if (availableMechanisms.contains(mechanism))
+            commonMechanisms << mechanism;
+    }
+    if (commonMechanisms.isEmpty()) {
+        q->warning("No supported SASL Authentication mechanism available");
+        q->disconnectFromHost();
+        return false;
+    }
+
+    saslClient = QXmppSaslClient::create(commonMechanisms.first(), q);
+    if (!saslClient) {
+        q->warning("SASL mechanism negotiation failed");
+        q->disconnectFromHost();
+        return false;
+    }
+    q->info(QString("SASL mechanism '%1' selected").arg(saslClient->mechanism()));
+    saslClient->setHost(config.domain());
+    saslClient->setServiceType("xmpp");
+    if (saslClient->mechanism() == "X-FACEBOOK-PLATFORM") {
+        saslClient->setUsername(config.facebookAppId());
+        saslClient->setPassword(config.facebookAccessToken());
+    } else if (saslClient->mechanism() == "X-MESSENGER-OAUTH2") {
+        saslClient->setPassword(config.windowsLiveAccessToken());
+    } else if (saslClient->mechanism() == "X-OAUTH2") {
+        saslClient->setUsername(config.user());
+        saslClient->setPassword(config.googleAccessToken());
+    } else {
+        saslClient->setUsername(config.user());
+        saslClient->setPassword(config.password());
+    }
+    return true;
+}
+
+bool QXmppOutgoingClientPrivate::carbonsRequested() const
+{
+    // message carbons are enabled inline if the application asked for them
+    auto *client = qobject_cast<QXmppClient *>(q->parent());
+    if (!client)
+        return false;
+    auto *carbonManager = client->findExtension<QXmppCarbonManager>();
+    return carbonManager && carbonManager->carbonsEnabled();
+}
+
+void QXmppOutgoingClientPrivate::handleStreamManagementEnabled(const QXmppStreamManagementEnabled &enabled)
+{
+    smId = enabled.id();
+    canResume = enabled.resume();
+    if (enabled.resume() && !enabled.location().isEmpty()) {
+        QRegExp locationRegex("([^:]+)(:[0-9]+)?");
+        if (locationRegex.exactMatch(enabled.location())) {
+            resumeHost = locationRegex.cap(0);
+            if (!locationRegex.cap(2).isEmpty())
+                resumePort = locationRegex.cap(2).mid(1).toUShort();
+            else
+                resumePort = 5222;
+        } else {
+            resumeHost = QString();
+            resumePort = 0;
+        }
+    }
+}
+
+void QXmppOutgoingClientPrivate::handleBoundJid(const QString &jid)
+{
+    if (jid.isEmpty())
+        return;
+
+    QRegExp jidRegex("^([^@/]+)@([^@/]+)/(.+)$");
+    if (jidRegex.exactMatch(jid)) {
+        config.setUser(jidRegex.cap(1));
+        config.setDomain(jidRegex.cap(2));
+        config.setResource(jidRegex.cap(3));
+    } else {
+        q->warning("Bind IQ received with invalid JID: " + jid);
+    }
 }
 
 /// Constructs an outgoing client stream.
@@ -179,7 +365,36 @@ QXmppOutgoingClient::QXmppOutgoingClient(QObject *parent)
     connect(socket, QOverload<QAbstractSocket::SocketError>::of(&QSslSocket::error), this, &QXmppOutgoingClient::socketError);
 
     // DNS lookups
-    connect(&d->dns, &QDnsLookup::finished, this, &QXmppOutgoingClient::_q_dnsLookupFinished);
+    connect(QXmppDnsCache::instance(), &QXmppDnsCache::finished, this, [this](const QString &name, QDnsLookup::Type type, const QXmppDnsResult &result) {
+        if (type != QDnsLookup::SRV || d->pendingDnsLookups <= 0)
+            return;
+
+        if (!d->dnsName.isEmpty() && name == d->dnsName) {
+            d->dnsName.clear();
+            d->collectServiceRecords(result, false);
+        } else if (!d->directTlsDnsName.isEmpty() && name == d->directTlsDnsName) {
+            d->directTlsDnsName.clear();
+            d->collectServiceRecords(result, true);
+        } else {
+            return;
+        }
+        _q_dnsLookupFinished();
+    });
+
+    // connection racing
+    d->racer = new QXmppConnectionRacer(this);
+    connect(d->racer, &QXmppConnectionRacer::finished, this, [this](const QXmppServiceRecord &record, const QHostAddress &address, qintptr socketDescriptor) {
+        // the address is known to be reachable, do not fall back to others
+        d->nextSrvRecordIdx = d->serviceRecords.size();
+        if (socketDescriptor >= 0)
+            d->connectToDescriptor(socketDescriptor, record, address);
+        else
+            d->connectToHost(address.toString(), record.port, record.directTls);
+    });
+    connect(d->racer, &QXmppConnectionRacer::failed, this, [this]() {
+        // the racer already tried every address
+        emit error(QXmppClient::SocketError);
+    });
 
     // XEP-0199: XMPP Ping
     d->pingTimer = new QTimer(this);
@@ -226,10 +441,23 @@ void QXmppOutgoingClient::connectToHost()
     // otherwise, lookup server
     const QString domain = configuration().domain();
     debug(QString("Looking up server for domain %1").arg(domain));
-    d->dns.setName("_xmpp-client._tcp." + domain);
-    d->dns.setType(QDnsLookup::SRV);
-    d->dns.lookup();
+    d->racer->abort();
+    d->serviceRecords.clear();
     d->nextSrvRecordIdx = 0;
+    d->dnsErrorString.clear();
+    d->directTlsDnsName.clear();
+    d->pendingDnsLookups = 1;
+    d->dnsName = QString("_xmpp-client._tcp." + domain).toLower();
+    QXmppDnsCache::instance()->lookup(d->dnsName, QDnsLookup::SRV);
+
+    // XEP-0368: SRV records for XMPP over TLS
+    if (d->config.streamSecurityMode() != QXmppConfiguration::TLSDisabled &&
+        d->config.streamSecurityMode() != QXmppConfiguration::LegacySSL &&
+        QSslSocket::supportsSsl()) {
+        d->pendingDnsLookups++;
+        d->directTlsDnsName = QString("_xmpps-client._tcp." + domain).toLower();
+        QXmppDnsCache::instance()->lookup(d->directTlsDnsName, QDnsLookup::SRV);
+    }
 }
 
 ///
@@ -240,20 +468,31 @@ void QXmppOutgoingClient::connectToHost()
 void QXmppOutgoingClient::disconnectFromHost()
 {
     d->canResume = false;
+    d->racer->abort();
     QXmppStream::disconnectFromHost();
 }
 
 void QXmppOutgoingClient::_q_dnsLookupFinished()
 {
-    if (d->dns.error() == QDnsLookup::NoError &&
-        !d->dns.serviceRecords().isEmpty()) {
-        // take the first returned record
-        d->connectToNextDNSHost();
-    } else {
+    // wait for both the STARTTLS and the Direct TLS lookups
+    if (--d->pendingDnsLookups > 0)
+        return;
+
+    d->serviceRecords = QXmppConnectionRacer::sortServiceRecords(d->serviceRecords);
+
+    if (d->serviceRecords.isEmpty()) {
         // as a fallback, use domain as the host name
         warning(QString("Lookup for domain %1 failed: %2")
-                    .arg(d->dns.name(), d->dns.errorString()));
-        d->connectToHost(d->config.domain(), d->config.port());
+                    .arg(d->config.domain(), d->dnsErrorString));
+        d->serviceRecords << QXmppServiceRecord { d->config.domain(), quint16(d->config.port()), 0, 0, false };
+    }
+
+    if (isProxied(d->config.networkProxy())) {
+        // the proxy resolves and connects, try the hosts one after the other
+        d->connectToNextDNSHost();
+    } else {
+        // race connections to all hosts, RFC 8305 "Happy Eyeballs"
+        d->racer->start(d->serviceRecords);
     }
 }
 
@@ -285,6 +524,7 @@ void QXmppOutgoingClient::_q_socketDisconnected()
 {
     debug("Socket disconnected");
     d->isAuthenticated = false;
+    d->compressionFailed = false;
     if (!d->redirectHost.isEmpty() && d->redirectPort > 0) {
         d->connectToHost(d->redirectHost, d->redirectPort);
         d->redirectHost = QString();
@@ -313,7 +553,7 @@ void QXmppOutgoingClient::socketError(QAbstractSocket::SocketError socketError)
 {
     Q_UNUSED(socketError);
     if (!d->sessionStarted &&
-        (d->dns.serviceRecords().count() > d->nextSrvRecordIdx)) {
+        (d->serviceRecords.count() > d->nextSrvRecordIdx)) {
         // some network error occurred during startup -> try next available SRV record server
         d->connectToNextDNSHost();
     } else
@@ -335,6 +575,7 @@ void QXmppOutgoingClient::handleStart()
         delete d->saslClient;
         d->saslClient = nullptr;
     }
+    d->isSasl2 = false;
 
     // reset session information
     d->bindId.clear();
@@ -389,58 +630,57 @@ void QXmppOutgoingClient::handleStanza(const QDomElement &nodeRecv)
         // handle authentication
         const bool nonSaslAvailable = features.nonSaslAuthMode() != QXmppStreamFeatures::Disabled;
         const bool saslAvailable = !features.authMechanisms().isEmpty();
-        if (saslAvailable && configuration().useSASLAuthentication()) {
-            // supported and preferred SASL auth mechanisms
-            const QString preferredMechanism = configuration().saslAuthMechanism();
-            QStringList supportedMechanisms = QXmppSaslClient::availableMechanisms();
-            if (supportedMechanisms.contains(preferredMechanism)) {
-                supportedMechanisms.removeAll(preferredMechanism);
-                supportedMechanisms.prepend(preferredMechanism);
-            }
-            if (configuration().facebookAppId().isEmpty() || configuration().facebookAccessToken().isEmpty())
-                supportedMechanisms.removeAll("X-FACEBOOK-PLATFORM");
-            if (configuration().windowsLiveAccessToken().isEmpty())
-                supportedMechanisms.removeAll("X-MESSENGER-OAUTH2");
-            if (configuration().googleAccessToken().isEmpty())
-                supportedMechanisms.removeAll("X-OAUTH2");
-
-            // determine SASL Authentication mechanism to use
-            QStringList commonMechanisms;
-            QString usedMechanism;
-            for (const auto &mechanism : qAsConst(supportedMechanisms)) {
-                if (features.authMechanisms().contains(mechanism))
-                    commonMechanisms << mechanism;
-            }
-            if (commonMechanisms.isEmpty()) {
-                warning("No supported SASL Authentication mechanism available");
-                disconnectFromHost();
+        const bool sasl2Available = !features.sasl2Mechanisms().isEmpty();
+        if (sasl2Available && !d->isAuthenticated &&
+            configuration().useSASLAuthentication() &&
+            configuration().useSASL2Authentication()) {
+            // XEP-0388: Extensible SASL Profile
+            if (!d->createSaslClient(features.sasl2Mechanisms()))
                 return;
-            } else {
-                usedMechanism = commonMechanisms.first();
-            }
 
-            d->saslClient = QXmppSaslClient::create(usedMechanism, this);
-            if (!d->saslClient) {
-                warning("SASL mechanism negotiation failed");
+            QByteArray response;
+            if (!d->saslClient->respond(QByteArray(), response)) {
+                warning("SASL initial response failed");
                 disconnectFromHost();
                 return;
             }
-            info(QString("SASL mechanism '%1' selected").arg(d->saslClient->mechanism()));
-            d->saslClient->setHost(d->config.domain());
-            d->saslClient->setServiceType("xmpp");
-            if (d->saslClient->mechanism() == "X-FACEBOOK-PLATFORM") {
-                d->saslClient->setUsername(configuration().facebookAppId());
-                d->saslClient->setPassword(configuration().facebookAccessToken());
-            } else if (d->saslClient->mechanism() == "X-MESSENGER-OAUTH2") {
-                d->saslClient->setPassword(configuration().windowsLiveAccessToken());
-            } else if (d->saslClient->mechanism() == "X-OAUTH2") {
-                d->saslClient->setUsername(configuration().user());
-                d->saslClient->setPassword(configuration().googleAccessToken());
-            } else {
-                d->saslClient->setUsername(configuration().user());
-                d->saslClient->setPassword(configuration().password());
+
+            QXmppSasl2Authenticate authenticate(d->saslClient->mechanism(), response);
+
+            // resume the previous stream if possible
+            d->streamManagementAvailable = features.sasl2StreamManagementAvailable();
+            if (d->streamManagementAvailable && d->canResume) {
+                d->isResuming = true;
+                authenticate.setResume(QXmppStreamManagementResume(lastIncomingSequenceNumber(), d->smId));
+            }
+
+            // XEP-0386: Bind 2, the server will only bind a resource if
+            // the stream could not be resumed
+            // as SASL 2 does not restart the stream, binding is postponed
+            // if stream compression is to be negotiated
+            const bool compressionRequested = configuration().streamCompressionEnabled() && QXmppStreamCompressor::isSupported();
+            d->inlineStreamManagementRequested = false;
+            if (features.bind2Available() && !compressionRequested) {
+                QStringList inlineFeatures;
+                if (features.bind2Features().contains(ns_stream_management)) {
+                    inlineFeatures << ns_stream_management;
+                    d->inlineStreamManagementRequested = true;
+                }
+                if (features.bind2Features().contains(ns_carbons) && d->carbonsRequested())
+                    inlineFeatures << ns_carbons;
+
+                authenticate.setBindRequested(true);
+                authenticate.setBindTag(configuration().resource());
+                authenticate.setBindFeatures(inlineFeatures);
             }
 
+            d->isSasl2 = true;
+            sendPacket(authenticate);
+            return;
+        } else if (saslAvailable && configuration().useSASLAuthentication()) {
+            if (!d->createSaslClient(features.authMechanisms()))
+                return;
+
             // send SASL auth request
             QByteArray response;
             if (!d->saslClient->respond(QByteArray(), response)) {
@@ -455,6 +695,18 @@ void QXmppOutgoingClient::handleStanza(const QDomElement &nodeRecv)
             return;
         }
 
+        // XEP-0138: Stream Compression
+        if (d->isAuthenticated && !isCompressionEnabled() && !d->compressionFailed &&
+            configuration().streamCompressionEnabled() &&
+            QXmppStreamCompressor::isSupported() &&
+            features.compressionMethods().contains(QStringLiteral("zlib"))) {
+            d->compressionFeatures = nodeRecv;
+            QXmppCompressPacket compress;
+            compress.setMethod(QStringLiteral("zlib"));
+            sendPacket(compress);
+            return;
+        }
+
         // store which features are available
         d->sessionAvailable = (features.sessionMode() != QXmppStreamFeatures::Disabled);
         d->bindModeAvailable = (features.bindMode() != QXmppStreamFeatures::Disabled);
@@ -486,6 +738,25 @@ void QXmppOutgoingClient::handleStanza(const QDomElement &nodeRecv)
         // otherwise we are done
         d->sessionStarted = true;
         emit connected();
+    } else if (QXmppCompressPacket::isCompressPacket(nodeRecv)) {
+        QXmppCompressPacket packet;
+        packet.parse(nodeRecv);
+
+        if (packet.type() == QXmppCompressPacket::Compressed) {
+            // the server expects a new, compressed stream
+            if (startCompression(configuration().streamCompressionLevel()))
+                handleStart();
+            else
+                disconnectFromHost();
+        } else if (packet.type() == QXmppCompressPacket::Failure) {
+            warning(QString("Stream compression failed: %1").arg(packet.condition()));
+
+            // carry on with the features offered before
+            d->compressionFailed = true;
+            const QDomElement features = d->compressionFeatures;
+            d->compressionFeatures = QDomElement();
+            handleStanza(features);
+        }
     } else if (ns == ns_stream && nodeRecv.tagName() == "error") {
         // handle redirects
         QRegExp redirectRegex("([^:]+)(:[0-9]+)?");
@@ -542,6 +813,83 @@ void QXmppOutgoingClient::handleStanza(const QDomElement &nodeRecv)
             warning("Authentication failure");
             disconnectFromHost();
         }
+    } else if (ns == ns_sasl_2) {
+        if (!d->saslClient || !d->isSasl2) {
+            warning("SASL 2 stanza received, but no mechanism selected");
+            return;
+        }
+        if (nodeRecv.tagName() == "success") {
+            QXmppSasl2Success success;
+            success.parse(nodeRecv);
+
+            debug("Authenticated");
+            d->isAuthenticated = true;
+
+            // there is no stream restart with SASL 2
+            if (success.isResumed()) {
+                setAcknowledgedSequenceNumber(success.resumed().h());
+                d->isResuming = false;
+                d->sessionStarted = true;
+
+                enableStreamManagement(false);
+                emit connected();
+                return;
+            }
+
+            // the server may not answer the resumption at all
+            if (d->isResuming) {
+                warning("The previous stream could not be resumed");
+                d->isResuming = false;
+                d->canResume = false;
+            }
+
+            if (success.isBound()) {
+                d->handleBoundJid(success.authorizationIdentifier());
+                d->sessionStarted = true;
+
+                if (success.isStreamManagementEnabled()) {
+                    // unacknowledged stanzas are sent again
+                    d->handleStreamManagementEnabled(success.streamManagementEnabled());
+                    enableStreamManagement(true);
+                } else if (d->inlineStreamManagementRequested) {
+                    // the server offered stream management inline but did
+                    // not enable it, ask again once bound
+                    d->sendStreamManagementEnable();
+                    return;
+                } else {
+                    d->canResume = false;
+                }
+                emit connected();
+            } else {
+                // the resource is bound after the server sent new stream
+                // features
+                d->isResuming = false;
+                d->canResume = false;
+            }
+        } else if (nodeRecv.tagName() == "challenge") {
+            QXmppSasl2Challenge challenge;
+            challenge.parse(nodeRecv);
+
+            QByteArray response;
+            if (d->saslClient->respond(challenge.value(), response)) {
+                sendPacket(QXmppSasl2Response(response));
+            } else {
+                warning("Could not respond to SASL challenge");
+                disconnectFromHost();
+            }
+        } else if (nodeRecv.tagName() == "failure") {
+            QXmppSasl2Failure failure;
+            failure.parse(nodeRecv);
+
+            if (failure.condition() == "not-authorized" || failure.condition() == "bad-auth")
+                d->xmppStreamError = QXmppStanza::Error::NotAuthorized;
+            else
+                d->xmppStreamError = QXmppStanza::Error::UndefinedCondition;
+            emit error(QXmppClient::XmppStreamError);
+
+            warning("Authentication failure" + (failure.text().isEmpty() ? QString() : QStringLiteral(": ") + failure.text()));
+            disconnectFromHost();
+        }
     } else if (ns == ns_client) {
 
         if (nodeRecv.tagName() == "iq") {
@@ -568,16 +916,7 @@ void QXmppOutgoingClient::handleStanza(const QDomElement &nodeRecv)
 
                 // bind result
                 if (bind.type() == QXmppIq::Result) {
-                    if (!bind.jid().isEmpty()) {
-                        QRegExp jidRegex("^([^@/]+)@([^@/]+)/(.+)$");
-                        if (jidRegex.exactMatch(bind.jid())) {
-                            configuration().setUser(jidRegex.cap(1));
-                            configuration().setDomain(jidRegex.cap(2));
-                            configuration().setResource(jidRegex.cap(3));
-                        } else {
-                            warning("Bind IQ received with invalid JID: " + bind.jid());
-                        }
-                    }
+                    d->handleBoundJid(bind.jid());
 
                     if (d->sessionAvailable) {
                         d->sendSessionStart();
@@ -671,21 +1010,7 @@ void QXmppOutgoingClient::handleStanza(const QDomElement &nodeRecv)
     } else if (QXmppStreamManagementEnabled::isStreamManagementEnabled(nodeRecv)) {
         QXmppStreamManagementEnabled streamManagementEnabled;
         streamManagementEnabled.parse(nodeRecv);
-        d->smId = streamManagementEnabled.id();
-        d->canResume = streamManagementEnabled.resume();
-        if (streamManagementEnabled.resume() && !streamManagementEnabled.location().isEmpty()) {
-            QRegExp locationRegex("([^:]+)(:[0-9]+)?");
-            if (locationRegex.exactMatch(streamManagementEnabled.location())) {
-                d->resumeHost = locationRegex.cap(0);
-                if (!locationRegex.cap(2).isEmpty())
-                    d->resumePort = locationRegex.cap(2).mid(1).toUShort();
-                else
-                    d->resumePort = 5222;
-            } else {
-                d->resumeHost = QString();
-                d->resumePort = 0;
-            }
-        }
+        d->handleStreamManagementEnabled(streamManagementEnabled);
 
         enableStreamManagement(true);
         // we are connected now
@@ -25,11 +25,49 @@
 #include "QXmppRosterManager.h"
 
 #include "QXmppClient.h"
+#include "QXmppConstants_p.h"
 #include "QXmppPresence.h"
 #include "QXmppRosterIq.h"
+#include "QXmppRosterStore.h"
+#include "QXmppStreamFeatures.h"
 #include "QXmppUtils.h"
 
 #include <QDomElement>
+#include <QTimer>
+#include <QVector>
+
+// Returns true if the parts of two presences which are relevant to the
+// roster are identical. The id and the addressing are not compared.
+static bool isSamePresence(const QXmppPresence &a, const QXmppPresence &b)
+{
+    // unknown extensions cannot be compared cheaply, assume they changed
+    if (!a.extensions().isEmpty() || !b.extensions().isEmpty())
+        return false;
+
+    const QXmppMucItem aItem = a.mucItem();
+    const QXmppMucItem bItem = b.mucItem();
+    return a.type() == b.type() &&
+        a.availableStatusType() == b.availableStatusType() &&
+        a.priority() == b.priority() &&
+        a.statusText() == b.statusText() &&
+        a.photoHash() == b.photoHash() &&
+        a.vCardUpdateType() == b.vCardUpdateType() &&
+        a.capabilityHash() == b.capabilityHash() &&
+        a.capabilityNode() == b.capabilityNode() &&
+        a.capabilityVer() == b.capabilityVer() &&
+        a.capabilityExt() == b.capabilityExt() &&
+        a.lastUserInteraction() == b.lastUserInteraction() &&
+        a.isMucSupported() == b.isMucSupported() &&
+        a.mucStatusCodes() == b.mucStatusCodes() &&
+        aItem.jid() == bItem.jid() &&
+        aItem.nick() == bItem.nick() &&
+        aItem.role() == bItem.role() &&
+        aItem.affiliation() == bItem.affiliation() &&
+        aItem.actor() == bItem.actor() &&
+        aItem.reason() == bItem.reason() &&
+        a.mixUserJid() == b.mixUserJid() &&
+        a.mixUserNick() == b.mixUserNick();
+}
 
 class QXmppRosterManagerPrivate
 {
@@ -39,8 +77,22 @@ public:
     // map of bareJid and its rosterEntry
     QMap<QString, QXmppRosterIq::Item> entries;
 
-    // map of resources of the jid and map of resources and presences
-    QMap<QString, QMap<QString, QXmppPresence>> presences;
+    // presence of a single resource, the presence shares its data with the
+    // received stanza
+    struct ResourcePresence
+    {
+        QString resource;
+        QXmppPresence presence;
+    };
+
+    // map of bareJid and the presences of its resources, most contacts have
+    // a single resource so a vector is smaller and faster than a hash
+    QHash<QString, QVector<ResourcePresence>> presences;
+
+    // presence changes which were not reported yet
+    QHash<QString, QSet<QString>> pendingPresences;
+    QTimer *presenceBatchTimer;
+    int presenceBatchInterval;
 
     // flag to store that the roster has been populated
     bool isRosterReceived;
@@ -48,16 +100,62 @@ public:
     // id of the initial roster request
     QString rosterReqId;
 
+    // XEP-0237: Roster Versioning
+    bool versioningSupported;
+    QString version;
+    QXmppRosterStore *store;
+
+    void setRoster(const QString &version, const QList<QXmppRosterIq::Item> &items);
+    void notifyPresenceChanged(const QString &bareJid, const QString &resource);
+
+    static int indexOfResource(const QVector<ResourcePresence> &resources, const QString &resource);
+
 private:
     QXmppRosterManager *q;
 };
 
 QXmppRosterManagerPrivate::QXmppRosterManagerPrivate(QXmppRosterManager *qq)
-    : isRosterReceived(false),
+    : presenceBatchTimer(nullptr),
+      presenceBatchInterval(-1),
+      isRosterReceived(false),
+      versioningSupported(false),
+      store(nullptr),
       q(qq)
 {
 }
 
+void QXmppRosterManagerPrivate::setRoster(const QString &newVersion, const QList<QXmppRosterIq::Item> &items)
+{
+    version = newVersion;
+    entries.clear();
+    for (const auto &item : items)
+        entries.insert(item.bareJid(), item);
+
+    if (store)
+        store->setRoster(version, items);
+}
+
+void QXmppRosterManagerPrivate::notifyPresenceChanged(const QString &bareJid, const QString &resource)
+{
+    if (presenceBatchInterval < 0) {
+        emit q->presenceChanged(bareJid, resource);
+        return;
+    }
+
+    pendingPresences[bareJid].insert(resource);
+    if (!presenceBatchTimer->isActive())
+        presenceBatchTimer->start(presenceBatchInterval);
+}
+
+int QXmppRosterManagerPrivate::indexOfResource(const QVector<ResourcePresence> &resources, const QString &resource)
+{
+    for (int i = 0; i < resources.size(); ++i) {
+        if (resources.at(i).resource == resource)
+            return i;
+    }
+    return -1;
+}
+
 /// Constructs a roster manager.
 
 QXmppRosterManager::QXmppRosterManager(QXmppClient *client)
@@ -65,6 +163,11 @@ QXmppRosterManager::QXmppRosterManager(QXmppClient *client)
 
     d = new QXmppRosterManagerPrivate(this);
 
+    d->presenceBatchTimer = new QTimer(this);
+    d->presenceBatchTimer->setSingleShot(true);
+    connect(d->presenceBatchTimer, &QTimer::timeout,
+            this, &QXmppRosterManager::_q_emitPresenceBatch);
+
     connect(client, &QXmppClient::connected,
             this, &QXmppRosterManager::_q_connected);
 
@@ -109,6 +212,11 @@ void QXmppRosterManager::_q_connected()
     QXmppRosterIq roster;
     roster.setType(QXmppIq::Get);
     roster.setFrom(client()->configuration().jid());
+
+    // XEP-0237: Roster Versioning, only request the changes since the
+    // version we have
+    if (d->versioningSupported)
+        roster.setVersion(d->version.isEmpty() ? QStringLiteral("") : d->version);
     d->rosterReqId = roster.id();
     if (client()->isAuthenticated())
         client()->sendPacket(roster);
@@ -116,17 +224,51 @@ void QXmppRosterManager::_q_connected()
 
 void QXmppRosterManager::_q_disconnected()
 {
-    d->entries.clear();
+    // a versioned roster is kept, so that only the changes need to be
+    // requested when reconnecting
+    if (d->version.isEmpty())
+        d->entries.clear();
     d->presences.clear();
+    d->pendingPresences.clear();
+    d->presenceBatchTimer->stop();
     d->isRosterReceived = false;
+    d->versioningSupported = false;
 }
 
 /// \cond
 bool QXmppRosterManager::handleStanza(const QDomElement &element)
 {
-    if (element.tagName() != "iq" || !QXmppRosterIq::isRosterIq(element))
+    // the stream features tell whether the roster can be versioned
+    //
+    // with SASL 2 and Bind 2 the stream is not restarted, so the features
+    // sent before authentication are the only ones: the server advertises
+    // versioning there or as an inline feature of Bind 2
+    if (QXmppStreamFeatures::isStreamFeatures(element)) {
+        QXmppStreamFeatures features;
+        features.parse(element);
+        if (features.rosterVersioningSupported() ||
+            features.bind2Features().contains(ns_rosterver))
+            d->versioningSupported = true;
+        return false;
+    }
+
+    if (element.tagName() != "iq")
         return false;
 
+    // XEP-0237: Roster Versioning, an empty result means that the roster
+    // did not change since the requested version
+    if (!QXmppRosterIq::isRosterIq(element)) {
+        if (d->rosterReqId.isEmpty() ||
+            element.attribute(QStringLiteral("id")) != d->rosterReqId ||
+            element.attribute(QStringLiteral("type")) != QLatin1String("result"))
+            return false;
+
+        d->rosterReqId.clear();
+        d->isRosterReceived = true;
+        emit rosterReceived();
+        return true;
+    }
+
     // Security check: only server should send this iq
     // from() should be either empty or bareJid of the user
     const QString fromJid = element.attribute("from");
@@ -145,10 +287,15 @@ bool QXmppRosterManager::handleStanza(const QDomElement &element)
         client()->sendPacket(returnIq);
 
         // store updated entries and notify changes
+        if (!rosterIq.version().isEmpty())
+            d->version = rosterIq.version();
+
         const QList<QXmppRosterIq::Item> items = rosterIq.items();
         for (const auto &item : items) {
             const QString bareJid = item.bareJid();
             if (item.subscriptionType() == QXmppRosterIq::Item::Remove) {
+                if (d->store)
+                    d->store->removeItem(d->version, bareJid);
                 if (d->entries.remove(bareJid)) {
                     // notify the user that the item was removed
                     emit itemRemoved(bareJid);
@@ -156,6 +303,8 @@ bool QXmppRosterManager::handleStanza(const QDomElement &element)
             } else {
                 const bool added = !d->entries.contains(bareJid);
                 d->entries.insert(bareJid, item);
+                if (d->store)
+                    d->store->updateItem(d->version, item);
                 if (added) {
                     // notify the user that the item was added
                     emit itemAdded(bareJid);
@@ -167,14 +316,18 @@ bool QXmppRosterManager::handleStanza(const QDomElement &element)
         }
     } break;
     case QXmppIq::Result: {
-        const QList<QXmppRosterIq::Item> items = rosterIq.items();
-        for (const auto &item : items) {
-            const QString bareJid = item.bareJid();
-            d->entries.insert(bareJid, item);
-        }
         if (isInitial) {
+            // the result holds the whole roster
+            d->rosterReqId.clear();
+            d->setRoster(rosterIq.version(), rosterIq.items());
             d->isRosterReceived = true;
             emit rosterReceived();
+        } else {
+            const QList<QXmppRosterIq::Item> items = rosterIq.items();
+            for (const auto &item : items) {
+                const QString bareJid = item.bareJid();
+                d->entries.insert(bareJid, item);
+            }
         }
         break;
     }
@@ -196,14 +349,31 @@ void QXmppRosterManager::_q_presenceReceived(const QXmppPresence &presence)
         return;
 
     switch (presence.type()) {
-    case QXmppPresence::Available:
-        d->presences[bareJid][resource] = presence;
-        emit presenceChanged(bareJid, resource);
+    case QXmppPresence::Available: {
+        auto &resources = d->presences[bareJid];
+        const int index = QXmppRosterManagerPrivate::indexOfResource(resources, resource);
+        if (index < 0) {
+            resources.append({ resource, presence });
+        } else if (isSamePresence(resources.at(index).presence, presence)) {
+            return;
+        } else {
+            resources[index].presence = presence;
+        }
+        d->notifyPresenceChanged(bareJid, resource);
         break;
-    case QXmppPresence::Unavailable:
-        d->presences[bareJid].remove(resource);
-        emit presenceChanged(bareJid, resource);
+    }
+    case QXmppPresence::Unavailable: {
+        const auto itr = d->presences.find(bareJid);
+        if (itr != d->presences.end()) {
+            const int index = QXmppRosterManagerPrivate::indexOfResource(*itr, resource);
+            if (index >= 0)
+                itr->remove(index);
+            if (itr->isEmpty())
+                d->presences.erase(itr);
+        }
+        d->notifyPresenceChanged(bareJid, resource);
         break;
+    }
     case QXmppPresence::Subscribe:
         if (client()->configuration().autoAcceptSubscriptions()) {
             // accept subscription request
@@ -363,10 +533,12 @@ QXmppRosterIq::Item QXmppRosterManager::getRosterEntry(
 
 QStringList QXmppRosterManager::getResources(const QString &bareJid) const
 {
-    if (d->presences.contains(bareJid))
-        return d->presences[bareJid].keys();
-    else
-        return QStringList();
+    QStringList resources;
+    const auto presences = d->presences.value(bareJid);
+    for (const auto &presence : presences)
+        resources << presence.resource;
+    resources.sort();
+    return resources;
 }
 
 /// Get all the presences of all the resources of the given bareJid. A bareJid
@@ -380,10 +552,11 @@ QStringList QXmppRosterManager::getResources(const QString &bareJid) const
 QMap<QString, QXmppPresence> QXmppRosterManager::getAllPresencesForBareJid(
     const QString &bareJid) const
 {
-    if (d->presences.contains(bareJid))
-        return d->presences[bareJid];
-    else
-        return QMap<QString, QXmppPresence>();
+    QMap<QString, QXmppPresence> presences;
+    const auto resources = d->presences.value(bareJid);
+    for (const auto &resource : resources)
+        presences.insert(resource.resource, resource.presence);
+    return presences;
 }
 
 /// Get the presence of the given resource of the given bareJid.
@@ -396,12 +569,99 @@ QMap<QString, QXmppPresence> QXmppRosterManager::getAllPresencesForBareJid(
 QXmppPresence QXmppRosterManager::getPresence(const QString &bareJid,
                                               const QString &resource) const
 {
-    if (d->presences.contains(bareJid) && d->presences[bareJid].contains(resource))
-        return d->presences[bareJid][resource];
-    else {
-        QXmppPresence presence;
-        presence.setType(QXmppPresence::Unavailable);
-        return presence;
+    const auto itr = d->presences.constFind(bareJid);
+    if (itr != d->presences.constEnd()) {
+        const int index = QXmppRosterManagerPrivate::indexOfResource(*itr, resource);
+        if (index >= 0)
+            return itr->at(index).presence;
+    }
+
+    QXmppPresence presence;
+    presence.setType(QXmppPresence::Unavailable);
+    return presence;
+}
+
+void QXmppRosterManager::_q_emitPresenceBatch()
+{
+    if (d->pendingPresences.isEmpty())
+        return;
+
+    const auto changes = d->pendingPresences;
+    d->pendingPresences.clear();
+    emit presencesChanged(changes);
+}
+
+///
+/// Returns the store in which the roster is persisted, or a null pointer if
+/// none was set.
+///
+/// \since QXmpp 1.4
+///
+QXmppRosterStore *QXmppRosterManager::rosterStore() const
+{
+    return d->store;
+}
+
+///
+/// Sets the store in which the roster is persisted (\xep{0237}: Roster
+/// Versioning).
+///
+/// The roster is loaded from the store right away, so this should be called
+/// before connecting. The store is not owned by the manager.
+///
+/// \param store
+///
+/// \since QXmpp 1.4
+///
+void QXmppRosterManager::setRosterStore(QXmppRosterStore *store)
+{
+    d->store = store;
+    if (!store)
+        return;
+
+    d->version = store->version();
+    d->entries.clear();
+    const auto items = store->items();
+    for (const auto &item : items)
+        d->entries.insert(item.bareJid(), item);
+}
+
+///
+/// Returns the interval in milliseconds during which presence changes are
+/// collected before being reported by presencesChanged().
+///
+/// A value of 0 reports the changes once control returns to the event loop,
+/// a negative value disables batching.
+///
+/// \since QXmpp 1.4
+///
+int QXmppRosterManager::presenceBatchInterval() const
+{
+    return d->presenceBatchInterval;
+}
+
+///
+/// Sets the interval in milliseconds during which presence changes are
+/// collected before being reported by presencesChanged().
+///
+/// A value of 0 reports the changes once control returns to the event loop,
+/// a negative value disables batching. While batching is enabled,
+/// presenceChanged() is not emitted.
+///
+/// The default value is -1.
+///
+/// \param msecs
+///
+/// \since QXmpp 1.4
+///
+void QXmppRosterManager::setPresenceBatchInterval(int msecs)
+{
+    d->presenceBatchInterval = msecs;
+
+    // report the changes collected so far
+    if (msecs < 0) {
+        d->presenceBatchTimer->stop();
+        _q_emitPresenceBatch();
     }
 }
 
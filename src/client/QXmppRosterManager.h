@@ -29,11 +29,14 @@
 #include "QXmppPresence.h"
 #include "QXmppRosterIq.h"
 
+#include <QHash>
 #include <QMap>
 #include <QObject>
+#include <QSet>
 #include <QStringList>
 
 class QXmppRosterManagerPrivate;
+class QXmppRosterStore;
 
 /// \brief The QXmppRosterManager class provides access to a connected client's
 /// roster.
@@ -60,7 +63,15 @@ class QXmppRosterManagerPrivate;
 /// emitted whenever roster entries are added, changed or removed.
 ///
 /// The \c presenceChanged() signal is emitted whenever the presence for a
-/// roster item changes.
+/// roster item changes. Presences which are identical to the one already
+/// known for a resource are ignored. To avoid a storm of signals at login,
+/// the changes can also be collected and reported at once by the
+/// \c presencesChanged() signal, see setPresenceBatchInterval().
+///
+/// If the server supports \xep{0237}: Roster Versioning, the roster is kept
+/// across reconnections and only the changes since the last known version are
+/// requested. A QXmppRosterStore can be set using setRosterStore() to also
+/// keep the roster between application runs.
 ///
 /// \ingroup Managers
 
@@ -82,6 +93,12 @@ public:
     QXmppPresence getPresence(const QString &bareJid,
                               const QString &resource) const;
 
+    QXmppRosterStore *rosterStore() const;
+    void setRosterStore(QXmppRosterStore *store);
+
+    int presenceBatchInterval() const;
+    void setPresenceBatchInterval(int msecs);
+
     /// \cond
     bool handleStanza(const QDomElement &element) override;
     /// \endcond
@@ -105,6 +122,15 @@ Q_SIGNALS:
     /// This signal is emitted when the presence of a particular bareJid and resource changes.
     void presenceChanged(const QString &bareJid, const QString &resource);
 
+    /// This signal is emitted instead of presenceChanged() when presence
+    /// batching is enabled. The \a changes map the bare JIDs whose presence
+    /// changed to the resources concerned.
+    ///
+    /// \sa setPresenceBatchInterval()
+    ///
+    /// \since QXmpp 1.4
+    void presencesChanged(const QHash<QString, QSet<QString>> &changes);
+
     /// This signal is emitted when a contact asks to subscribe to your presence.
     ///
     /// You can either accept the request by calling acceptSubscription() or refuse it
@@ -130,6 +156,7 @@ private Q_SLOTS:
     void _q_connected();
     void _q_disconnected();
     void _q_presenceReceived(const QXmppPresence &);
+    void _q_emitPresenceBatch();
 
 private:
     QXmppRosterManagerPrivate *d;
@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2008-2020 The QXmpp developers
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "QXmppRosterStore.h"
+
+#include <QDomDocument>
+#include <QFile>
+#include <QMap>
+#include <QSaveFile>
+#include <QXmlStreamWriter>
+
+QXmppRosterStore::~QXmppRosterStore() = default;
+
+class QXmppRosterFileStorePrivate
+{
+public:
+    void load();
+    void save();
+
+    QString fileName;
+    QString version;
+    QMap<QString, QXmppRosterIq::Item> items;
+};
+
+void QXmppRosterFileStorePrivate::load()
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+        return;
+
+    QDomDocument doc;
+    if (!doc.setContent(&file, true))
+        return;
+
+    // the roster is stored as a roster result
+    QXmppRosterIq iq;
+    iq.parse(doc.documentElement());
+    version = iq.version();
+    const auto parsedItems = iq.items();
+    for (const auto &item : parsedItems)
+        items.insert(item.bareJid(), item);
+}
+
+void QXmppRosterFileStorePrivate::save()
+{
+    QXmppRosterIq iq;
+    iq.setId(QString());
+    iq.setType(QXmppIq::Result);
+    iq.setVersion(version);
+    for (const auto &item : qAsConst(items))
+        iq.addItem(item);
+
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly))
+        return;
+
+    QXmlStreamWriter writer(&file);
+    iq.toXml(&writer);
+    file.commit();
+}
+
+/// Constructs a roster store which reads and writes the given file.
+///
+/// The roster is loaded from the file if it exists.
+///
+/// \param fileName
+
+QXmppRosterFileStore::QXmppRosterFileStore(const QString &fileName)
+    : d(new QXmppRosterFileStorePrivate)
+{
+    d->fileName = fileName;
+    d->load();
+}
+
+QXmppRosterFileStore::~QXmppRosterFileStore()
+{
+    delete d;
+}
+
+/// Returns the name of the file the roster is stored in.
+
+QString QXmppRosterFileStore::fileName() const
+{
+    return d->fileName;
+}
+
+QString QXmppRosterFileStore::version() const
+{
+    return d->version;
+}
+
+QList<QXmppRosterIq::Item> QXmppRosterFileStore::items() const
+{
+    return d->items.values();
+}
+
+void QXmppRosterFileStore::setRoster(const QString &version, const QList<QXmppRosterIq::Item> &items)
+{
+    d->version = version;
+    d->items.clear();
+    for (const auto &item : items)
+        d->items.insert(item.bareJid(), item);
+    d->save();
+}
+
+void QXmppRosterFileStore::updateItem(const QString &version, const QXmppRosterIq::Item &item)
+{
+    d->version = version;
+    d->items.insert(item.bareJid(), item);
+    d->save();
+}
+
+void QXmppRosterFileStore::removeItem(const QString &version, const QString &bareJid)
+{
+    d->version = version;
+    d->items.remove(bareJid);
+    d->save();
+}
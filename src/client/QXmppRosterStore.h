@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2008-2020 The QXmpp developers
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPROSTERSTORE_H
+#define QXMPPROSTERSTORE_H
+
+#include "QXmppRosterIq.h"
+
+class QXmppRosterFileStorePrivate;
+
+///
+/// \brief The QXmppRosterStore class represents an abstract persistent
+/// storage for a roster and its version (\xep{0237}: Roster Versioning).
+///
+/// The QXmppRosterManager loads the cached roster from the store and only
+/// requests the changes since the stored version when it connects. Each
+/// roster push is then written to the store.
+///
+/// A store holds the roster of a single account.
+///
+/// \since QXmpp 1.4
+///
+class QXMPP_EXPORT QXmppRosterStore
+{
+public:
+    virtual ~QXmppRosterStore();
+
+    /// Returns the version of the stored roster, or an empty string if the
+    /// roster is not versioned.
+    virtual QString version() const = 0;
+
+    /// Returns the stored roster items.
+    virtual QList<QXmppRosterIq::Item> items() const = 0;
+
+    /// Replaces the stored roster with the given \a items and \a version.
+    virtual void setRoster(const QString &version, const QList<QXmppRosterIq::Item> &items) = 0;
+
+    /// Adds or replaces a single \a item and updates the stored \a version.
+    virtual void updateItem(const QString &version, const QXmppRosterIq::Item &item) = 0;
+
+    /// Removes the item for \a bareJid and updates the stored \a version.
+    virtual void removeItem(const QString &version, const QString &bareJid) = 0;
+};
+
+///
+/// \brief The QXmppRosterFileStore class stores a roster in an XML file.
+///
+/// The file is written atomically after each change.
+///
+/// \since QXmpp 1.4
+///
+class QXMPP_EXPORT QXmppRosterFileStore : public QXmppRosterStore
+{
+public:
+    QXmppRosterFileStore(const QString &fileName);
+    ~QXmppRosterFileStore() override;
+
+    QString fileName() const;
+
+    QString version() const override;
+    QList<QXmppRosterIq::Item> items() const override;
+    void setRoster(const QString &version, const QList<QXmppRosterIq::Item> &items) override;
+    void updateItem(const QString &version, const QXmppRosterIq::Item &item) override;
+    void removeItem(const QString &version, const QString &bareJid) override;
+
+private:
+    Q_DISABLE_COPY(QXmppRosterFileStore)
+    QXmppRosterFileStorePrivate *const d;
+};
+
+#endif
@@ -23,10 +23,15 @@
 
 #include "QXmppTransferManager.h"
 
+#include "QXmppBase64_p.h"
 #include "QXmppByteStreamIq.h"
 #include "QXmppClient.h"
 #include "QXmppConstants_p.h"
+#include "QXmppDiscoveryIq.h"
+#include "QXmppDiscoveryManager.h"
 #include "QXmppIbbIq.h"
+#include "QXmppMessage.h"
+#include "QXmppPingIq.h"
 #include "QXmppSocks.h"
 #include "QXmppStreamInitiationIq_p.h"
 #include "QXmppStun.h"
@@ -42,13 +47,71 @@
 #include <QHostAddress>
 #include <QMetaMethod>
 #include <QNetworkInterface>
+#include <QPointer>
 #include <QTime>
 #include <QTimer>
 #include <QUrl>
 
+#ifdef Q_OS_LINUX
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#endif
+
 // time to try to connect to a SOCKS host (7 seconds)
 const int socksTimeout = 7000;
 
+// delay between connection attempts to stream hosts, and the number of
+// attempts which may run at the same time
+const int candidateDelay = 250;
+const int maximumCandidateAttempts = 4;
+
+// size of the blocks read when hashing a file
+const int hashBlockSize = 65536;
+
+// bounds of the adaptive block size and send window of SOCKS5 bytestreams
+const qint64 minimumSendWindow = 32768;
+const qint64 maximumSendWindow = 8 * 1024 * 1024;
+const int minimumSendBlockSize = 16384;
+const int maximumSendBlockSize = 1024 * 1024;
+
+// interval in milliseconds at which the send rate of SOCKS5 bytestreams is
+// sampled
+const qint64 sendSampleInterval = 20;
+
+// round-trip time increase above which an in-band bytestream is considered
+// to be queuing up, in addition to twice the lowest round-trip time
+const qint64 ibbRttSlack = 20;
+
+// Returns the smoothed round-trip time of a TCP connection in microseconds,
+// or -1 if it is not known.
+
+static qint64 socketRtt(const QAbstractSocket *socket)
+{
+#ifdef Q_OS_LINUX
+    struct tcp_info info;
+    socklen_t length = sizeof(info);
+    if (socket->socketDescriptor() >= 0 &&
+        getsockopt(int(socket->socketDescriptor()), IPPROTO_TCP, TCP_INFO, &info, &length) == 0 &&
+        info.tcpi_rtt > 0)
+        return info.tcpi_rtt;
+#else
+    Q_UNUSED(socket);
+#endif
+    return -1;
+}
+
+// Returns true if the entity's cached capabilities show that it writes
+// proposed ranges in place.
+
+static bool supportsRanges(QXmppClient *client, const QString &jid)
+{
+    auto *discoveryManager = client->findExtension<QXmppDiscoveryManager>();
+    QXmppDiscoveryIq info;
+    return discoveryManager && discoveryManager->cachedInfo(jid, info) &&
+        info.features().contains(QString::fromLatin1(ns_stream_initiation_file_transfer_ranges));
+}
+
 static QString streamHash(const QString &sid, const QString &initiatorJid, const QString &targetJid)
 {
     QCryptographicHash hash(QCryptographicHash::Sha1);
@@ -57,6 +120,36 @@ static QString streamHash(const QString &sid, const QString &initiatorJid, const
     return hash.result().toHex();
 }
 
+// XEP-0300: Use of Cryptographic Hash Functions in XMPP
+static const QList<QPair<QCryptographicHash::Algorithm, QString>> HASH_ALGORITHMS = {
+    { QCryptographicHash::Md5, QStringLiteral("md5") },
+    { QCryptographicHash::Sha1, QStringLiteral("sha-1") },
+    { QCryptographicHash::Sha256, QStringLiteral("sha-256") },
+    { QCryptographicHash::Sha512, QStringLiteral("sha-512") },
+    { QCryptographicHash::Sha3_256, QStringLiteral("sha3-256") },
+    { QCryptographicHash::Sha3_512, QStringLiteral("sha3-512") }
+};
+
+static QString hashAlgorithmName(QCryptographicHash::Algorithm algorithm)
+{
+    for (const auto &pair : HASH_ALGORITHMS) {
+        if (pair.first == algorithm)
+            return pair.second;
+    }
+    return QString();
+}
+
+static bool hashAlgorithmFromName(const QString &name, QCryptographicHash::Algorithm &algorithm)
+{
+    for (const auto &pair : HASH_ALGORITHMS) {
+        if (pair.second == name) {
+            algorithm = pair.first;
+            return true;
+        }
+    }
+    return false;
+}
+
 class QXmppTransferFileInfoPrivate : public QSharedData
 {
 public:
@@ -64,13 +157,21 @@ public:
 
     QDateTime date;
     QByteArray hash;
+    QCryptographicHash::Algorithm hashAlgorithm;
     QString name;
     QString description;
     qint64 size;
+    bool rangeSupported;
+    qint64 rangeOffset;
+    qint64 rangeLength;
 };
 
 QXmppTransferFileInfoPrivate::QXmppTransferFileInfoPrivate()
-    : size(0)
+    : hashAlgorithm(QCryptographicHash::Md5),
+      size(0),
+      rangeSupported(false),
+      rangeOffset(0),
+      rangeLength(0)
 {
 }
 
@@ -108,6 +209,30 @@ void QXmppTransferFileInfo::setHash(const QByteArray &hash)
     d->hash = hash;
 }
 
+/// Returns the algorithm used to compute the hash() of the file.
+///
+/// MD5 hashes are transmitted as defined by \xep{0096}: SI File Transfer,
+/// other algorithms as defined by \xep{0300}: Use of Cryptographic Hash
+/// Functions in XMPP.
+///
+/// \since QXmpp 1.4
+
+QCryptographicHash::Algorithm QXmppTransferFileInfo::hashAlgorithm() const
+{
+    return d->hashAlgorithm;
+}
+
+/// Sets the algorithm used to compute the hash() of the file.
+///
+/// The default is MD5, which is understood by all implementations.
+///
+/// \since QXmpp 1.4
+
+void QXmppTransferFileInfo::setHashAlgorithm(QCryptographicHash::Algorithm algorithm)
+{
+    d->hashAlgorithm = algorithm;
+}
+
 QString QXmppTransferFileInfo::name() const
 {
     return d->name;
@@ -138,9 +263,77 @@ void QXmppTransferFileInfo::setSize(qint64 size)
     d->size = size;
 }
 
+/// Returns whether the file can be transferred in ranges, as defined by
+/// \xep{0096}: SI File Transfer.
+///
+/// In an offer, this tells that the sender can start from any offset of the
+/// file, so that the receiver can resume an interrupted transfer.
+///
+/// \since QXmpp 1.4
+
+bool QXmppTransferFileInfo::isRangeSupported() const
+{
+    return d->rangeSupported;
+}
+
+/// Sets whether the file can be transferred in ranges.
+///
+/// \since QXmpp 1.4
+
+void QXmppTransferFileInfo::setRangeSupported(bool supported)
+{
+    d->rangeSupported = supported;
+}
+
+/// Returns the offset of the first byte of the range to transfer.
+///
+/// In an answer to an offer, this is the range requested by the receiver.
+/// In an offer, this is a range proposed by the sender when a file is split
+/// across several bytestreams.
+///
+/// \since QXmpp 1.4
+
+qint64 QXmppTransferFileInfo::rangeOffset() const
+{
+    return d->rangeOffset;
+}
+
+/// Sets the offset of the first byte of the range to transfer.
+///
+/// \since QXmpp 1.4
+
+void QXmppTransferFileInfo::setRangeOffset(qint64 offset)
+{
+    d->rangeOffset = offset;
+    if (offset)
+        d->rangeSupported = true;
+}
+
+/// Returns the number of bytes of the range to transfer, or 0 if the range
+/// extends to the end of the file.
+///
+/// \since QXmpp 1.4
+
+qint64 QXmppTransferFileInfo::rangeLength() const
+{
+    return d->rangeLength;
+}
+
+/// Sets the number of bytes of the range to transfer, 0 meaning up to the
+/// end of the file.
+///
+/// \since QXmpp 1.4
+
+void QXmppTransferFileInfo::setRangeLength(qint64 length)
+{
+    d->rangeLength = length;
+    if (length)
+        d->rangeSupported = true;
+}
+
 bool QXmppTransferFileInfo::isNull() const
 {
-    return d->date.isNull() && d->description.isEmpty() && d->hash.isEmpty() && d->name.isEmpty() && d->size == 0;
+    return d->date.isNull() && d->description.isEmpty() && d->hash.isEmpty() && d->name.isEmpty() && d->size == 0 && !d->rangeSupported;
 }
 
 QXmppTransferFileInfo &QXmppTransferFileInfo::operator=(const QXmppTransferFileInfo &other)
@@ -153,6 +346,7 @@ bool QXmppTransferFileInfo::operator==(const QXmppTransferFileInfo &other) const
 {
     return other.d->size == d->size &&
         other.d->hash == d->hash &&
+        other.d->hashAlgorithm == d->hashAlgorithm &&
         other.d->name == d->name;
 }
 
@@ -160,9 +354,29 @@ void QXmppTransferFileInfo::parse(const QDomElement &element)
 {
     d->date = QXmppUtils::datetimeFromString(element.attribute("date"));
     d->hash = QByteArray::fromHex(element.attribute("hash").toLatin1());
+    d->hashAlgorithm = QCryptographicHash::Md5;
     d->name = element.attribute("name");
     d->size = element.attribute("size").toLongLong();
     d->description = element.firstChildElement("desc").text();
+
+    const QDomElement rangeElement = element.firstChildElement("range");
+    d->rangeSupported = !rangeElement.isNull();
+    d->rangeOffset = rangeElement.attribute("offset").toLongLong();
+    d->rangeLength = rangeElement.attribute("length").toLongLong();
+
+    // prefer a XEP-0300 hash over the MD5 hash
+    for (auto hashElement = element.firstChildElement("hash");
+         !hashElement.isNull();
+         hashElement = hashElement.nextSiblingElement("hash")) {
+        QCryptographicHash::Algorithm algorithm;
+        if (hashElement.namespaceURI() == ns_hashes &&
+            hashAlgorithmFromName(hashElement.attribute("algo"), algorithm) &&
+            algorithm != QCryptographicHash::Md5) {
+            d->hash = QByteArray::fromBase64(hashElement.text().toLatin1());
+            d->hashAlgorithm = algorithm;
+            break;
+        }
+    }
 }
 
 void QXmppTransferFileInfo::toXml(QXmlStreamWriter *writer) const
@@ -171,7 +385,7 @@ void QXmppTransferFileInfo::toXml(QXmlStreamWriter *writer) const
     writer->writeDefaultNamespace(ns_stream_initiation_file_transfer);
     if (d->date.isValid())
         writer->writeAttribute("date", QXmppUtils::datetimeToString(d->date));
-    if (!d->hash.isEmpty())
+    if (!d->hash.isEmpty() && d->hashAlgorithm == QCryptographicHash::Md5)
         writer->writeAttribute("hash", d->hash.toHex());
     if (!d->name.isEmpty())
         writer->writeAttribute("name", d->name);
@@ -179,6 +393,21 @@ void QXmppTransferFileInfo::toXml(QXmlStreamWriter *writer) const
         writer->writeAttribute("size", QString::number(d->size));
     if (!d->description.isEmpty())
         writer->writeTextElement("desc", d->description);
+    if (d->rangeSupported) {
+        writer->writeStartElement("range");
+        if (d->rangeOffset > 0)
+            writer->writeAttribute("offset", QString::number(d->rangeOffset));
+        if (d->rangeLength > 0)
+            writer->writeAttribute("length", QString::number(d->rangeLength));
+        writer->writeEndElement();
+    }
+    if (!d->hash.isEmpty() && d->hashAlgorithm != QCryptographicHash::Md5) {
+        writer->writeStartElement("hash");
+        writer->writeDefaultNamespace(ns_hashes);
+        writer->writeAttribute("algo", hashAlgorithmName(d->hashAlgorithm));
+        writer->writeCharacters(d->hash.toBase64());
+        writer->writeEndElement();
+    }
     writer->writeEndElement();
 }
 
@@ -187,12 +416,17 @@ class QXmppTransferJobPrivate
 public:
     QXmppTransferJobPrivate();
 
+    void ibbAcknowledge(qint64 rtt, int blocks, int maximumWindow);
+    void updateSendWindow();
+    qint64 endOffset() const;
+
     int blockSize;
     QXmppClient *client;
     QXmppTransferJob::Direction direction;
     qint64 done;
     QXmppTransferJob::Error error;
-    QCryptographicHash hash;
+    QCryptographicHash *hash;
+    QXmppTransferHasher *hasher;
     QIODevice *iodevice;
     QString offerId;
     QString jid;
@@ -208,12 +442,47 @@ public:
     // file meta-data
     QXmppTransferFileInfo fileInfo;
 
+    // the part of the file which is transferred, a length of 0 meaning up
+    // to the end of the file
+    qint64 rangeOffset;
+    qint64 rangeLength;
+
+    // the received data completes data held before, so the whole file
+    // needs to be hashed to be verified
+    bool verifyFile;
+
     // for in-band bytestreams
-    int ibbSequence;
+    quint16 ibbSequence;
+    bool ibbMessages;
+
+    // outgoing in-band bytestreams keep a window of unacknowledged data
+    // stanzas, indexed by the id of the IQ which acknowledges them along
+    // with the time it was sent and the number of blocks it covers
+    QHash<QString, QPair<qint64, int>> ibbPending;
+    int ibbWindow;
+    int ibbInFlight;
+    int ibbUnconfirmed;
+    int ibbAcknowledged;
+    qint64 ibbMinimumRtt;
+    bool ibbSlowStart;
 
     // for socks5 bytestreams
     QTcpSocket *socksSocket;
     QXmppByteStreamIq::StreamHost socksProxy;
+
+    // outgoing socks5 bytestreams are sent from a memory-mapped file, or
+    // through a buffer which is reused for each block
+    qint64 sendWindow;
+    QByteArray sendBuffer;
+    uchar *mappedData;
+    qint64 mappedOffset;
+    qint64 mappedSize;
+
+    // rate in bytes per second at which the socket's buffer drains, sampled
+    // from the bytes handed over to the system since the last sample
+    qint64 sendRate;
+    qint64 sendSampleBytes;
+    QElapsedTimer sendSampleTimer;
 };
 
 QXmppTransferJobPrivate::QXmppTransferJobPrivate()
@@ -222,16 +491,104 @@ QXmppTransferJobPrivate::QXmppTransferJobPrivate()
       direction(QXmppTransferJob::IncomingDirection),
       done(0),
       error(QXmppTransferJob::NoError),
-      hash(QCryptographicHash::Md5),
+      hash(nullptr),
+      hasher(nullptr),
       iodevice(nullptr),
       method(QXmppTransferJob::NoMethod),
       state(QXmppTransferJob::OfferState),
       deviceIsOwn(false),
+      rangeOffset(0),
+      rangeLength(0),
+      verifyFile(false),
       ibbSequence(0),
-      socksSocket(nullptr)
+      ibbMessages(false),
+      ibbWindow(1),
+      ibbInFlight(0),
+      ibbUnconfirmed(0),
+      ibbAcknowledged(0),
+      ibbMinimumRtt(-1),
+      ibbSlowStart(true),
+      socksSocket(nullptr),
+      sendWindow(minimumSendWindow),
+      mappedData(nullptr),
+      mappedOffset(0),
+      mappedSize(0),
+      sendRate(0),
+      sendSampleBytes(0)
 {
 }
 
+// Returns the offset following the last byte to transfer, or 0 if unknown.
+
+qint64 QXmppTransferJobPrivate::endOffset() const
+{
+    return rangeLength ? rangeOffset + rangeLength : fileInfo.size();
+}
+
+// Sizes the send window of a SOCKS5 bytestream to twice the bandwidth-delay
+// product of the connection, so that the system's buffer never runs dry
+// while waiting for the event loop.
+//
+// The bandwidth is the smoothed rate at which the socket's buffer drains.
+// Where the round-trip time is not available from the system, the window
+// covers the interval between samples instead.
+
+void QXmppTransferJobPrivate::updateSendWindow()
+{
+    const qint64 pending = socksSocket->bytesToWrite();
+    const qint64 sent = done - pending;
+    if (!sendSampleTimer.isValid()) {
+        sendSampleTimer.start();
+        sendSampleBytes = sent;
+        return;
+    }
+
+    const qint64 elapsed = sendSampleTimer.elapsed();
+    if (elapsed < sendSampleInterval)
+        return;
+    sendSampleTimer.restart();
+
+    const qint64 rate = (sent - sendSampleBytes) * 1000 / elapsed;
+    sendSampleBytes = sent;
+    sendRate = sendRate ? (7 * sendRate + rate) / 8 : rate;
+
+    qint64 rtt = socketRtt(socksSocket);
+    if (rtt < 0)
+        rtt = elapsed * 1000;
+    qint64 window = 2 * sendRate * rtt / 1000000;
+
+    // the buffer ran dry, so the measured rate was limited by the window
+    // itself: probe for more bandwidth
+    if (!pending)
+        window = qMax(window, 2 * sendWindow);
+
+    sendWindow = qBound(minimumSendWindow, window, maximumSendWindow);
+    blockSize = int(qBound(qint64(minimumSendBlockSize), sendWindow / 4, qint64(maximumSendBlockSize)));
+}
+
+void QXmppTransferJobPrivate::ibbAcknowledge(qint64 rtt, int blocks, int maximumWindow)
+{
+    ibbInFlight -= blocks;
+    if (ibbMinimumRtt < 0 || rtt < ibbMinimumRtt)
+        ibbMinimumRtt = rtt;
+
+    // resize the window once per window of acknowledged blocks
+    ibbAcknowledged += blocks;
+    if (ibbAcknowledged < ibbWindow)
+        return;
+    ibbAcknowledged = 0;
+
+    if (rtt > 2 * ibbMinimumRtt + ibbRttSlack) {
+        // the stanzas are queuing up on their way, back off
+        ibbWindow = qMax(1, ibbWindow / 2);
+        ibbSlowStart = false;
+    } else if (ibbSlowStart) {
+        ibbWindow = qMin(2 * ibbWindow, maximumWindow);
+    } else {
+        ibbWindow = qMin(ibbWindow + 1, maximumWindow);
+    }
+}
+
 QXmppTransferJob::QXmppTransferJob(const QString &jid, QXmppTransferJob::Direction direction, QXmppClient *client, QObject *parent)
     : QXmppLoggable(parent),
       d(new QXmppTransferJobPrivate)
@@ -243,6 +600,12 @@ QXmppTransferJob::QXmppTransferJob(const QString &jid, QXmppTransferJob::Directi
 
 QXmppTransferJob::~QXmppTransferJob()
 {
+    // the hasher is a child of the job, it must stop before being deleted
+    if (d->hasher) {
+        d->hasher->requestInterruption();
+        d->hasher->wait();
+    }
+    delete d->hash;
     delete d;
 }
 
@@ -257,22 +620,83 @@ void QXmppTransferJob::abort()
 /// Call this method if you wish to accept an incoming transfer job.
 ///
 
+/// If the sender proposed to only send a range of the file, because it is
+/// split across several bytestreams, the range is written in place and the
+/// rest of the file is left untouched.
+
 void QXmppTransferJob::accept(const QString &filePath)
 {
     if (d->direction == IncomingDirection && d->state == OfferState && !d->iodevice) {
+        const bool ranged = d->fileInfo.isRangeSupported() &&
+            (d->fileInfo.rangeOffset() || d->fileInfo.rangeLength());
+
+        // the range is proposed by the sender and must lie within the file
+        const qint64 offset = d->fileInfo.rangeOffset();
+        const qint64 length = d->fileInfo.rangeLength();
+        if (ranged && (offset < 0 || length < 0 || offset > d->fileInfo.size() || length > d->fileInfo.size() - offset)) {
+            warning(QString("Invalid range proposed by %1").arg(d->jid));
+            abort();
+            return;
+        }
+
         auto *file = new QFile(filePath, this);
-        if (!file->open(QIODevice::WriteOnly)) {
+        if (!file->open(ranged ? QIODevice::ReadWrite : QIODevice::WriteOnly) ||
+            (ranged && !file->seek(d->fileInfo.rangeOffset()))) {
             warning(QString("Could not write to %1").arg(filePath));
             abort();
             return;
         }
 
+        if (ranged) {
+            d->rangeOffset = offset;
+            d->rangeLength = length;
+            d->done = offset;
+        }
+
         d->iodevice = file;
         setLocalFileUrl(QUrl::fromLocalFile(filePath));
         setState(QXmppTransferJob::StartState);
     }
 }
 
+/// Call this method if you wish to accept an incoming transfer job and
+/// continue from the data which a previous attempt saved to \a filePath.
+///
+/// If the sender supports ranged transfers, only the rest of the file is
+/// requested and the whole file is hashed once complete, so that the data
+/// held before is verified too. Otherwise the file is received from the
+/// start.
+///
+/// \since QXmpp 1.4
+
+void QXmppTransferJob::resume(const QString &filePath)
+{
+    if (d->direction != IncomingDirection || d->state != OfferState || d->iodevice)
+        return;
+
+    const qint64 held = QFileInfo(filePath).size();
+    if (!d->fileInfo.isRangeSupported() ||
+        d->fileInfo.rangeOffset() || d->fileInfo.rangeLength() ||
+        held <= 0 || held >= d->fileInfo.size()) {
+        accept(filePath);
+        return;
+    }
+
+    auto *file = new QFile(filePath, this);
+    if (!file->open(QIODevice::ReadWrite) || !file->seek(held)) {
+        warning(QString("Could not write to %1").arg(filePath));
+        abort();
+        return;
+    }
+
+    d->rangeOffset = held;
+    d->done = held;
+    d->verifyFile = true;
+    d->iodevice = file;
+    setLocalFileUrl(QUrl::fromLocalFile(filePath));
+    setState(QXmppTransferJob::StartState);
+}
+
 /// Call this method if you wish to accept an incoming transfer job.
 ///
 
@@ -408,6 +832,16 @@ void QXmppTransferJob::terminate(QXmppTransferJob::Error cause)
     d->error = cause;
     d->state = FinishedState;
 
+    // stop hashing the file
+    if (d->hasher)
+        d->hasher->requestInterruption();
+
+    // release the mapping before the file can be closed
+    if (d->mappedData) {
+        qobject_cast<QFile *>(d->iodevice)->unmap(d->mappedData);
+        d->mappedData = nullptr;
+    }
+
     // close IO device
     if (d->iodevice && d->deviceIsOwn)
         d->iodevice->close();
@@ -423,23 +857,102 @@ void QXmppTransferJob::terminate(QXmppTransferJob::Error cause)
 }
 
 /// \cond
+QXmppTransferHasher::QXmppTransferHasher(const QString &filePath, QCryptographicHash::Algorithm algorithm, QObject *parent)
+    : QThread(parent),
+      m_filePath(filePath),
+      m_algorithm(algorithm)
+{
+}
+
+void QXmppTransferHasher::run()
+{
+    QFile file(m_filePath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        emit hashed(QByteArray());
+        return;
+    }
+
+    QCryptographicHash hash(m_algorithm);
+    QByteArray buffer(hashBlockSize, Qt::Uninitialized);
+    qint64 length;
+    while ((length = file.read(buffer.data(), buffer.size())) > 0) {
+        if (isInterruptionRequested()) {
+            emit hashed(QByteArray());
+            return;
+        }
+        hash.addData(buffer.constData(), int(length));
+    }
+
+    emit hashed(length < 0 ? QByteArray() : hash.result());
+}
+
 QXmppTransferIncomingJob::QXmppTransferIncomingJob(const QString &jid, QXmppClient *client, QObject *parent)
-    : QXmppTransferJob(jid, IncomingDirection, client, parent), m_candidateClient(nullptr), m_candidateTimer(nullptr)
+    : QXmppTransferJob(jid, IncomingDirection, client, parent), m_candidateDelayTimer(new QTimer(this))
 {
+    m_candidateDelayTimer->setSingleShot(true);
+    m_candidateDelayTimer->setInterval(candidateDelay);
+    connect(m_candidateDelayTimer, &QTimer::timeout, this, &QXmppTransferIncomingJob::connectToNextHost);
 }
 
 void QXmppTransferIncomingJob::checkData()
 {
-    if ((d->fileInfo.size() && d->done != d->fileInfo.size()) ||
-        (!d->fileInfo.hash().isEmpty() && d->hash.result() != d->fileInfo.hash()))
+    // the file is already being verified
+    if (d->hasher)
+        return;
+
+    if (d->endOffset() && d->done != d->endOffset()) {
         terminate(QXmppTransferJob::FileCorruptError);
-    else
+        return;
+    }
+
+    if (d->fileInfo.hash().isEmpty() ||
+        ((d->rangeOffset || d->rangeLength) && !d->verifyFile)) {
+        // a part of the file cannot be checked against the hash of the
+        // whole file
+        terminate(QXmppTransferJob::NoError);
+    } else if (d->verifyFile) {
+        // hash the whole file, including the data held before resuming
+        auto *file = qobject_cast<QFile *>(d->iodevice);
+        file->flush();
+
+        d->hasher = new QXmppTransferHasher(file->fileName(), d->fileInfo.hashAlgorithm(), this);
+        connect(d->hasher, &QXmppTransferHasher::hashed, this, [this](const QByteArray &hash) {
+            if (hash == d->fileInfo.hash())
+                terminate(QXmppTransferJob::NoError);
+            else
+                terminate(QXmppTransferJob::FileCorruptError);
+        });
+        d->hasher->start();
+    } else if (receivedHash()->result() != d->fileInfo.hash()) {
+        terminate(QXmppTransferJob::FileCorruptError);
+    } else {
         terminate(QXmppTransferJob::NoError);
+    }
+}
+
+// Returns the hash of the data received so far, using the algorithm
+// announced by the sender.
+
+QCryptographicHash *QXmppTransferIncomingJob::receivedHash()
+{
+    if (!d->hash)
+        d->hash = new QCryptographicHash(d->fileInfo.hashAlgorithm());
+    return d->hash;
 }
 
+// Starts a connection attempt to the next stream host. Attempts are started
+// one after the other with a short delay, or as soon as one fails, so that
+// unreachable hosts do not hold back the reachable ones.
+
 void QXmppTransferIncomingJob::connectToNextHost()
 {
+    if (d->state == QXmppTransferJob::FinishedState)
+        return;
+
     if (m_streamCandidates.isEmpty()) {
+        if (!m_candidates.isEmpty())
+            return;
+
         // could not connect to any stream host
         QXmppByteStreamIq response;
         response.setId(m_streamOfferId);
@@ -454,28 +967,55 @@ void QXmppTransferIncomingJob::connectToNextHost()
         return;
     }
 
+    if (m_candidates.size() >= maximumCandidateAttempts)
+        return;
+
     // try next host
-    m_candidateHost = m_streamCandidates.takeFirst();
-    info(QString("Connecting to streamhost: %1 (%2 %3)").arg(m_candidateHost.jid(), m_candidateHost.host(), QString::number(m_candidateHost.port())));
+    Candidate candidate;
+    candidate.host = m_streamCandidates.takeFirst();
+    info(QString("Connecting to streamhost: %1 (%2 %3)").arg(candidate.host.jid(), candidate.host.host(), QString::number(candidate.host.port())));
 
     const QString hostName = streamHash(d->sid,
                                         d->jid,
                                         d->client->configuration().jid());
 
     // try to connect to stream host
-    m_candidateClient = new QXmppSocksClient(m_candidateHost.host(), m_candidateHost.port(), this);
-    m_candidateTimer = new QTimer(this);
+    candidate.client = new QXmppSocksClient(candidate.host.host(), candidate.host.port(), this);
+    candidate.timer = new QTimer(this);
 
-    connect(m_candidateClient, &QAbstractSocket::disconnected,
+    connect(candidate.client, &QAbstractSocket::disconnected,
             this, &QXmppTransferIncomingJob::_q_candidateDisconnected);
-    connect(m_candidateClient, &QXmppSocksClient::ready,
+    connect(candidate.client, QOverload<QAbstractSocket::SocketError>::of(&QAbstractSocket::error),
+            this, &QXmppTransferIncomingJob::_q_candidateDisconnected);
+    connect(candidate.client, &QXmppSocksClient::ready,
             this, &QXmppTransferIncomingJob::_q_candidateReady);
-    connect(m_candidateTimer, &QTimer::timeout,
+    connect(candidate.timer, &QTimer::timeout,
             this, &QXmppTransferIncomingJob::_q_candidateDisconnected);
 
-    m_candidateTimer->setSingleShot(true);
-    m_candidateTimer->start(socksTimeout);
-    m_candidateClient->connectToHost(hostName, 0);
+    m_candidates << candidate;
+    candidate.timer->setSingleShot(true);
+    candidate.timer->start(socksTimeout);
+    candidate.client->connectToHost(hostName, 0);
+
+    // give this attempt a head start before trying the next host
+    if (!m_streamCandidates.isEmpty())
+        m_candidateDelayTimer->start();
+}
+
+// Removes the attempt which owns the given socket or timer from the running
+// attempts and stores it in candidate. Returns false if there is no such
+// attempt.
+
+bool QXmppTransferIncomingJob::takeCandidate(QObject *object, Candidate &candidate)
+{
+    for (int i = 0; i < m_candidates.size(); ++i) {
+        if (m_candidates.at(i).client == object || m_candidates.at(i).timer == object) {
+            candidate = m_candidates.takeAt(i);
+            candidate.timer->deleteLater();
+            return true;
+        }
+    }
+    return false;
 }
 
 void QXmppTransferIncomingJob::connectToHosts(const QXmppByteStreamIq &iq)
@@ -494,24 +1034,34 @@ bool QXmppTransferIncomingJob::writeData(const QByteArray &data)
     if (written < 0)
         return false;
     d->done += written;
-    if (!d->fileInfo.hash().isEmpty())
-        d->hash.addData(data);
+    if (!d->fileInfo.hash().isEmpty() && !d->rangeOffset && !d->rangeLength)
+        receivedHash()->addData(data);
     progress(d->done, d->fileInfo.size());
     return true;
 }
 
 void QXmppTransferIncomingJob::_q_candidateReady()
 {
-    if (!m_candidateClient)
+    Candidate winner;
+    if (!takeCandidate(sender(), winner))
         return;
 
-    info(QString("Connected to streamhost: %1 (%2 %3)").arg(m_candidateHost.jid(), m_candidateHost.host(), QString::number(m_candidateHost.port())));
+    info(QString("Connected to streamhost: %1 (%2 %3)").arg(winner.host.jid(), winner.host.host(), QString::number(winner.host.port())));
 
+    // the first host to complete the handshake wins, tear down the others
+    m_candidateDelayTimer->stop();
+    m_streamCandidates.clear();
+    for (const auto &candidate : qAsConst(m_candidates)) {
+        disconnect(candidate.client, nullptr, this, nullptr);
+        candidate.client->abort();
+        candidate.client->deleteLater();
+        candidate.timer->deleteLater();
+    }
+    m_candidates.clear();
+
+    disconnect(winner.client, nullptr, this, nullptr);
     setState(QXmppTransferJob::TransferState);
-    d->socksSocket = m_candidateClient;
-    m_candidateClient = nullptr;
-    m_candidateTimer->deleteLater();
-    m_candidateTimer = nullptr;
+    d->socksSocket = winner.client;
 
     connect(d->socksSocket, &QIODevice::readyRead, this, &QXmppTransferIncomingJob::_q_receiveData);
     connect(d->socksSocket, &QAbstractSocket::disconnected, this, &QXmppTransferIncomingJob::_q_disconnected);
@@ -521,23 +1071,23 @@ void QXmppTransferIncomingJob::_q_candidateReady()
     ackIq.setTo(m_streamOfferFrom);
     ackIq.setType(QXmppIq::Result);
     ackIq.setSid(d->sid);
-    ackIq.setStreamHostUsed(m_candidateHost.jid());
+    ackIq.setStreamHostUsed(winner.host.jid());
     d->client->sendPacket(ackIq);
 }
 
 void QXmppTransferIncomingJob::_q_candidateDisconnected()
 {
-    if (!m_candidateClient)
+    Candidate candidate;
+    if (!takeCandidate(sender(), candidate))
         return;
 
-    warning(QString("Failed to connect to streamhost: %1 (%2 %3)").arg(m_candidateHost.jid(), m_candidateHost.host(), QString::number(m_candidateHost.port())));
+    warning(QString("Failed to connect to streamhost: %1 (%2 %3)").arg(candidate.host.jid(), candidate.host.host(), QString::number(candidate.host.port())));
 
-    m_candidateClient->deleteLater();
-    m_candidateClient = nullptr;
-    m_candidateTimer->deleteLater();
-    m_candidateTimer = nullptr;
+    disconnect(candidate.client, nullptr, this, nullptr);
+    candidate.client->deleteLater();
 
-    // try next host
+    // try next host without waiting
+    m_candidateDelayTimer->stop();
     connectToNextHost();
 }
 
@@ -559,7 +1109,7 @@ void QXmppTransferIncomingJob::_q_receiveData()
         writeData(d->socksSocket->readAll());
 
         // if we have received all the data, stop here
-        if (fileSize() && d->done >= fileSize())
+        if (d->endOffset() && d->done >= d->endOffset())
             checkData();
     }
 }
@@ -590,6 +1140,17 @@ void QXmppTransferOutgoingJob::startSending()
 {
     setState(QXmppTransferJob::TransferState);
 
+    // local files are mapped, so that blocks are written to the socket
+    // straight from the page cache without an intermediate read buffer
+    auto *file = qobject_cast<QFile *>(d->iodevice);
+    if (file && !file->isSequential() && file->size() > file->pos()) {
+        d->mappedOffset = d->done;
+        d->mappedSize = file->size() - file->pos();
+        d->mappedData = file->map(file->pos(), d->mappedSize);
+        if (!d->mappedData)
+            d->mappedSize = 0;
+    }
+
     connect(d->socksSocket, &QIODevice::bytesWritten, this, &QXmppTransferOutgoingJob::_q_sendData);
     connect(d->iodevice, &QIODevice::readyRead, this, &QXmppTransferOutgoingJob::_q_sendData);
 
@@ -625,29 +1186,43 @@ void QXmppTransferOutgoingJob::_q_sendData()
     if (d->state != QXmppTransferJob::TransferState)
         return;
 
-    // don't saturate the outgoing socket
-    if (d->socksSocket->bytesToWrite() > 2 * d->blockSize)
-        return;
+    d->updateSendWindow();
+
+    const qint64 end = d->endOffset();
+    const qint64 previouslyDone = d->done;
+    while (d->socksSocket->bytesToWrite() < d->sendWindow) {
+        // check whether we have written the whole file or range
+        const qint64 mapped = d->done - d->mappedOffset;
+        if ((end && d->done >= end) ||
+            (d->mappedData && mapped >= d->mappedSize)) {
+            if (!d->socksSocket->bytesToWrite())
+                terminate(QXmppTransferJob::NoError);
+            break;
+        }
 
-    // check whether we have written the whole file
-    if (d->fileInfo.size() && d->done >= d->fileInfo.size()) {
-        if (!d->socksSocket->bytesToWrite())
-            terminate(QXmppTransferJob::NoError);
-        return;
-    }
+        qint64 length = end ? qMin(qint64(d->blockSize), end - d->done) : d->blockSize;
+        if (d->mappedData) {
+            length = qMin(length, d->mappedSize - mapped);
+            d->socksSocket->write(reinterpret_cast<const char *>(d->mappedData + mapped), length);
+        } else {
+            if (d->sendBuffer.size() < length)
+                d->sendBuffer.resize(int(length));
+            length = d->iodevice->read(d->sendBuffer.data(), length);
+            if (length < 0) {
+                terminate(QXmppTransferJob::FileAccessError);
+                return;
+            }
 
-    char *buffer = new char[d->blockSize];
-    qint64 length = d->iodevice->read(buffer, d->blockSize);
-    if (length < 0) {
-        delete[] buffer;
-        terminate(QXmppTransferJob::FileAccessError);
-        return;
-    } else {
-        d->socksSocket->write(buffer, length);
-        delete[] buffer;
+            // wait for the device to provide more data
+            if (!length)
+                break;
+            d->socksSocket->write(d->sendBuffer.constData(), length);
+        }
         d->done += length;
-        emit progress(d->done, fileSize());
     }
+
+    if (d->done != previouslyDone)
+        emit progress(d->done, fileSize());
 }
 /// \endcond
 
@@ -659,21 +1234,26 @@ public:
     QXmppTransferIncomingJob *getIncomingJobByRequestId(const QString &jid, const QString &id);
     QXmppTransferIncomingJob *getIncomingJobBySid(const QString &jid, const QString &sid);
     QXmppTransferOutgoingJob *getOutgoingJobByRequestId(const QString &jid, const QString &id);
+    QXmppTransferOutgoingJob *getOutgoingJobBySid(const QString &jid, const QString &sid);
 
     int ibbBlockSize;
+    int ibbWindowSize;
+    bool ibbMessagesEnabled;
     QList<QXmppTransferJob *> jobs;
     QString proxy;
     bool proxyOnly;
     QXmppSocksServer *socksServer;
     QXmppTransferJob::Methods supportedMethods;
+    QCryptographicHash::Algorithm hashAlgorithm;
 
 private:
     QXmppTransferJob *getJobByRequestId(QXmppTransferJob::Direction direction, const QString &jid, const QString &id);
+    QXmppTransferJob *getJobBySid(QXmppTransferJob::Direction direction, const QString &jid, const QString &sid);
     QXmppTransferManager *q;
 };
 
 QXmppTransferManagerPrivate::QXmppTransferManagerPrivate(QXmppTransferManager *qq)
-    : ibbBlockSize(4096), proxyOnly(false), socksServer(nullptr), supportedMethods(QXmppTransferJob::AnyMethod), q(qq)
+    : ibbBlockSize(4096), ibbWindowSize(16), ibbMessagesEnabled(false), proxyOnly(false), socksServer(nullptr), supportedMethods(QXmppTransferJob::AnyMethod), hashAlgorithm(QCryptographicHash::Md5), q(qq)
 {
 }
 
@@ -693,22 +1273,32 @@ QXmppTransferIncomingJob *QXmppTransferManagerPrivate::getIncomingJobByRequestId
     return static_cast<QXmppTransferIncomingJob *>(getJobByRequestId(QXmppTransferJob::IncomingDirection, jid, id));
 }
 
-QXmppTransferIncomingJob *QXmppTransferManagerPrivate::getIncomingJobBySid(const QString &jid, const QString &sid)
+QXmppTransferJob *QXmppTransferManagerPrivate::getJobBySid(QXmppTransferJob::Direction direction, const QString &jid, const QString &sid)
 {
     for (auto *job : jobs) {
-        if (job->d->direction == QXmppTransferJob::IncomingDirection &&
+        if (job->d->direction == direction &&
             job->d->jid == jid &&
             job->d->sid == sid)
-            return static_cast<QXmppTransferIncomingJob *>(job);
+            return job;
     }
     return nullptr;
 }
 
+QXmppTransferIncomingJob *QXmppTransferManagerPrivate::getIncomingJobBySid(const QString &jid, const QString &sid)
+{
+    return static_cast<QXmppTransferIncomingJob *>(getJobBySid(QXmppTransferJob::IncomingDirection, jid, sid));
+}
+
 QXmppTransferOutgoingJob *QXmppTransferManagerPrivate::getOutgoingJobByRequestId(const QString &jid, const QString &id)
 {
     return static_cast<QXmppTransferOutgoingJob *>(getJobByRequestId(QXmppTransferJob::OutgoingDirection, jid, id));
 }
 
+QXmppTransferOutgoingJob *QXmppTransferManagerPrivate::getOutgoingJobBySid(const QString &jid, const QString &sid)
+{
+    return static_cast<QXmppTransferOutgoingJob *>(getJobBySid(QXmppTransferJob::OutgoingDirection, jid, sid));
+}
+
 /// Constructs a QXmppTransferManager to handle incoming and outgoing
 /// file transfers.
 
@@ -818,15 +1408,33 @@ void QXmppTransferManager::byteStreamSetReceived(const QXmppByteStreamIq &iq)
 /// \cond
 QStringList QXmppTransferManager::discoveryFeatures() const
 {
-    return QStringList()
+    QStringList features = QStringList()
         << ns_ibb                               // XEP-0047: In-Band Bytestreams
         << ns_bytestreams                       // XEP-0065: SOCKS5 Bytestreams
         << ns_stream_initiation                 // XEP-0095: Stream Initiation
-        << ns_stream_initiation_file_transfer;  // XEP-0096: SI File Transfer
+        << ns_stream_initiation_file_transfer   // XEP-0096: SI File Transfer
+        << ns_stream_initiation_file_transfer_ranges  // QXmpp: ranges proposed by the sender
+        << ns_hashes;                           // XEP-0300: Use of Cryptographic Hash Functions in XMPP
+
+    // hash functions which can be used to verify received files
+    for (const auto &pair : HASH_ALGORITHMS)
+        features << QString::fromLatin1(ns_hash_function_text_names) + QLatin1Char(':') + pair.second;
+    return features;
 }
 
 bool QXmppTransferManager::handleStanza(const QDomElement &element)
 {
+    // XEP-0047: In-Band Bytestreams over message stanzas
+    if (element.tagName() == "message") {
+        if (!QXmppIbbDataIq::isIbbDataIq(element))
+            return false;
+
+        QXmppIbbDataIq ibbData;
+        ibbData.parse(element);
+        ibbDataMessageReceived(ibbData);
+        return true;
+    }
+
     if (element.tagName() != "iq")
         return false;
 
@@ -883,6 +1491,18 @@ void QXmppTransferManager::ibbCloseIqReceived(const QXmppIbbCloseIq &iq)
     QXmppTransferIncomingJob *job = d->getIncomingJobBySid(iq.from(), iq.sid());
     if (!job ||
         job->method() != QXmppTransferJob::InBandMethod) {
+        // the receiver closed one of our bytestreams before it was complete
+        QXmppTransferJob *outgoingJob = d->getOutgoingJobBySid(iq.from(), iq.sid());
+        if (outgoingJob &&
+            outgoingJob->method() == QXmppTransferJob::InBandMethod &&
+            outgoingJob->state() != QXmppTransferJob::FinishedState) {
+            response.setType(QXmppIq::Result);
+            client()->sendPacket(response);
+
+            outgoingJob->terminate(QXmppTransferJob::ProtocolError);
+            return;
+        }
+
         // the job is unknown, cancel it
         QXmppStanza::Error error(QXmppStanza::Error::Cancel, QXmppStanza::Error::ItemNotFound);
         response.setType(QXmppIq::Error);
@@ -917,6 +1537,8 @@ void QXmppTransferManager::ibbDataIqReceived(const QXmppIbbDataIq &iq)
         return;
     }
 
+    // several data IQs may be in flight, but they travel in order, so a gap
+    // in the sequence numbers means that one of them was lost
     if (iq.sequence() != job->d->ibbSequence) {
         // the packet is out of sequence
         QXmppStanza::Error error(QXmppStanza::Error::Cancel, QXmppStanza::Error::UnexpectedRequest);
@@ -935,6 +1557,33 @@ void QXmppTransferManager::ibbDataIqReceived(const QXmppIbbDataIq &iq)
     client()->sendPacket(response);
 }
 
+void QXmppTransferManager::ibbDataMessageReceived(const QXmppIbbDataIq &message)
+{
+    QXmppTransferIncomingJob *job = d->getIncomingJobBySid(message.from(), message.sid());
+    if (!job ||
+        job->method() != QXmppTransferJob::InBandMethod ||
+        job->state() != QXmppTransferJob::TransferState)
+        return;
+
+    if (message.sequence() != job->d->ibbSequence) {
+        // messages are not acknowledged, so a lost chunk can only be
+        // reported by closing the bytestream
+        warning(QStringLiteral("Received out of sequence in-band data from %1").arg(message.from()));
+
+        QXmppIbbCloseIq closeIq;
+        closeIq.setTo(job->d->jid);
+        closeIq.setSid(job->d->sid);
+        client()->sendPacket(closeIq);
+
+        job->terminate(QXmppTransferJob::ProtocolError);
+        return;
+    }
+
+    // write data
+    job->writeData(message.payload());
+    job->d->ibbSequence++;
+}
+
 void QXmppTransferManager::ibbOpenIqReceived(const QXmppIbbOpenIq &iq)
 {
     QXmppIq response;
@@ -962,6 +1611,7 @@ void QXmppTransferManager::ibbOpenIqReceived(const QXmppIbbOpenIq &iq)
     }
 
     job->d->blockSize = iq.blockSize();
+    job->d->ibbMessages = (iq.stanzaType() == QXmppIbbOpenIq::MessageStanza);
     job->setState(QXmppTransferJob::TransferState);
 
     // accept transfer
@@ -969,11 +1619,9 @@ void QXmppTransferManager::ibbOpenIqReceived(const QXmppIbbOpenIq &iq)
     client()->sendPacket(response);
 }
 
-void QXmppTransferManager::ibbResponseReceived(const QXmppIq &iq)
+void QXmppTransferManager::ibbResponseReceived(QXmppTransferJob *job, const QXmppIq &iq)
 {
-    QXmppTransferJob *job = d->getOutgoingJobByRequestId(iq.from(), iq.id());
-    if (!job ||
-        job->method() != QXmppTransferJob::InBandMethod ||
+    if (job->method() != QXmppTransferJob::InBandMethod ||
         job->state() == QXmppTransferJob::FinishedState)
         return;
 
@@ -981,32 +1629,88 @@ void QXmppTransferManager::ibbResponseReceived(const QXmppIq &iq)
     if (!job->d->iodevice->isOpen())
         return;
 
-    if (iq.type() == QXmppIq::Result) {
-        const QByteArray buffer = job->d->iodevice->read(job->d->blockSize);
-        job->setState(QXmppTransferJob::TransferState);
-        if (buffer.size()) {
-            // send next data block
+    // when data is sent in messages, the responses are those of the pings
+    // which follow them, and any response tells they were delivered
+    const bool acknowledges = job->d->ibbPending.contains(iq.id());
+    const auto pending = job->d->ibbPending.take(iq.id());
+
+    if (iq.type() == QXmppIq::Result || (acknowledges && job->d->ibbMessages)) {
+        if (acknowledges)
+            job->d->ibbAcknowledge(job->d->transferStart.elapsed() - pending.first, pending.second, d->ibbWindowSize);
+        else
+            job->setState(QXmppTransferJob::TransferState);
+
+        ibbSendData(job);
+    } else if (iq.type() == QXmppIq::Error) {
+        // close the bytestream
+        QXmppIbbCloseIq closeIq;
+        closeIq.setTo(job->d->jid);
+        closeIq.setSid(job->d->sid);
+        job->d->requestId = closeIq.id();
+        client()->sendPacket(closeIq);
+
+        job->terminate(QXmppTransferJob::ProtocolError);
+    }
+}
+
+void QXmppTransferManager::ibbSendData(QXmppTransferJob *job)
+{
+    // fill the window with data stanzas
+    const int window = qMin(job->d->ibbWindow, d->ibbWindowSize);
+    const qint64 end = job->d->endOffset();
+    const qint64 previouslyDone = job->d->done;
+    bool atEnd = false;
+    while (job->d->ibbInFlight < window) {
+        const qint64 length = end ? qMin(qint64(job->d->blockSize), end - job->d->done) : job->d->blockSize;
+        const QByteArray buffer = length > 0 ? job->d->iodevice->read(length) : QByteArray();
+        if (buffer.isEmpty()) {
+            atEnd = true;
+            break;
+        }
+
+        if (job->d->ibbMessages) {
+            QXmppElement dataElement;
+            dataElement.setTagName(QStringLiteral("data"));
+            dataElement.setAttribute(QStringLiteral("xmlns"), ns_ibb);
+            dataElement.setAttribute(QStringLiteral("sid"), job->d->sid);
+            dataElement.setAttribute(QStringLiteral("seq"), QString::number(job->d->ibbSequence++));
+            dataElement.setValue(QString::fromLatin1(QXmppBase64::encode(buffer)));
+
+            QXmppMessage message;
+            message.setTo(job->d->jid);
+            message.setType(QXmppMessage::Normal);
+            message.setExtensions(QXmppElementList() << dataElement);
+            client()->sendPacket(message);
+            job->d->ibbUnconfirmed++;
+        } else {
             QXmppIbbDataIq dataIq;
             dataIq.setTo(job->d->jid);
             dataIq.setSid(job->d->sid);
             dataIq.setSequence(job->d->ibbSequence++);
             dataIq.setPayload(buffer);
-            job->d->requestId = dataIq.id();
+            job->d->ibbPending.insert(dataIq.id(), qMakePair(job->d->transferStart.elapsed(), 1));
             client()->sendPacket(dataIq);
-
-            job->d->done += buffer.size();
-            job->progress(job->d->done, job->fileSize());
-        } else {
-            // close the bytestream
-            QXmppIbbCloseIq closeIq;
-            closeIq.setTo(job->d->jid);
-            closeIq.setSid(job->d->sid);
-            job->d->requestId = closeIq.id();
-            client()->sendPacket(closeIq);
-
-            job->terminate(QXmppTransferJob::NoError);
         }
-    } else if (iq.type() == QXmppIq::Error) {
+
+        job->d->ibbInFlight++;
+        job->d->done += buffer.size();
+    }
+
+    if (job->d->done != previouslyDone)
+        job->progress(job->d->done, job->fileSize());
+
+    // messages are not acknowledged, so ping the peer after every half
+    // window: the reply arrives once the preceding messages were delivered
+    if (job->d->ibbUnconfirmed &&
+        (atEnd || job->d->ibbUnconfirmed >= qMax(1, window / 2))) {
+        QXmppPingIq ping;
+        ping.setTo(job->d->jid);
+        job->d->ibbPending.insert(ping.id(), qMakePair(job->d->transferStart.elapsed(), job->d->ibbUnconfirmed));
+        job->d->ibbUnconfirmed = 0;
+        client()->sendPacket(ping);
+    }
+
+    if (atEnd && !job->d->ibbInFlight) {
         // close the bytestream
         QXmppIbbCloseIq closeIq;
         closeIq.setTo(job->d->jid);
@@ -1014,7 +1718,7 @@ void QXmppTransferManager::ibbResponseReceived(const QXmppIq &iq)
         job->d->requestId = closeIq.id();
         client()->sendPacket(closeIq);
 
-        job->terminate(QXmppTransferJob::ProtocolError);
+        job->terminate(QXmppTransferJob::NoError);
     }
 }
 
@@ -1044,11 +1748,12 @@ void QXmppTransferManager::_q_iqReceived(const QXmppIq &iq)
         }
 
         // handle IQ from peer
-        else if (ptr->d->jid == iq.from() && ptr->d->requestId == iq.id()) {
+        else if (ptr->d->jid == iq.from() &&
+                 (ptr->d->requestId == iq.id() || ptr->d->ibbPending.contains(iq.id()))) {
             QXmppTransferJob *job = ptr;
             if (job->direction() == QXmppTransferJob::OutgoingDirection &&
                 job->method() == QXmppTransferJob::InBandMethod) {
-                ibbResponseReceived(iq);
+                ibbResponseReceived(job, iq);
                 return;
             } else if (job->direction() == QXmppTransferJob::IncomingDirection &&
                        job->method() == QXmppTransferJob::SocksMethod) {
@@ -1146,6 +1851,14 @@ void QXmppTransferManager::_q_jobStateChanged(QXmppTransferJob::State state)
     response.setProfile(QXmppStreamInitiationIq::FileTransfer);
     response.setFeatureForm(form);
 
+    // request the part of the file we are missing
+    if (job->d->rangeOffset || job->d->rangeLength) {
+        QXmppTransferFileInfo rangeInfo;
+        rangeInfo.setRangeOffset(job->d->rangeOffset);
+        rangeInfo.setRangeLength(job->d->rangeLength);
+        response.setFileInfo(rangeInfo);
+    }
+
     client()->sendPacket(response);
 
     // notify user
@@ -1156,6 +1869,9 @@ void QXmppTransferManager::_q_jobStateChanged(QXmppTransferJob::State state)
 ///
 /// The remote party will be given the choice to accept or refuse the transfer.
 ///
+/// The file is hashed in a worker thread using hashAlgorithm(), the offer
+/// is sent once the hash is available.
+///
 /// Returns 0 if the \a jid is not valid or if the file at \a filePath cannot be read.
 ///
 /// \note The recipient's \a jid must be a full JID with a resource, for instance "user@host/resource".
@@ -1168,39 +1884,77 @@ QXmppTransferJob *QXmppTransferManager::sendFile(const QString &jid, const QStri
         return nullptr;
     }
 
-    QFileInfo info(filePath);
+    QXmppTransferJob *job = createFileJob(jid, filePath, description);
+    if (job->state() == QXmppTransferJob::FinishedState)
+        return job;
 
-    QXmppTransferFileInfo fileInfo;
-    fileInfo.setDate(info.lastModified());
-    fileInfo.setName(info.fileName());
-    fileInfo.setSize(info.size());
-    fileInfo.setDescription(description);
+    offerFile(QList<QXmppTransferJob *>() << job, filePath);
 
-    // open file
-    QIODevice *device = new QFile(filePath, this);
-    if (!device->open(QIODevice::ReadOnly)) {
-        warning(QString("Could not read from %1").arg(filePath));
-        delete device;
-        device = nullptr;
+    // notify user
+    emit jobStarted(job);
+
+    return job;
+}
+
+/// Sends the file at \a filePath to a remote party, split in \a count ranges
+/// which are transferred in parallel, each using its own bytestream.
+///
+/// This speeds up transfers on links with a high latency, on which a single
+/// bytestream cannot keep the link busy. Each offer proposes a range to the
+/// remote party, which writes it in place when accepting the job with
+/// QXmppTransferJob::accept(const QString &). The hash of the whole file is
+/// announced in each offer, but cannot be verified by the individual jobs.
+///
+/// Proposing ranges is not part of \xep{0096}: SI File Transfer, so the
+/// file is only split if the remote party's capabilities are known, see
+/// QXmppDiscoveryManager::cachedInfo(), and include support for it.
+/// Otherwise the file is sent in one piece using sendFile().
+///
+/// Returns an empty list if the \a jid is not valid.
+///
+/// \note The recipient's \a jid must be a full JID with a resource, for instance "user@host/resource".
+///
+/// \since QXmpp 1.4
+
+QList<QXmppTransferJob *> QXmppTransferManager::sendFileRanges(const QString &jid, const QString &filePath, int count, const QString &description)
+{
+    QList<QXmppTransferJob *> jobs;
+    if (QXmppUtils::jidToResource(jid).isEmpty()) {
+        warning("The file recipient's JID must be a full JID");
+        return jobs;
     }
 
-    // hash file
-    if (device && !device->isSequential()) {
-        QCryptographicHash hash(QCryptographicHash::Md5);
-        QByteArray buffer;
-        while (device->bytesAvailable()) {
-            buffer = device->read(16384);
-            hash.addData(buffer);
-        }
-        device->reset();
-        fileInfo.setHash(hash.result());
+    const qint64 size = QFileInfo(filePath).size();
+    count = int(qBound(qint64(1), qint64(count), qMax(size, qint64(1))));
+
+    // other implementations ignore the proposed range and would save each
+    // range as a whole file
+    if (count > 1 && !supportsRanges(client(), jid)) {
+        info(QString("%1 does not support receiving several ranges, sending the file in one piece").arg(jid));
+        count = 1;
+    }
+    if (count == 1) {
+        jobs << sendFile(jid, filePath, description);
+        return jobs;
     }
 
-    // create job
-    QXmppTransferJob *job = sendFile(jid, device, fileInfo);
-    job->setLocalFileUrl(QUrl::fromLocalFile(filePath));
-    job->d->deviceIsOwn = true;
-    return job;
+    // create one job per range
+    const qint64 rangeLength = (size + count - 1) / count;
+    for (qint64 offset = 0; offset < size; offset += rangeLength) {
+        QXmppTransferJob *job = createFileJob(jid, filePath, description);
+        job->d->fileInfo.setRangeOffset(offset);
+        job->d->fileInfo.setRangeLength(qMin(rangeLength, size - offset));
+        jobs << job;
+    }
+
+    if (jobs.first()->state() != QXmppTransferJob::FinishedState)
+        offerFile(jobs, filePath);
+
+    // notify user
+    for (auto *job : qAsConst(jobs))
+        emit jobStarted(job);
+
+    return jobs;
 }
 
 /// Sends the file in \a device to a remote party.
@@ -1220,6 +1974,23 @@ QXmppTransferJob *QXmppTransferManager::sendFile(const QString &jid, QIODevice *
         return nullptr;
     }
 
+    QXmppTransferJob *job = createOutgoingJob(jid, device, fileInfo, sid);
+    if (job->state() == QXmppTransferJob::FinishedState)
+        return job;
+
+    sendOffer(job);
+
+    // notify user
+    emit jobStarted(job);
+
+    return job;
+}
+
+// Creates an outgoing job, which is terminated if the device cannot be read
+// or no stream method is supported.
+
+QXmppTransferJob *QXmppTransferManager::createOutgoingJob(const QString &jid, QIODevice *device, const QXmppTransferFileInfo &fileInfo, const QString &sid)
+{
     auto *job = new QXmppTransferOutgoingJob(jid, client(), this);
     if (sid.isEmpty())
         job->d->sid = QXmppUtils::generateStanzaHash();
@@ -1234,12 +2005,90 @@ QXmppTransferJob *QXmppTransferManager::sendFile(const QString &jid, QIODevice *
         return job;
     }
 
+    // the receiver can resume from any offset of a random-access device
+    if (!device->isSequential())
+        job->d->fileInfo.setRangeSupported(true);
+
     // check we support some methods
     if (!d->supportedMethods) {
         job->terminate(QXmppTransferJob::ProtocolError);
         return job;
     }
 
+    // start job
+    d->jobs.append(job);
+
+    connect(job, &QObject::destroyed, this, &QXmppTransferManager::_q_jobDestroyed);
+    connect(job, QOverload<QXmppTransferJob::Error>::of(&QXmppTransferJob::error), this, &QXmppTransferManager::_q_jobError);
+    connect(job, &QXmppTransferJob::finished, this, &QXmppTransferManager::_q_jobFinished);
+
+    return job;
+}
+
+QXmppTransferJob *QXmppTransferManager::createFileJob(const QString &jid, const QString &filePath, const QString &description)
+{
+    QFileInfo info(filePath);
+
+    QXmppTransferFileInfo fileInfo;
+    fileInfo.setDate(info.lastModified());
+    fileInfo.setName(info.fileName());
+    fileInfo.setSize(info.size());
+    fileInfo.setDescription(description);
+
+    // open file
+    QIODevice *device = new QFile(filePath, this);
+    if (!device->open(QIODevice::ReadOnly)) {
+        warning(QString("Could not read from %1").arg(filePath));
+        delete device;
+        device = nullptr;
+    }
+
+    // create job
+    QXmppTransferJob *job = createOutgoingJob(jid, device, fileInfo, QString());
+    job->setLocalFileUrl(QUrl::fromLocalFile(filePath));
+    job->d->deviceIsOwn = true;
+    return job;
+}
+
+// Hashes the file at filePath once for all the jobs which send it, then
+// offers them.
+
+void QXmppTransferManager::offerFile(const QList<QXmppTransferJob *> &jobs, const QString &filePath)
+{
+    QXmppTransferJob *first = jobs.first();
+    if (first->d->iodevice->isSequential()) {
+        for (auto *job : jobs)
+            sendOffer(job);
+        return;
+    }
+
+    QList<QPointer<QXmppTransferJob>> pendingJobs;
+    for (auto *job : jobs)
+        pendingJobs << job;
+
+    // hash file, the hasher is stopped if the first job is terminated
+    first->d->hasher = new QXmppTransferHasher(filePath, d->hashAlgorithm, first);
+    connect(first->d->hasher, &QXmppTransferHasher::hashed, first, [this, pendingJobs](const QByteArray &hash) {
+        for (const auto &job : pendingJobs) {
+            if (!job || job->state() != QXmppTransferJob::OfferState)
+                continue;
+
+            if (hash.isEmpty()) {
+                warning(QString("Could not hash %1").arg(job->localFileUrl().toLocalFile()));
+                job->terminate(QXmppTransferJob::FileAccessError);
+                continue;
+            }
+
+            job->d->fileInfo.setHash(hash);
+            job->d->fileInfo.setHashAlgorithm(d->hashAlgorithm);
+            sendOffer(job);
+        }
+    });
+    first->d->hasher->start();
+}
+
+void QXmppTransferManager::sendOffer(QXmppTransferJob *job)
+{
     // collect supported stream methods
     QXmppDataForm form;
     form.setType(QXmppDataForm::Form);
@@ -1252,27 +2101,15 @@ QXmppTransferJob *QXmppTransferManager::sendFile(const QString &jid, QIODevice *
         methodField.setOptions(methodField.options() << qMakePair(QString(), QString::fromLatin1(ns_bytestreams)));
     form.setFields(QList<QXmppDataForm::Field>() << methodField);
 
-    // start job
-    d->jobs.append(job);
-
-    connect(job, &QObject::destroyed, this, &QXmppTransferManager::_q_jobDestroyed);
-    connect(job, QOverload<QXmppTransferJob::Error>::of(&QXmppTransferJob::error), this, &QXmppTransferManager::_q_jobError);
-    connect(job, &QXmppTransferJob::finished, this, &QXmppTransferManager::_q_jobFinished);
-
     QXmppStreamInitiationIq request;
     request.setType(QXmppIq::Set);
-    request.setTo(jid);
+    request.setTo(job->d->jid);
     request.setProfile(QXmppStreamInitiationIq::FileTransfer);
     request.setFileInfo(job->d->fileInfo);
     request.setFeatureForm(form);
     request.setSiId(job->d->sid);
     job->d->requestId = request.id();
     client()->sendPacket(request);
-
-    // notify user
-    emit jobStarted(job);
-
-    return job;
 }
 
 void QXmppTransferManager::_q_socksServerConnected(QTcpSocket *socket, const QString &hostName, quint16 port)
@@ -1286,6 +2123,7 @@ void QXmppTransferManager::_q_socksServerConnected(QTcpSocket *socket, const QSt
     }
     warning("QXmppSocksServer got a connection for a unknown stream");
     socket->close();
+    socket->deleteLater();
 }
 
 void QXmppTransferManager::socksServerSendOffer(QXmppTransferJob *job)
@@ -1354,16 +2192,36 @@ void QXmppTransferManager::streamInitiationResultReceived(const QXmppStreamIniti
         }
     }
 
+    // the remote party may only want a part of the file
+    const QXmppTransferFileInfo rangeInfo = iq.fileInfo();
+    if (rangeInfo.rangeOffset() || rangeInfo.rangeLength()) {
+        const qint64 size = job->d->fileInfo.size();
+        if (!job->d->fileInfo.isRangeSupported() ||
+            rangeInfo.rangeOffset() < 0 || rangeInfo.rangeLength() < 0 ||
+            (size && rangeInfo.rangeOffset() + rangeInfo.rangeLength() > size) ||
+            !job->d->iodevice->seek(job->d->iodevice->pos() + rangeInfo.rangeOffset())) {
+            warning("QXmppTransferManager received an invalid range");
+            job->terminate(QXmppTransferJob::ProtocolError);
+            return;
+        }
+
+        job->d->rangeOffset = rangeInfo.rangeOffset();
+        job->d->rangeLength = rangeInfo.rangeLength();
+        job->d->done = job->d->rangeOffset;
+    }
+
     // remote party accepted stream initiation
     job->setState(QXmppTransferJob::StartState);
     if (job->method() == QXmppTransferJob::InBandMethod) {
         // lower block size for IBB
         job->d->blockSize = d->ibbBlockSize;
+        job->d->ibbMessages = d->ibbMessagesEnabled;
 
         QXmppIbbOpenIq openIq;
         openIq.setTo(job->d->jid);
         openIq.setSid(job->d->sid);
         openIq.setBlockSize(job->d->blockSize);
+        openIq.setStanzaType(job->d->ibbMessages ? QXmppIbbOpenIq::MessageStanza : QXmppIbbOpenIq::IqStanza);
         job->d->requestId = openIq.id();
         client()->sendPacket(openIq);
     } else if (job->method() == QXmppTransferJob::SocksMethod) {
@@ -1519,3 +2377,76 @@ void QXmppTransferManager::setSupportedMethods(QXmppTransferJob::Methods methods
 {
     d->supportedMethods = methods;
 }
+
+/// Returns the algorithm used to hash the files sent using their path.
+///
+/// \since QXmpp 1.4
+
+QCryptographicHash::Algorithm QXmppTransferManager::hashAlgorithm() const
+{
+    return d->hashAlgorithm;
+}
+
+/// Sets the algorithm used to hash the files sent using their path, so that
+/// the receiver can verify them.
+///
+/// The default is MD5, as defined by \xep{0096}: SI File Transfer. Other
+/// algorithms are announced as defined by \xep{0300}: Use of Cryptographic
+/// Hash Functions in XMPP and may not be verified by older clients.
+///
+/// \since QXmpp 1.4
+
+void QXmppTransferManager::setHashAlgorithm(QCryptographicHash::Algorithm algorithm)
+{
+    d->hashAlgorithm = algorithm;
+}
+
+/// Returns the maximum number of unacknowledged data stanzas of an outgoing
+/// in-band bytestream.
+///
+/// \since QXmpp 1.4
+
+int QXmppTransferManager::ibbWindowSize() const
+{
+    return d->ibbWindowSize;
+}
+
+/// Sets the maximum number of unacknowledged data stanzas of an outgoing
+/// in-band bytestream.
+///
+/// Within this limit, the window starts with a single stanza and grows as
+/// long as the round-trip time stays close to the lowest one observed, it
+/// shrinks when the stanzas start queuing up. The default is 16, a size of
+/// 1 waits for each data stanza to be acknowledged before sending the next.
+///
+/// \since QXmpp 1.4
+
+void QXmppTransferManager::setIbbWindowSize(int windowSize)
+{
+    d->ibbWindowSize = qMax(1, windowSize);
+}
+
+/// Returns whether outgoing in-band bytestreams send their data in message
+/// stanzas.
+///
+/// \since QXmpp 1.4
+
+bool QXmppTransferManager::ibbMessagesEnabled() const
+{
+    return d->ibbMessagesEnabled;
+}
+
+/// Sets whether outgoing in-band bytestreams send their data in message
+/// stanzas instead of IQs, as allowed by \xep{0047}: In-Band Bytestreams.
+///
+/// Messages are not acknowledged one by one, instead the peer is pinged
+/// after every half window to know that the preceding messages were
+/// delivered. Only enable this if the peer supports it, older clients
+/// silently drop the data.
+///
+/// \since QXmpp 1.4
+
+void QXmppTransferManager::setIbbMessagesEnabled(bool enabled)
+{
+    d->ibbMessagesEnabled = enabled;
+}
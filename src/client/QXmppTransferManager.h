@@ -26,6 +26,7 @@
 
 #include "QXmppClientExtension.h"
 
+#include <QCryptographicHash>
 #include <QDateTime>
 #include <QSharedData>
 #include <QUrl>
@@ -56,6 +57,9 @@ public:
     QByteArray hash() const;
     void setHash(const QByteArray &hash);
 
+    QCryptographicHash::Algorithm hashAlgorithm() const;
+    void setHashAlgorithm(QCryptographicHash::Algorithm algorithm);
+
     QString name() const;
     void setName(const QString &name);
 
@@ -65,6 +69,15 @@ public:
     qint64 size() const;
     void setSize(qint64 size);
 
+    bool isRangeSupported() const;
+    void setRangeSupported(bool supported);
+
+    qint64 rangeOffset() const;
+    void setRangeOffset(qint64 offset);
+
+    qint64 rangeLength() const;
+    void setRangeLength(qint64 length);
+
     bool isNull() const;
     QXmppTransferFileInfo &operator=(const QXmppTransferFileInfo &other);
     bool operator==(const QXmppTransferFileInfo &other) const;
@@ -197,6 +210,7 @@ public Q_SLOTS:
     void abort();
     void accept(const QString &filePath);
     void accept(QIODevice *output);
+    void resume(const QString &filePath);
 
 private Q_SLOTS:
     void _q_terminated();
@@ -264,6 +278,15 @@ public:
     QXmppTransferJob::Methods supportedMethods() const;
     void setSupportedMethods(QXmppTransferJob::Methods methods);
 
+    QCryptographicHash::Algorithm hashAlgorithm() const;
+    void setHashAlgorithm(QCryptographicHash::Algorithm algorithm);
+
+    int ibbWindowSize() const;
+    void setIbbWindowSize(int windowSize);
+
+    bool ibbMessagesEnabled() const;
+    void setIbbMessagesEnabled(bool enabled);
+
     /// \cond
     QStringList discoveryFeatures() const override;
     bool handleStanza(const QDomElement &element) override;
@@ -287,6 +310,7 @@ Q_SIGNALS:
 public Q_SLOTS:
     QXmppTransferJob *sendFile(const QString &jid, const QString &filePath, const QString &description = QString());
     QXmppTransferJob *sendFile(const QString &jid, QIODevice *device, const QXmppTransferFileInfo &fileInfo, const QString &sid = QString());
+    QList<QXmppTransferJob *> sendFileRanges(const QString &jid, const QString &filePath, int count, const QString &description = QString());
 
 protected:
     /// \cond
@@ -310,12 +334,18 @@ private:
     void byteStreamSetReceived(const QXmppByteStreamIq &);
     void ibbCloseIqReceived(const QXmppIbbCloseIq &);
     void ibbDataIqReceived(const QXmppIbbDataIq &);
+    void ibbDataMessageReceived(const QXmppIbbDataIq &);
     void ibbOpenIqReceived(const QXmppIbbOpenIq &);
-    void ibbResponseReceived(const QXmppIq &);
+    void ibbResponseReceived(QXmppTransferJob *job, const QXmppIq &);
+    void ibbSendData(QXmppTransferJob *job);
     void streamInitiationIqReceived(const QXmppStreamInitiationIq &);
     void streamInitiationResultReceived(const QXmppStreamInitiationIq &);
     void streamInitiationSetReceived(const QXmppStreamInitiationIq &);
     void socksServerSendOffer(QXmppTransferJob *job);
+    QXmppTransferJob *createOutgoingJob(const QString &jid, QIODevice *device, const QXmppTransferFileInfo &fileInfo, const QString &sid);
+    QXmppTransferJob *createFileJob(const QString &jid, const QString &filePath, const QString &description);
+    void offerFile(const QList<QXmppTransferJob *> &jobs, const QString &filePath);
+    void sendOffer(QXmppTransferJob *job);
 
     friend class QXmppTransferManagerPrivate;
 };
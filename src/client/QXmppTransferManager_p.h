@@ -27,6 +27,8 @@
 #include "QXmppByteStreamIq.h"
 #include "QXmppTransferManager.h"
 
+#include <QThread>
+
 //
 //  W A R N I N G
 //  -------------
@@ -41,6 +43,29 @@
 class QTimer;
 class QXmppSocksClient;
 
+// Hashes a file in a worker thread, so that large files do not block the
+// event loop before they are offered.
+
+class QXmppTransferHasher : public QThread
+{
+    Q_OBJECT
+
+public:
+    QXmppTransferHasher(const QString &filePath, QCryptographicHash::Algorithm algorithm, QObject *parent);
+
+Q_SIGNALS:
+    // The hash is empty if the file could not be read or if hashing was
+    // interrupted.
+    void hashed(const QByteArray &hash);
+
+protected:
+    void run() override;
+
+private:
+    QString m_filePath;
+    QCryptographicHash::Algorithm m_algorithm;
+};
+
 class QXmppTransferIncomingJob : public QXmppTransferJob
 {
     Q_OBJECT
@@ -48,6 +73,7 @@ class QXmppTransferIncomingJob : public QXmppTransferJob
 public:
     QXmppTransferIncomingJob(const QString &jid, QXmppClient *client, QObject *parent);
     void checkData();
+    QCryptographicHash *receivedHash();
     void connectToHosts(const QXmppByteStreamIq &iq);
     bool writeData(const QByteArray &data);
 
@@ -58,11 +84,19 @@ private Q_SLOTS:
     void _q_receiveData();
 
 private:
+    // A connection attempt to a stream host.
+    struct Candidate
+    {
+        QXmppByteStreamIq::StreamHost host;
+        QXmppSocksClient *client;
+        QTimer *timer;
+    };
+
     void connectToNextHost();
+    bool takeCandidate(QObject *object, Candidate &candidate);
 
-    QXmppByteStreamIq::StreamHost m_candidateHost;
-    QXmppSocksClient *m_candidateClient;
-    QTimer *m_candidateTimer;
+    QList<Candidate> m_candidates;
+    QTimer *m_candidateDelayTimer;
     QList<QXmppByteStreamIq::StreamHost> m_streamCandidates;
     QString m_streamOfferId;
     QString m_streamOfferFrom;
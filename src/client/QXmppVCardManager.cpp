@@ -25,20 +25,191 @@
 
 #include "QXmppClient.h"
 #include "QXmppConstants_p.h"
+#include "QXmppPresence.h"
 #include "QXmppUtils.h"
 #include "QXmppVCardIq.h"
 
+#include <QCache>
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QDomDocument>
+#include <QFile>
+#include <QSaveFile>
+#include <QTimer>
+#include <QXmlStreamReader>
+#include <QXmlStreamWriter>
+
+// default number of seconds after which a cached vCard is retrieved again
+static const int DEFAULT_CACHE_MAX_AGE = 24 * 3600;
+
+// XEP-0153: vCard-Based Avatars, the hash of a photo is the SHA-1 of its data
+static QByteArray photoHash(const QByteArray& photo)
+{
+    if (photo.isEmpty())
+        return QByteArray();
+    return QCryptographicHash::hash(photo, QCryptographicHash::Sha1);
+}
+
 class QXmppVCardManagerPrivate
 {
 public:
+    struct CacheEntry
+    {
+        QXmppVCardIq vCard;
+        QByteArray photoHash;
+        QDateTime stamp;
+    };
+
+    bool isCacheEnabled() const;
+    QString cacheFileName(const QString& jid) const;
+    bool lookup(const QString& jid, CacheEntry& entry);
+    bool load(const QString& jid, CacheEntry& entry) const;
+    bool loadPhotoHash(const QString& jid, QByteArray& hash) const;
+    void store(const QString& jid, const QXmppVCardIq& vCard);
+    void remove(const QString& jid);
+
     QXmppVCardIq clientVCard;
     bool isClientVCardReceived;
+
+    // in-memory LRU cache and on-disk cache of other entities' vCards
+    QCache<QString, CacheEntry> cache;
+    QString cacheDirectory;
+    int cacheMaxAge;
+
+    // photo hash advertised in the presence of each entity
+    QHash<QString, QByteArray> advertisedHashes;
+
+    // pending requests by JID and by IQ id
+    QHash<QString, QString> pendingIds;
+    QHash<QString, QString> pendingJids;
+
+    static QXmppVCardIq failedResponse(const QString& id, const QString& jid, const QXmppStanza::Error& error);
 };
 
+// Returns an error response to a pending request.
+
+QXmppVCardIq QXmppVCardManagerPrivate::failedResponse(const QString& id, const QString& jid, const QXmppStanza::Error& error)
+{
+    QXmppVCardIq response;
+    response.setType(QXmppIq::Error);
+    response.setId(id);
+    response.setFrom(jid);
+    response.setError(error);
+    return response;
+}
+
+bool QXmppVCardManagerPrivate::isCacheEnabled() const
+{
+    return cache.maxCost() > 0 || !cacheDirectory.isEmpty();
+}
+
+QString QXmppVCardManagerPrivate::cacheFileName(const QString& jid) const
+{
+    const QByteArray name = QCryptographicHash::hash(jid.toUtf8(), QCryptographicHash::Sha1).toHex();
+    return QDir(cacheDirectory).filePath(QString::fromLatin1(name) + QStringLiteral(".vcard.xml"));
+}
+
+// Returns the cached vCard for the JID, unless it is too old or its photo
+// does not match the hash advertised by the entity anymore.
+
+bool QXmppVCardManagerPrivate::lookup(const QString& jid, CacheEntry& entry)
+{
+    if (const auto* cached = cache.object(jid)) {
+        entry = *cached;
+    } else if (load(jid, entry)) {
+        if (cache.maxCost() > 0)
+            cache.insert(jid, new CacheEntry(entry));
+    } else {
+        return false;
+    }
+
+    if (!entry.stamp.isValid() || entry.stamp.secsTo(QDateTime::currentDateTimeUtc()) >= cacheMaxAge)
+        return false;
+
+    const auto advertised = advertisedHashes.constFind(jid);
+    return advertised == advertisedHashes.constEnd() || *advertised == entry.photoHash;
+}
+
+bool QXmppVCardManagerPrivate::load(const QString& jid, CacheEntry& entry) const
+{
+    if (cacheDirectory.isEmpty())
+        return false;
+
+    QFile file(cacheFileName(jid));
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    QDomDocument doc;
+    if (!doc.setContent(&file, true))
+        return false;
+
+    const QDomElement iqElement = doc.documentElement().firstChildElement(QStringLiteral("iq"));
+    if (doc.documentElement().attribute(QStringLiteral("jid")) != jid || !QXmppVCardIq::isVCard(iqElement))
+        return false;
+
+    entry.vCard.parse(iqElement);
+    entry.photoHash = QByteArray::fromHex(doc.documentElement().attribute(QStringLiteral("hash")).toLatin1());
+    entry.stamp = QXmppUtils::datetimeFromString(doc.documentElement().attribute(QStringLiteral("stamp")));
+    return true;
+}
+
+// Reads the photo hash of a vCard stored on disk without parsing the vCard.
+
+bool QXmppVCardManagerPrivate::loadPhotoHash(const QString& jid, QByteArray& hash) const
+{
+    if (cacheDirectory.isEmpty())
+        return false;
+
+    QFile file(cacheFileName(jid));
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    QXmlStreamReader reader(&file);
+    if (!reader.readNextStartElement() || reader.attributes().value(QStringLiteral("jid")) != jid)
+        return false;
+
+    hash = QByteArray::fromHex(reader.attributes().value(QStringLiteral("hash")).toLatin1());
+    return true;
+}
+
+void QXmppVCardManagerPrivate::store(const QString& jid, const QXmppVCardIq& vCard)
+{
+    CacheEntry entry { vCard, photoHash(vCard.photo()), QDateTime::currentDateTimeUtc() };
+    entry.vCard.setId(QString());
+    entry.vCard.setTo(QString());
+
+    if (!cacheDirectory.isEmpty()) {
+        QSaveFile file(cacheFileName(jid));
+        if (file.open(QIODevice::WriteOnly)) {
+            QXmlStreamWriter writer(&file);
+            writer.writeStartElement(QStringLiteral("vcard"));
+            writer.writeAttribute(QStringLiteral("jid"), jid);
+            writer.writeAttribute(QStringLiteral("hash"), QString::fromLatin1(entry.photoHash.toHex()));
+            writer.writeAttribute(QStringLiteral("stamp"), QXmppUtils::datetimeToString(entry.stamp));
+            entry.vCard.toXml(&writer);
+            writer.writeEndElement();
+            file.commit();
+        }
+    }
+
+    if (cache.maxCost() > 0)
+        cache.insert(jid, new CacheEntry(entry));
+}
+
+void QXmppVCardManagerPrivate::remove(const QString& jid)
+{
+    cache.remove(jid);
+    if (!cacheDirectory.isEmpty())
+        QFile::remove(cacheFileName(jid));
+}
+
 QXmppVCardManager::QXmppVCardManager()
     : d(new QXmppVCardManagerPrivate)
 {
     d->isClientVCardReceived = false;
+    d->cache.setMaxCost(0);
+    d->cacheMaxAge = DEFAULT_CACHE_MAX_AGE;
 }
 
 QXmppVCardManager::~QXmppVCardManager()
@@ -49,15 +220,44 @@ QXmppVCardManager::~QXmppVCardManager()
 /// This function requests the server for vCard of the specified jid.
 /// Once received the signal vCardReceived() is emitted.
 ///
+/// If the vCard is cached and its photo matches the hash advertised by the
+/// entity, the signal is emitted without sending a request. If a request for
+/// the same JID is already pending, its id is returned.
+///
 /// \param jid Jid of the specific entry in the roster
 ///
 QString QXmppVCardManager::requestVCard(const QString& jid)
 {
+    const bool isOther = !jid.isEmpty() && jid != client()->configuration().jidBare();
+    if (isOther) {
+        // answer from the cache
+        QXmppVCardManagerPrivate::CacheEntry entry;
+        if (d->lookup(jid, entry)) {
+            QXmppVCardIq response = entry.vCard;
+            response.setId(QXmppUtils::generateStanzaHash());
+            response.setType(QXmppIq::Result);
+            response.setFrom(jid);
+            QTimer::singleShot(0, this, [this, response]() {
+                emit vCardReceived(response);
+            });
+            return response.id();
+        }
+
+        // wait for the response to the pending request
+        const auto pending = d->pendingIds.constFind(jid);
+        if (pending != d->pendingIds.constEnd())
+            return *pending;
+    }
+
     QXmppVCardIq request(jid);
-    if (client()->sendPacket(request))
-        return request.id();
-    else
+    if (!client()->sendPacket(request))
         return QString();
+
+    if (isOther) {
+        d->pendingIds.insert(jid, request.id());
+        d->pendingJids.insert(request.id(), jid);
+    }
+    return request.id();
 }
 
 /// Returns the vCard of the connected client.
@@ -100,6 +300,123 @@ bool QXmppVCardManager::isClientVCardReceived() const
     return d->isClientVCardReceived;
 }
 
+///
+/// Returns the maximum number of vCards kept in memory.
+///
+/// \since QXmpp 1.4
+///
+int QXmppVCardManager::vCardCacheSize() const
+{
+    return d->cache.maxCost();
+}
+
+///
+/// Sets the maximum number of vCards kept in memory. When the limit is
+/// reached, the least recently used vCards are dropped.
+///
+/// The default is 0, which disables the in-memory cache.
+///
+/// \param count
+///
+/// \since QXmpp 1.4
+///
+void QXmppVCardManager::setVCardCacheSize(int count)
+{
+    d->cache.setMaxCost(count);
+}
+
+///
+/// Returns the directory in which vCards are cached.
+///
+/// \since QXmpp 1.4
+///
+QString QXmppVCardManager::vCardCacheDirectory() const
+{
+    return d->cacheDirectory;
+}
+
+///
+/// Sets the directory in which vCards are cached, so that they are kept
+/// across sessions. The directory is created if needed.
+///
+/// By default vCards are not cached on disk.
+///
+/// \param path
+///
+/// \since QXmpp 1.4
+///
+void QXmppVCardManager::setVCardCacheDirectory(const QString& path)
+{
+    d->cacheDirectory = path;
+    if (!path.isEmpty())
+        QDir().mkpath(path);
+}
+
+///
+/// Returns the number of seconds after which a cached vCard is retrieved
+/// again.
+///
+/// \since QXmpp 1.4
+///
+int QXmppVCardManager::vCardCacheMaxAge() const
+{
+    return d->cacheMaxAge;
+}
+
+///
+/// Sets the number of seconds after which a cached vCard is retrieved again,
+/// so that changes which are not advertised in the presence of the entity
+/// are picked up.
+///
+/// The default is one day.
+///
+/// \param seconds
+///
+/// \since QXmpp 1.4
+///
+void QXmppVCardManager::setVCardCacheMaxAge(int seconds)
+{
+    d->cacheMaxAge = seconds;
+}
+
+///
+/// Looks up the cached vCard of \a bareJid.
+///
+/// Returns false if the vCard is not cached, if it is older than
+/// vCardCacheMaxAge() or if its photo does not match the hash advertised by
+/// the entity anymore.
+///
+/// \param bareJid
+/// \param vCard
+///
+/// \since QXmpp 1.4
+///
+bool QXmppVCardManager::cachedVCard(const QString& bareJid, QXmppVCardIq& vCard) const
+{
+    QXmppVCardManagerPrivate::CacheEntry entry;
+    if (!d->lookup(bareJid, entry))
+        return false;
+
+    vCard = entry.vCard;
+    return true;
+}
+
+///
+/// Removes all vCards from the memory and disk caches.
+///
+/// \since QXmpp 1.4
+///
+void QXmppVCardManager::clearVCardCache()
+{
+    d->cache.clear();
+    if (!d->cacheDirectory.isEmpty()) {
+        QDir dir(d->cacheDirectory);
+        const auto fileNames = dir.entryList(QStringList() << QStringLiteral("*.vcard.xml"), QDir::Files);
+        for (const auto& fileName : fileNames)
+            dir.remove(fileName);
+    }
+}
+
 /// \cond
 QStringList QXmppVCardManager::discoveryFeatures() const
 {
@@ -109,10 +426,35 @@ QStringList QXmppVCardManager::discoveryFeatures() const
 
 bool QXmppVCardManager::handleStanza(const QDomElement& element)
 {
+    // errors may be returned without a vCard
+    if (element.tagName() == "iq" && !QXmppVCardIq::isVCard(element)) {
+        const QString id = element.attribute(QStringLiteral("id"));
+        if (!d->pendingJids.contains(id) || element.attribute(QStringLiteral("type")) != QStringLiteral("error"))
+            return false;
+
+        const QString jid = d->pendingJids.take(id);
+        d->pendingIds.remove(jid);
+
+        QXmppIq error;
+        error.parse(element);
+        emit vCardReceived(QXmppVCardManagerPrivate::failedResponse(id, jid, error.error()));
+        return true;
+    }
+
     if (element.tagName() == "iq" && QXmppVCardIq::isVCard(element)) {
         QXmppVCardIq vCardIq;
         vCardIq.parse(element);
 
+        // complete the pending request
+        const QString jid = d->pendingJids.take(vCardIq.id());
+        if (!jid.isEmpty())
+            d->pendingIds.remove(jid);
+
+        // cache the vCards of other entities
+        if (vCardIq.type() == QXmppIq::Result && d->isCacheEnabled() &&
+            !vCardIq.from().isEmpty() && vCardIq.from() != client()->configuration().jidBare())
+            d->store(vCardIq.from(), vCardIq);
+
         if (vCardIq.from().isEmpty() || vCardIq.from() == client()->configuration().jidBare()) {
             d->clientVCard = vCardIq;
             d->isClientVCardReceived = true;
@@ -126,4 +468,61 @@ bool QXmppVCardManager::handleStanza(const QDomElement& element)
 
     return false;
 }
+
+void QXmppVCardManager::setClient(QXmppClient* client)
+{
+    QXmppClientExtension::setClient(client);
+
+    connect(client, &QXmppClient::presenceReceived,
+            this, &QXmppVCardManager::_q_presenceReceived);
+
+    // responses to pending requests will not arrive anymore, and the
+    // advertised hashes are sent again with the presences of the next session
+    connect(client, &QXmppClient::disconnected, this, [this]() {
+        d->advertisedHashes.clear();
+
+        const auto pendingJids = d->pendingJids;
+        d->pendingIds.clear();
+        d->pendingJids.clear();
+
+        const QXmppStanza::Error error(QXmppStanza::Error::Wait, QXmppStanza::Error::ServiceUnavailable,
+                                       QStringLiteral("The connection was closed before a response was received"));
+        for (auto itr = pendingJids.cbegin(); itr != pendingJids.cend(); ++itr)
+            emit vCardReceived(QXmppVCardManagerPrivate::failedResponse(itr.key(), itr.value(), error));
+    });
+}
 /// \endcond
+
+void QXmppVCardManager::_q_presenceReceived(const QXmppPresence& presence)
+{
+    if (presence.type() != QXmppPresence::Available ||
+        (presence.vCardUpdateType() != QXmppPresence::VCardUpdateValidPhoto &&
+         presence.vCardUpdateType() != QXmppPresence::VCardUpdateNoPhoto))
+        return;
+
+    // room occupants have their own vCard
+    const QString jid = presence.mucItem().isNull() ? QXmppUtils::jidToBareJid(presence.from()) : presence.from();
+    if (jid.isEmpty() || jid == client()->configuration().jidBare())
+        return;
+
+    const QByteArray hash = presence.vCardUpdateType() == QXmppPresence::VCardUpdateValidPhoto ? presence.photoHash() : QByteArray();
+    const auto advertised = d->advertisedHashes.constFind(jid);
+    if (advertised != d->advertisedHashes.constEnd() && *advertised == hash)
+        return;
+    d->advertisedHashes.insert(jid, hash);
+
+    // retrieve the vCard again if the cached photo changed
+    QByteArray cachedHash;
+    bool cached = false;
+    if (const auto* entry = d->cache.object(jid)) {
+        cachedHash = entry->photoHash;
+        cached = true;
+    } else {
+        cached = d->loadPhotoHash(jid, cachedHash);
+    }
+
+    if (cached && cachedHash != hash) {
+        d->remove(jid);
+        requestVCard(jid);
+    }
+}
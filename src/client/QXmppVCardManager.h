@@ -26,6 +26,7 @@
 
 #include "QXmppClientExtension.h"
 
+class QXmppPresence;
 class QXmppVCardIq;
 class QXmppVCardManagerPrivate;
 
@@ -51,6 +52,16 @@ class QXmppVCardManagerPrivate;
 ///
 /// \note Client can't set/change vCards of roster entries.
 ///
+/// <B>Caching vCards:</B><BR>
+/// The vCards of other entities can be cached in memory, see
+/// setVCardCacheSize(), and on disk, see setVCardCacheDirectory(). A cached
+/// vCard is returned by requestVCard() without any network traffic for as
+/// long as the photo hash advertised by the contact's presence (\xep{0153}:
+/// vCard-Based Avatars) matches its photo and it is not older than
+/// vCardCacheMaxAge(). When the advertised hash changes, the vCard is
+/// requested again and vCardReceived() is emitted. Requests for
+/// a JID whose vCard is already being retrieved are collapsed.
+///
 /// \ingroup Managers
 ///
 class QXMPP_EXPORT QXmppVCardManager : public QXmppClientExtension
@@ -69,6 +80,18 @@ public:
     QString requestClientVCard();
     bool isClientVCardReceived() const;
 
+    int vCardCacheSize() const;
+    void setVCardCacheSize(int count);
+
+    QString vCardCacheDirectory() const;
+    void setVCardCacheDirectory(const QString& path);
+
+    int vCardCacheMaxAge() const;
+    void setVCardCacheMaxAge(int seconds);
+
+    bool cachedVCard(const QString& bareJid, QXmppVCardIq& vCard) const;
+    void clearVCardCache();
+
     /// \cond
     QStringList discoveryFeatures() const override;
     bool handleStanza(const QDomElement& element) override;
@@ -77,12 +100,23 @@ public:
 Q_SIGNALS:
     /// This signal is emitted when the requested vCard is received
     /// after calling the requestVCard() function.
+    ///
+    /// If the request failed or the connection was closed before a response
+    /// was received, an IQ of type error is emitted.
     void vCardReceived(const QXmppVCardIq&);
 
     /// This signal is emitted when the client's vCard is received
     /// after calling the requestClientVCard() function.
     void clientVCardReceived();
 
+protected:
+    /// \cond
+    void setClient(QXmppClient* client) override;
+    /// \endcond
+
+private Q_SLOTS:
+    void _q_presenceReceived(const QXmppPresence& presence);
+
 private:
     QXmppVCardManagerPrivate* d;
 };
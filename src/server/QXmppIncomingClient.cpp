@@ -24,6 +24,7 @@
 #include "QXmppIncomingClient.h"
 
 #include "QXmppBindIq.h"
+#include "QXmppCompression_p.h"
 #include "QXmppConstants_p.h"
 #include "QXmppMessage.h"
 #include "QXmppPasswordChecker.h"
@@ -51,15 +52,32 @@ public:
     QXmppPasswordChecker *passwordChecker;
     QXmppSaslServer *saslServer;
 
+    // XEP-0388: Extensible SASL Profile
+    bool isSasl2;
+    // XEP-0386: Bind 2
+    bool bind2Requested;
+    QString bind2Tag;
+    // XEP-0198: Stream Management, which is not supported
+    bool resumeRequested;
+
+    // XEP-0138: Stream Compression
+    bool compressionEnabled;
+    int compressionLevel;
+
     void checkCredentials(const QByteArray &response);
     QString origin() const;
 
+    void sendStreamFeatures();
+    void sendSaslChallenge(const QByteArray &challenge);
+    void sendSaslFailure(const QString &condition = QString());
+    void sendSaslSuccess();
+
 private:
     QXmppIncomingClient *q;
 };
 
 QXmppIncomingClientPrivate::QXmppIncomingClientPrivate(QXmppIncomingClient *qq)
-    : idleTimer(nullptr), passwordChecker(nullptr), saslServer(nullptr), q(qq)
+    : idleTimer(nullptr), passwordChecker(nullptr), saslServer(nullptr), isSasl2(false), bind2Requested(false), resumeRequested(false), compressionEnabled(false), compressionLevel(-1), q(qq)
 {
 }
 
@@ -95,6 +113,85 @@ QString QXmppIncomingClientPrivate::origin() const
         return "<unknown>";
 }
 
+void QXmppIncomingClientPrivate::sendStreamFeatures()
+{
+    QXmppStreamFeatures features;
+    QSslSocket *socket = q->socket();
+    if (socket && !socket->isEncrypted() && !socket->localCertificate().isNull() && !socket->privateKey().isNull())
+        features.setTlsMode(QXmppStreamFeatures::Enabled);
+    if (!jid.isEmpty()) {
+        features.setBindMode(QXmppStreamFeatures::Required);
+        features.setSessionMode(QXmppStreamFeatures::Enabled);
+
+        // XEP-0138: Stream Compression
+        if (compressionEnabled && !q->isCompressionEnabled() && QXmppStreamCompressor::isSupported())
+            features.setCompressionMethods(QStringList() << QStringLiteral("zlib"));
+    } else if (passwordChecker) {
+        QStringList mechanisms;
+        mechanisms << "PLAIN";
+        if (passwordChecker->hasGetPassword())
+            mechanisms << "DIGEST-MD5";
+        features.setAuthMechanisms(mechanisms);
+
+        // XEP-0388: Extensible SASL Profile and XEP-0386: Bind 2
+        //
+        // stream management and message carbons are not implemented, so
+        // neither inline resumption nor inline features are offered
+        features.setSasl2Mechanisms(mechanisms);
+        features.setBind2Available(true);
+    }
+    q->sendPacket(features);
+}
+
+void QXmppIncomingClientPrivate::sendSaslChallenge(const QByteArray &challenge)
+{
+    if (isSasl2)
+        q->sendPacket(QXmppSasl2Challenge(challenge));
+    else
+        q->sendPacket(QXmppSaslChallenge(challenge));
+}
+
+void QXmppIncomingClientPrivate::sendSaslFailure(const QString &condition)
+{
+    if (isSasl2)
+        q->sendPacket(QXmppSasl2Failure(condition));
+    else
+        q->sendPacket(QXmppSaslFailure(condition));
+}
+
+void QXmppIncomingClientPrivate::sendSaslSuccess()
+{
+    if (!isSasl2) {
+        q->sendPacket(QXmppSaslSuccess());
+        q->handleStart();
+        return;
+    }
+
+    // with SASL 2 the stream is not restarted, the resource is either bound
+    // inline or after new stream features have been sent
+    QXmppSasl2Success success;
+
+    // tell the client its previous stream is gone, so that it does not
+    // take the new session for a resumed one
+    if (resumeRequested)
+        success.setResumeFailed(true);
+
+    if (bind2Requested) {
+        resource = QXmppUtils::generateStanzaHash(8);
+        if (!bind2Tag.isEmpty())
+            resource.prepend(bind2Tag + QLatin1Char('.'));
+        jid = QString("%1/%2").arg(QXmppUtils::jidToBareJid(jid), resource);
+        success.setBound(true);
+    }
+    success.setAuthorizationIdentifier(jid);
+    q->sendPacket(success);
+
+    if (bind2Requested)
+        emit q->connected();
+    else
+        sendStreamFeatures();
+}
+
 /// Constructs a new incoming client stream.
 ///
 /// \param socket The socket for the XMPP stream.
@@ -173,6 +270,30 @@ void QXmppIncomingClient::setPasswordChecker(QXmppPasswordChecker *checker)
     d->passwordChecker = checker;
 }
 
+/// Sets whether \xep{0138}: Stream Compression is offered once the client
+/// has authenticated.
+///
+/// \param enabled
+///
+/// \since QXmpp 1.4
+
+void QXmppIncomingClient::setStreamCompressionEnabled(bool enabled)
+{
+    d->compressionEnabled = enabled;
+}
+
+/// Sets the zlib level used for stream compression, from 0 (no compression)
+/// to 9 (best compression), or -1 for the zlib default level.
+///
+/// \param level
+///
+/// \since QXmpp 1.4
+
+void QXmppIncomingClient::setStreamCompressionLevel(int level)
+{
+    d->compressionLevel = level;
+}
+
 /// \cond
 void QXmppIncomingClient::handleStream(const QDomElement &streamElement)
 {
@@ -210,20 +331,7 @@ void QXmppIncomingClient::handleStream(const QDomElement &streamElement)
     }
 
     // send stream features
-    QXmppStreamFeatures features;
-    if (socket() && !socket()->isEncrypted() && !socket()->localCertificate().isNull() && !socket()->privateKey().isNull())
-        features.setTlsMode(QXmppStreamFeatures::Enabled);
-    if (!d->jid.isEmpty()) {
-        features.setBindMode(QXmppStreamFeatures::Required);
-        features.setSessionMode(QXmppStreamFeatures::Enabled);
-    } else if (d->passwordChecker) {
-        QStringList mechanisms;
-        mechanisms << "PLAIN";
-        if (d->passwordChecker->hasGetPassword())
-            mechanisms << "DIGEST-MD5";
-        features.setAuthMechanisms(mechanisms);
-    }
-    sendPacket(features);
+    d->sendStreamFeatures();
 }
 
 void QXmppIncomingClient::handleStanza(const QDomElement &nodeRecv)
@@ -238,21 +346,67 @@ void QXmppIncomingClient::handleStanza(const QDomElement &nodeRecv)
         socket()->flush();
         socket()->startServerEncryption();
         return;
-    } else if (ns == ns_sasl) {
+    } else if (QXmppCompressPacket::isCompressPacket(nodeRecv)) {
+        QXmppCompressPacket request;
+        request.parse(nodeRecv);
+        if (request.type() != QXmppCompressPacket::Compress)
+            return;
+
+        QXmppCompressPacket response(QXmppCompressPacket::Failure);
+        if (!d->compressionEnabled || d->jid.isEmpty() || isCompressionEnabled() ||
+            !QXmppStreamCompressor::isSupported()) {
+            response.setCondition(QStringLiteral("setup-failed"));
+            sendPacket(response);
+        } else if (request.method() != QLatin1String("zlib")) {
+            response.setCondition(QStringLiteral("unsupported-method"));
+            sendPacket(response);
+        } else {
+            // the client restarts the stream, compressed
+            sendPacket(QXmppCompressPacket(QXmppCompressPacket::Compressed));
+            if (!startCompression(d->compressionLevel)) {
+                disconnectFromHost();
+                return;
+            }
+            handleStart();
+            updateCounter("incoming-client.compression.started");
+        }
+        return;
+    } else if (ns == ns_sasl || ns == ns_sasl_2) {
+        d->isSasl2 = (ns == ns_sasl_2);
+
         if (!d->passwordChecker) {
             warning("Cannot perform authentication, no password checker");
-            sendPacket(QXmppSaslFailure("temporary-auth-failure"));
+            d->sendSaslFailure("temporary-auth-failure");
             disconnectFromHost();
             return;
         }
 
-        if (nodeRecv.tagName() == QLatin1String("auth")) {
-            QXmppSaslAuth auth;
-            auth.parse(nodeRecv);
+        if (nodeRecv.tagName() == QLatin1String("auth") ||
+            nodeRecv.tagName() == QLatin1String("authenticate")) {
+            QString mechanism;
+            QByteArray initialResponse;
+            if (d->isSasl2) {
+                QXmppSasl2Authenticate authenticate;
+                authenticate.parse(nodeRecv);
+                mechanism = authenticate.mechanism();
+                initialResponse = authenticate.initialResponse();
+                d->bind2Requested = authenticate.bindRequested();
+                d->bind2Tag = authenticate.bindTag();
+                d->resumeRequested = authenticate.resumeRequested();
+
+                // features which were not offered are ignored
+                if (!authenticate.bindFeatures().isEmpty())
+                    info(QStringLiteral("Ignoring inline features %1 from %2").arg(authenticate.bindFeatures().join(QLatin1Char(' ')), d->origin()));
+            } else {
+                QXmppSaslAuth auth;
+                auth.parse(nodeRecv);
+                mechanism = auth.mechanism();
+                initialResponse = auth.value();
+            }
 
-            d->saslServer = QXmppSaslServer::create(auth.mechanism(), this);
+            d->saslServer = QXmppSaslServer::create(mechanism, this);
             if (!d->saslServer) {
-                sendPacket(QXmppSaslFailure("invalid-mechanism"));
+                d->sendSaslFailure("invalid-mechanism");
                 disconnectFromHost();
                 return;
             }
@@ -260,45 +414,52 @@ void QXmppIncomingClient::handleStanza(const QDomElement &nodeRecv)
             d->saslServer->setRealm(d->domain.toUtf8());
 
             QByteArray challenge;
-            QXmppSaslServer::Response result = d->saslServer->respond(auth.value(), challenge);
+            QXmppSaslServer::Response result = d->saslServer->respond(initialResponse, challenge);
 
             if (result == QXmppSaslServer::InputNeeded) {
                 // check credentials
-                d->checkCredentials(auth.value());
+                d->checkCredentials(initialResponse);
             } else if (result == QXmppSaslServer::Challenge) {
-                sendPacket(QXmppSaslChallenge(challenge));
+                d->sendSaslChallenge(challenge);
             } else {
                 // FIXME: what condition?
-                sendPacket(QXmppSaslFailure());
+                d->sendSaslFailure();
                 disconnectFromHost();
                 return;
             }
         } else if (nodeRecv.tagName() == QLatin1String("response")) {
-            QXmppSaslResponse response;
-            response.parse(nodeRecv);
+            QByteArray value;
+            if (d->isSasl2) {
+                QXmppSasl2Response response;
+                response.parse(nodeRecv);
+                value = response.value();
+            } else {
+                QXmppSaslResponse response;
+                response.parse(nodeRecv);
+                value = response.value();
+            }
 
             if (!d->saslServer) {
                 warning("SASL response received, but no mechanism selected");
-                sendPacket(QXmppSaslFailure());
+                d->sendSaslFailure();
                 disconnectFromHost();
                 return;
             }
 
             QByteArray challenge;
-            QXmppSaslServer::Response result = d->saslServer->respond(response.value(), challenge);
+            QXmppSaslServer::Response result = d->saslServer->respond(value, challenge);
             if (result == QXmppSaslServer::InputNeeded) {
                 // check credentials
-                d->checkCredentials(response.value());
+                d->checkCredentials(value);
             } else if (result == QXmppSaslServer::Succeeded) {
                 // authentication succeeded
                 d->jid = QString("%1@%2").arg(d->saslServer->username(), d->domain);
                 info(QString("Authentication succeeded for '%1' from %2").arg(d->jid, d->origin()));
                 updateCounter("incoming-client.auth.success");
-                sendPacket(QXmppSaslSuccess());
-                handleStart();
+                d->sendSaslSuccess();
             } else {
                 // FIXME: what condition?
-                sendPacket(QXmppSaslFailure());
+                d->sendSaslFailure();
                 disconnectFromHost();
             }
         }
@@ -379,7 +540,7 @@ void QXmppIncomingClient::onDigestReply()
     if (reply->error() == QXmppPasswordReply::TemporaryError) {
         warning(QString("Temporary authentication failure for '%1' from %2").arg(d->saslServer->username(), d->origin()));
         updateCounter("incoming-client.auth.temporary-auth-failure");
-        sendPacket(QXmppSaslFailure("temporary-auth-failure"));
+        d->sendSaslFailure("temporary-auth-failure");
         disconnectFromHost();
         return;
     }
@@ -391,13 +552,13 @@ void QXmppIncomingClient::onDigestReply()
     if (result != QXmppSaslServer::Challenge) {
         warning(QString("Authentication failed for '%1' from %2").arg(d->saslServer->username(), d->origin()));
         updateCounter("incoming-client.auth.not-authorized");
-        sendPacket(QXmppSaslFailure("not-authorized"));
+        d->sendSaslFailure("not-authorized");
         disconnectFromHost();
         return;
     }
 
     // send new challenge
-    sendPacket(QXmppSaslChallenge(challenge));
+    d->sendSaslChallenge(challenge);
 }
 
 void QXmppIncomingClient::onPasswordReply()
@@ -413,19 +574,18 @@ void QXmppIncomingClient::onPasswordReply()
         d->jid = jid;
         info(QString("Authentication succeeded for '%1' from %2").arg(d->jid, d->origin()));
         updateCounter("incoming-client.auth.success");
-        sendPacket(QXmppSaslSuccess());
-        handleStart();
+        d->sendSaslSuccess();
         break;
     case QXmppPasswordReply::AuthorizationError:
         warning(QString("Authentication failed for '%1' from %2").arg(jid, d->origin()));
         updateCounter("incoming-client.auth.not-authorized");
-        sendPacket(QXmppSaslFailure("not-authorized"));
+        d->sendSaslFailure("not-authorized");
         disconnectFromHost();
         break;
     case QXmppPasswordReply::TemporaryError:
         warning(QString("Temporary authentication failure for '%1' from %2").arg(jid, d->origin()));
         updateCounter("incoming-client.auth.temporary-auth-failure");
-        sendPacket(QXmppSaslFailure("temporary-auth-failure"));
+        d->sendSaslFailure("temporary-auth-failure");
         disconnectFromHost();
         break;
     }
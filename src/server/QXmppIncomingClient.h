@@ -49,6 +49,8 @@ public:
 
     void setInactivityTimeout(int secs);
     void setPasswordChecker(QXmppPasswordChecker *checker);
+    void setStreamCompressionEnabled(bool enabled);
+    void setStreamCompressionLevel(int level);
 
 Q_SIGNALS:
     /// This signal is emitted when an element is received.
@@ -23,13 +23,13 @@
 
 #include "QXmppOutgoingServer.h"
 
+#include "QXmppConnectionRacer_p.h"
 #include "QXmppConstants_p.h"
 #include "QXmppDialback.h"
 #include "QXmppStartTlsPacket.h"
 #include "QXmppStreamFeatures.h"
 #include "QXmppUtils.h"
 
-#include <QDnsLookup>
 #include <QDomElement>
 #include <QList>
 #include <QSslError>
@@ -41,7 +41,9 @@ class QXmppOutgoingServerPrivate
 {
 public:
     QList<QByteArray> dataQueue;
-    QDnsLookup dns;
+    QString dnsName;
+    QXmppDnsResult dnsResult;
+    QXmppConnectionRacer *racer;
     QString localDomain;
     QString localStreamKey;
     QString remoteDomain;
@@ -69,7 +71,30 @@ QXmppOutgoingServer::QXmppOutgoingServer(const QString &domain, QObject *parent)
     connect(socket, QOverload<QAbstractSocket::SocketError>::of(&QSslSocket::error), this, &QXmppOutgoingServer::socketError);
 
     // DNS lookups
-    connect(&d->dns, &QDnsLookup::finished, this, &QXmppOutgoingServer::_q_dnsLookupFinished);
+    connect(QXmppDnsCache::instance(), &QXmppDnsCache::finished, this, [this](const QString &name, QDnsLookup::Type type, const QXmppDnsResult &result) {
+        if (type == QDnsLookup::SRV && !d->dnsName.isEmpty() && name == d->dnsName) {
+            d->dnsName.clear();
+            d->dnsResult = result;
+            _q_dnsLookupFinished();
+        }
+    });
+
+    // connection racing
+    d->racer = new QXmppConnectionRacer(this);
+    connect(d->racer, &QXmppConnectionRacer::finished, this, [this](const QXmppServiceRecord &record, const QHostAddress &address, qintptr socketDescriptor) {
+        // take over the winning connection if possible
+        if (socketDescriptor >= 0 && socket()->setSocketDescriptor(socketDescriptor)) {
+            info(QString("Using connection to %1:%2").arg(record.host, QString::number(record.port)));
+            QMetaObject::invokeMethod(this, "_q_socketConnected");
+            return;
+        }
+        info(QString("Connecting to %1:%2").arg(record.host, QString::number(record.port)));
+        socket()->connectToHost(address, record.port);
+    });
+    connect(d->racer, &QXmppConnectionRacer::failed, this, [this]() {
+        warning(QStringLiteral("Could not connect to %1").arg(d->remoteDomain));
+        emit disconnected();
+    });
 
     d->dialbackTimer = new QTimer(this);
     d->dialbackTimer->setInterval(5000);
@@ -100,35 +125,34 @@ void QXmppOutgoingServer::connectToHost(const QString &domain)
 
     // lookup server for domain
     debug(QString("Looking up server for domain %1").arg(domain));
-    d->dns.setName("_xmpp-server._tcp." + domain);
-    d->dns.setType(QDnsLookup::SRV);
-    d->dns.lookup();
+    d->dnsName = QString("_xmpp-server._tcp." + domain).toLower();
+    QXmppDnsCache::instance()->lookup(d->dnsName, QDnsLookup::SRV);
 }
 
 void QXmppOutgoingServer::_q_dnsLookupFinished()
 {
-    QString host;
-    quint16 port;
-
-    if (d->dns.error() == QDnsLookup::NoError &&
-        !d->dns.serviceRecords().isEmpty()) {
-        // take the first returned record
-        host = d->dns.serviceRecords().first().target();
-        port = d->dns.serviceRecords().first().port();
-    } else {
+    QList<QXmppServiceRecord> records;
+    if (d->dnsResult.error == QDnsLookup::NoError) {
+        for (const auto &record : qAsConst(d->dnsResult.serviceRecords)) {
+            // a target of "." means the service is decidedly not available
+            if (record.host.isEmpty() || record.host == QStringLiteral("."))
+                continue;
+            records << record;
+        }
+    }
+
+    if (records.isEmpty()) {
         // as a fallback, use domain as the host name
         warning(QString("Lookup for domain %1 failed: %2")
-                    .arg(d->dns.name(), d->dns.errorString()));
-        host = d->remoteDomain;
-        port = 5269;
+                    .arg(d->remoteDomain, d->dnsResult.errorString));
+        records << QXmppServiceRecord { d->remoteDomain, 5269, 0, 0, false };
     }
 
     // set the name the SSL certificate should match
     socket()->setPeerVerifyName(d->remoteDomain);
 
-    // connect to server
-    info(QString("Connecting to %1:%2").arg(host, QString::number(port)));
-    socket()->connectToHost(host, port);
+    // race connections to all hosts, RFC 8305 "Happy Eyeballs"
+    d->racer->start(QXmppConnectionRacer::sortServiceRecords(records));
 }
 
 void QXmppOutgoingServer::_q_socketDisconnected()
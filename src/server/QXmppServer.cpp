@@ -86,6 +86,10 @@ public:
     QXmppLogger *logger;
     QXmppPasswordChecker *passwordChecker;
 
+    // XEP-0138: Stream Compression
+    bool streamCompressionEnabled;
+    int streamCompressionLevel;
+
     // client-to-server
     QSet<QXmppIncomingClient *> incomingClients;
     QHash<QString, QXmppIncomingClient *> incomingClientsByJid;
@@ -111,6 +115,8 @@ private:
 QXmppServerPrivate::QXmppServerPrivate(QXmppServer *qq)
     : logger(nullptr),
       passwordChecker(nullptr),
+      streamCompressionEnabled(false),
+      streamCompressionLevel(-1),
       loaded(false),
       started(false),
       q(qq)
@@ -416,6 +422,55 @@ void QXmppServer::setPasswordChecker(QXmppPasswordChecker *checker)
     d->passwordChecker = checker;
 }
 
+///
+/// Returns whether \xep{0138}: Stream Compression is offered to clients
+/// once they have authenticated.
+///
+/// The default value is false.
+///
+/// \since QXmpp 1.4
+///
+bool QXmppServer::streamCompressionEnabled() const
+{
+    return d->streamCompressionEnabled;
+}
+
+///
+/// Sets whether \xep{0138}: Stream Compression is offered to clients once
+/// they have authenticated.
+///
+/// This only applies to clients which connect afterwards.
+///
+/// \since QXmpp 1.4
+///
+void QXmppServer::setStreamCompressionEnabled(bool enabled)
+{
+    d->streamCompressionEnabled = enabled;
+}
+
+///
+/// Returns the zlib level used for stream compression.
+///
+/// The default value is -1, which selects the zlib default level.
+///
+/// \since QXmpp 1.4
+///
+int QXmppServer::streamCompressionLevel() const
+{
+    return d->streamCompressionLevel;
+}
+
+///
+/// Sets the zlib level used for stream compression, from 0 (no compression)
+/// to 9 (best compression), or -1 for the zlib default level.
+///
+/// \since QXmpp 1.4
+///
+void QXmppServer::setStreamCompressionLevel(int level)
+{
+    d->streamCompressionLevel = level;
+}
+
 /// Returns the statistics for the server.
 
 QVariantMap QXmppServer::statistics() const
@@ -565,6 +620,58 @@ bool QXmppServer::listenForClients(const QHostAddress &address, quint16 port)
     return true;
 }
 
+///
+/// Listen for incoming XMPP client connections using Direct TLS as defined
+/// in \xep{0368}: Use of SRV records for XMPP over TLS.
+///
+/// The TLS handshake is performed as soon as the TCP connection is
+/// established, which saves clients the STARTTLS round trip and stream
+/// restart. A local certificate and private key must have been set.
+///
+/// \param address
+/// \param port
+///
+/// \since QXmpp 1.4
+///
+bool QXmppServer::listenForDirectTlsClients(const QHostAddress &address, quint16 port)
+{
+    bool check;
+    Q_UNUSED(check)
+
+    if (d->domain.isEmpty()) {
+        d->warning("No domain was specified!");
+        return false;
+    }
+
+    if (d->localCertificate.isNull() || d->privateKey.isNull()) {
+        d->warning("Cannot listen for Direct TLS clients without a certificate and private key");
+        return false;
+    }
+
+    // create new server
+    auto *server = new QXmppSslServer(this);
+    server->addCaCertificates(d->caCertificates);
+    server->setLocalCertificate(d->localCertificate);
+    server->setPrivateKey(d->privateKey);
+    server->setDirectTlsEnabled(true);
+
+    check = connect(server, SIGNAL(newConnection(QSslSocket *)),
+                    this, SLOT(_q_clientConnection(QSslSocket *)));
+    Q_ASSERT(check);
+
+    if (!server->listen(address, port)) {
+        d->warning(QString("Could not start listening for Direct TLS C2S on %1 %2").arg(address.toString(), QString::number(port)));
+        delete server;
+        return false;
+    }
+    d->serversForClients.insert(server);
+
+    // start extensions
+    d->loadExtensions(this);
+    d->startExtensions();
+    return true;
+}
+
 /// Closes the server.
 ///
 
@@ -669,6 +776,8 @@ void QXmppServer::addIncomingClient(QXmppIncomingClient *stream)
 {
 
     stream->setPasswordChecker(d->passwordChecker);
+    stream->setStreamCompressionEnabled(d->streamCompressionEnabled);
+    stream->setStreamCompressionLevel(d->streamCompressionLevel);
 
     connect(stream, &QXmppStream::connected,
             this, &QXmppServer::_q_clientConnected);
@@ -854,11 +963,19 @@ void QXmppServer::_q_serverDisconnected()
 class QXmppSslServerPrivate
 {
 public:
+    QXmppSslServerPrivate();
+
     QList<QSslCertificate> caCertificates;
     QSslCertificate localCertificate;
     QSslKey privateKey;
+    bool directTls;
 };
 
+QXmppSslServerPrivate::QXmppSslServerPrivate()
+    : directTls(false)
+{
+}
+
 /// Constructs a new SSL server instance.
 ///
 /// \param parent
@@ -890,6 +1007,13 @@ void QXmppSslServer::incomingConnection(qintptr socketDescriptor)
         socket->addCaCertificates(d->caCertificates);
         socket->setLocalCertificate(d->localCertificate);
         socket->setPrivateKey(d->privateKey);
+
+        // the handshake completes asynchronously, once the stream is set up
+        if (d->directTls)
+            socket->startServerEncryption();
+    } else if (d->directTls) {
+        delete socket;
+        return;
     }
     emit newConnection(socket);
 }
@@ -921,3 +1045,27 @@ void QXmppSslServer::setPrivateKey(const QSslKey &key)
 {
     d->privateKey = key;
 }
+
+///
+/// Returns whether incoming connections start with a TLS handshake (Direct
+/// TLS) instead of plaintext.
+///
+/// \since QXmpp 1.4
+///
+bool QXmppSslServer::isDirectTlsEnabled() const
+{
+    return d->directTls;
+}
+
+///
+/// Sets whether incoming connections start with a TLS handshake (Direct
+/// TLS) instead of plaintext.
+///
+/// \param enabled
+///
+/// \since QXmpp 1.4
+///
+void QXmppSslServer::setDirectTlsEnabled(bool enabled)
+{
+    d->directTls = enabled;
+}
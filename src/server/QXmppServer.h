@@ -80,6 +80,12 @@ public:
     QXmppPasswordChecker *passwordChecker();
     void setPasswordChecker(QXmppPasswordChecker *checker);
 
+    bool streamCompressionEnabled() const;
+    void setStreamCompressionEnabled(bool enabled);
+
+    int streamCompressionLevel() const;
+    void setStreamCompressionLevel(int level);
+
     QVariantMap statistics() const;
 
     void addCaCertificates(const QString &caCertificates);
@@ -90,6 +96,7 @@ public:
 
     void close();
     bool listenForClients(const QHostAddress &address = QHostAddress::Any, quint16 port = 5222);
+    bool listenForDirectTlsClients(const QHostAddress &address = QHostAddress::Any, quint16 port = 5223);
     bool listenForServers(const QHostAddress &address = QHostAddress::Any, quint16 port = 5269);
 
     bool sendElement(const QDomElement &element);
@@ -141,6 +148,9 @@ public:
     void setLocalCertificate(const QSslCertificate &certificate);
     void setPrivateKey(const QSslKey &key);
 
+    bool isDirectTlsEnabled() const;
+    void setDirectTlsEnabled(bool enabled);
+
 Q_SIGNALS:
     /// This signal is emitted when a new connection is established.
     void newConnection(QSslSocket *socket);
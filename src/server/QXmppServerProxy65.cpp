@@ -0,0 +1,773 @@
+/*
+ * Copyright (C) 2008-2020 The QXmpp developers
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "QXmppServerProxy65.h"
+
+#include "QXmppByteStreamIq.h"
+#include "QXmppConstants_p.h"
+#include "QXmppDiscoveryIq.h"
+#include "QXmppServer.h"
+#include "QXmppServerProxy65_p.h"
+#include "QXmppSocks.h"
+
+#include <QCryptographicHash>
+#include <QDomElement>
+#include <QSocketNotifier>
+#include <QTcpSocket>
+#include <QTimer>
+
+#include <limits>
+
+#ifdef Q_OS_LINUX
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+// time after which a connection which was not paired is closed
+const int pendingTimeout = 30000;
+
+// number of connections waiting for activation, for one stream and in total
+const int maximumPendingPerStream = 2;
+const int maximumPendingConnections = 1024;
+
+// size of the blocks copied or spliced at once
+const qint64 copyBlockSize = 65536;
+const qint64 spliceBlockSize = 65536;
+
+// number of blocks relayed in one direction before returning to the
+// event loop, so a fast stream cannot starve the other sessions
+const int maximumSpliceBlocks = 16;
+
+static QString streamHash(const QString &sid, const QString &initiatorJid, const QString &targetJid)
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    QString str = sid + initiatorJid + targetJid;
+    hash.addData(str.toLatin1());
+    return hash.result().toHex();
+}
+
+#ifdef Q_OS_LINUX
+// Splices data from a pipe into a socket, without raising SIGPIPE when the
+// peer has gone away.
+static ssize_t spliceToSocket(int pipeFd, int socketFd, size_t size)
+{
+    sigset_t pipeSet, oldSet;
+    sigemptyset(&pipeSet);
+    sigaddset(&pipeSet, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipeSet, &oldSet);
+
+    const ssize_t written = ::splice(pipeFd, nullptr, socketFd, nullptr, size, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (written < 0 && errno == EPIPE) {
+        const int error = errno;
+        const struct timespec zero = { 0, 0 };
+        sigtimedwait(&pipeSet, nullptr, &zero);
+        errno = error;
+    }
+
+    pthread_sigmask(SIG_SETMASK, &oldSet, nullptr);
+    return written;
+}
+#endif
+
+/// \cond
+QXmppProxy65Relay::QXmppProxy65Relay(QTcpSocket *initiator, QTcpSocket *target, qint64 rateLimit, bool spliceEnabled, QObject *parent)
+    : QObject(parent),
+      m_initiator(initiator),
+      m_target(target),
+      m_spliced(false),
+      m_finished(false),
+      m_rateLimit(rateLimit),
+      m_allowance(rateLimit),
+      m_refillTime(0),
+      m_resumeTimer(new QTimer(this))
+{
+    m_initiator->setParent(this);
+    m_target->setParent(this);
+
+    m_streams[0].source = m_initiator;
+    m_streams[0].destination = m_target;
+    m_streams[1].source = m_target;
+    m_streams[1].destination = m_initiator;
+
+    m_clock.start();
+    m_resumeTimer->setSingleShot(true);
+    connect(m_resumeTimer, &QTimer::timeout, this, &QXmppProxy65Relay::resume);
+
+    if (spliceEnabled && setupSplice()) {
+        m_spliced = true;
+    } else {
+        for (auto &stream : m_streams) {
+            Stream *ptr = &stream;
+            stream.source->setReadBufferSize(copyBlockSize);
+            connect(stream.source, &QIODevice::readyRead, this, [this, ptr]() {
+                relay(*ptr);
+            });
+            connect(stream.destination, &QIODevice::bytesWritten, this, [this, ptr]() {
+                relay(*ptr);
+            });
+            connect(stream.source, &QAbstractSocket::disconnected, this, [this, ptr]() {
+                ptr->atEnd = true;
+                relay(*ptr);
+            });
+        }
+    }
+
+    // relay whatever the peers sent before the stream was activated
+    QTimer::singleShot(0, this, &QXmppProxy65Relay::resume);
+}
+
+QXmppProxy65Relay::~QXmppProxy65Relay()
+{
+#ifdef Q_OS_LINUX
+    if (m_spliced) {
+        for (auto &stream : m_streams) {
+            delete stream.readNotifier;
+            delete stream.writeNotifier;
+            ::close(stream.pipe[0]);
+            ::close(stream.pipe[1]);
+        }
+        ::close(m_streams[0].sourceFd);
+        ::close(m_streams[0].destinationFd);
+    }
+#endif
+}
+
+bool QXmppProxy65Relay::isSpliced() const
+{
+    return m_spliced;
+}
+
+qint64 QXmppProxy65Relay::initiatorBytes() const
+{
+    return m_streams[0].bytes;
+}
+
+qint64 QXmppProxy65Relay::targetBytes() const
+{
+    return m_streams[1].bytes;
+}
+
+// Takes the connections over from Qt so that the kernel can move the data
+// between them, returns false if the connections must stay with Qt.
+
+bool QXmppProxy65Relay::setupSplice()
+{
+#ifdef Q_OS_LINUX
+    // data buffered by Qt would be lost
+    if (m_initiator->bytesAvailable() || m_initiator->bytesToWrite() ||
+        m_target->bytesAvailable() || m_target->bytesToWrite())
+        return false;
+
+    const int initiatorFd = fcntl(int(m_initiator->socketDescriptor()), F_DUPFD_CLOEXEC, 0);
+    const int targetFd = fcntl(int(m_target->socketDescriptor()), F_DUPFD_CLOEXEC, 0);
+    if (initiatorFd < 0 || targetFd < 0 ||
+        pipe2(m_streams[0].pipe, O_NONBLOCK | O_CLOEXEC) < 0) {
+        ::close(initiatorFd);
+        ::close(targetFd);
+        return false;
+    }
+    if (pipe2(m_streams[1].pipe, O_NONBLOCK | O_CLOEXEC) < 0) {
+        ::close(initiatorFd);
+        ::close(targetFd);
+        ::close(m_streams[0].pipe[0]);
+        ::close(m_streams[0].pipe[1]);
+        return false;
+    }
+
+    // closing Qt's descriptors does not shut the connections down, our
+    // duplicates keep them open
+    for (auto *socket : { m_initiator, m_target }) {
+        socket->disconnect();
+        socket->abort();
+        socket->deleteLater();
+    }
+    m_initiator = nullptr;
+    m_target = nullptr;
+
+    m_streams[0].sourceFd = initiatorFd;
+    m_streams[0].destinationFd = targetFd;
+    m_streams[1].sourceFd = targetFd;
+    m_streams[1].destinationFd = initiatorFd;
+
+    for (auto &stream : m_streams) {
+        stream.source = nullptr;
+        stream.destination = nullptr;
+
+        stream.readNotifier = new QSocketNotifier(stream.sourceFd, QSocketNotifier::Read, this);
+        connect(stream.readNotifier, SIGNAL(activated(int)),
+                this, SLOT(_q_readActivated(int)));
+
+        stream.writeNotifier = new QSocketNotifier(stream.destinationFd, QSocketNotifier::Write, this);
+        stream.writeNotifier->setEnabled(false);
+        connect(stream.writeNotifier, SIGNAL(activated(int)),
+                this, SLOT(_q_writeActivated(int)));
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+void QXmppProxy65Relay::_q_readActivated(int fd)
+{
+    for (auto &stream : m_streams) {
+        if (stream.sourceFd == fd)
+            relay(stream);
+    }
+}
+
+void QXmppProxy65Relay::_q_writeActivated(int fd)
+{
+    for (auto &stream : m_streams) {
+        if (stream.destinationFd == fd)
+            relay(stream);
+    }
+}
+
+void QXmppProxy65Relay::relay(Stream &stream)
+{
+    if (m_finished || stream.done)
+        return;
+
+    if (m_spliced)
+        relaySpliced(stream);
+    else
+        relayCopied(stream);
+}
+
+void QXmppProxy65Relay::relaySpliced(Stream &stream)
+{
+#ifdef Q_OS_LINUX
+    int blocks = 0;
+    while (blocks < maximumSpliceBlocks) {
+        // drain the pipe first
+        if (stream.piped) {
+            const ssize_t written = spliceToSocket(stream.pipe[0], stream.destinationFd, size_t(stream.piped));
+            if (written < 0) {
+                if (errno == EINTR)
+                    continue;
+                if (errno == EAGAIN) {
+                    stream.readNotifier->setEnabled(false);
+                    stream.writeNotifier->setEnabled(true);
+                    return;
+                }
+                finish();
+                return;
+            }
+            stream.piped -= written;
+            stream.bytes += written;
+            continue;
+        }
+        stream.writeNotifier->setEnabled(false);
+
+        if (stream.atEnd) {
+            ::shutdown(stream.destinationFd, SHUT_WR);
+            streamDone(stream);
+            return;
+        }
+
+        const qint64 size = qMin(spliceBlockSize, allowance());
+        if (!size) {
+            stream.readNotifier->setEnabled(false);
+            waitForAllowance();
+            return;
+        }
+
+        const ssize_t read = ::splice(stream.sourceFd, nullptr, stream.pipe[1], nullptr, size_t(size), SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (read < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN) {
+                stream.readNotifier->setEnabled(true);
+                return;
+            }
+            finish();
+            return;
+        }
+        if (!read)
+            stream.atEnd = true;
+        consume(read);
+        stream.piped += read;
+        ++blocks;
+    }
+
+    // more data may be waiting, come back from the event loop
+    stream.readNotifier->setEnabled(true);
+#else
+    Q_UNUSED(stream);
+#endif
+}
+
+void QXmppProxy65Relay::relayCopied(Stream &stream)
+{
+    // let the destination's buffer bound the amount read from the source
+    while (stream.source->bytesAvailable() && stream.destination->bytesToWrite() < copyBlockSize) {
+        const qint64 size = qMin(qMin(stream.source->bytesAvailable(), copyBlockSize), allowance());
+        if (!size) {
+            waitForAllowance();
+            return;
+        }
+
+        const QByteArray data = stream.source->read(size);
+        stream.destination->write(data);
+        stream.bytes += data.size();
+        consume(data.size());
+    }
+
+    if (stream.atEnd && !stream.source->bytesAvailable()) {
+        stream.destination->disconnectFromHost();
+        streamDone(stream);
+    }
+}
+
+void QXmppProxy65Relay::streamDone(Stream &stream)
+{
+    stream.done = true;
+    if (stream.readNotifier)
+        stream.readNotifier->setEnabled(false);
+    if (stream.writeNotifier)
+        stream.writeNotifier->setEnabled(false);
+
+    if (m_streams[0].done && m_streams[1].done)
+        finish();
+}
+
+// Returns the number of bytes the session may relay right now.
+
+qint64 QXmppProxy65Relay::allowance()
+{
+    if (m_rateLimit <= 0)
+        return std::numeric_limits<qint64>::max();
+
+    // refill the bucket, which holds at most one second worth of data
+    const qint64 now = m_clock.nsecsElapsed();
+    const qint64 tokens = qint64(double(now - m_refillTime) * m_rateLimit / 1e9);
+    if (tokens > 0) {
+        m_allowance = qMin(m_rateLimit, m_allowance + tokens);
+        m_refillTime += qint64(double(tokens) * 1e9 / m_rateLimit);
+    }
+    return m_allowance;
+}
+
+void QXmppProxy65Relay::consume(qint64 bytes)
+{
+    if (m_rateLimit > 0)
+        m_allowance -= bytes;
+}
+
+void QXmppProxy65Relay::waitForAllowance()
+{
+    if (m_resumeTimer->isActive())
+        return;
+
+    // wait until a block can be relayed
+    const qint64 block = qMin(m_rateLimit, spliceBlockSize);
+    m_resumeTimer->start(qMax(1, int(block * 1000 / m_rateLimit)));
+}
+
+void QXmppProxy65Relay::resume()
+{
+    for (auto &stream : m_streams)
+        relay(stream);
+}
+
+void QXmppProxy65Relay::finish()
+{
+    if (m_finished)
+        return;
+    m_finished = true;
+
+    m_resumeTimer->stop();
+    for (auto &stream : m_streams) {
+        if (stream.readNotifier)
+            stream.readNotifier->setEnabled(false);
+        if (stream.writeNotifier)
+            stream.writeNotifier->setEnabled(false);
+    }
+    if (m_initiator)
+        m_initiator->disconnectFromHost();
+    if (m_target)
+        m_target->disconnectFromHost();
+
+    emit finished();
+}
+/// \endcond
+
+class QXmppServerProxy65Private
+{
+public:
+    QXmppServerProxy65Private(QXmppServerProxy65 *qq);
+    void removePending(const QString &hash, QTcpSocket *socket);
+    void sendError(const QXmppIq &request, QXmppStanza::Error::Condition condition);
+
+    QString jid;
+    QString host;
+    quint16 port;
+    qint64 rateLimit;
+    bool spliceEnabled;
+    qint64 relayedBytes;
+
+    QXmppSocksServer *socksServer;
+
+    // connections waiting for activation, by stream hash: the target
+    // connects first, then the initiator
+    QHash<QString, QList<QTcpSocket *>> pending;
+    int pendingCount;
+    QHash<QXmppProxy65Relay *, QString> sessions;
+
+private:
+    QXmppServerProxy65 *q;
+};
+
+QXmppServerProxy65Private::QXmppServerProxy65Private(QXmppServerProxy65 *qq)
+    : port(7777),
+      rateLimit(0),
+      spliceEnabled(true),
+      relayedBytes(0),
+      socksServer(nullptr),
+      pendingCount(0),
+      q(qq)
+{
+}
+
+void QXmppServerProxy65Private::removePending(const QString &hash, QTcpSocket *socket)
+{
+    auto itr = pending.find(hash);
+    if (itr == pending.end())
+        return;
+
+    pendingCount -= itr->removeAll(socket);
+    if (itr->isEmpty())
+        pending.erase(itr);
+}
+
+void QXmppServerProxy65Private::sendError(const QXmppIq &request, QXmppStanza::Error::Condition condition)
+{
+    QXmppIq response(QXmppIq::Error);
+    response.setId(request.id());
+    response.setFrom(q->jid());
+    response.setTo(request.from());
+    response.setError(QXmppStanza::Error(QXmppStanza::Error::Cancel, condition));
+    q->server()->sendPacket(response);
+}
+
+/// Constructs a new SOCKS5 bytestream proxy.
+
+QXmppServerProxy65::QXmppServerProxy65()
+    : d(new QXmppServerProxy65Private(this))
+{
+    d->socksServer = new QXmppSocksServer(this);
+    connect(d->socksServer, &QXmppSocksServer::newConnection,
+            this, &QXmppServerProxy65::_q_newConnection);
+}
+
+QXmppServerProxy65::~QXmppServerProxy65()
+{
+    delete d;
+}
+
+/// Returns the JID of the proxy.
+///
+/// Defaults to "proxy." followed by the server's domain.
+
+QString QXmppServerProxy65::jid() const
+{
+    if (d->jid.isEmpty() && server())
+        return QStringLiteral("proxy.") + server()->domain();
+    return d->jid;
+}
+
+/// Sets the JID of the proxy.
+///
+/// \param jid
+
+void QXmppServerProxy65::setJid(const QString &jid)
+{
+    d->jid = jid;
+}
+
+/// Returns the host name or address advertised to the clients.
+///
+/// Defaults to the server's domain.
+
+QString QXmppServerProxy65::host() const
+{
+    if (d->host.isEmpty() && server())
+        return server()->domain();
+    return d->host;
+}
+
+/// Sets the host name or address advertised to the clients.
+///
+/// \param host
+
+void QXmppServerProxy65::setHost(const QString &host)
+{
+    d->host = host;
+}
+
+/// Returns the port on which the proxy accepts SOCKS5 connections.
+///
+/// Once the proxy is started, this is the port it actually listens on.
+
+quint16 QXmppServerProxy65::port() const
+{
+    return d->socksServer->serverPort() ? d->socksServer->serverPort() : d->port;
+}
+
+/// Sets the port on which the proxy accepts SOCKS5 connections, 0 lets the
+/// system pick a free port. The default is 7777.
+///
+/// \param port
+
+void QXmppServerProxy65::setPort(quint16 port)
+{
+    d->port = port;
+}
+
+/// Returns the maximum number of bytes per second relayed for a single
+/// bytestream, in both directions. 0 means unlimited.
+
+qint64 QXmppServerProxy65::rateLimit() const
+{
+    return d->rateLimit;
+}
+
+/// Sets the maximum number of bytes per second relayed for a single
+/// bytestream, in both directions. 0 means unlimited, which is the default.
+///
+/// The limit applies to the bytestreams activated afterwards.
+///
+/// \param bytesPerSecond
+
+void QXmppServerProxy65::setRateLimit(qint64 bytesPerSecond)
+{
+    d->rateLimit = qMax(qint64(0), bytesPerSecond);
+}
+
+/// Returns whether the data is relayed using splice() where available.
+
+bool QXmppServerProxy65::isSpliceEnabled() const
+{
+    return d->spliceEnabled;
+}
+
+/// Sets whether the data is relayed using splice() where available. When
+/// disabled, or on systems other than Linux, the data is copied through the
+/// proxy's sockets.
+///
+/// \param enabled
+
+void QXmppServerProxy65::setSpliceEnabled(bool enabled)
+{
+    d->spliceEnabled = enabled;
+}
+
+/// Returns the number of bytestreams currently being relayed.
+
+int QXmppServerProxy65::sessionCount() const
+{
+    return d->sessions.size();
+}
+
+/// Returns the total number of bytes relayed by the proxy, in both
+/// directions.
+
+qint64 QXmppServerProxy65::relayedBytes() const
+{
+    qint64 bytes = d->relayedBytes;
+    for (auto itr = d->sessions.constBegin(); itr != d->sessions.constEnd(); ++itr)
+        bytes += itr.key()->initiatorBytes() + itr.key()->targetBytes();
+    return bytes;
+}
+
+/// \cond
+QStringList QXmppServerProxy65::discoveryItems() const
+{
+    return QStringList() << jid();
+}
+
+bool QXmppServerProxy65::handleStanza(const QDomElement &element)
+{
+    if (element.attribute(QStringLiteral("to")) != jid() ||
+        element.tagName() != QLatin1String("iq"))
+        return false;
+
+    if (QXmppDiscoveryIq::isDiscoveryIq(element)) {
+        QXmppDiscoveryIq request;
+        request.parse(element);
+
+        if (request.type() == QXmppIq::Get && request.queryType() == QXmppDiscoveryIq::InfoQuery) {
+            QXmppDiscoveryIq::Identity identity;
+            identity.setCategory(QStringLiteral("proxy"));
+            identity.setType(QStringLiteral("bytestreams"));
+            identity.setName(QStringLiteral("SOCKS5 Bytestreams"));
+
+            QXmppDiscoveryIq response;
+            response.setType(QXmppIq::Result);
+            response.setId(request.id());
+            response.setFrom(jid());
+            response.setTo(request.from());
+            response.setQueryType(QXmppDiscoveryIq::InfoQuery);
+            response.setIdentities(QList<QXmppDiscoveryIq::Identity>() << identity);
+            response.setFeatures(QStringList() << ns_disco_info << ns_bytestreams);
+            server()->sendPacket(response);
+            return true;
+        }
+    } else if (QXmppByteStreamIq::isByteStreamIq(element)) {
+        QXmppByteStreamIq request;
+        request.parse(element);
+
+        if (request.type() == QXmppIq::Get) {
+            // advertise the stream host
+            QXmppByteStreamIq::StreamHost streamHost;
+            streamHost.setJid(jid());
+            streamHost.setHost(host());
+            streamHost.setPort(port());
+
+            QXmppByteStreamIq response;
+            response.setType(QXmppIq::Result);
+            response.setId(request.id());
+            response.setFrom(jid());
+            response.setTo(request.from());
+            response.setSid(request.sid());
+            response.setStreamHosts(QList<QXmppByteStreamIq::StreamHost>() << streamHost);
+            server()->sendPacket(response);
+            return true;
+
+        } else if (request.type() == QXmppIq::Set && !request.activate().isEmpty()) {
+            // pair the connections of the initiator and the target
+            const QString hash = streamHash(request.sid(), request.from(), request.activate());
+            const QList<QTcpSocket *> sockets = d->pending.value(hash);
+            if (sockets.size() != 2) {
+                warning(QString("Could not activate bytestream %1 from %2").arg(request.sid(), request.from()));
+                d->sendError(request, QXmppStanza::Error::ItemNotFound);
+                return true;
+            }
+            d->pending.remove(hash);
+            d->pendingCount -= sockets.size();
+            for (auto *socket : sockets)
+                socket->disconnect(this);
+
+            auto *relay = new QXmppProxy65Relay(sockets.at(1), sockets.at(0), d->rateLimit, d->spliceEnabled, this);
+            connect(relay, &QXmppProxy65Relay::finished,
+                    this, &QXmppServerProxy65::_q_relayFinished);
+            d->sessions.insert(relay, request.sid());
+
+            info(QString("Activated bytestream %1 from %2 to %3%4").arg(request.sid(), request.from(), request.activate(), relay->isSpliced() ? QStringLiteral(" (spliced)") : QString()));
+
+            QXmppIq response(QXmppIq::Result);
+            response.setId(request.id());
+            response.setFrom(jid());
+            response.setTo(request.from());
+            server()->sendPacket(response);
+
+            emit sessionStarted(request.sid(), request.from(), request.activate());
+            return true;
+        }
+    }
+
+    // we do not support the given IQ
+    QXmppIq request;
+    request.parse(element);
+    if (request.type() != QXmppIq::Error && request.type() != QXmppIq::Result)
+        d->sendError(request, QXmppStanza::Error::FeatureNotImplemented);
+    return true;
+}
+
+bool QXmppServerProxy65::start()
+{
+    if (!d->socksServer->listen(d->port)) {
+        warning(QString("Could not start SOCKS5 proxy on port %1").arg(QString::number(d->port)));
+        return false;
+    }
+    info(QString("SOCKS5 proxy %1 listening on port %2").arg(jid(), QString::number(port())));
+    return true;
+}
+
+void QXmppServerProxy65::stop()
+{
+    d->socksServer->close();
+
+    for (auto itr = d->pending.constBegin(); itr != d->pending.constEnd(); ++itr) {
+        for (auto *socket : itr.value()) {
+            socket->disconnect(this);
+            socket->abort();
+            socket->deleteLater();
+        }
+    }
+    d->pending.clear();
+    d->pendingCount = 0;
+
+    // report the sessions which are cut short like finished ones
+    const auto sessions = d->sessions;
+    d->sessions.clear();
+    for (auto itr = sessions.constBegin(); itr != sessions.constEnd(); ++itr) {
+        auto *relay = itr.key();
+        relay->disconnect(this);
+        d->relayedBytes += relay->initiatorBytes() + relay->targetBytes();
+        emit sessionFinished(itr.value(), relay->initiatorBytes(), relay->targetBytes());
+        delete relay;
+    }
+}
+/// \endcond
+
+void QXmppServerProxy65::_q_newConnection(QTcpSocket *socket, const QString &hostName, quint16 port)
+{
+    QList<QTcpSocket *> &sockets = d->pending[hostName];
+    if (port != 0 || sockets.size() >= maximumPendingPerStream || d->pendingCount >= maximumPendingConnections) {
+        warning(QString("Rejected SOCKS5 connection for %1").arg(hostName));
+        if (sockets.isEmpty())
+            d->pending.remove(hostName);
+        socket->disconnectFromHost();
+        socket->deleteLater();
+        return;
+    }
+    sockets << socket;
+    d->pendingCount++;
+
+    connect(socket, &QAbstractSocket::disconnected, this, [this, socket, hostName]() {
+        d->removePending(hostName, socket);
+        socket->deleteLater();
+    });
+
+    // do not keep connections which are never activated
+    QTimer::singleShot(pendingTimeout, socket, [this, socket, hostName]() {
+        if (d->pending.value(hostName).contains(socket))
+            socket->disconnectFromHost();
+    });
+}
+
+void QXmppServerProxy65::_q_relayFinished()
+{
+    auto *relay = qobject_cast<QXmppProxy65Relay *>(sender());
+    if (!relay || !d->sessions.contains(relay))
+        return;
+
+    const QString sid = d->sessions.take(relay);
+    d->relayedBytes += relay->initiatorBytes() + relay->targetBytes();
+    info(QString("Finished bytestream %1, relayed %2 and %3 bytes").arg(sid, QString::number(relay->initiatorBytes()), QString::number(relay->targetBytes())));
+
+    emit sessionFinished(sid, relay->initiatorBytes(), relay->targetBytes());
+    relay->deleteLater();
+}
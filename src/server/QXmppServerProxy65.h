@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2008-2020 The QXmpp developers
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPSERVERPROXY65_H
+#define QXMPPSERVERPROXY65_H
+
+#include "QXmppServerExtension.h"
+
+class QTcpSocket;
+class QXmppServerProxy65Private;
+
+/// \brief The QXmppServerProxy65 class is a server extension which provides
+/// a \xep{0065}: SOCKS5 Bytestreams proxy, so that users behind a NAT can
+/// exchange files.
+///
+/// The proxy answers service discovery and stream host queries sent to its
+/// jid(), accepts the SOCKS5 connections of both parties on port() and
+/// relays the data once the initiator activates the bytestream.
+///
+/// On Linux, the data is relayed using splice() through a pipe, so that it
+/// never gets copied to user space.
+///
+/// \code
+/// QXmppServerProxy65 *proxy = new QXmppServerProxy65;
+/// proxy->setHost("proxy.example.com");
+/// server->addExtension(proxy);
+/// \endcode
+///
+/// \ingroup Core
+///
+/// \since QXmpp 1.4
+
+class QXMPP_EXPORT QXmppServerProxy65 : public QXmppServerExtension
+{
+    Q_OBJECT
+    Q_CLASSINFO("ExtensionName", "proxy65")
+
+    /// The JID of the proxy
+    Q_PROPERTY(QString jid READ jid WRITE setJid)
+    /// The host name or address advertised to the clients
+    Q_PROPERTY(QString host READ host WRITE setHost)
+    /// The port on which the proxy accepts SOCKS5 connections
+    Q_PROPERTY(quint16 port READ port WRITE setPort)
+
+public:
+    QXmppServerProxy65();
+    ~QXmppServerProxy65() override;
+
+    QString jid() const;
+    void setJid(const QString &jid);
+
+    QString host() const;
+    void setHost(const QString &host);
+
+    quint16 port() const;
+    void setPort(quint16 port);
+
+    qint64 rateLimit() const;
+    void setRateLimit(qint64 bytesPerSecond);
+
+    bool isSpliceEnabled() const;
+    void setSpliceEnabled(bool enabled);
+
+    int sessionCount() const;
+    qint64 relayedBytes() const;
+
+    /// \cond
+    QStringList discoveryItems() const override;
+    bool handleStanza(const QDomElement &element) override;
+    bool start() override;
+    void stop() override;
+    /// \endcond
+
+Q_SIGNALS:
+    /// This signal is emitted when the initiator activated a bytestream.
+    void sessionStarted(const QString &sid, const QString &initiator, const QString &target);
+
+    /// This signal is emitted when a bytestream is closed, with the number
+    /// of bytes relayed from the initiator to the target and from the target
+    /// to the initiator.
+    void sessionFinished(const QString &sid, qint64 initiatorBytes, qint64 targetBytes);
+
+private Q_SLOTS:
+    void _q_newConnection(QTcpSocket *socket, const QString &hostName, quint16 port);
+    void _q_relayFinished();
+
+private:
+    QXmppServerProxy65Private *d;
+};
+
+#endif
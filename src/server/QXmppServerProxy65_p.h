@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2008-2020 The QXmpp developers
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPSERVERPROXY65_P_H
+#define QXMPPSERVERPROXY65_P_H
+
+#include <QElapsedTimer>
+#include <QObject>
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.  It exists for the convenience
+// of the QXmppServerProxy65 class.  This header file may change from
+// version to version without notice, or even be removed.
+//
+// We mean it.
+//
+
+class QSocketNotifier;
+class QTcpSocket;
+class QTimer;
+
+// Relays the data of an activated bytestream between the initiator and the
+// target, within a rate limit shared by both directions.
+//
+// On Linux the sockets are taken over from Qt and the data is moved with
+// splice() through a pipe, otherwise it is copied through the sockets.
+
+class QXmppProxy65Relay : public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(bool spliced READ isSpliced CONSTANT)
+
+public:
+    QXmppProxy65Relay(QTcpSocket *initiator, QTcpSocket *target, qint64 rateLimit, bool spliceEnabled, QObject *parent);
+    ~QXmppProxy65Relay() override;
+
+    bool isSpliced() const;
+    qint64 initiatorBytes() const;
+    qint64 targetBytes() const;
+
+Q_SIGNALS:
+    void finished();
+
+private Q_SLOTS:
+    void _q_readActivated(int fd);
+    void _q_writeActivated(int fd);
+
+private:
+    // One direction of the relay.
+    struct Stream
+    {
+        QTcpSocket *source = nullptr;
+        QTcpSocket *destination = nullptr;
+        int sourceFd = -1;
+        int destinationFd = -1;
+        int pipe[2] = { -1, -1 };
+        qint64 piped = 0;
+        QSocketNotifier *readNotifier = nullptr;
+        QSocketNotifier *writeNotifier = nullptr;
+        qint64 bytes = 0;
+        bool atEnd = false;
+        bool done = false;
+    };
+
+    bool setupSplice();
+    void relay(Stream &stream);
+    void relaySpliced(Stream &stream);
+    void relayCopied(Stream &stream);
+    void streamDone(Stream &stream);
+    qint64 allowance();
+    void consume(qint64 bytes);
+    void waitForAllowance();
+    void resume();
+    void finish();
+
+    Stream m_streams[2];
+    QTcpSocket *m_initiator;
+    QTcpSocket *m_target;
+    bool m_spliced;
+    bool m_finished;
+
+    qint64 m_rateLimit;
+    qint64 m_allowance;
+    qint64 m_refillTime;
+    QElapsedTimer m_clock;
+    QTimer *m_resumeTimer;
+};
+
+#endif
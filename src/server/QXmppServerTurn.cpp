@@ -0,0 +1,1117 @@
+/*
+ * Copyright (C) 2008-2020 The QXmpp developers
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "QXmppServerTurn.h"
+
+#include "QXmppPasswordChecker.h"
+#include "QXmppServer.h"
+#include "QXmppServerTurn_p.h"
+#include "QXmppUtils.h"
+
+#include <QNetworkInterface>
+#include <QPointer>
+#include <QThread>
+#include <QTimer>
+#include <QUdpSocket>
+#include <QtEndian>
+
+#include <string.h>
+#ifdef Q_OS_LINUX
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+static const quint32 STUN_MAGIC = 0x2112A442;
+static const int STUN_HEADER = 20;
+
+// attributes which are read in place
+static const quint16 LifetimeAttribute = 0x000d;
+static const quint16 XorPeerAddressAttribute = 0x0012;
+static const quint16 DataAttribute = 0x0013;
+
+// see RFC 5766 - 2.2, 8. and 11.
+static const quint32 defaultLifetime = 600;
+static const quint32 maximumLifetime = 3600;
+static const qint64 permissionLifetime = 300000;
+static const qint64 channelLifetime = 600000;
+
+// time during which the key of a user is reused without asking the
+// password checker again
+static const qint64 keyLifetime = 300000;
+
+// time after which requests waiting for a password checker lookup are
+// dropped, so that a lookup which never completes can be retried
+static const qint64 pendingLifetime = 10000;
+
+// time during which an unknown user is rejected without asking the
+// password checker again
+static const qint64 rejectionLifetime = 30000;
+
+// lookups in the password checker allowed for each client address, as a
+// burst which is refilled at one lookup per interval
+static const int lookupBurst = 5;
+static const qint64 lookupInterval = 1000;
+
+static bool isAnyAddress(const QHostAddress &host)
+{
+    return host == QHostAddress::Any ||
+        host == QHostAddress::AnyIPv4 ||
+        host == QHostAddress::AnyIPv6;
+}
+
+/// \cond
+bool QXmppTurnShared::reserveAllocation(const QString &username)
+{
+    QMutexLocker locker(&mutex);
+    if (allocationLimit > 0 && allocationCount.loadAcquire() >= allocationLimit)
+        return false;
+    int &count = userAllocations[username];
+    if (userAllocationLimit > 0 && count >= userAllocationLimit)
+        return false;
+    count++;
+    allocationCount.ref();
+    return true;
+}
+
+void QXmppTurnShared::releaseAllocation(const QString &username)
+{
+    QMutexLocker locker(&mutex);
+    auto it = userAllocations.find(username);
+    if (it != userAllocations.end() && !--it.value())
+        userAllocations.erase(it);
+    allocationCount.deref();
+}
+
+QXmppTurnWorker::QXmppTurnWorker(QXmppTurnShared *shared, bool reusePort, QObject *parent)
+    : QXmppLoggable(parent),
+      m_shared(shared),
+      m_reusePort(reusePort),
+      m_socket(nullptr),
+      m_expiryTimer(new QTimer(this)),
+      m_clientBatch(32),
+      m_peerBatch(32),
+      m_indicationId(QXmppUtils::generateRandomBytes(12)),
+      m_indicationCount(0),
+      m_relayedBytes(0),
+      m_droppedPackets(0)
+{
+    m_clock.start();
+    m_expiryTimer->setInterval(1000);
+    connect(m_expiryTimer, &QTimer::timeout, this, &QXmppTurnWorker::_q_expire);
+}
+
+QXmppTurnWorker::~QXmppTurnWorker()
+{
+    close();
+}
+
+quint16 QXmppTurnWorker::localPort() const
+{
+    return m_socket ? m_socket->localPort() : 0;
+}
+
+bool QXmppTurnWorker::bindSocket()
+{
+#ifdef Q_OS_LINUX
+    if (m_reusePort) {
+        // let the workers share the port, see SO_REUSEPORT in socket(7)
+        const QHostAddress &host = m_shared->host;
+        sockaddr_storage address;
+        socklen_t addressLength;
+        memset(&address, 0, sizeof(address));
+        if (host.protocol() == QAbstractSocket::IPv4Protocol) {
+            auto *in = reinterpret_cast<sockaddr_in *>(&address);
+            in->sin_family = AF_INET;
+            in->sin_addr.s_addr = htonl(host.toIPv4Address());
+            in->sin_port = htons(m_shared->port);
+            addressLength = sizeof(sockaddr_in);
+        } else {
+            auto *in6 = reinterpret_cast<sockaddr_in6 *>(&address);
+            in6->sin6_family = AF_INET6;
+            if (host.protocol() == QAbstractSocket::IPv6Protocol) {
+                const Q_IPV6ADDR addr = host.toIPv6Address();
+                memcpy(in6->sin6_addr.s6_addr, addr.c, sizeof(addr.c));
+            }
+            in6->sin6_port = htons(m_shared->port);
+            addressLength = sizeof(sockaddr_in6);
+        }
+
+        const int fd = ::socket(address.ss_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0)
+            return false;
+        const int enable = 1;
+        if (::setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) < 0 ||
+            ::bind(fd, reinterpret_cast<sockaddr *>(&address), addressLength) < 0 ||
+            !m_socket->setSocketDescriptor(fd, QAbstractSocket::BoundState)) {
+            ::close(fd);
+            return false;
+        }
+        return true;
+    }
+#endif
+    return m_socket->bind(m_shared->host, m_shared->port);
+}
+
+/// Starts receiving the clients' messages.
+
+bool QXmppTurnWorker::listen()
+{
+    m_socket = new QUdpSocket(this);
+    if (!bindSocket()) {
+        warning(QStringLiteral("Could not listen for TURN on %1 port %2").arg(m_shared->host.toString(), QString::number(m_shared->port)));
+        delete m_socket;
+        m_socket = nullptr;
+        return false;
+    }
+    connect(m_socket, &QIODevice::readyRead, this, &QXmppTurnWorker::_q_readyRead);
+    m_expiryTimer->start();
+    return true;
+}
+
+/// Releases all the allocations and stops listening.
+
+void QXmppTurnWorker::close()
+{
+    m_expiryTimer->stop();
+
+    const auto allocations = m_allocations.values();
+    for (auto *allocation : allocations)
+        removeAllocation(allocation, QStringLiteral("server stopped"));
+
+    m_pendingRequests.clear();
+    m_keys.clear();
+    m_rejectedUsers.clear();
+    m_lookupAllowances.clear();
+
+    delete m_socket;
+    m_socket = nullptr;
+    reportCounters();
+}
+
+void QXmppTurnWorker::_q_readyRead()
+{
+    // consecutive datagrams for the same peer are sent at once
+    QList<QByteArray> pending;
+    QUdpSocket *pendingSocket = nullptr;
+    Address pendingPeer;
+    auto flush = [&]() {
+        if (!pending.isEmpty())
+            QXmppDatagramBatch::write(pendingSocket, pending, pendingPeer.first, pendingPeer.second);
+        pending.clear();
+        pendingSocket = nullptr;
+    };
+
+    int count;
+    do {
+        count = m_clientBatch.read(m_socket);
+        for (int i = 0; i < count; ++i) {
+            const auto &datagram = m_clientBatch.datagram(i);
+            const Address client(datagram.host, datagram.port);
+            if (datagram.size < 4)
+                continue;
+
+            const uchar first = uchar(datagram.data[0]);
+            if ((first & 0xc0) == 0x40) {
+                // ChannelData, see RFC 5766 - 11.4
+                auto *allocation = m_allocations.value(client);
+                if (!allocation)
+                    continue;
+                const auto *header = reinterpret_cast<const uchar *>(datagram.data);
+                const quint16 channel = qFromBigEndian<quint16>(header);
+                const quint16 length = qFromBigEndian<quint16>(header + 2);
+                const auto it = allocation->channels.constFind(channel);
+                if (it == allocation->channels.constEnd() || length > datagram.size - 4 ||
+                    !consume(allocation, length))
+                    continue;
+
+                if (allocation->socket != pendingSocket || it.value() != pendingPeer) {
+                    flush();
+                    pendingSocket = allocation->socket;
+                    pendingPeer = it.value();
+                }
+                pending << QByteArray(datagram.data + 4, length);
+                allocation->sentBytes += length;
+                m_relayedBytes += length;
+            } else if (!(first & 0xc0)) {
+                // the message may release an allocation
+                flush();
+                handleStun(datagram.data, datagram.size, client);
+            }
+        }
+    } while (count == m_clientBatch.capacity());
+    flush();
+
+    reportCounters();
+}
+
+void QXmppTurnWorker::_q_expire()
+{
+    const qint64 now = m_clock.elapsed();
+
+    const auto allocations = m_allocations.values();
+    for (auto *allocation : allocations) {
+        if (allocation->expiry <= now) {
+            removeAllocation(allocation, QStringLiteral("expired"));
+            continue;
+        }
+
+        for (auto it = allocation->permissions.begin(); it != allocation->permissions.end();) {
+            if (it.value() <= now)
+                it = allocation->permissions.erase(it);
+            else
+                ++it;
+        }
+        for (auto it = allocation->channelExpiries.begin(); it != allocation->channelExpiries.end();) {
+            if (it.value() <= now) {
+                allocation->channelNumbers.remove(allocation->channels.take(it.key()));
+                it = allocation->channelExpiries.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    for (auto it = m_keys.begin(); it != m_keys.end();) {
+        if (it.value().expiry <= now)
+            it = m_keys.erase(it);
+        else
+            ++it;
+    }
+    for (auto it = m_rejectedUsers.begin(); it != m_rejectedUsers.end();) {
+        if (it.value() <= now)
+            it = m_rejectedUsers.erase(it);
+        else
+            ++it;
+    }
+
+    // the clients retransmit the dropped requests, which starts a new lookup
+    for (auto it = m_pendingRequests.begin(); it != m_pendingRequests.end();) {
+        if (it.value().first().expiry <= now)
+            it = m_pendingRequests.erase(it);
+        else
+            ++it;
+    }
+
+    // a full allowance is the same as none
+    for (auto it = m_lookupAllowances.begin(); it != m_lookupAllowances.end();) {
+        const LookupAllowance &allowance = it.value();
+        if (allowance.allowance + (now - allowance.refillTime) / lookupInterval >= lookupBurst)
+            it = m_lookupAllowances.erase(it);
+        else
+            ++it;
+    }
+}
+
+// Applies the rate limit to \a bytes relayed for \a allocation.
+
+bool QXmppTurnWorker::consume(QXmppTurnServerAllocation *allocation, qint64 bytes)
+{
+    const qint64 rateLimit = m_shared->rateLimit;
+    if (rateLimit <= 0)
+        return true;
+
+    const qint64 now = m_clock.elapsed();
+    const qint64 refill = (now - allocation->refillTime) * rateLimit / 1000;
+    if (refill > 0) {
+        allocation->allowance = qMin(rateLimit, allocation->allowance + refill);
+        allocation->refillTime = now;
+    }
+    if (allocation->allowance < bytes) {
+        allocation->droppedPackets++;
+        m_droppedPackets++;
+        return false;
+    }
+    allocation->allowance -= bytes;
+    return true;
+}
+
+// Applies the rate limit to a lookup in the password checker for a client
+// of the given \a host.
+
+bool QXmppTurnWorker::consumeLookup(const QHostAddress &host, qint64 now)
+{
+    auto it = m_lookupAllowances.find(host);
+    if (it == m_lookupAllowances.end())
+        it = m_lookupAllowances.insert(host, { lookupBurst, now });
+
+    LookupAllowance &allowance = it.value();
+    const qint64 refill = (now - allowance.refillTime) / lookupInterval;
+    if (refill > 0) {
+        allowance.allowance = int(qMin<qint64>(lookupBurst, allowance.allowance + refill));
+        allowance.refillTime += refill * lookupInterval;
+    }
+    if (allowance.allowance <= 0)
+        return false;
+    allowance.allowance--;
+    return true;
+}
+
+// Asks the password checker for the key of \a username.
+//
+// The checker is not required to be thread-safe, so it is called from the
+// thread of the extension and the result is sent back to the worker.
+
+void QXmppTurnWorker::requestDigest(const QString &username)
+{
+    QXmppTurnShared *shared = m_shared;
+    QPointer<QXmppTurnWorker> worker(this);
+    QTimer::singleShot(0, shared->checkerContext, [shared, worker, username]() {
+        // the key is MD5(username ":" realm ":" password)
+        QXmppPasswordRequest request;
+        request.setDomain(shared->realm);
+        request.setUsername(username);
+        QXmppPasswordReply *reply = shared->passwordChecker->getDigest(request);
+        QObject::connect(reply, &QXmppPasswordReply::finished, reply, [reply, worker, username]() {
+            reply->deleteLater();
+
+            // the workers are deleted in this thread
+            if (!worker)
+                return;
+            const QXmppPasswordReply::Error error = reply->error();
+            const QByteArray digest = reply->digest();
+            QXmppTurnWorker *receiver = worker.data();
+            QTimer::singleShot(0, receiver, [receiver, username, error, digest]() {
+                receiver->digestReceived(username, error, digest);
+            });
+        });
+    });
+}
+
+void QXmppTurnWorker::digestReceived(const QString &username, QXmppPasswordReply::Error error, const QByteArray &digest)
+{
+    if (!m_socket)
+        return;
+
+    const QList<PendingRequest> pending = m_pendingRequests.take(username);
+    const qint64 now = m_clock.elapsed();
+    if (error == QXmppPasswordReply::NoError) {
+        m_keys.insert(username, { digest, now + keyLifetime });
+        for (const auto &request : pending)
+            handleRequest(request.datagram, request.client);
+    } else {
+        if (error == QXmppPasswordReply::AuthorizationError)
+            m_rejectedUsers.insert(username, now + rejectionLifetime);
+
+        // a temporary failure must not make the client give up
+        const bool temporary = error == QXmppPasswordReply::TemporaryError;
+        for (const auto &request : pending) {
+            QXmppStunMessage message;
+            message.decode(request.datagram);
+            if (temporary)
+                sendError(message, request.client, 500, QStringLiteral("Server Error"));
+            else
+                sendError(message, request.client, 401, QStringLiteral("Unauthorized"));
+        }
+    }
+}
+
+void QXmppTurnWorker::handleStun(const char *data, int size, const Address &client)
+{
+    QXmppStunMessageView view;
+    if (!view.parse(data, size) || view.cookie() != STUN_MAGIC)
+        return;
+
+    const quint16 messageClass = view.messageClass();
+    const quint16 messageMethod = view.messageMethod();
+    if (messageClass == QXmppStunMessage::Indication) {
+        if (messageMethod == QXmppStunMessage::Send)
+            handleSend(view, client);
+        return;
+    } else if (messageClass != QXmppStunMessage::Request) {
+        return;
+    }
+
+    if (messageMethod == QXmppStunMessage::Binding) {
+        // plain STUN, see RFC 5389 - 10.1
+        QXmppStunMessage response;
+        response.setType(QXmppStunMessage::Binding | QXmppStunMessage::Response);
+        response.setId(QByteArray(view.id(), 12));
+        response.xorMappedHost = client.first;
+        response.xorMappedPort = client.second;
+        m_socket->writeDatagram(response.encode(), client.first, client.second);
+        return;
+    }
+
+    handleRequest(QByteArray(data, size), client);
+}
+
+void QXmppTurnWorker::handleRequest(const QByteArray &datagram, const Address &client)
+{
+    QXmppStunMessageView view;
+    view.parse(datagram.constData(), datagram.size());
+
+    QXmppStunMessage request;
+    if (!request.decode(datagram))
+        return;
+
+    auto *allocation = m_allocations.value(client);
+    if (allocation && allocation->lastRequestId == request.id()) {
+        m_socket->writeDatagram(allocation->lastResponse, client.first, client.second);
+        return;
+    }
+
+    // long-term credentials, see RFC 5389 - 10.2.2
+    if (!view.hasIntegrity()) {
+        sendError(request, client, 401, QStringLiteral("Unauthorized"));
+        return;
+    }
+    const QString username = request.username();
+    if (username.isEmpty() || request.realm().isEmpty() || request.nonce().isEmpty()) {
+        sendError(request, client, 400, QStringLiteral("Bad Request"));
+        return;
+    }
+    if (request.realm() != m_shared->realm) {
+        sendError(request, client, 401, QStringLiteral("Unauthorized"));
+        return;
+    }
+    if (request.nonce() != m_shared->nonce) {
+        sendError(request, client, 438, QStringLiteral("Stale Nonce"));
+        return;
+    }
+
+    const qint64 now = m_clock.elapsed();
+    const auto cachedKey = m_keys.constFind(username);
+    if (cachedKey == m_keys.constEnd() || cachedKey.value().expiry <= now) {
+        const auto rejected = m_rejectedUsers.constFind(username);
+        if (rejected != m_rejectedUsers.constEnd() && rejected.value() > now) {
+            sendError(request, client, 401, QStringLiteral("Unauthorized"));
+            return;
+        }
+
+        // requests over the limit are dropped, the client retransmits them
+        if (!consumeLookup(client.first, now))
+            return;
+
+        // concurrent requests of the same user wait for a single lookup
+        QList<PendingRequest> &pending = m_pendingRequests[username];
+        pending << PendingRequest { datagram, client, now + pendingLifetime };
+        if (pending.size() == 1)
+            requestDigest(username);
+        return;
+    }
+
+    const QByteArray key = cachedKey.value().key;
+    if (!view.checkIntegrity(key)) {
+        sendError(request, client, 401, QStringLiteral("Unauthorized"));
+        return;
+    }
+    if (allocation && allocation->username != username) {
+        sendError(request, client, 441, QStringLiteral("Wrong Credentials"), key);
+        return;
+    }
+
+    // requests which do not need an allocation
+    const quint16 method = request.messageMethod();
+    QXmppStunMessage response;
+    response.setType(method | QXmppStunMessage::Response);
+    response.setId(request.id());
+
+    if (method == QXmppStunMessage::Allocate) {
+        // see RFC 5766 - 6.2. Receiving an Allocate Request
+        if (allocation) {
+            sendError(request, client, 437, QStringLiteral("Allocation Mismatch"), key);
+            return;
+        }
+        if (!request.requestedTransport()) {
+            sendError(request, client, 400, QStringLiteral("Bad Request"), key);
+            return;
+        }
+        if (request.requestedTransport() != 0x11) {
+            sendError(request, client, 442, QStringLiteral("Unsupported Transport Protocol"), key);
+            return;
+        }
+        if (!m_shared->reserveAllocation(username)) {
+            sendError(request, client, 486, QStringLiteral("Allocation Quota Reached"), key);
+            return;
+        }
+
+        auto *socket = new QUdpSocket(this);
+        if (!socket->bind(m_shared->relayHost, 0)) {
+            delete socket;
+            m_shared->releaseAllocation(username);
+            sendError(request, client, 508, QStringLiteral("Insufficient Capacity"), key);
+            return;
+        }
+
+        quint32 lifetime = defaultLifetime;
+        QXmppStunMessageView::Attribute attribute;
+        if (view.findAttribute(LifetimeAttribute, attribute))
+            lifetime = qBound(defaultLifetime, request.lifetime(), maximumLifetime);
+
+        allocation = new QXmppTurnServerAllocation;
+        allocation->client = client;
+        allocation->username = username;
+        allocation->key = key;
+        allocation->socket = socket;
+        allocation->expiry = now + lifetime * 1000;
+        allocation->allowance = m_shared->rateLimit;
+        allocation->refillTime = now;
+        m_allocations.insert(client, allocation);
+        connect(socket, &QIODevice::readyRead, this, [this, allocation]() {
+            relayFromPeers(allocation);
+        });
+
+        info(QStringLiteral("TURN allocation for %1 from %2 port %3 relayed on port %4").arg(username, client.first.toString(), QString::number(client.second), QString::number(socket->localPort())));
+        emit setGauge(QStringLiteral("turn.allocation.count"), m_shared->allocationCount.loadAcquire());
+        emit updateCounter(QStringLiteral("turn.allocation.created"));
+
+        response.xorRelayedHost = socket->localAddress();
+        response.xorRelayedPort = socket->localPort();
+        response.xorMappedHost = client.first;
+        response.xorMappedPort = client.second;
+        response.setLifetime(lifetime);
+        sendResponse(request, response, client, key, allocation);
+        return;
+    }
+
+    if (!allocation) {
+        sendError(request, client, 437, QStringLiteral("Allocation Mismatch"), key);
+        return;
+    }
+
+    if (method == QXmppStunMessage::Refresh) {
+        // see RFC 5766 - 7.2. Receiving a Refresh Request
+        quint32 lifetime = defaultLifetime;
+        QXmppStunMessageView::Attribute attribute;
+        if (view.findAttribute(LifetimeAttribute, attribute))
+            lifetime = request.lifetime() ? qBound(defaultLifetime, request.lifetime(), maximumLifetime) : 0;
+        response.setLifetime(lifetime);
+
+        if (!lifetime) {
+            sendResponse(request, response, client, key, nullptr);
+            removeAllocation(allocation, QStringLiteral("released"));
+        } else {
+            allocation->expiry = now + lifetime * 1000;
+            sendResponse(request, response, client, key, allocation);
+        }
+    } else if (method == QXmppStunMessage::CreatePermission) {
+        // see RFC 5766 - 9.2. Receiving a CreatePermission Request
+        QList<QHostAddress> peers;
+        QXmppStunMessageView::Attribute attribute;
+        int offset = 0;
+        while (view.nextAttribute(offset, attribute)) {
+            QHostAddress host;
+            quint16 port;
+            if (attribute.type == XorPeerAddressAttribute && view.decodeAddress(attribute, host, port))
+                peers << host;
+        }
+        if (peers.isEmpty()) {
+            sendError(request, client, 400, QStringLiteral("Bad Request"), key);
+            return;
+        }
+        for (const auto &host : peers)
+            allocation->permissions.insert(host, now + permissionLifetime);
+        sendResponse(request, response, client, key, allocation);
+    } else if (method == QXmppStunMessage::ChannelBind) {
+        // see RFC 5766 - 11.2. Receiving a ChannelBind Request
+        const quint16 channel = request.channelNumber();
+        const Address peer(request.xorPeerHost, request.xorPeerPort);
+        const auto boundPeer = allocation->channels.constFind(channel);
+        const auto boundChannel = allocation->channelNumbers.constFind(peer);
+        if (channel < 0x4000 || channel > 0x7ffe || peer.first.isNull() ||
+            (boundPeer != allocation->channels.constEnd() && boundPeer.value() != peer) ||
+            (boundChannel != allocation->channelNumbers.constEnd() && boundChannel.value() != channel)) {
+            sendError(request, client, 400, QStringLiteral("Bad Request"), key);
+            return;
+        }
+        allocation->channels.insert(channel, peer);
+        allocation->channelNumbers.insert(peer, channel);
+        allocation->channelExpiries.insert(channel, now + channelLifetime);
+        allocation->permissions.insert(peer.first, now + permissionLifetime);
+        sendResponse(request, response, client, key, allocation);
+    } else {
+        sendError(request, client, 400, QStringLiteral("Bad Request"), key);
+    }
+}
+
+// Relays the data of a Send indication, see RFC 5766 - 10.2.
+
+void QXmppTurnWorker::handleSend(const QXmppStunMessageView &view, const Address &client)
+{
+    auto *allocation = m_allocations.value(client);
+    if (!allocation)
+        return;
+
+    QXmppStunMessageView::Attribute peerAttribute, dataAttribute;
+    QHostAddress host;
+    quint16 port;
+    if (!view.findAttribute(XorPeerAddressAttribute, peerAttribute) ||
+        !view.findAttribute(DataAttribute, dataAttribute) ||
+        !view.decodeAddress(peerAttribute, host, port))
+        return;
+
+    // a channel bound to the peer holds a permission
+    if (allocation->permissions.value(host) <= m_clock.elapsed() &&
+        !allocation->channelNumbers.contains(Address(host, port)))
+        return;
+    if (!consume(allocation, dataAttribute.length))
+        return;
+
+    allocation->socket->writeDatagram(dataAttribute.value, dataAttribute.length, host, port);
+    allocation->sentBytes += dataAttribute.length;
+    m_relayedBytes += dataAttribute.length;
+}
+
+void QXmppTurnWorker::relayFromPeers(QXmppTurnServerAllocation *allocation)
+{
+    const qint64 now = m_clock.elapsed();
+
+    QList<QByteArray> datagrams;
+    int count;
+    do {
+        count = m_peerBatch.read(allocation->socket);
+        for (int i = 0; i < count; ++i) {
+            const auto &datagram = m_peerBatch.datagram(i);
+            const quint16 channel = allocation->channelNumbers.value(Address(datagram.host, datagram.port));
+            if (!channel && allocation->permissions.value(datagram.host) <= now) {
+                allocation->droppedPackets++;
+                m_droppedPackets++;
+                continue;
+            }
+            if (datagram.size > 0xffff || !consume(allocation, datagram.size))
+                continue;
+
+            QByteArray buffer;
+            if (channel) {
+                // ChannelData, see RFC 5766 - 11.5
+                buffer.resize(4 + datagram.size);
+                auto *header = reinterpret_cast<uchar *>(buffer.data());
+                qToBigEndian(channel, header);
+                qToBigEndian(quint16(datagram.size), header + 2);
+                memcpy(buffer.data() + 4, datagram.data, size_t(datagram.size));
+            } else {
+                // Data indication, see RFC 5766 - 10.3
+                qToBigEndian(++m_indicationCount, reinterpret_cast<uchar *>(m_indicationId.data() + 8));
+                buffer.resize(STUN_HEADER + 24 + 4 + datagram.size + 3);
+                QXmppStunMessageWriter writer(buffer.data(), buffer.size());
+                writer.writeHeader(QXmppStunMessage::Data | QXmppStunMessage::Indication, m_indicationId.constData());
+                writer.addAddress(XorPeerAddressAttribute, datagram.host, datagram.port);
+                writer.addAttribute(DataAttribute, datagram.data, datagram.size);
+                buffer.resize(writer.size());
+            }
+            datagrams << buffer;
+            allocation->receivedBytes += datagram.size;
+            m_relayedBytes += datagram.size;
+        }
+    } while (count == m_peerBatch.capacity());
+
+    if (!datagrams.isEmpty())
+        QXmppDatagramBatch::write(m_socket, datagrams, allocation->client.first, allocation->client.second);
+    reportCounters();
+}
+
+void QXmppTurnWorker::removeAllocation(QXmppTurnServerAllocation *allocation, const QString &reason)
+{
+    m_allocations.remove(allocation->client);
+    m_shared->releaseAllocation(allocation->username);
+
+    allocation->socket->disconnect(this);
+    allocation->socket->close();
+    allocation->socket->deleteLater();
+
+    info(QStringLiteral("TURN allocation for %1 from %2 port %3 %4 (sent %5 bytes, received %6 bytes, dropped %7 packets)").arg(allocation->username, allocation->client.first.toString(), QString::number(allocation->client.second), reason, QString::number(allocation->sentBytes), QString::number(allocation->receivedBytes), QString::number(allocation->droppedPackets)));
+    emit setGauge(QStringLiteral("turn.allocation.count"), m_shared->allocationCount.loadAcquire());
+    emit allocationFinished(allocation->username, allocation->sentBytes, allocation->receivedBytes, allocation->droppedPackets);
+
+    delete allocation;
+}
+
+void QXmppTurnWorker::sendError(const QXmppStunMessage &request, const Address &client, int code, const QString &phrase, const QByteArray &key)
+{
+    QXmppStunMessage response;
+    response.setType(request.messageMethod() | QXmppStunMessage::Error);
+    response.setId(request.id());
+    response.errorCode = code;
+    response.errorPhrase = phrase;
+    if (code == 401 || code == 438) {
+        response.setRealm(m_shared->realm);
+        response.setNonce(m_shared->nonce);
+    }
+    m_socket->writeDatagram(response.encode(key), client.first, client.second);
+}
+
+void QXmppTurnWorker::sendResponse(const QXmppStunMessage &request, QXmppStunMessage &response, const Address &client, const QByteArray &key, QXmppTurnServerAllocation *allocation)
+{
+    response.setSoftware(QStringLiteral("QXmpp"));
+    const QByteArray datagram = response.encode(key);
+    m_socket->writeDatagram(datagram, client.first, client.second);
+    if (allocation) {
+        allocation->lastRequestId = request.id();
+        allocation->lastResponse = datagram;
+    }
+}
+
+void QXmppTurnWorker::reportCounters()
+{
+    if (m_relayedBytes) {
+        m_shared->relayedBytes.fetchAndAddRelaxed(m_relayedBytes);
+        emit updateCounter(QStringLiteral("turn.relayed-bytes"), m_relayedBytes);
+        m_relayedBytes = 0;
+    }
+    if (m_droppedPackets) {
+        emit updateCounter(QStringLiteral("turn.dropped-packets"), m_droppedPackets);
+        m_droppedPackets = 0;
+    }
+}
+/// \endcond
+
+class QXmppServerTurnPrivate
+{
+public:
+    QXmppServerTurnPrivate();
+
+    QHostAddress host;
+    quint16 port;
+    QHostAddress relayHost;
+    QString realm;
+    QXmppPasswordChecker *passwordChecker;
+    int threadCount;
+    int allocationLimit;
+    int userAllocationLimit;
+    qint64 rateLimit;
+
+    QXmppTurnShared shared;
+    QList<QXmppTurnWorker *> workers;
+    QList<QThread *> threads;
+};
+
+QXmppServerTurnPrivate::QXmppServerTurnPrivate()
+    : host(QHostAddress::AnyIPv4),
+      port(3478),
+      passwordChecker(nullptr),
+      threadCount(1),
+      allocationLimit(0),
+      userAllocationLimit(0),
+      rateLimit(0)
+{
+}
+
+/// Constructs a new STUN and TURN server extension.
+
+QXmppServerTurn::QXmppServerTurn()
+    : d(new QXmppServerTurnPrivate)
+{
+}
+
+QXmppServerTurn::~QXmppServerTurn()
+{
+    stop();
+    delete d;
+}
+
+/// Returns the address on which the server receives STUN and TURN messages.
+
+QHostAddress QXmppServerTurn::host() const
+{
+    return d->host;
+}
+
+/// Sets the address on which the server receives STUN and TURN messages.
+///
+/// The default is to listen on all IPv4 addresses.
+///
+/// \param host
+
+void QXmppServerTurn::setHost(const QHostAddress &host)
+{
+    d->host = host;
+}
+
+/// Returns the port on which the server receives STUN and TURN messages.
+///
+/// Once the server is started, this is the port it actually listens on.
+
+quint16 QXmppServerTurn::port() const
+{
+    return d->workers.isEmpty() ? d->port : d->shared.port;
+}
+
+/// Sets the port on which the server receives STUN and TURN messages.
+///
+/// The default is 3478, a port of 0 lets the system choose a free port.
+///
+/// \param port
+
+void QXmppServerTurn::setPort(quint16 port)
+{
+    d->port = port;
+}
+
+/// Returns the address on which relayed transport addresses are allocated.
+
+QHostAddress QXmppServerTurn::relayHost() const
+{
+    return d->relayHost;
+}
+
+/// Sets the address on which relayed transport addresses are allocated.
+///
+/// It defaults to host(), or if the server listens on all addresses, to
+/// the first IPv4 address of the machine.
+///
+/// \param host
+
+void QXmppServerTurn::setRelayHost(const QHostAddress &host)
+{
+    d->relayHost = host;
+}
+
+/// Returns the realm used for authentication.
+
+QString QXmppServerTurn::realm() const
+{
+    return d->realm;
+}
+
+/// Sets the realm used for authentication, which defaults to the server's
+/// domain.
+///
+/// \param realm
+
+void QXmppServerTurn::setRealm(const QString &realm)
+{
+    d->realm = realm;
+}
+
+/// Returns the password checker used to authenticate clients.
+
+QXmppPasswordChecker *QXmppServerTurn::passwordChecker() const
+{
+    return d->passwordChecker;
+}
+
+/// Sets the password checker used to authenticate clients, which defaults
+/// to the server's password checker.
+///
+/// The checker's getDigest() is called with the realm as the domain, always
+/// from the thread of the extension. The keys are cached for five minutes,
+/// unknown users are rejected for thirty seconds without calling the checker
+/// again and each client address may cause at most one lookup per second,
+/// after a burst of five.
+///
+/// \param checker
+
+void QXmppServerTurn::setPasswordChecker(QXmppPasswordChecker *checker)
+{
+    d->passwordChecker = checker;
+}
+
+/// Returns the number of relaying threads.
+
+int QXmppServerTurn::threadCount() const
+{
+    return d->threadCount;
+}
+
+/// Sets the number of relaying threads, which defaults to 1.
+///
+/// With a single thread, the server runs in the thread of the extension.
+/// Several threads are only supported on Linux.
+///
+/// \param count
+
+void QXmppServerTurn::setThreadCount(int count)
+{
+    d->threadCount = qMax(1, count);
+}
+
+/// Returns the maximum number of allocations, or 0 if there is no limit.
+
+int QXmppServerTurn::allocationLimit() const
+{
+    return d->allocationLimit;
+}
+
+/// Sets the maximum number of allocations, or 0 for no limit.
+///
+/// The limit is read when the server is started, changing it afterwards
+/// only takes effect after a restart.
+///
+/// \param limit
+
+void QXmppServerTurn::setAllocationLimit(int limit)
+{
+    d->allocationLimit = limit;
+}
+
+/// Returns the maximum number of allocations per user, or 0 if there is
+/// no limit.
+
+int QXmppServerTurn::userAllocationLimit() const
+{
+    return d->userAllocationLimit;
+}
+
+/// Sets the maximum number of allocations per user, or 0 for no limit.
+///
+/// The limit is read when the server is started, changing it afterwards
+/// only takes effect after a restart.
+///
+/// \param limit
+
+void QXmppServerTurn::setUserAllocationLimit(int limit)
+{
+    d->userAllocationLimit = limit;
+}
+
+/// Returns the maximum number of bytes per second relayed for each
+/// allocation, or 0 if there is no limit.
+
+qint64 QXmppServerTurn::rateLimit() const
+{
+    return d->rateLimit;
+}
+
+/// Sets the maximum number of bytes per second relayed for each
+/// allocation, in both directions. Packets beyond the limit are dropped.
+///
+/// An allocation may exceed the limit for bursts of up to one second.
+///
+/// The limit is read when the server is started, changing it afterwards
+/// only takes effect after a restart.
+///
+/// \param bytesPerSecond The limit, or 0 for no limit.
+
+void QXmppServerTurn::setRateLimit(qint64 bytesPerSecond)
+{
+    d->rateLimit = qMax(qint64(0), bytesPerSecond);
+}
+
+/// Returns the number of current allocations.
+
+int QXmppServerTurn::allocationCount() const
+{
+    return d->shared.allocationCount.loadAcquire();
+}
+
+/// Returns the total number of bytes relayed.
+
+qint64 QXmppServerTurn::relayedBytes() const
+{
+    return d->shared.relayedBytes.loadAcquire();
+}
+
+bool QXmppServerTurn::start()
+{
+    if (!d->workers.isEmpty())
+        return true;
+
+    QXmppTurnShared &shared = d->shared;
+    shared.passwordChecker = d->passwordChecker;
+    if (!shared.passwordChecker && server())
+        shared.passwordChecker = server()->passwordChecker();
+    if (!shared.passwordChecker) {
+        warning(QStringLiteral("Not starting TURN server without a password checker"));
+        return false;
+    }
+
+    shared.host = d->host;
+    shared.port = d->port;
+    shared.realm = d->realm;
+    if (shared.realm.isEmpty() && server())
+        shared.realm = server()->domain();
+    if (shared.realm.isEmpty()) {
+        warning(QStringLiteral("Not starting TURN server without a realm"));
+        return false;
+    }
+    shared.checkerContext = this;
+    shared.nonce = QXmppUtils::generateStanzaHash(32).toLatin1();
+    shared.allocationLimit = d->allocationLimit;
+    shared.userAllocationLimit = d->userAllocationLimit;
+    shared.rateLimit = d->rateLimit;
+
+    // relayed addresses must be reachable by the peers
+    shared.relayHost = d->relayHost;
+    if (shared.relayHost.isNull())
+        shared.relayHost = isAnyAddress(d->host) ? QHostAddress() : d->host;
+    if (shared.relayHost.isNull()) {
+        const auto addresses = QNetworkInterface::allAddresses();
+        for (const auto &address : addresses) {
+            if (address.protocol() == QAbstractSocket::IPv4Protocol && !address.isLoopback()) {
+                shared.relayHost = address;
+                break;
+            }
+        }
+    }
+    if (shared.relayHost.isNull())
+        shared.relayHost = QHostAddress::LocalHost;
+
+#ifdef Q_OS_LINUX
+    const int threadCount = d->threadCount;
+#else
+    const int threadCount = 1;
+#endif
+
+    for (int i = 0; i < threadCount; ++i) {
+        auto *worker = new QXmppTurnWorker(&shared, threadCount > 1);
+        connect(worker, &QXmppLoggable::logMessage,
+                this, &QXmppLoggable::logMessage);
+        connect(worker, &QXmppLoggable::setGauge,
+                this, &QXmppLoggable::setGauge);
+        connect(worker, &QXmppLoggable::updateCounter,
+                this, &QXmppLoggable::updateCounter);
+        connect(worker, &QXmppTurnWorker::allocationFinished,
+                this, &QXmppServerTurn::allocationFinished);
+        d->workers << worker;
+
+        bool ok = false;
+        if (threadCount > 1) {
+            auto *thread = new QThread;
+            thread->setObjectName(QStringLiteral("TURN %1").arg(i));
+            worker->moveToThread(thread);
+            thread->start();
+            d->threads << thread;
+            QMetaObject::invokeMethod(worker, "listen", Qt::BlockingQueuedConnection, Q_RETURN_ARG(bool, ok));
+        } else {
+            ok = worker->listen();
+        }
+        if (!ok) {
+            stop();
+            return false;
+        }
+
+        // the other workers share the port of the first one
+        if (!i)
+            shared.port = worker->localPort();
+    }
+
+    info(QStringLiteral("TURN server listening on %1 port %2 with %3 thread(s)").arg(shared.host.toString(), QString::number(shared.port), QString::number(threadCount)));
+    return true;
+}
+
+void QXmppServerTurn::stop()
+{
+    for (int i = 0; i < d->workers.size(); ++i) {
+        QXmppTurnWorker *worker = d->workers.at(i);
+        if (i < d->threads.size()) {
+            QThread *thread = d->threads.at(i);
+            QMetaObject::invokeMethod(worker, "close", Qt::BlockingQueuedConnection);
+            thread->quit();
+            thread->wait();
+            delete worker;
+            delete thread;
+        } else {
+            delete worker;
+        }
+    }
+    d->workers.clear();
+    d->threads.clear();
+}
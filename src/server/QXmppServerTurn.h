@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2008-2020 The QXmpp developers
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPSERVERTURN_H
+#define QXMPPSERVERTURN_H
+
+#include "QXmppServerExtension.h"
+
+#include <QHostAddress>
+
+class QXmppPasswordChecker;
+class QXmppServerTurnPrivate;
+
+/// \brief The QXmppServerTurn class is a server extension which provides a
+/// STUN and TURN server, as defined by RFC 5389 and RFC 5766, so that the
+/// users' media sessions can be relayed when no direct path exists.
+///
+/// Clients authenticate with the long-term credential mechanism, using the
+/// passwords of the server's password checker. The relayed addresses are
+/// allocated on relayHost().
+///
+/// Datagrams are received and sent in batches. On Linux, the server can
+/// use several threads which share the same port, each of them serving its
+/// own set of clients.
+///
+/// \code
+/// QXmppServerTurn *turn = new QXmppServerTurn;
+/// turn->setHost(QHostAddress("192.0.2.1"));
+/// turn->setThreadCount(4);
+/// server->addExtension(turn);
+/// \endcode
+///
+/// \ingroup Core
+///
+/// \since QXmpp 1.4
+
+class QXMPP_EXPORT QXmppServerTurn : public QXmppServerExtension
+{
+    Q_OBJECT
+    Q_CLASSINFO("ExtensionName", "turn")
+
+    /// The port on which the server receives STUN and TURN messages
+    Q_PROPERTY(quint16 port READ port WRITE setPort)
+    /// The realm used for authentication
+    Q_PROPERTY(QString realm READ realm WRITE setRealm)
+    /// The number of relaying threads
+    Q_PROPERTY(int threadCount READ threadCount WRITE setThreadCount)
+
+public:
+    QXmppServerTurn();
+    ~QXmppServerTurn() override;
+
+    QHostAddress host() const;
+    void setHost(const QHostAddress &host);
+
+    quint16 port() const;
+    void setPort(quint16 port);
+
+    QHostAddress relayHost() const;
+    void setRelayHost(const QHostAddress &host);
+
+    QString realm() const;
+    void setRealm(const QString &realm);
+
+    QXmppPasswordChecker *passwordChecker() const;
+    void setPasswordChecker(QXmppPasswordChecker *checker);
+
+    int threadCount() const;
+    void setThreadCount(int count);
+
+    int allocationLimit() const;
+    void setAllocationLimit(int limit);
+
+    int userAllocationLimit() const;
+    void setUserAllocationLimit(int limit);
+
+    qint64 rateLimit() const;
+    void setRateLimit(qint64 bytesPerSecond);
+
+    int allocationCount() const;
+    qint64 relayedBytes() const;
+
+    /// \cond
+    bool start() override;
+    void stop() override;
+    /// \endcond
+
+Q_SIGNALS:
+    /// This signal is emitted when an allocation is released or expires,
+    /// with the number of bytes relayed from the client to its peers and
+    /// from the peers to the client, and the number of packets dropped.
+    void allocationFinished(const QString &username, qint64 sentBytes, qint64 receivedBytes, qint64 droppedPackets);
+
+private:
+    QXmppServerTurnPrivate *d;
+};
+
+#endif
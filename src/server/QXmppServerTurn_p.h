@@ -0,0 +1,194 @@
+/*
+ * Copyright (C) 2008-2020 The QXmpp developers
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPSERVERTURN_P_H
+#define QXMPPSERVERTURN_P_H
+
+#include "QXmppPasswordChecker.h"
+#include "QXmppStun_p.h"
+
+#include <QAtomicInteger>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMutex>
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.  It exists for the convenience
+// of the QXmppServerTurn class.  This header file may change from
+// version to version without notice, or even be removed.
+//
+// We mean it.
+//
+
+class QUdpSocket;
+class QTimer;
+
+// The settings and totals shared by the relay workers.
+
+struct QXmppTurnShared
+{
+    bool reserveAllocation(const QString &username);
+    void releaseAllocation(const QString &username);
+
+    QHostAddress host;
+    quint16 port = 0;
+    QHostAddress relayHost;
+    QString realm;
+    QByteArray nonce;
+    QXmppPasswordChecker *passwordChecker = nullptr;
+    // the password checker is only called from the thread of this object
+    QObject *checkerContext = nullptr;
+    int allocationLimit = 0;
+    int userAllocationLimit = 0;
+    qint64 rateLimit = 0;
+
+    QAtomicInt allocationCount;
+    QAtomicInteger<qint64> relayedBytes;
+
+    QMutex mutex;
+    QHash<QString, int> userAllocations;
+};
+
+// A relayed transport address, allocated to the client with the given
+// address on one of the server's sockets.
+
+struct QXmppTurnServerAllocation
+{
+    typedef QPair<QHostAddress, quint16> Address;
+
+    Address client;
+    QString username;
+    QByteArray key;
+    QUdpSocket *socket = nullptr;
+    qint64 expiry = 0;
+
+    // expiry of the permissions and channels
+    QHash<QHostAddress, qint64> permissions;
+    QHash<quint16, Address> channels;
+    QHash<Address, quint16> channelNumbers;
+    QHash<quint16, qint64> channelExpiries;
+
+    // the last response, sent again if the client retransmits its request
+    QByteArray lastRequestId;
+    QByteArray lastResponse;
+
+    // rate limit
+    qint64 allowance = 0;
+    qint64 refillTime = 0;
+
+    // counters
+    qint64 sentBytes = 0;
+    qint64 receivedBytes = 0;
+    qint64 droppedPackets = 0;
+};
+
+// Serves the clients which reach one of the server's sockets.
+//
+// With several threads, each worker lives in its own thread and the kernel
+// spreads the clients over the workers' sockets, which share the same port.
+
+class QXmppTurnWorker : public QXmppLoggable
+{
+    Q_OBJECT
+
+public:
+    QXmppTurnWorker(QXmppTurnShared *shared, bool reusePort, QObject *parent = nullptr);
+    ~QXmppTurnWorker() override;
+
+    quint16 localPort() const;
+
+public Q_SLOTS:
+    bool listen();
+    void close();
+
+Q_SIGNALS:
+    void allocationFinished(const QString &username, qint64 sentBytes, qint64 receivedBytes, qint64 droppedPackets);
+
+private Q_SLOTS:
+    void _q_readyRead();
+    void _q_expire();
+
+private:
+    typedef QXmppTurnServerAllocation::Address Address;
+
+    struct PendingRequest
+    {
+        QByteArray datagram;
+        Address client;
+        // time after which the request is dropped if the lookup it waits
+        // for has not completed
+        qint64 expiry;
+    };
+
+    struct CachedKey
+    {
+        QByteArray key;
+        qint64 expiry;
+    };
+
+    struct LookupAllowance
+    {
+        int allowance;
+        qint64 refillTime;
+    };
+
+    bool bindSocket();
+    bool consume(QXmppTurnServerAllocation *allocation, qint64 bytes);
+    bool consumeLookup(const QHostAddress &host, qint64 now);
+    void requestDigest(const QString &username);
+    void digestReceived(const QString &username, QXmppPasswordReply::Error error, const QByteArray &digest);
+    void handleStun(const char *data, int size, const Address &client);
+    void handleRequest(const QByteArray &datagram, const Address &client);
+    void handleSend(const QXmppStunMessageView &view, const Address &client);
+    void relayFromPeers(QXmppTurnServerAllocation *allocation);
+    void removeAllocation(QXmppTurnServerAllocation *allocation, const QString &reason);
+    void sendError(const QXmppStunMessage &request, const Address &client, int code, const QString &phrase, const QByteArray &key = QByteArray());
+    void sendResponse(const QXmppStunMessage &request, QXmppStunMessage &response, const Address &client, const QByteArray &key, QXmppTurnServerAllocation *allocation);
+    void reportCounters();
+
+    QXmppTurnShared *m_shared;
+    bool m_reusePort;
+    QUdpSocket *m_socket;
+    QTimer *m_expiryTimer;
+    QElapsedTimer m_clock;
+
+    QXmppDatagramBatch m_clientBatch;
+    QXmppDatagramBatch m_peerBatch;
+    QHash<Address, QXmppTurnServerAllocation *> m_allocations;
+
+    // authentication
+    QHash<QString, CachedKey> m_keys;
+    QHash<QString, qint64> m_rejectedUsers;
+    QHash<QHostAddress, LookupAllowance> m_lookupAllowances;
+    QHash<QString, QList<PendingRequest>> m_pendingRequests;
+
+    // data indications
+    QByteArray m_indicationId;
+    quint32 m_indicationCount;
+
+    // counters not yet reported
+    qint64 m_relayedBytes;
+    qint64 m_droppedPackets;
+};
+
+#endif
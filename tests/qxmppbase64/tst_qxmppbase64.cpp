@@ -0,0 +1,201 @@
+/*
+ * Copyright (C) 2008-2020 The QXmpp developers
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "QXmppBase64_p.h"
+
+#include <QObject>
+#include <QtTest>
+
+Q_DECLARE_METATYPE(QXmppBase64::Implementation)
+
+static QByteArray randomData(int size)
+{
+    QByteArray data(size, Qt::Uninitialized);
+    for (int i = 0; i < size; ++i)
+        data[i] = char(qrand());
+    return data;
+}
+
+static void addImplementationRows()
+{
+    QTest::addColumn<QXmppBase64::Implementation>("implementation");
+
+    QTest::newRow("scalar") << QXmppBase64::Scalar;
+    QTest::newRow("ssse3") << QXmppBase64::Ssse3;
+    QTest::newRow("avx2") << QXmppBase64::Avx2;
+    QTest::newRow("neon") << QXmppBase64::Neon;
+}
+
+class tst_QXmppBase64 : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void init();
+    void cleanupTestCase();
+
+    void testRoundTrip_data();
+    void testRoundTrip();
+    void testLenient_data();
+    void testLenient();
+    void testUtf16_data();
+    void testUtf16();
+
+    void benchmarkEncode_data();
+    void benchmarkEncode();
+    void benchmarkDecode_data();
+    void benchmarkDecode();
+
+private:
+    void selectImplementation();
+
+    QXmppBase64::Implementation m_defaultImplementation = QXmppBase64::implementation();
+};
+
+void tst_QXmppBase64::init()
+{
+    qsrand(0);
+}
+
+void tst_QXmppBase64::cleanupTestCase()
+{
+    QXmppBase64::setImplementation(m_defaultImplementation);
+}
+
+void tst_QXmppBase64::selectImplementation()
+{
+    QFETCH(QXmppBase64::Implementation, implementation);
+    if (!QXmppBase64::setImplementation(implementation))
+        QSKIP("Implementation is not supported on this CPU");
+    QCOMPARE(QXmppBase64::implementation(), implementation);
+}
+
+void tst_QXmppBase64::testRoundTrip_data()
+{
+    addImplementationRows();
+}
+
+void tst_QXmppBase64::testRoundTrip()
+{
+    selectImplementation();
+
+    QCOMPARE(QXmppBase64::encode(QByteArray()), QByteArray());
+    QCOMPARE(QXmppBase64::decode(QByteArray()), QByteArray());
+    QCOMPARE(QXmppBase64::encode("f"), QByteArray("Zg=="));
+    QCOMPARE(QXmppBase64::encode("fo"), QByteArray("Zm8="));
+    QCOMPARE(QXmppBase64::encode("foo"), QByteArray("Zm9v"));
+
+    // cover all block sizes and tails
+    for (int size = 0; size < 300; ++size) {
+        const QByteArray data = randomData(size);
+        const QByteArray encoded = QXmppBase64::encode(data);
+        QCOMPARE(encoded, data.toBase64());
+        QCOMPARE(QXmppBase64::decode(encoded), data);
+    }
+}
+
+void tst_QXmppBase64::testLenient_data()
+{
+    addImplementationRows();
+}
+
+void tst_QXmppBase64::testLenient()
+{
+    selectImplementation();
+
+    QCOMPARE(QXmppBase64::decode(QByteArray("Zm9v\nYmFy")), QByteArray("foobar"));
+    QCOMPARE(QXmppBase64::decode(QByteArray("Zg")), QByteArray("f"));
+    QCOMPARE(QXmppBase64::decode(QByteArray("Zg==Zm8=")), QByteArray::fromBase64("Zg==Zm8="));
+
+    // line-wrapped data, as found in vCard photos
+    const QByteArray data = randomData(4000);
+    QByteArray wrapped;
+    const QByteArray encoded = data.toBase64();
+    for (int i = 0; i < encoded.size(); i += 76)
+        wrapped += encoded.mid(i, 76) + "\r\n";
+    QCOMPARE(QXmppBase64::decode(wrapped), data);
+
+    // characters outside of the alphabet at arbitrary positions
+    for (int i = 0; i < 200; ++i) {
+        QByteArray noisy = encoded.left(qrand() % 600);
+        const int count = qrand() % 5;
+        for (int j = 0; j < count; ++j)
+            noisy.insert(qrand() % (noisy.size() + 1), "\n =*\x80\xff"[qrand() % 6]);
+        QCOMPARE(QXmppBase64::decode(noisy), QByteArray::fromBase64(noisy));
+    }
+}
+
+void tst_QXmppBase64::testUtf16_data()
+{
+    addImplementationRows();
+}
+
+void tst_QXmppBase64::testUtf16()
+{
+    selectImplementation();
+
+    const QByteArray data = randomData(10000);
+    const QString encoded = QString::fromLatin1(data.toBase64());
+    QCOMPARE(QXmppBase64::decode(encoded), data);
+
+    // characters beyond Latin-1 are skipped
+    QString noisy = encoded;
+    noisy.insert(5000, QChar(0x141));
+    noisy.insert(10, QChar(0x2003));
+    QCOMPARE(QXmppBase64::decode(noisy), data);
+}
+
+void tst_QXmppBase64::benchmarkEncode_data()
+{
+    addImplementationRows();
+}
+
+void tst_QXmppBase64::benchmarkEncode()
+{
+    selectImplementation();
+
+    const QByteArray data = randomData(1024 * 1024);
+    QByteArray encoded;
+    QBENCHMARK {
+        encoded = QXmppBase64::encode(data);
+    }
+    QCOMPARE(encoded.size(), data.toBase64().size());
+}
+
+void tst_QXmppBase64::benchmarkDecode_data()
+{
+    addImplementationRows();
+}
+
+void tst_QXmppBase64::benchmarkDecode()
+{
+    selectImplementation();
+
+    const QByteArray data = randomData(1024 * 1024);
+    const QByteArray encoded = data.toBase64();
+    QByteArray decoded;
+    QBENCHMARK {
+        decoded = QXmppBase64::decode(encoded);
+    }
+    QCOMPARE(decoded, data);
+}
+
+QTEST_MAIN(tst_QXmppBase64)
+#include "tst_qxmppbase64.moc"
@@ -27,6 +27,25 @@
 #include "util.h"
 #include <QMimeType>
 #include <QObject>
+#include <QThread>
+
+// Reads the data of a copy sharing its private data with other copies.
+class DataReader : public QThread
+{
+public:
+    explicit DataReader(const QXmppBitsOfBinaryIq &iq)
+        : iq(iq)
+    {
+    }
+
+    void run() override
+    {
+        data = iq.data();
+    }
+
+    const QXmppBitsOfBinaryIq iq;
+    QByteArray data;
+};
 
 class tst_QXmppBitsOfBinaryIq : public QObject
 {
@@ -35,6 +54,7 @@ class tst_QXmppBitsOfBinaryIq : public QObject
 private slots:
     void testBasic();
     void testResult();
+    void testLazyData();
     void testOtherSubelement();
     void testIsBobIq();
 };
@@ -150,6 +170,43 @@ void tst_QXmppBitsOfBinaryIq::testResult()
     serializePacket(iq, xml);
 }
 
+void tst_QXmppBitsOfBinaryIq::testLazyData()
+{
+    const QByteArray xml = QByteArrayLiteral(
+        "<iq id=\"data-result\" type=\"result\">"
+        "<data xmlns=\"urn:xmpp:bob\" "
+        "cid=\"sha1+5a4c38d44fc64805cbb2d92d8b208be13ff40c0f@bob.xmpp.org\" "
+        "type=\"text/plain\">"
+        "SGVsbG8s\nIFdvcmxk\nIQ=="
+        "</data>"
+        "</iq>");
+
+    // data which is not accessed is written back unchanged
+    QXmppBitsOfBinaryIq iq;
+    parsePacket(iq, xml);
+    serializePacket(iq, xml);
+
+    // copies may be decoded from different threads
+    DataReader first(iq);
+    DataReader second(iq);
+    first.start();
+    second.start();
+    QVERIFY(first.wait(5000));
+    QVERIFY(second.wait(5000));
+    QCOMPARE(first.data, QByteArray("Hello, World!"));
+    QCOMPARE(second.data, QByteArray("Hello, World!"));
+    QCOMPARE(iq.data(), QByteArray("Hello, World!"));
+
+    // the decoded data is kept and the encoded text is still written back
+    const QXmppBitsOfBinaryIq copy = iq;
+    QCOMPARE(copy.data(), QByteArray("Hello, World!"));
+    serializePacket(copy, xml);
+
+    iq.setData(QByteArrayLiteral("data"));
+    QCOMPARE(iq.data(), QByteArray("data"));
+    QCOMPARE(copy.data(), QByteArray("Hello, World!"));
+}
+
 void tst_QXmppBitsOfBinaryIq::testOtherSubelement()
 {
     const QByteArray xml(
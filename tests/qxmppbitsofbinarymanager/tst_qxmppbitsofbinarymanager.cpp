@@ -0,0 +1,358 @@
+/*
+ * Copyright (C) 2008-2020 The QXmpp developers
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "QXmppBitsOfBinaryContentId.h"
+#include "QXmppBitsOfBinaryDataList.h"
+#include "QXmppBitsOfBinaryIq.h"
+#include "QXmppBitsOfBinaryManager.h"
+#include "QXmppClient.h"
+#include "QXmppLogger.h"
+#include "QXmppMessage.h"
+#include "QXmppServer.h"
+
+#include "util.h"
+#include <QMimeDatabase>
+#include <QObject>
+#include <QTemporaryDir>
+
+static QXmppBitsOfBinaryData createData(const QByteArray &content, int maxAge = -1)
+{
+    QXmppBitsOfBinaryContentId cid;
+    cid.setAlgorithm(QCryptographicHash::Sha1);
+    cid.setHash(QCryptographicHash::hash(content, QCryptographicHash::Sha1));
+
+    QXmppBitsOfBinaryData data;
+    data.setCid(cid);
+    data.setContentType(QMimeDatabase().mimeTypeForName(QStringLiteral("image/png")));
+    data.setData(content);
+    data.setMaxAge(maxAge);
+    return data;
+}
+
+class tst_QXmppBitsOfBinaryManager : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testInsert();
+    void testMemoryCache();
+    void testDiskCache();
+    void testDiskCacheSize();
+    void testAnswerRequest();
+    void testRequestData();
+    void testPendingRequests();
+};
+
+void tst_QXmppBitsOfBinaryManager::testInsert()
+{
+    QXmppBitsOfBinaryManager manager;
+    const QXmppBitsOfBinaryData data = createData("sticker");
+    QVERIFY(!manager.contains(data.cid()));
+
+    QVERIFY(manager.insert(data));
+    QVERIFY(manager.contains(data.cid()));
+
+    QXmppBitsOfBinaryData cached;
+    QVERIFY(manager.cachedData(data.cid(), cached));
+    QCOMPARE(cached.data(), QByteArray("sticker"));
+    QCOMPARE(cached.contentType().name(), QStringLiteral("image/png"));
+    QCOMPARE(cached.maxAge(), -1);
+
+    // the data must match its content id
+    QXmppBitsOfBinaryData forged = createData("sticker");
+    forged.setData("malware");
+    QVERIFY(!manager.insert(forged));
+    QVERIFY(!manager.insert(QXmppBitsOfBinaryData()));
+
+    // data which must not be cached
+    const QXmppBitsOfBinaryData uncacheable = createData("secret", 0);
+    QVERIFY(!manager.insert(uncacheable));
+    QVERIFY(!manager.contains(uncacheable.cid()));
+
+    // the remaining max-age is returned
+    const QXmppBitsOfBinaryData expiring = createData("expiring", 3600);
+    QVERIFY(manager.insert(expiring));
+    QVERIFY(manager.cachedData(expiring.cid(), cached));
+    QVERIFY(cached.maxAge() > 3590 && cached.maxAge() <= 3600);
+
+    manager.remove(data.cid());
+    QVERIFY(!manager.contains(data.cid()));
+    manager.clearCache();
+    QVERIFY(!manager.contains(expiring.cid()));
+}
+
+void tst_QXmppBitsOfBinaryManager::testMemoryCache()
+{
+    QXmppBitsOfBinaryManager manager;
+    manager.setCacheSize(10);
+    QCOMPARE(manager.cacheSize(), 10);
+
+    const QXmppBitsOfBinaryData first = createData("12345");
+    const QXmppBitsOfBinaryData second = createData("67890");
+    const QXmppBitsOfBinaryData third = createData("abcde");
+    QVERIFY(manager.insert(first));
+    QVERIFY(manager.insert(second));
+
+    // the least recently used data is dropped
+    QVERIFY(manager.contains(first.cid()));
+    QVERIFY(manager.insert(third));
+    QVERIFY(manager.contains(first.cid()));
+    QVERIFY(!manager.contains(second.cid()));
+    QVERIFY(manager.contains(third.cid()));
+}
+
+void tst_QXmppBitsOfBinaryManager::testDiskCache()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+
+    const QXmppBitsOfBinaryData data = createData("inline image", 3600);
+    {
+        QXmppBitsOfBinaryManager manager;
+        manager.setCacheDirectory(dir.path());
+        QCOMPARE(manager.cacheDirectory(), dir.path());
+        QVERIFY(manager.insert(data));
+    }
+
+    // the data is kept across sessions
+    QXmppBitsOfBinaryManager manager;
+    manager.setCacheSize(0);
+    manager.setCacheDirectory(dir.path());
+    QXmppBitsOfBinaryData cached;
+    QVERIFY(manager.cachedData(data.cid(), cached));
+    QCOMPARE(cached.data(), data.data());
+    QCOMPARE(cached.cid(), data.cid());
+
+    manager.clearCache();
+    QVERIFY(!manager.contains(data.cid()));
+    QVERIFY(QDir(dir.path()).entryList(QDir::Files).isEmpty());
+}
+
+void tst_QXmppBitsOfBinaryManager::testDiskCacheSize()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+
+    QXmppClient client;
+    auto *manager = new QXmppBitsOfBinaryManager;
+    client.addExtension(manager);
+    manager->setCacheSize(0);
+    manager->setCacheDirectory(dir.path());
+    QCOMPARE(manager->diskCacheSize(), qint64(64 * 1024 * 1024));
+
+    auto receive = [&client](const QXmppBitsOfBinaryData &data) {
+        QXmppBitsOfBinaryDataList dataList;
+        dataList << data;
+        QXmppMessage message;
+        message.setBitsOfBinaryData(dataList);
+        emit client.messageReceived(message);
+    };
+
+    // the modification times are compared in milliseconds
+    const QXmppBitsOfBinaryData published = createData("published");
+    const QXmppBitsOfBinaryData first = createData("first");
+    const QXmppBitsOfBinaryData second = createData("other");
+    const QXmppBitsOfBinaryData third = createData("third");
+    QVERIFY(manager->insert(published));
+    QTest::qWait(20);
+    receive(first);
+    QTest::qWait(20);
+    receive(second);
+    QTest::qWait(20);
+
+    qint64 usage = 0;
+    const auto files = QDir(dir.path()).entryInfoList(QDir::Files);
+    QCOMPARE(files.size(), 3);
+    for (const auto &info : files)
+        usage += info.size();
+
+    // the least recently used received data is removed
+    manager->setDiskCacheSize(usage);
+    receive(third);
+    QCOMPARE(QDir(dir.path()).entryList(QDir::Files).size(), 3);
+    QVERIFY(!manager->contains(first.cid()));
+    QVERIFY(manager->contains(second.cid()));
+    QVERIFY(manager->contains(third.cid()));
+
+    // published data is kept
+    manager->setDiskCacheSize(0);
+    receive(first);
+    QVERIFY(manager->contains(published.cid()));
+    QVERIFY(manager->contains(first.cid()));
+    QVERIFY(!manager->contains(second.cid()));
+    QVERIFY(!manager->contains(third.cid()));
+}
+
+void tst_QXmppBitsOfBinaryManager::testAnswerRequest()
+{
+    QXmppClient client;
+    auto *manager = new QXmppBitsOfBinaryManager;
+    client.addExtension(manager);
+
+    QXmppLogger logger;
+    logger.setLoggingType(QXmppLogger::SignalLogging);
+    client.setLogger(&logger);
+
+    QList<QXmppBitsOfBinaryIq> responses;
+    connect(&logger, &QXmppLogger::message, this, [&](QXmppLogger::MessageType type, const QString &text) {
+        if (type == QXmppLogger::SentMessage) {
+            QXmppBitsOfBinaryIq iq;
+            iq.parse(xmlToDom(text));
+            responses << iq;
+        }
+    });
+
+    const QXmppBitsOfBinaryData data = createData("sticker");
+    QXmppBitsOfBinaryIq request;
+    request.setId(QStringLiteral("get-data-1"));
+    request.setFrom(QStringLiteral("ladymacbeth@shakespeare.lit/castle"));
+    request.setType(QXmppIq::Get);
+    request.setCid(data.cid());
+
+    // unknown data
+    QVERIFY(manager->handleStanza(writePacketToDom(request)));
+    QCOMPARE(responses.size(), 1);
+    QCOMPARE(responses.at(0).type(), QXmppIq::Error);
+    QCOMPARE(responses.at(0).error().condition(), QXmppStanza::Error::ItemNotFound);
+
+    // cached data
+    QVERIFY(manager->insert(data));
+    QVERIFY(manager->handleStanza(writePacketToDom(request)));
+    QCOMPARE(responses.size(), 2);
+    QCOMPARE(responses.at(1).type(), QXmppIq::Result);
+    QCOMPARE(responses.at(1).id(), QStringLiteral("get-data-1"));
+    QCOMPARE(responses.at(1).to(), QStringLiteral("ladymacbeth@shakespeare.lit/castle"));
+    QCOMPARE(responses.at(1).data(), QByteArray("sticker"));
+
+    // data received from other entities is not revealed
+    const QXmppBitsOfBinaryData attached = createData("attached");
+    QXmppMessage message;
+    message.setFrom(QStringLiteral("romeo@montague.lit/orchard"));
+    message.bitsOfBinaryData() << attached;
+    emit client.messageReceived(message);
+    QVERIFY(manager->contains(attached.cid()));
+
+    request.setCid(attached.cid());
+    QVERIFY(manager->handleStanza(writePacketToDom(request)));
+    QCOMPARE(responses.size(), 3);
+    QCOMPARE(responses.at(2).type(), QXmppIq::Error);
+    QCOMPARE(responses.at(2).error().condition(), QXmppStanza::Error::ItemNotFound);
+
+    // published data stays published when it is received again
+    message.bitsOfBinaryData().clear();
+    message.bitsOfBinaryData() << data;
+    emit client.messageReceived(message);
+    request.setCid(data.cid());
+    QVERIFY(manager->handleStanza(writePacketToDom(request)));
+    QCOMPARE(responses.size(), 4);
+    QCOMPARE(responses.at(3).type(), QXmppIq::Result);
+
+    // answering can be disabled
+    manager->setAnswersRequests(false);
+    QVERIFY(!manager->answersRequests());
+    QVERIFY(!manager->handleStanza(writePacketToDom(request)));
+    QCOMPARE(responses.size(), 4);
+
+    logger.disconnect(this);
+}
+
+void tst_QXmppBitsOfBinaryManager::testRequestData()
+{
+    QXmppClient client;
+    auto *manager = new QXmppBitsOfBinaryManager;
+    client.addExtension(manager);
+
+    const QXmppBitsOfBinaryData data = createData("sticker");
+    QVERIFY(manager->insert(data));
+
+    // cached data is delivered without a request
+    int received = 0;
+    connect(manager, &QXmppBitsOfBinaryManager::dataReceived, this, [&](const QXmppBitsOfBinaryData &result) {
+        QCOMPARE(result.data(), QByteArray("sticker"));
+        received++;
+    });
+    QVERIFY(!manager->requestData(QStringLiteral("romeo@montague.lit"), data.cid()).isEmpty());
+    QCOMPARE(received, 0);
+    QTRY_COMPARE(received, 1);
+
+    // data attached to messages is cached
+    const QXmppBitsOfBinaryData attached = createData("attached");
+    QXmppMessage message;
+    message.setFrom(QStringLiteral("romeo@montague.lit/orchard"));
+    message.setBody(QStringLiteral("Look at this!"));
+    message.bitsOfBinaryData() << attached;
+    emit client.messageReceived(message);
+    QVERIFY(manager->contains(attached.cid()));
+}
+
+void tst_QXmppBitsOfBinaryManager::testPendingRequests()
+{
+    const QString testDomain("localhost");
+    const QHostAddress testHost(QHostAddress::LocalHost);
+    const quint16 testPort = 12345;
+
+    TestPasswordChecker passwordChecker;
+    passwordChecker.addCredentials("testuser", "testpwd");
+
+    QXmppServer server;
+    server.setDomain(testDomain);
+    server.setPasswordChecker(&passwordChecker);
+    QVERIFY(server.listenForClients(testHost, testPort));
+
+    QXmppClient client;
+    auto *manager = new QXmppBitsOfBinaryManager;
+    client.addExtension(manager);
+
+    QXmppConfiguration config;
+    config.setDomain(testDomain);
+    config.setHost(testHost.toString());
+    config.setPort(testPort);
+    config.setUser("testuser");
+    config.setPassword("testpwd");
+
+    QSignalSpy connectedSpy(&client, &QXmppClient::connected);
+    client.connectToServer(config);
+    QVERIFY(connectedSpy.wait());
+
+    QList<QXmppBitsOfBinaryContentId> failedCids;
+    QList<QXmppStanza::Error> errors;
+    connect(manager, &QXmppBitsOfBinaryManager::requestFailed, this, [&](const QXmppBitsOfBinaryContentId &cid, const QXmppStanza::Error &error) {
+        failedCids << cid;
+        errors << error;
+    });
+
+    // the request cannot be answered before the connection is closed
+    const QXmppBitsOfBinaryData data = createData("sticker");
+    QVERIFY(!manager->requestData(QStringLiteral("romeo@montague.lit/orchard"), data.cid()).isEmpty());
+    client.disconnectFromServer();
+
+    QTRY_COMPARE(failedCids.size(), 1);
+    QCOMPARE(failedCids.at(0), data.cid());
+    QCOMPARE(errors.at(0).type(), QXmppStanza::Error::Wait);
+    QCOMPARE(errors.at(0).condition(), QXmppStanza::Error::ServiceUnavailable);
+    QVERIFY(!manager->contains(data.cid()));
+
+    // no further signal is emitted
+    QTest::qWait(100);
+    QCOMPARE(failedCids.size(), 1);
+}
+
+QTEST_MAIN(tst_QXmppBitsOfBinaryManager)
+#include "tst_qxmppbitsofbinarymanager.moc"
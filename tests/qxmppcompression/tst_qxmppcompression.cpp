@@ -0,0 +1,206 @@
+/*
+ * Copyright (C) 2008-2020 The QXmpp developers
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "QXmppClient.h"
+#include "QXmppCompression_p.h"
+#include "QXmppConstants_p.h"
+#include "QXmppIncomingClient.h"
+#include "QXmppMessage.h"
+#include "QXmppOutgoingClient.h"
+#include "QXmppServer.h"
+
+#include "util.h"
+#include <QObject>
+
+class tst_QXmppCompression : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testCompress();
+    void testCompressed();
+    void testFailure();
+    void testRoundTrip();
+    void testCorrupted();
+    void testClientServer_data();
+    void testClientServer();
+};
+
+void tst_QXmppCompression::testCompress()
+{
+    const QByteArray xml(
+        "<compress xmlns=\"http://jabber.org/protocol/compress\">"
+        "<method>zlib</method>"
+        "</compress>");
+
+    QVERIFY(QXmppCompressPacket::isCompressPacket(xmlToDom(QString::fromUtf8(xml))));
+
+    QXmppCompressPacket packet(QXmppCompressPacket::Failure);
+    parsePacket(packet, xml);
+    QCOMPARE(packet.type(), QXmppCompressPacket::Compress);
+    QCOMPARE(packet.method(), QStringLiteral("zlib"));
+    QVERIFY(packet.condition().isEmpty());
+    serializePacket(packet, xml);
+}
+
+void tst_QXmppCompression::testCompressed()
+{
+    const QByteArray xml("<compressed xmlns=\"http://jabber.org/protocol/compress\"/>");
+
+    QXmppCompressPacket packet;
+    parsePacket(packet, xml);
+    QCOMPARE(packet.type(), QXmppCompressPacket::Compressed);
+    serializePacket(packet, xml);
+}
+
+void tst_QXmppCompression::testFailure()
+{
+    const QByteArray xml(
+        "<failure xmlns=\"http://jabber.org/protocol/compress\">"
+        "<unsupported-method/>"
+        "</failure>");
+
+    QXmppCompressPacket packet;
+    parsePacket(packet, xml);
+    QCOMPARE(packet.type(), QXmppCompressPacket::Failure);
+    QCOMPARE(packet.condition(), QStringLiteral("unsupported-method"));
+    serializePacket(packet, xml);
+
+    // elements from other namespaces are not compression packets
+    QVERIFY(!QXmppCompressPacket::isCompressPacket(xmlToDom("<failure xmlns=\"urn:ietf:params:xml:ns:xmpp-sasl\"/>")));
+}
+
+void tst_QXmppCompression::testRoundTrip()
+{
+    if (!QXmppStreamCompressor::isSupported())
+        QSKIP("QXmpp was built without zlib");
+
+    QXmppStreamCompressor client;
+    QXmppStreamCompressor server(9);
+    QVERIFY(client.isValid());
+    QVERIFY(server.isValid());
+    QCOMPARE(server.level(), 9);
+
+    // each chunk must be decodable on its own thanks to the sync flush
+    const QByteArray stanza("<message to=\"foo@example.com\" type=\"chat\"><body>Hello, world!</body></message>");
+    QByteArray compressed, decompressed;
+    for (int i = 0; i < 10; ++i) {
+        QVERIFY(client.compress(stanza, compressed));
+        QVERIFY(!compressed.isEmpty());
+        QVERIFY(server.decompress(compressed, decompressed));
+        QCOMPARE(decompressed, stanza);
+    }
+
+    // data larger than the internal buffers
+    const QByteArray large = QByteArray("<presence/>").repeated(10000);
+    QVERIFY(server.compress(large, compressed));
+    QVERIFY(compressed.size() < large.size());
+    QVERIFY(client.decompress(compressed, decompressed));
+    QCOMPARE(decompressed, large);
+
+    QCOMPARE(client.uncompressedBytesWritten(), qint64(10 * stanza.size()));
+    QCOMPARE(server.uncompressedBytesRead(), qint64(10 * stanza.size()));
+    QCOMPARE(client.compressedBytesWritten(), server.compressedBytesRead());
+    QCOMPARE(client.uncompressedBytesRead(), qint64(large.size()));
+    QVERIFY(client.cpuTime() > 0);
+}
+
+void tst_QXmppCompression::testCorrupted()
+{
+    if (!QXmppStreamCompressor::isSupported())
+        QSKIP("QXmpp was built without zlib");
+
+    QXmppStreamCompressor compressor;
+    QByteArray output;
+    QVERIFY(!compressor.decompress(QByteArray("this is not deflate data"), output));
+}
+
+void tst_QXmppCompression::testClientServer_data()
+{
+    QTest::addColumn<bool>("refused");
+
+    QTest::newRow("compressed") << false;
+    QTest::newRow("refused") << true;
+}
+
+void tst_QXmppCompression::testClientServer()
+{
+    QFETCH(bool, refused);
+
+    if (!QXmppStreamCompressor::isSupported())
+        QSKIP("QXmpp was built without zlib");
+
+    TestPasswordChecker passwordChecker;
+    passwordChecker.addCredentials("testuser", "testpwd");
+
+    QXmppLogger serverLogger;
+    serverLogger.setLoggingType(QXmppLogger::SignalLogging);
+
+    QXmppServer server;
+    server.setDomain("localhost");
+    server.setLogger(&serverLogger);
+    server.setPasswordChecker(&passwordChecker);
+    server.setStreamCompressionEnabled(true);
+    QVERIFY(server.listenForClients(QHostAddress::LocalHost, 12345));
+
+    // withdraw the offer once it was sent, so that the server answers the
+    // client's request with a failure
+    if (refused) {
+        connect(&serverLogger, &QXmppLogger::message, this, [&server](QXmppLogger::MessageType type, const QString &text) {
+            if (type != QXmppLogger::SentMessage || !text.contains(QLatin1String(ns_compressFeature)))
+                return;
+            const auto streams = server.findChildren<QXmppIncomingClient *>();
+            for (auto *stream : streams)
+                stream->setStreamCompressionEnabled(false);
+        });
+    }
+
+    QXmppConfiguration config;
+    config.setDomain("localhost");
+    config.setHost(QHostAddress(QHostAddress::LocalHost).toString());
+    config.setPort(12345);
+    config.setUser("testuser");
+    config.setPassword("testpwd");
+    config.setStreamCompressionEnabled(true);
+
+    QXmppClient client;
+    QSignalSpy connectedSpy(&client, &QXmppClient::connected);
+    client.connectToServer(config);
+    QVERIFY(connectedSpy.wait(10000));
+
+    // without compression, the client carries on with the session
+    auto *stream = client.findChild<QXmppOutgoingClient *>();
+    QVERIFY(stream);
+    QCOMPARE(stream->isCompressionEnabled(), !refused);
+
+    // the server routes the message back over the same stream
+    QString received;
+    connect(&client, &QXmppClient::messageReceived, this, [&received](const QXmppMessage &message) {
+        received = message.body();
+    });
+    const QString body = QStringLiteral("Hello, world!");
+    QVERIFY(client.sendPacket(QXmppMessage(QString(), config.jid(), body)));
+    QTRY_COMPARE(received, body);
+
+    client.disconnectFromServer();
+}
+
+QTEST_MAIN(tst_QXmppCompression)
+#include "tst_qxmppcompression.moc"
@@ -0,0 +1,177 @@
+/*
+ * Copyright (C) 2008-2020 The QXmpp developers
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "QXmppConnectionRacer_p.h"
+
+#include <QElapsedTimer>
+#include <QSignalSpy>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QtTest>
+
+Q_DECLARE_METATYPE(QXmppServiceRecord)
+
+static QXmppServiceRecord makeRecord(const QString &host, quint16 port, quint16 priority = 0, quint16 weight = 0, bool directTls = false)
+{
+    return QXmppServiceRecord { host, port, priority, weight, directTls };
+}
+
+class tst_QXmppConnectionRacer : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void testSortPriority();
+    void testSortDirectTls();
+    void testSortWeight();
+    void testRaceSuccess();
+    void testRaceFailure();
+};
+
+void tst_QXmppConnectionRacer::initTestCase()
+{
+    qRegisterMetaType<QXmppServiceRecord>();
+    qRegisterMetaType<qintptr>("qintptr");
+}
+
+void tst_QXmppConnectionRacer::testSortPriority()
+{
+    const QList<QXmppServiceRecord> records = {
+        makeRecord("c.example.com", 5222, 30),
+        makeRecord("a.example.com", 5222, 10),
+        makeRecord("b.example.com", 5222, 20),
+    };
+
+    const auto sorted = QXmppConnectionRacer::sortServiceRecords(records);
+    QCOMPARE(sorted.size(), 3);
+    QCOMPARE(sorted.at(0).host, QStringLiteral("a.example.com"));
+    QCOMPARE(sorted.at(1).host, QStringLiteral("b.example.com"));
+    QCOMPARE(sorted.at(2).host, QStringLiteral("c.example.com"));
+}
+
+void tst_QXmppConnectionRacer::testSortDirectTls()
+{
+    const QList<QXmppServiceRecord> records = {
+        makeRecord("starttls.example.com", 5222, 10),
+        makeRecord("directtls.example.com", 5223, 10, 0, true),
+        makeRecord("backup.example.com", 5223, 20, 0, true),
+    };
+
+    const auto sorted = QXmppConnectionRacer::sortServiceRecords(records);
+    QCOMPARE(sorted.size(), 3);
+    QCOMPARE(sorted.at(0).host, QStringLiteral("directtls.example.com"));
+    QCOMPARE(sorted.at(1).host, QStringLiteral("starttls.example.com"));
+    QCOMPARE(sorted.at(2).host, QStringLiteral("backup.example.com"));
+}
+
+void tst_QXmppConnectionRacer::testSortWeight()
+{
+    const QList<QXmppServiceRecord> records = {
+        makeRecord("light.example.com", 5222, 10, 1),
+        makeRecord("heavy.example.com", 5222, 10, 1000),
+    };
+
+    // the heavier record should be selected first most of the time
+    int heavyFirst = 0;
+    for (int i = 0; i < 100; ++i) {
+        const auto sorted = QXmppConnectionRacer::sortServiceRecords(records);
+        QCOMPARE(sorted.size(), 2);
+        if (sorted.first().host == QStringLiteral("heavy.example.com"))
+            heavyFirst++;
+    }
+    QVERIFY(heavyFirst > 90);
+}
+
+void tst_QXmppConnectionRacer::testRaceSuccess()
+{
+    QTcpServer server;
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+
+    // find a port nobody listens on
+    QTcpServer closedServer;
+    QVERIFY(closedServer.listen(QHostAddress::LocalHost));
+    const quint16 closedPort = closedServer.serverPort();
+    closedServer.close();
+
+    QXmppConnectionRacer racer;
+    racer.setAttemptDelay(50);
+    QSignalSpy finishedSpy(&racer, &QXmppConnectionRacer::finished);
+    QSignalSpy failedSpy(&racer, &QXmppConnectionRacer::failed);
+
+    // the preferred targets are unreachable: a non-routable address
+    // (RFC 5737) which never answers and a closed port
+    QElapsedTimer timer;
+    timer.start();
+    racer.start({
+        makeRecord("192.0.2.1", 5222),
+        makeRecord("127.0.0.1", closedPort),
+        makeRecord("127.0.0.1", server.serverPort()),
+    });
+    QVERIFY(racer.isRunning());
+
+    QVERIFY(finishedSpy.wait(5000));
+    QVERIFY(timer.elapsed() < 1000);
+    QCOMPARE(failedSpy.size(), 0);
+    QVERIFY(!racer.isRunning());
+
+    const auto record = finishedSpy.first().at(0).value<QXmppServiceRecord>();
+    const auto address = finishedSpy.first().at(1).value<QHostAddress>();
+    QCOMPARE(record.port, server.serverPort());
+    QCOMPARE(address, QHostAddress(QHostAddress::LocalHost));
+
+    // the winning connection is handed over rather than closed
+    const auto socketDescriptor = finishedSpy.first().at(2).value<qintptr>();
+#ifdef Q_OS_UNIX
+    QVERIFY(socketDescriptor >= 0);
+    QVERIFY(server.waitForNewConnection(1000));
+    QTcpSocket *serverSocket = server.nextPendingConnection();
+    QVERIFY(serverSocket);
+
+    QTcpSocket socket;
+    QVERIFY(socket.setSocketDescriptor(socketDescriptor));
+    QCOMPARE(socket.state(), QAbstractSocket::ConnectedState);
+    socket.write("hello");
+    QVERIFY(serverSocket->waitForReadyRead(1000));
+    QCOMPARE(serverSocket->readAll(), QByteArray("hello"));
+#else
+    QCOMPARE(socketDescriptor, qintptr(-1));
+#endif
+}
+
+void tst_QXmppConnectionRacer::testRaceFailure()
+{
+    QTcpServer closedServer;
+    QVERIFY(closedServer.listen(QHostAddress::LocalHost));
+    const quint16 closedPort = closedServer.serverPort();
+    closedServer.close();
+
+    QXmppConnectionRacer racer;
+    QSignalSpy finishedSpy(&racer, &QXmppConnectionRacer::finished);
+    QSignalSpy failedSpy(&racer, &QXmppConnectionRacer::failed);
+
+    racer.start({ makeRecord("127.0.0.1", closedPort) });
+    QVERIFY(failedSpy.wait(5000));
+    QCOMPARE(finishedSpy.size(), 0);
+    QVERIFY(!racer.isRunning());
+}
+
+QTEST_MAIN(tst_QXmppConnectionRacer)
+#include "tst_qxmppconnectionracer.moc"
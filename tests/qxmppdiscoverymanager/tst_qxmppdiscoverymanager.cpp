@@ -0,0 +1,339 @@
+/*
+ * Copyright (C) 2008-2020 The QXmpp developers
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "QXmppClient.h"
+#include "QXmppDiscoveryIq.h"
+#include "QXmppDiscoveryManager.h"
+#include "QXmppPresence.h"
+#include "QXmppServer.h"
+#include "QXmppVersionManager.h"
+
+#include "util.h"
+#include <QObject>
+
+// information response from XEP-0115, example 2
+static const QByteArray EXODUS_VER = QByteArray::fromBase64("QgayPKawpkPSDYmwT/WM94uAlu0=");
+
+static QByteArray exodusInfo(const QString &node)
+{
+    return QStringLiteral(
+               "<iq from=\"romeo@montague.lit/orchard\" id=\"disco1\" type=\"result\">"
+               "<query xmlns=\"http://jabber.org/protocol/disco#info\" node=\"%1\">"
+               "<identity category=\"client\" name=\"Exodus 0.9.1\" type=\"pc\"/>"
+               "<feature var=\"http://jabber.org/protocol/caps\"/>"
+               "<feature var=\"http://jabber.org/protocol/disco#info\"/>"
+               "<feature var=\"http://jabber.org/protocol/disco#items\"/>"
+               "<feature var=\"http://jabber.org/protocol/muc\"/>"
+               "</query>"
+               "</iq>")
+        .arg(node)
+        .toUtf8();
+}
+
+static QXmppPresence capsPresence(const QString &from, const QByteArray &ver)
+{
+    QXmppPresence presence;
+    presence.setFrom(from);
+    presence.setCapabilityHash(QStringLiteral("sha-1"));
+    presence.setCapabilityNode(QStringLiteral("http://code.google.com/p/exodus"));
+    presence.setCapabilityVer(ver);
+    return presence;
+}
+
+class tst_QXmppDiscoveryManager : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testCapabilitiesMemoized();
+    void testCapabilitiesCache();
+    void testCapabilitiesCacheMismatch();
+    void testCapabilitiesCacheFile();
+    void testDiscoveryCache();
+    void testPendingRequests();
+};
+
+void tst_QXmppDiscoveryManager::testCapabilitiesMemoized()
+{
+    QXmppClient client;
+    auto *manager = client.findExtension<QXmppDiscoveryManager>();
+    QVERIFY(manager);
+
+    const QByteArray ver = manager->capabilitiesVerificationString();
+    QCOMPARE(ver, manager->capabilities().verificationString());
+    QCOMPARE(manager->capabilitiesVerificationString(), ver);
+
+    // changing the identity changes the hash
+    manager->setClientName(QStringLiteral("tst_QXmppDiscoveryManager"));
+    const QByteArray renamedVer = manager->capabilitiesVerificationString();
+    QVERIFY(renamedVer != ver);
+    QCOMPARE(renamedVer, manager->capabilities().verificationString());
+
+    // removing an extension removes its features
+    QVERIFY(manager->capabilities().features().contains(QStringLiteral("jabber:iq:version")));
+    QVERIFY(client.removeExtension(client.findExtension<QXmppVersionManager>()));
+    QVERIFY(!manager->capabilities().features().contains(QStringLiteral("jabber:iq:version")));
+    QVERIFY(manager->capabilitiesVerificationString() != renamedVer);
+}
+
+void tst_QXmppDiscoveryManager::testCapabilitiesCache()
+{
+    QXmppClient client;
+    auto *manager = client.findExtension<QXmppDiscoveryManager>();
+
+    const QString romeo = QStringLiteral("romeo@montague.lit/orchard");
+    const QString benvolio = QStringLiteral("benvolio@montague.lit/street");
+
+    emit client.presenceReceived(capsPresence(romeo, EXODUS_VER));
+
+    QXmppDiscoveryIq info;
+    QVERIFY(!manager->cachedInfo(romeo, info));
+
+    // the response to the capabilities query is cached
+    QDomDocument doc;
+    QVERIFY(doc.setContent(exodusInfo("http://code.google.com/p/exodus#QgayPKawpkPSDYmwT/WM94uAlu0="), true));
+    QVERIFY(manager->handleStanza(doc.documentElement()));
+
+    QVERIFY(manager->cachedInfo(romeo, info));
+    QCOMPARE(info.from(), romeo);
+    QCOMPARE(info.features().size(), 4);
+
+    // another entity with the same hash resolves without any query
+    emit client.presenceReceived(capsPresence(benvolio, EXODUS_VER));
+    QVERIFY(manager->cachedInfo(benvolio, info));
+    QCOMPARE(info.from(), benvolio);
+    QVERIFY(info.features().contains(QStringLiteral("http://jabber.org/protocol/muc")));
+
+    // the entity went offline
+    QXmppPresence unavailable(QXmppPresence::Unavailable);
+    unavailable.setFrom(benvolio);
+    emit client.presenceReceived(unavailable);
+    QVERIFY(!manager->cachedInfo(benvolio, info));
+
+    // the announced hashes do not survive the session, the verified
+    // information does
+    emit client.disconnected();
+    QVERIFY(!manager->cachedInfo(romeo, info));
+    emit client.presenceReceived(capsPresence(romeo, EXODUS_VER));
+    QVERIFY(manager->cachedInfo(romeo, info));
+}
+
+void tst_QXmppDiscoveryManager::testCapabilitiesCacheMismatch()
+{
+    QXmppClient client;
+    auto *manager = client.findExtension<QXmppDiscoveryManager>();
+
+    const QByteArray bogusVer = QByteArray::fromBase64("q07IKJEyjvHSyhy//CH0CxmKi8w=");
+    emit client.presenceReceived(capsPresence("romeo@montague.lit/orchard", bogusVer));
+
+    // information which does not match the hash is not cached
+    QDomDocument doc;
+    QVERIFY(doc.setContent(exodusInfo("http://code.google.com/p/exodus#q07IKJEyjvHSyhy//CH0CxmKi8w="), true));
+    QVERIFY(manager->handleStanza(doc.documentElement()));
+
+    QXmppDiscoveryIq info;
+    QVERIFY(!manager->cachedInfo("romeo@montague.lit/orchard", info));
+}
+
+void tst_QXmppDiscoveryManager::testCapabilitiesCacheFile()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString fileName = dir.filePath(QStringLiteral("caps.xml"));
+
+    {
+        QXmppClient client;
+        auto *manager = client.findExtension<QXmppDiscoveryManager>();
+        manager->setCapabilitiesCacheFileName(fileName);
+        QCOMPARE(manager->capabilitiesCacheFileName(), fileName);
+
+        QDomDocument doc;
+        QVERIFY(doc.setContent(exodusInfo("http://code.google.com/p/exodus#QgayPKawpkPSDYmwT/WM94uAlu0="), true));
+        QVERIFY(manager->handleStanza(doc.documentElement()));
+    }
+
+    // the next run knows the capabilities
+    QXmppClient client;
+    auto *manager = client.findExtension<QXmppDiscoveryManager>();
+    manager->setCapabilitiesCacheFileName(fileName);
+    emit client.presenceReceived(capsPresence("juliet@capulet.lit/balcony", EXODUS_VER));
+
+    QXmppDiscoveryIq info;
+    QVERIFY(manager->cachedInfo("juliet@capulet.lit/balcony", info));
+    QCOMPARE(info.identities().size(), 1);
+    QCOMPARE(info.identities().first().name(), QStringLiteral("Exodus 0.9.1"));
+    QCOMPARE(info.verificationString(), EXODUS_VER);
+}
+
+void tst_QXmppDiscoveryManager::testDiscoveryCache()
+{
+    const QString testDomain("localhost");
+    const QHostAddress testHost(QHostAddress::LocalHost);
+    const quint16 testPort = 12345;
+
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString fileName = dir.filePath(QStringLiteral("disco.xml"));
+
+    TestPasswordChecker passwordChecker;
+    passwordChecker.addCredentials("testuser", "testpwd");
+
+    QXmppServer server;
+    server.setDomain(testDomain);
+    server.setPasswordChecker(&passwordChecker);
+    QVERIFY(server.listenForClients(testHost, testPort));
+
+    QXmppClient client;
+    auto *manager = client.findExtension<QXmppDiscoveryManager>();
+    manager->setDiscoveryCacheTtl(60);
+    manager->setDiscoveryCacheFileName(fileName);
+    QCOMPARE(manager->discoveryCacheTtl(), 60);
+
+    QXmppConfiguration config;
+    config.setDomain(testDomain);
+    config.setHost(testHost.toString());
+    config.setPort(testPort);
+    config.setUser("testuser");
+    config.setPassword("testpwd");
+
+    QSignalSpy connectedSpy(&client, &QXmppClient::connected);
+    client.connectToServer(config);
+    QVERIFY(connectedSpy.wait());
+
+    // the client queries itself, identical requests are collapsed
+    int infoCount = 0;
+    QXmppDiscoveryIq lastInfo;
+    connect(manager, &QXmppDiscoveryManager::infoReceived, this, [&](const QXmppDiscoveryIq &iq) {
+        infoCount++;
+        lastInfo = iq;
+    });
+
+    const QString jid = client.configuration().jid();
+    const QString id = manager->requestInfo(jid);
+    QVERIFY(!id.isEmpty());
+    QCOMPARE(manager->requestInfo(jid), id);
+    QVERIFY(manager->requestItems(jid) != id);
+
+    QTRY_COMPARE(infoCount, 1);
+    QTest::qWait(100);
+    QCOMPARE(infoCount, 1);
+
+    // the response is now answered from the cache
+    const QString cachedId = manager->requestInfo(jid);
+    QVERIFY(!cachedId.isEmpty());
+    QVERIFY(cachedId != id);
+    QCOMPARE(infoCount, 1);
+    QTRY_COMPARE(infoCount, 2);
+    QCOMPARE(lastInfo.id(), cachedId);
+    QCOMPARE(lastInfo.features(), manager->capabilities().features());
+
+    // pending requests fail when the connection is closed
+    const QString pendingId = manager->requestItems(QStringLiteral("romeo@montague.lit/orchard"));
+    QVERIFY(!pendingId.isEmpty());
+    QXmppDiscoveryIq failed;
+    connect(manager, &QXmppDiscoveryManager::itemsReceived, this, [&](const QXmppDiscoveryIq &iq) {
+        failed = iq;
+    });
+    client.disconnectFromServer();
+    QTRY_COMPARE(failed.id(), pendingId);
+    QCOMPARE(failed.type(), QXmppIq::Error);
+    QCOMPARE(failed.from(), QStringLiteral("romeo@montague.lit/orchard"));
+
+    // the next session knows the response without connecting
+    QXmppClient otherClient;
+    auto *otherManager = otherClient.findExtension<QXmppDiscoveryManager>();
+    otherManager->setDiscoveryCacheFileName(fileName);
+
+    int otherInfoCount = 0;
+    connect(otherManager, &QXmppDiscoveryManager::infoReceived, this, [&]() {
+        otherInfoCount++;
+    });
+    QVERIFY(!otherManager->requestInfo(jid).isEmpty());
+    QTRY_COMPARE(otherInfoCount, 1);
+
+    otherManager->clearDiscoveryCache();
+    QVERIFY(otherManager->requestInfo(jid).isEmpty());
+}
+
+void tst_QXmppDiscoveryManager::testPendingRequests()
+{
+    TestPasswordChecker passwordChecker;
+    passwordChecker.addCredentials("testuser", "testpwd");
+
+    QXmppServer server;
+    server.setDomain("localhost");
+    server.setPasswordChecker(&passwordChecker);
+    QVERIFY(server.listenForClients(QHostAddress::LocalHost, 12345));
+
+    QXmppClient client;
+    auto *manager = client.findExtension<QXmppDiscoveryManager>();
+    QCOMPARE(manager->requestTimeout(), 30000);
+    manager->setRequestTimeout(200);
+    QCOMPARE(manager->requestTimeout(), 200);
+
+    QXmppConfiguration config;
+    config.setDomain("localhost");
+    config.setHost(QHostAddress(QHostAddress::LocalHost).toString());
+    config.setPort(12345);
+    config.setUser("testuser");
+    config.setPassword("testpwd");
+
+    QSignalSpy connectedSpy(&client, &QXmppClient::connected);
+    client.connectToServer(config);
+    QVERIFY(connectedSpy.wait());
+
+    QList<QXmppDiscoveryIq> responses;
+    connect(manager, &QXmppDiscoveryManager::infoReceived, this, [&](const QXmppDiscoveryIq &iq) {
+        responses << iq;
+    });
+    connect(manager, &QXmppDiscoveryManager::itemsReceived, this, [&](const QXmppDiscoveryIq &iq) {
+        responses << iq;
+    });
+
+    // the remote server is unreachable, the request times out
+    const QString romeo = QStringLiteral("romeo@montague.lit/orchard");
+    const QString itemsId = manager->requestItems(romeo);
+    QVERIFY(!itemsId.isEmpty());
+    QTRY_COMPARE(responses.size(), 1);
+    QCOMPARE(responses.first().id(), itemsId);
+    QCOMPARE(responses.first().type(), QXmppIq::Error);
+    QCOMPARE(responses.first().error().condition(), QXmppStanza::Error::RemoteServerTimeout);
+    QVERIFY(manager->requestItems(romeo) != itemsId);
+
+    // a result without a query completes the request
+    responses.clear();
+    const QString juliet = QStringLiteral("juliet@capulet.lit/balcony");
+    const QString infoId = manager->requestInfo(juliet);
+    QVERIFY(!infoId.isEmpty());
+
+    QDomDocument doc;
+    QVERIFY(doc.setContent(QStringLiteral("<iq xmlns=\"jabber:client\" type=\"result\" id=\"%1\" from=\"%2\"/>").arg(infoId, juliet), true));
+    QVERIFY(manager->handleStanza(doc.documentElement()));
+    QCOMPARE(responses.size(), 1);
+    QCOMPARE(responses.first().id(), infoId);
+    QCOMPARE(responses.first().type(), QXmppIq::Error);
+    QCOMPARE(responses.first().queryType(), QXmppDiscoveryIq::InfoQuery);
+    QVERIFY(manager->requestInfo(juliet) != infoId);
+
+    client.disconnectFromServer();
+}
+
+QTEST_MAIN(tst_QXmppDiscoveryManager)
+#include "tst_qxmppdiscoverymanager.moc"
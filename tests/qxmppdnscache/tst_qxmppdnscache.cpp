@@ -0,0 +1,277 @@
+/*
+ * Copyright (C) 2008-2020 The QXmpp developers
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "QXmppDnsCache_p.h"
+
+#include <QSignalSpy>
+#include <QtTest>
+
+// A resolver which records lookups and answers them when told to.
+class TestResolver : public QXmppDnsResolver
+{
+    Q_OBJECT
+
+public:
+    void lookup(const QString &name, QDnsLookup::Type type) override
+    {
+        requests << qMakePair(name, type);
+    }
+
+    void reply(const QXmppDnsResult &result)
+    {
+        const auto request = requests.takeFirst();
+        emit finished(request.first, request.second, result);
+    }
+
+    QList<QPair<QString, QDnsLookup::Type>> requests;
+};
+
+static QXmppDnsResult addressResult(const QString &address, quint32 ttl)
+{
+    QXmppDnsResult result;
+    result.addresses << QHostAddress(address);
+    result.timeToLive = ttl;
+    return result;
+}
+
+class tst_QXmppDnsCache : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void init();
+    void cleanup();
+    void testCached();
+    void testCaseInsensitive();
+    void testCollapse();
+    void testExpiry();
+    void testNegative();
+    void testServerFailure();
+    void testServiceRecords();
+    void testRefresh();
+    void testInstancePerThread();
+
+private:
+    QXmppDnsCache *cache;
+    TestResolver *resolver;
+};
+
+void tst_QXmppDnsCache::init()
+{
+    cache = new QXmppDnsCache;
+    resolver = new TestResolver;
+    cache->setResolver(resolver);
+}
+
+void tst_QXmppDnsCache::cleanup()
+{
+    delete cache;
+}
+
+void tst_QXmppDnsCache::testCached()
+{
+    QSignalSpy spy(cache, &QXmppDnsCache::finished);
+
+    cache->lookup("example.com", QDnsLookup::A);
+    QCOMPARE(resolver->requests.size(), 1);
+    resolver->reply(addressResult("192.0.2.1", 300));
+    QCOMPARE(spy.size(), 1);
+
+    // the second lookup is answered from the cache, asynchronously
+    cache->lookup("example.com", QDnsLookup::A);
+    QCOMPARE(resolver->requests.size(), 0);
+    QCOMPARE(spy.size(), 1);
+    QVERIFY(spy.wait());
+    QCOMPARE(spy.size(), 2);
+
+    const auto args = spy.last();
+    QCOMPARE(args.at(0).toString(), QStringLiteral("example.com"));
+    QCOMPARE(args.at(1).value<QDnsLookup::Type>(), QDnsLookup::A);
+    const auto result = args.at(2).value<QXmppDnsResult>();
+    QCOMPARE(result.addresses, QList<QHostAddress>() << QHostAddress("192.0.2.1"));
+
+    // other record types are looked up separately
+    cache->lookup("example.com", QDnsLookup::AAAA);
+    QCOMPARE(resolver->requests.size(), 1);
+}
+
+void tst_QXmppDnsCache::testCaseInsensitive()
+{
+    cache->lookup("Example.COM", QDnsLookup::A);
+    QCOMPARE(resolver->requests.size(), 1);
+    QCOMPARE(resolver->requests.first().first, QStringLiteral("example.com"));
+    resolver->reply(addressResult("192.0.2.1", 300));
+
+    cache->lookup("example.com", QDnsLookup::A);
+    QCOMPARE(resolver->requests.size(), 0);
+}
+
+void tst_QXmppDnsCache::testCollapse()
+{
+    QSignalSpy spy(cache, &QXmppDnsCache::finished);
+
+    cache->lookup("example.com", QDnsLookup::A);
+    cache->lookup("example.com", QDnsLookup::A);
+    cache->lookup("example.com", QDnsLookup::A);
+    QCOMPARE(resolver->requests.size(), 1);
+
+    resolver->reply(addressResult("192.0.2.1", 300));
+    QCOMPARE(spy.size(), 1);
+}
+
+void tst_QXmppDnsCache::testExpiry()
+{
+    cache->lookup("example.com", QDnsLookup::A);
+    resolver->reply(addressResult("192.0.2.1", 1));
+
+    cache->lookup("example.com", QDnsLookup::A);
+    QCOMPARE(resolver->requests.size(), 0);
+
+    // once the time to live has elapsed, the name is looked up again
+    QTest::qWait(1100);
+    cache->lookup("example.com", QDnsLookup::A);
+    QCOMPARE(resolver->requests.size(), 1);
+}
+
+void tst_QXmppDnsCache::testNegative()
+{
+    QSignalSpy spy(cache, &QXmppDnsCache::finished);
+
+    QXmppDnsResult notFound;
+    notFound.error = QDnsLookup::NotFoundError;
+    notFound.errorString = QStringLiteral("Non existent domain");
+
+    cache->lookup("missing.example.com", QDnsLookup::A);
+    resolver->reply(notFound);
+    QCOMPARE(spy.size(), 1);
+
+    // the failure is cached
+    cache->lookup("missing.example.com", QDnsLookup::A);
+    QCOMPARE(resolver->requests.size(), 0);
+    QVERIFY(spy.wait());
+    QCOMPARE(spy.last().at(2).value<QXmppDnsResult>().error, QDnsLookup::NotFoundError);
+
+    // unless negative caching is disabled
+    cache->clear();
+    cache->setNegativeTtl(0);
+    cache->lookup("missing.example.com", QDnsLookup::A);
+    resolver->reply(notFound);
+    cache->lookup("missing.example.com", QDnsLookup::A);
+    QCOMPARE(resolver->requests.size(), 1);
+}
+
+void tst_QXmppDnsCache::testServerFailure()
+{
+    QXmppDnsResult failure;
+    failure.error = QDnsLookup::ServerFailureError;
+
+    // temporary failures are not cached
+    cache->lookup("example.com", QDnsLookup::A);
+    resolver->reply(failure);
+    cache->lookup("example.com", QDnsLookup::A);
+    QCOMPARE(resolver->requests.size(), 1);
+}
+
+void tst_QXmppDnsCache::testServiceRecords()
+{
+    QSignalSpy spy(cache, &QXmppDnsCache::finished);
+
+    QXmppDnsResult result;
+    result.serviceRecords << QXmppServiceRecord { "xmpp.example.com", 5222, 10, 0, false };
+    result.timeToLive = 300;
+
+    cache->lookup("_xmpp-client._tcp.example.com", QDnsLookup::SRV);
+    resolver->reply(result);
+
+    cache->lookup("_xmpp-client._tcp.example.com", QDnsLookup::SRV);
+    QCOMPARE(resolver->requests.size(), 0);
+    QVERIFY(spy.wait());
+
+    const auto cached = spy.last().at(2).value<QXmppDnsResult>();
+    QCOMPARE(cached.serviceRecords.size(), 1);
+    QCOMPARE(cached.serviceRecords.first().host, QStringLiteral("xmpp.example.com"));
+    QCOMPARE(cached.serviceRecords.first().port, quint16(5222));
+}
+
+void tst_QXmppDnsCache::testRefresh()
+{
+    QSignalSpy spy(cache, &QXmppDnsCache::finished);
+
+    cache->lookup("example.com", QDnsLookup::A);
+    resolver->reply(addressResult("192.0.2.1", 2));
+
+    // make the entry popular
+    cache->lookup("example.com", QDnsLookup::A);
+    cache->lookup("example.com", QDnsLookup::A);
+    QCOMPARE(resolver->requests.size(), 0);
+
+    // shortly before expiry, the cached answer is served while the entry
+    // is refreshed in the background
+    QTest::qWait(1850);
+    spy.clear();
+    cache->lookup("example.com", QDnsLookup::A);
+    QCOMPARE(resolver->requests.size(), 1);
+    QVERIFY(spy.wait());
+    QCOMPARE(spy.size(), 1);
+
+    resolver->reply(addressResult("192.0.2.2", 300));
+    QTest::qWait(200);
+
+    spy.clear();
+    cache->lookup("example.com", QDnsLookup::A);
+    QCOMPARE(resolver->requests.size(), 0);
+    QVERIFY(spy.wait());
+    QCOMPARE(spy.last().at(2).value<QXmppDnsResult>().addresses, QList<QHostAddress>() << QHostAddress("192.0.2.2"));
+}
+
+// A thread which fetches its DNS cache.
+class InstanceThread : public QThread
+{
+public:
+    void run() override
+    {
+        instance = QXmppDnsCache::instance();
+        sameInstance = (QXmppDnsCache::instance() == instance);
+        sameThread = (instance->thread() == QThread::currentThread());
+    }
+
+    QXmppDnsCache *instance = nullptr;
+    bool sameInstance = false;
+    bool sameThread = false;
+};
+
+void tst_QXmppDnsCache::testInstancePerThread()
+{
+    QXmppDnsCache *mainInstance = QXmppDnsCache::instance();
+    QVERIFY(mainInstance);
+    QCOMPARE(QXmppDnsCache::instance(), mainInstance);
+    QCOMPARE(mainInstance->thread(), QThread::currentThread());
+
+    InstanceThread thread;
+    thread.start();
+    QVERIFY(thread.wait(5000));
+    QVERIFY(thread.instance);
+    QVERIFY(thread.instance != mainInstance);
+    QVERIFY(thread.sameInstance);
+    QVERIFY(thread.sameThread);
+}
+
+QTEST_MAIN(tst_QXmppDnsCache)
+#include "tst_qxmppdnscache.moc"
@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2008-2020 The QXmpp developers
+ *
+ * Author:
+ *  Linus Jahn
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+
+#include "QXmppIbbIq.h"
+
+#include "util.h"
+#include <QObject>
+#include <QThread>
+
+// Reads the payload of a copy of a data IQ.
+class PayloadReader : public QThread
+{
+public:
+    explicit PayloadReader(const QXmppIbbDataIq &iq)
+        : iq(iq)
+    {
+    }
+
+    void run() override
+    {
+        payload = iq.payload();
+    }
+
+    const QXmppIbbDataIq iq;
+    QByteArray payload;
+};
+
+class tst_QXmppIbbIq : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testDataIq();
+    void testDataIqPayload();
+};
+
+void tst_QXmppIbbIq::testDataIq()
+{
+    const QByteArray xml(
+        "<iq id=\"kr91n475\" "
+        "to=\"juliet@capulet.com/balcony\" "
+        "from=\"romeo@montague.net/orchard\" "
+        "type=\"set\">"
+        "<data xmlns=\"http://jabber.org/protocol/ibb\" sid=\"i781hf64\" seq=\"0\">"
+        "SGVsbG8sIFdvcmxkIQ=="
+        "</data>"
+        "</iq>");
+
+    QDomDocument doc;
+    QVERIFY(doc.setContent(xml, true));
+    QVERIFY(QXmppIbbDataIq::isIbbDataIq(doc.documentElement()));
+
+    QXmppIbbDataIq iq;
+    parsePacket(iq, xml);
+    QCOMPARE(iq.sid(), QStringLiteral("i781hf64"));
+    QCOMPARE(iq.sequence(), quint16(0));
+    QCOMPARE(iq.payload(), QByteArray("Hello, World!"));
+    serializePacket(iq, xml);
+
+    iq = QXmppIbbDataIq();
+    iq.setId(QStringLiteral("kr91n475"));
+    iq.setTo(QStringLiteral("juliet@capulet.com/balcony"));
+    iq.setFrom(QStringLiteral("romeo@montague.net/orchard"));
+    iq.setType(QXmppIq::Set);
+    iq.setSid(QStringLiteral("i781hf64"));
+    iq.setSequence(0);
+    iq.setPayload(QByteArrayLiteral("Hello, World!"));
+    serializePacket(iq, xml);
+}
+
+void tst_QXmppIbbIq::testDataIqPayload()
+{
+    // the payload is decoded while parsing, line breaks are skipped
+    const QByteArray xml(
+        "<iq id=\"kr91n476\" type=\"set\">"
+        "<data xmlns=\"http://jabber.org/protocol/ibb\" sid=\"i781hf64\" seq=\"1\">"
+        "SGVsbG8s\nIFdvcmxk\nIQ=="
+        "</data>"
+        "</iq>");
+
+    QXmppIbbDataIq iq;
+    parsePacket(iq, xml);
+
+    // copies may be read from different threads
+    PayloadReader first(iq);
+    PayloadReader second(iq);
+    first.start();
+    second.start();
+    QVERIFY(first.wait(5000));
+    QVERIFY(second.wait(5000));
+    QCOMPARE(first.payload, QByteArray("Hello, World!"));
+    QCOMPARE(second.payload, QByteArray("Hello, World!"));
+
+    // the payload is written back in canonical form
+    const QByteArray canonicalXml(
+        "<iq id=\"kr91n476\" type=\"set\">"
+        "<data xmlns=\"http://jabber.org/protocol/ibb\" sid=\"i781hf64\" seq=\"1\">"
+        "SGVsbG8sIFdvcmxkIQ=="
+        "</data>"
+        "</iq>");
+    serializePacket(iq, canonicalXml);
+}
+
+QTEST_MAIN(tst_QXmppIbbIq)
+#include "tst_qxmppibbiq.moc"
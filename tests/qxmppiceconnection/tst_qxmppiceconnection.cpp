@@ -22,9 +22,12 @@
  */
 
 #include "QXmppStun.h"
+#include "QXmppStun_p.h"
 
 #include "util.h"
+#include <QElapsedTimer>
 #include <QHostInfo>
+#include <QUdpSocket>
 
 class tst_QXmppIceConnection : public QObject
 {
@@ -34,6 +37,10 @@ private slots:
     void testBind();
     void testBindStun();
     void testConnect();
+    void testConnectTrickle_data();
+    void testConnectTrickle();
+    void testDatagramBatch();
+    void testDatagramBatchLarge();
 };
 
 void tst_QXmppIceConnection::testBind()
@@ -160,6 +167,161 @@ void tst_QXmppIceConnection::testConnect()
     loop.exec();
     QVERIFY(clientL.isConnected());
     QVERIFY(clientR.isConnected());
+
+    // send a burst of packets
+    QList<QByteArray> datagrams;
+    for (int i = 0; i < 20; ++i)
+        datagrams << QByteArray(i < 19 ? 200 : 50, char('a' + i));
+    qint64 expectedBytes = 0;
+    for (const auto &datagram : datagrams)
+        expectedBytes += datagram.size();
+
+    QList<QByteArray> received;
+    connect(clientR.component(componentId), &QXmppIceComponent::datagramReceived,
+            this, [&](const QByteArray &datagram) {
+                received << datagram;
+                if (received.size() == datagrams.size())
+                    loop.quit();
+            });
+    QCOMPARE(clientL.component(componentId)->sendDatagrams(datagrams), expectedBytes);
+    loop.exec();
+    QCOMPARE(received, datagrams);
+}
+
+void tst_QXmppIceConnection::testConnectTrickle_data()
+{
+    QTest::addColumn<bool>("aggressive");
+
+    QTest::newRow("regular nomination") << false;
+    QTest::newRow("aggressive nomination") << true;
+}
+
+void tst_QXmppIceConnection::testConnectTrickle()
+{
+    QFETCH(bool, aggressive);
+
+    const int componentId = 1024;
+    const QList<QHostAddress> addresses = { QHostAddress(QHostAddress::LocalHost) };
+
+    QXmppIceConnection clientL;
+    clientL.setIceControlling(true);
+    clientL.setAggressiveNomination(aggressive);
+    clientL.addComponent(componentId);
+    QCOMPARE(clientL.aggressiveNomination(), aggressive);
+
+    QXmppIceConnection clientR;
+    clientR.setIceControlling(false);
+    clientR.addComponent(componentId);
+
+    // exchange credentials
+    clientL.setRemoteUser(clientR.localUser());
+    clientL.setRemotePassword(clientR.localPassword());
+    clientR.setRemoteUser(clientL.localUser());
+    clientR.setRemotePassword(clientL.localPassword());
+
+    // trickle candidates as they are gathered
+    int trickledL = 0;
+    connect(&clientL, &QXmppIceConnection::localCandidateAdded,
+            this, [&](const QXmppJingleCandidate &candidate) {
+                trickledL++;
+                clientR.addRemoteCandidate(candidate);
+            });
+    connect(&clientR, &QXmppIceConnection::localCandidateAdded,
+            &clientL, &QXmppIceConnection::addRemoteCandidate);
+
+    // start checking before any candidate is known
+    QElapsedTimer timer;
+    timer.start();
+    clientL.connectToHost();
+    clientR.connectToHost();
+    QVERIFY(clientL.bind(addresses));
+    QVERIFY(clientR.bind(addresses));
+    QCOMPARE(trickledL, clientL.localCandidates().size());
+
+    // checks are paced at 50ms, connecting takes a few of them
+    QTRY_VERIFY_WITH_TIMEOUT(clientL.isConnected() && clientR.isConnected(), 10000);
+
+    // report the time it took to connect, without asserting on it
+    QTest::setBenchmarkResult(timer.elapsed(), QTest::WalltimeMilliseconds);
+
+    // data flows in both directions
+    QByteArray receivedL;
+    QByteArray receivedR;
+    connect(clientL.component(componentId), &QXmppIceComponent::datagramReceived,
+            this, [&](const QByteArray &datagram) {
+                receivedL = datagram;
+            });
+    connect(clientR.component(componentId), &QXmppIceComponent::datagramReceived,
+            this, [&](const QByteArray &datagram) {
+                receivedR = datagram;
+            });
+    QCOMPARE(clientL.component(componentId)->sendDatagram("ping"), qint64(4));
+    QTRY_COMPARE_WITH_TIMEOUT(receivedR, QByteArray("ping"), 5000);
+    QCOMPARE(clientR.component(componentId)->sendDatagram("pong"), qint64(4));
+    QTRY_COMPARE_WITH_TIMEOUT(receivedL, QByteArray("pong"), 5000);
+}
+
+void tst_QXmppIceConnection::testDatagramBatch()
+{
+    QUdpSocket receiver;
+    QVERIFY(receiver.bind(QHostAddress::LocalHost, 0));
+    QUdpSocket sender;
+    QVERIFY(sender.bind(QHostAddress::LocalHost, 0));
+
+    QList<QByteArray> datagrams;
+    for (int i = 0; i < 10; ++i)
+        datagrams << QByteArray(100 + i, char('a' + i));
+    QCOMPARE(QXmppDatagramBatch::write(&sender, datagrams, QHostAddress::LocalHost, receiver.localPort()),
+             qint64(1045));
+
+    QXmppDatagramBatch batch(4, 1024);
+    QCOMPARE(batch.capacity(), 4);
+
+    QList<QByteArray> received;
+    while (received.size() < datagrams.size()) {
+        if (!receiver.hasPendingDatagrams())
+            QVERIFY(receiver.waitForReadyRead(1000));
+        const int count = batch.read(&receiver);
+        QVERIFY(count <= batch.capacity());
+        for (int i = 0; i < count; ++i) {
+            const auto &datagram = batch.datagram(i);
+            QCOMPARE(datagram.host, QHostAddress(QHostAddress::LocalHost));
+            QCOMPARE(datagram.port, sender.localPort());
+            received << QByteArray(datagram.data, datagram.size);
+        }
+    }
+    QCOMPARE(received, datagrams);
+    QCOMPARE(batch.read(&receiver), 0);
+}
+
+void tst_QXmppIceConnection::testDatagramBatchLarge()
+{
+    QUdpSocket receiver;
+    QVERIFY(receiver.bind(QHostAddress::LocalHost, 0));
+    receiver.setSocketOption(QAbstractSocket::ReceiveBufferSizeSocketOption, 1024 * 1024);
+    QUdpSocket sender;
+    QVERIFY(sender.bind(QHostAddress::LocalHost, 0));
+
+    // datagrams after the first one may be larger than a memory page
+    const QList<QByteArray> datagrams = QList<QByteArray>()
+        << QByteArray(100, 'a')
+        << QByteArray(8000, 'b')
+        << QByteArray(30000, 'c')
+        << QByteArray(100, 'd');
+    QCOMPARE(QXmppDatagramBatch::write(&sender, datagrams, QHostAddress::LocalHost, receiver.localPort()),
+             qint64(38200));
+
+    QXmppDatagramBatch batch;
+    QList<QByteArray> received;
+    while (received.size() < datagrams.size()) {
+        if (!receiver.hasPendingDatagrams())
+            QVERIFY(receiver.waitForReadyRead(1000));
+        const int count = batch.read(&receiver);
+        QCOMPARE(batch.dropped(), 0);
+        for (int i = 0; i < count; ++i)
+            received << QByteArray(batch.datagram(i).data, batch.datagram(i).size);
+    }
+    QCOMPARE(received, datagrams);
 }
 
 QTEST_MAIN(tst_QXmppIceConnection)
@@ -0,0 +1,210 @@
+/*
+ * Copyright (C) 2008-2020 The QXmpp developers
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "QXmppClient.h"
+#include "QXmppMamIq.h"
+#include "QXmppMamIterator.h"
+#include "QXmppMamManager.h"
+#include "QXmppUtils.h"
+
+#include "util.h"
+#include <QObject>
+
+static QDomElement archivedMessage(const QString &queryId, const QString &id, const QString &body)
+{
+    return xmlToDom(QStringLiteral(
+                        "<message to='juliet@capulet.lit/chamber'>"
+                        "<result xmlns='urn:xmpp:mam:2' queryid='%1' id='%2'>"
+                        "<forwarded xmlns='urn:xmpp:forward:0'>"
+                        "<delay xmlns='urn:xmpp:delay' stamp='2010-07-10T23:08:25Z'/>"
+                        "<message xmlns='jabber:client' from='romeo@montague.lit/orchard' type='chat'>"
+                        "<body>%3</body>"
+                        "</message>"
+                        "</forwarded>"
+                        "</result>"
+                        "</message>")
+                        .arg(queryId, id, body));
+}
+
+static QDomElement fin(const QString &queryId, const QString &last, bool complete)
+{
+    return xmlToDom(QStringLiteral(
+                        "<iq type='result' id='%1'>"
+                        "<fin xmlns='urn:xmpp:mam:2'%3>"
+                        "<set xmlns='http://jabber.org/protocol/rsm'>"
+                        "<last>%2</last>"
+                        "</set>"
+                        "</fin>"
+                        "</iq>")
+                        .arg(queryId, last, complete ? QStringLiteral(" complete='true'") : QString()));
+}
+
+class tst_QXmppMamIterator : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void init();
+    void cleanup();
+
+    void testPaging();
+    void testWindows();
+    void testError();
+
+private:
+    QXmppClient *m_client;
+    QXmppLogger m_logger;
+    QXmppMamManager *m_manager;
+    QList<QXmppMamQueryIq> m_queries;
+};
+
+void tst_QXmppMamIterator::init()
+{
+    m_client = new QXmppClient;
+    m_manager = new QXmppMamManager;
+    m_client->addExtension(m_manager);
+
+    // record the queries sent by the iterator
+    m_queries.clear();
+    m_logger.setLoggingType(QXmppLogger::SignalLogging);
+    m_client->setLogger(&m_logger);
+    connect(&m_logger, &QXmppLogger::message, this, [this](QXmppLogger::MessageType type, const QString &text) {
+        const QDomElement element = xmlToDom(text);
+        if (type == QXmppLogger::SentMessage && QXmppMamQueryIq::isMamQueryIq(element)) {
+            QXmppMamQueryIq query;
+            query.parse(element);
+            m_queries << query;
+        }
+    });
+}
+
+void tst_QXmppMamIterator::cleanup()
+{
+    m_logger.disconnect(this);
+    delete m_client;
+}
+
+void tst_QXmppMamIterator::testPaging()
+{
+    QXmppMamIterator iterator(m_client);
+    iterator.setWith(QStringLiteral("romeo@montague.lit"));
+    iterator.setPageSize(2);
+    iterator.setMaximumBufferedMessages(2);
+
+    QSignalSpy availableSpy(&iterator, &QXmppMamIterator::messagesAvailable);
+    QSignalSpy finishedSpy(&iterator, &QXmppMamIterator::finished);
+
+    iterator.start();
+    QVERIFY(iterator.isRunning());
+    QCOMPARE(m_queries.size(), 1);
+    QCOMPARE(m_queries.first().resultSetQuery().max(), 2);
+    QVERIFY(m_queries.first().resultSetQuery().after().isEmpty());
+
+    // the first page fills the buffer, the next one is not requested yet
+    const QString queryId = m_queries.first().queryId();
+    QVERIFY(m_manager->handleStanza(archivedMessage(queryId, "m1", "one")));
+    QVERIFY(m_manager->handleStanza(archivedMessage(queryId, "m2", "two")));
+    QVERIFY(m_manager->handleStanza(fin(queryId, "m2", false)));
+    QCOMPARE(availableSpy.size(), 1);
+    QCOMPARE(iterator.bufferedMessages(), 2);
+    QCOMPARE(m_queries.size(), 1);
+
+    // taking the messages releases the back-pressure
+    QCOMPARE(bodies(iterator.takeMessages(1)), QStringList { "one" });
+    QCOMPARE(m_queries.size(), 2);
+    QCOMPARE(m_queries.last().resultSetQuery().after(), QStringLiteral("m2"));
+
+    const QString nextQueryId = m_queries.last().queryId();
+    QVERIFY(m_manager->handleStanza(archivedMessage(nextQueryId, "m3", "three")));
+    QVERIFY(m_manager->handleStanza(fin(nextQueryId, "m3", true)));
+    QCOMPARE(availableSpy.size(), 2);
+    QCOMPARE(finishedSpy.size(), 0);
+
+    QCOMPARE(bodies(iterator.takeMessages()), QStringList({ "two", "three" }));
+    QCOMPARE(finishedSpy.size(), 1);
+    QVERIFY(!iterator.isRunning());
+    QCOMPARE(m_queries.size(), 2);
+}
+
+void tst_QXmppMamIterator::testWindows()
+{
+    const QDateTime start(QDate(2020, 1, 1), QTime(0, 0), Qt::UTC);
+    const QDateTime end(QDate(2020, 1, 3), QTime(0, 0), Qt::UTC);
+
+    QXmppMamIterator iterator(m_client);
+    iterator.setStart(start);
+    iterator.setEnd(end);
+    iterator.setWindowCount(2);
+
+    QSignalSpy availableSpy(&iterator, &QXmppMamIterator::messagesAvailable);
+    QSignalSpy finishedSpy(&iterator, &QXmppMamIterator::finished);
+
+    // both windows are requested in parallel
+    iterator.start();
+    QCOMPARE(m_queries.size(), 2);
+
+    auto fieldValue = [](const QXmppMamQueryIq &query, const QString &key) -> QDateTime {
+        const auto fields = query.form().fields();
+        for (const auto &field : fields) {
+            if (field.key() == key)
+                return QXmppUtils::datetimeFromString(field.value().toString());
+        }
+        return QDateTime();
+    };
+    QCOMPARE(fieldValue(m_queries.at(0), "start"), start);
+    QCOMPARE(fieldValue(m_queries.at(0), "end"), QDateTime(QDate(2020, 1, 1), QTime(23, 59, 59, 999), Qt::UTC));
+    QCOMPARE(fieldValue(m_queries.at(1), "start"), QDateTime(QDate(2020, 1, 2), QTime(0, 0), Qt::UTC));
+    QCOMPARE(fieldValue(m_queries.at(1), "end"), end);
+
+    // the second window completes first, its messages are held back
+    const QString firstId = m_queries.at(0).queryId();
+    const QString secondId = m_queries.at(1).queryId();
+    QVERIFY(m_manager->handleStanza(archivedMessage(secondId, "b1", "later")));
+    QVERIFY(m_manager->handleStanza(fin(secondId, "b1", true)));
+    QCOMPARE(availableSpy.size(), 0);
+    QVERIFY(iterator.takeMessages().isEmpty());
+
+    QVERIFY(m_manager->handleStanza(archivedMessage(firstId, "a1", "earlier")));
+    QVERIFY(m_manager->handleStanza(fin(firstId, "a1", true)));
+    QCOMPARE(availableSpy.size(), 1);
+
+    QCOMPARE(bodies(iterator.takeMessages()), QStringList({ "earlier", "later" }));
+    QCOMPARE(finishedSpy.size(), 1);
+}
+
+void tst_QXmppMamIterator::testError()
+{
+    QXmppMamIterator iterator(m_client);
+    QSignalSpy failedSpy(&iterator, &QXmppMamIterator::failed);
+
+    iterator.start();
+    QCOMPARE(m_queries.size(), 1);
+
+    QXmppIq error(QXmppIq::Error);
+    error.setId(m_queries.first().queryId());
+    error.setError(QXmppStanza::Error(QXmppStanza::Error::Cancel, QXmppStanza::Error::ItemNotFound));
+    emit m_client->iqReceived(error);
+
+    QCOMPARE(failedSpy.size(), 1);
+    QVERIFY(!iterator.isRunning());
+}
+
+QTEST_MAIN(tst_QXmppMamIterator)
+#include "tst_qxmppmamiterator.moc"
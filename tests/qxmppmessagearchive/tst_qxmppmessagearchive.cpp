@@ -0,0 +1,264 @@
+/*
+ * Copyright (C) 2008-2020 The QXmpp developers
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "QXmppClient.h"
+#include "QXmppMamIq.h"
+#include "QXmppMamManager.h"
+#include "QXmppMessageArchive.h"
+
+#include "util.h"
+#include <QObject>
+#include <QTemporaryDir>
+
+static QXmppMessage message(const QString &from, const QString &to, const QString &body, const QString &stanzaId, const QDateTime &stamp)
+{
+    QXmppMessage message(from, to, body);
+    message.setStanzaId(stanzaId);
+    message.setStamp(stamp);
+    return message;
+}
+
+class tst_QXmppMessageArchive : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void init();
+
+    void testQueries();
+    void testReopen();
+    void testSynchronize();
+
+private:
+    void fill(QXmppMessageArchive &archive);
+
+    QTemporaryDir m_dir;
+    QString m_fileName;
+};
+
+void tst_QXmppMessageArchive::init()
+{
+    QVERIFY(m_dir.isValid());
+    m_fileName = m_dir.filePath(QStringLiteral("%1.archive").arg(QTest::currentTestFunction()));
+}
+
+void tst_QXmppMessageArchive::fill(QXmppMessageArchive &archive)
+{
+    const QDateTime day(QDate(2020, 1, 1), QTime(12, 0), Qt::UTC);
+
+    archive.setAccountJid(QStringLiteral("juliet@capulet.lit/balcony"));
+    QVERIFY(archive.addMessage(message("romeo@montague.lit/orchard", "juliet@capulet.lit", "Hello Juliet", "id1", day)));
+    QVERIFY(archive.addMessage(message("juliet@capulet.lit/balcony", "romeo@montague.lit", "Who is there?", "id2", day.addSecs(60))));
+    QVERIFY(archive.addMessage(message("nurse@capulet.lit/kitchen", "juliet@capulet.lit", "Madam!", "id3", day.addSecs(120))));
+
+    // messages which arrive late are still ordered by time
+    QVERIFY(archive.addMessage(message("romeo@montague.lit/orchard", "juliet@capulet.lit", "It is Romeo", "id4", day.addSecs(30))));
+}
+
+void tst_QXmppMessageArchive::testQueries()
+{
+    QXmppMessageArchive archive;
+    QVERIFY(archive.open(m_fileName));
+    fill(archive);
+
+    QCOMPARE(archive.count(), 4);
+    QCOMPARE(archive.conversations(), QStringList({ "nurse@capulet.lit", "romeo@montague.lit" }));
+
+    // live messages do not move the resume point
+    QVERIFY(archive.lastStanzaId().isEmpty());
+
+    // duplicates are ignored
+    QVERIFY(!archive.addMessage(message("romeo@montague.lit/orchard", "juliet@capulet.lit", "Hello Juliet", "id1", QDateTime::currentDateTimeUtc())));
+    QCOMPARE(archive.count(), 4);
+
+    QVERIFY(archive.contains("id2"));
+    QVERIFY(!archive.contains("id5"));
+    const QXmppMessage stored = archive.message("id2");
+    QCOMPARE(stored.body(), QStringLiteral("Who is there?"));
+    QCOMPARE(stored.from(), QStringLiteral("juliet@capulet.lit/balcony"));
+    QCOMPARE(stored.stamp(), QDateTime(QDate(2020, 1, 1), QTime(12, 1), Qt::UTC));
+
+    QCOMPARE(bodies(archive.messages()), QStringList({ "Hello Juliet", "It is Romeo", "Who is there?", "Madam!" }));
+    QCOMPARE(bodies(archive.messages("romeo@montague.lit/orchard")), QStringList({ "Hello Juliet", "It is Romeo", "Who is there?" }));
+    QCOMPARE(bodies(archive.messages("romeo@montague.lit", QDateTime(), QDateTime(), 2)), QStringList({ "It is Romeo", "Who is there?" }));
+    QCOMPARE(bodies(archive.messages(QString(), QDateTime(QDate(2020, 1, 1), QTime(12, 0, 30), Qt::UTC), QDateTime(QDate(2020, 1, 1), QTime(12, 1), Qt::UTC))),
+             QStringList({ "It is Romeo", "Who is there?" }));
+    QVERIFY(archive.messages("tybalt@capulet.lit").isEmpty());
+
+    QCOMPARE(bodies(archive.search("JULIET")), QStringList { "Hello Juliet" });
+    QCOMPARE(bodies(archive.search("i", "romeo@montague.lit", 2)), QStringList({ "It is Romeo", "Who is there?" }));
+    QVERIFY(archive.search("Madam", "romeo@montague.lit").isEmpty());
+}
+
+void tst_QXmppMessageArchive::testReopen()
+{
+    {
+        QXmppMessageArchive archive;
+        QVERIFY(archive.open(m_fileName));
+        fill(archive);
+    }
+
+    // simulate a record which was only partially written
+    QFile file(m_fileName);
+    QVERIFY(file.open(QIODevice::Append));
+    const qint64 size = file.size();
+    file.write(QByteArray::fromHex("ff000000"));
+    file.close();
+
+    QXmppMessageArchive archive;
+    QVERIFY(archive.open(m_fileName));
+    QCOMPARE(QFileInfo(m_fileName).size(), size);
+    QCOMPARE(archive.count(), 4);
+    QVERIFY(archive.lastStanzaId().isEmpty());
+    QCOMPARE(archive.conversations(), QStringList({ "nurse@capulet.lit", "romeo@montague.lit" }));
+    QCOMPARE(bodies(archive.messages("romeo@montague.lit")), QStringList({ "Hello Juliet", "It is Romeo", "Who is there?" }));
+    QCOMPARE(archive.message("id3").body(), QStringLiteral("Madam!"));
+
+    // files which are not archives are rejected
+    archive.close();
+    QFile other(m_dir.filePath("other"));
+    QVERIFY(other.open(QIODevice::WriteOnly));
+    other.write("<roster/>");
+    other.close();
+    QVERIFY(!archive.open(other.fileName()));
+    QVERIFY(!archive.isOpen());
+}
+
+void tst_QXmppMessageArchive::testSynchronize()
+{
+    QXmppClient client;
+    auto *manager = new QXmppMamManager;
+    client.addExtension(manager);
+
+    // record the queries sent by the archive
+    QList<QXmppMamQueryIq> queries;
+    QXmppLogger logger;
+    logger.setLoggingType(QXmppLogger::SignalLogging);
+    client.setLogger(&logger);
+    connect(&logger, &QXmppLogger::message, this, [&queries](QXmppLogger::MessageType type, const QString &text) {
+        const QDomElement element = xmlToDom(text);
+        if (type == QXmppLogger::SentMessage && QXmppMamQueryIq::isMamQueryIq(element)) {
+            QXmppMamQueryIq query;
+            query.parse(element);
+            queries << query;
+        }
+    });
+
+    auto archivedMessage = [](const QString &queryId, const QString &id, const QString &body, const QString &messageId = QString()) {
+        return xmlToDom(QStringLiteral(
+                            "<message to='juliet@capulet.lit/balcony'>"
+                            "<result xmlns='urn:xmpp:mam:2' queryid='%1' id='%2'>"
+                            "<forwarded xmlns='urn:xmpp:forward:0'>"
+                            "<delay xmlns='urn:xmpp:delay' stamp='2010-07-10T23:08:25Z'/>"
+                            "<message xmlns='jabber:client' id='%4' from='romeo@montague.lit/orchard' to='juliet@capulet.lit/balcony' type='chat'>"
+                            "<body>%3</body>"
+                            "</message>"
+                            "</forwarded>"
+                            "</result>"
+                            "</message>")
+                            .arg(queryId, id, body, messageId));
+    };
+    auto fin = [](const QString &queryId, const QString &last, bool complete) {
+        return xmlToDom(QStringLiteral(
+                            "<iq type='result' id='%1'>"
+                            "<fin xmlns='urn:xmpp:mam:2'%3>"
+                            "<set xmlns='http://jabber.org/protocol/rsm'><last>%2</last></set>"
+                            "</fin>"
+                            "</iq>")
+                            .arg(queryId, last, complete ? QStringLiteral(" complete='true'") : QString()));
+    };
+
+    QXmppMessageArchive archive;
+    archive.setPageSize(2);
+    QSignalSpy synchronizedSpy(&archive, &QXmppMessageArchive::synchronized);
+    QVERIFY(!archive.synchronize(&client));
+
+    // the first synchronization retrieves the whole archive
+    QVERIFY(archive.open(m_fileName));
+    QVERIFY(archive.synchronize(&client));
+    QVERIFY(archive.isSynchronizing());
+    QCOMPARE(queries.size(), 1);
+    QCOMPARE(queries.last().resultSetQuery().max(), 2);
+    QVERIFY(queries.last().resultSetQuery().after().isEmpty());
+
+    QString queryId = queries.last().queryId();
+    QVERIFY(manager->handleStanza(archivedMessage(queryId, "a1", "one")));
+    QVERIFY(manager->handleStanza(archivedMessage(queryId, "a2", "two")));
+    QVERIFY(manager->handleStanza(fin(queryId, "a2", false)));
+    QCOMPARE(archive.count(), 2);
+    QCOMPARE(queries.size(), 2);
+    QCOMPARE(queries.last().resultSetQuery().after(), QStringLiteral("a2"));
+
+    queryId = queries.last().queryId();
+    QVERIFY(manager->handleStanza(archivedMessage(queryId, "a3", "three")));
+    QVERIFY(manager->handleStanza(fin(queryId, "a3", true)));
+    QVERIFY(!archive.isSynchronizing());
+    QCOMPARE(synchronizedSpy.size(), 1);
+    QCOMPARE(synchronizedSpy.last().at(0).toInt(), 3);
+    QCOMPARE(archive.lastStanzaId(), QStringLiteral("a3"));
+    QCOMPARE(archive.message("a1").body(), QStringLiteral("one"));
+    QCOMPARE(archive.conversations(), QStringList { "romeo@montague.lit" });
+
+    // the next synchronization only retrieves the new messages
+    archive.close();
+    QVERIFY(archive.open(m_fileName));
+    QVERIFY(archive.synchronize(&client));
+    QCOMPARE(queries.size(), 3);
+    QCOMPARE(queries.last().resultSetQuery().after(), QStringLiteral("a3"));
+
+    queryId = queries.last().queryId();
+    QVERIFY(manager->handleStanza(fin(queryId, QString(), true)));
+    QCOMPARE(synchronizedSpy.size(), 2);
+    QCOMPARE(synchronizedSpy.last().at(0).toInt(), 0);
+    QCOMPARE(archive.count(), 3);
+
+    // a live message without stanza-id is not archived again when the
+    // server returns it, and does not move the resume point
+    QXmppMessage live("romeo@montague.lit/orchard", "juliet@capulet.lit/balcony", "four");
+    live.setId(QStringLiteral("live-4"));
+    QVERIFY(archive.addMessage(live));
+    QVERIFY(!archive.addMessage(live));
+    QCOMPARE(archive.count(), 4);
+    QCOMPARE(archive.lastStanzaId(), QStringLiteral("a3"));
+
+    QVERIFY(archive.synchronize(&client));
+    QCOMPARE(queries.last().resultSetQuery().after(), QStringLiteral("a3"));
+    queryId = queries.last().queryId();
+    QVERIFY(manager->handleStanza(archivedMessage(queryId, "a4", "four", "live-4")));
+    QVERIFY(manager->handleStanza(archivedMessage(queryId, "a5", "five", "live-5")));
+    QVERIFY(manager->handleStanza(fin(queryId, "a5", true)));
+    QCOMPARE(synchronizedSpy.last().at(0).toInt(), 1);
+    QCOMPARE(archive.count(), 5);
+    QVERIFY(archive.contains("a4"));
+    QCOMPARE(archive.lastStanzaId(), QStringLiteral("a5"));
+
+    // the resume point and the stanza-id of the live message are kept in
+    // the file
+    archive.close();
+    QVERIFY(archive.open(m_fileName));
+    QCOMPARE(archive.count(), 5);
+    QCOMPARE(archive.lastStanzaId(), QStringLiteral("a5"));
+    QVERIFY(archive.contains("a4"));
+    QCOMPARE(archive.message("a4").body(), QStringLiteral("four"));
+    QCOMPARE(bodies(archive.messages()).count(QStringLiteral("four")), 1);
+}
+
+QTEST_MAIN(tst_QXmppMessageArchive)
+#include "tst_qxmppmessagearchive.moc"
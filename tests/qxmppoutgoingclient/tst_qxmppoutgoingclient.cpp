@@ -0,0 +1,192 @@
+/*
+ * Copyright (C) 2008-2020 The QXmpp developers
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "QXmppClient.h"
+#include "QXmppCompression_p.h"
+#include "QXmppDnsCache_p.h"
+#include "QXmppOutgoingClient.h"
+#include "QXmppServer.h"
+
+#include "util.h"
+
+// A resolver which answers SRV lookups from a fixed set of records.
+class TestResolver : public QXmppDnsResolver
+{
+    Q_OBJECT
+
+public:
+    void lookup(const QString &name, QDnsLookup::Type type) override
+    {
+        requests << name;
+
+        QXmppDnsResult result;
+        if (type == QDnsLookup::SRV && records.contains(name)) {
+            result.serviceRecords = records.value(name);
+            result.timeToLive = 300;
+        } else {
+            result.error = QDnsLookup::NotFoundError;
+        }
+
+        // real lookups never complete synchronously
+        QTimer::singleShot(0, this, [this, name, type, result]() {
+            emit finished(name, type, result);
+        });
+    }
+
+    QHash<QString, QList<QXmppServiceRecord>> records;
+    QStringList requests;
+};
+
+class tst_QXmppOutgoingClient : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testServiceRecords_data();
+    void testServiceRecords();
+    void testReconnectCompressed();
+};
+
+void tst_QXmppOutgoingClient::testServiceRecords_data()
+{
+    QTest::addColumn<int>("startTlsPriority");
+    QTest::addColumn<int>("directTlsPriority");
+    QTest::addColumn<bool>("tlsDisabled");
+    QTest::addColumn<bool>("expectDirectTls");
+
+    // a priority of -1 means there is no record
+    QTest::newRow("same priority") << 10 << 10 << false << true;
+    QTest::newRow("starttls preferred") << 5 << 10 << false << false;
+    QTest::newRow("direct tls preferred") << 10 << 5 << false << true;
+    QTest::newRow("direct tls only") << -1 << 10 << false << true;
+    QTest::newRow("starttls only") << 10 << -1 << false << false;
+    QTest::newRow("tls disabled") << 10 << 5 << true << false;
+}
+
+void tst_QXmppOutgoingClient::testServiceRecords()
+{
+    QFETCH(int, startTlsPriority);
+    QFETCH(int, directTlsPriority);
+    QFETCH(bool, tlsDisabled);
+    QFETCH(bool, expectDirectTls);
+
+    const quint16 startTlsPort = 12345;
+    const quint16 directTlsPort = 12346;
+
+    auto *resolver = new TestResolver;
+    if (startTlsPriority >= 0)
+        resolver->records.insert("_xmpp-client._tcp.localhost", { QXmppServiceRecord { "127.0.0.1", startTlsPort, quint16(startTlsPriority), 0, false } });
+    if (directTlsPriority >= 0)
+        resolver->records.insert("_xmpps-client._tcp.localhost", { QXmppServiceRecord { "127.0.0.1", directTlsPort, quint16(directTlsPriority), 0, false } });
+    QXmppDnsCache::instance()->setResolver(resolver);
+
+    TestPasswordChecker passwordChecker;
+    passwordChecker.addCredentials("testuser", "testpwd");
+
+    // separate servers tell which kind of connection was made
+    QXmppServer startTlsServer;
+    startTlsServer.setDomain("localhost");
+    startTlsServer.setPasswordChecker(&passwordChecker);
+    startTlsServer.setLocalCertificate(testCertificate());
+    startTlsServer.setPrivateKey(testPrivateKey());
+    QVERIFY(startTlsServer.listenForClients(QHostAddress::LocalHost, startTlsPort));
+    QSignalSpy startTlsSpy(&startTlsServer, &QXmppServer::clientConnected);
+
+    QXmppServer directTlsServer;
+    directTlsServer.setDomain("localhost");
+    directTlsServer.setPasswordChecker(&passwordChecker);
+    directTlsServer.setLocalCertificate(testCertificate());
+    directTlsServer.setPrivateKey(testPrivateKey());
+    QVERIFY(directTlsServer.listenForDirectTlsClients(QHostAddress::LocalHost, directTlsPort));
+    QSignalSpy directTlsSpy(&directTlsServer, &QXmppServer::clientConnected);
+
+    QXmppClient client;
+    QEventLoop loop;
+    connect(&client, &QXmppClient::connected, &loop, &QEventLoop::quit);
+    connect(&client, &QXmppClient::disconnected, &loop, &QEventLoop::quit);
+    QTimer::singleShot(10000, &loop, &QEventLoop::quit);
+
+    // no host is given, so the servers are found using SRV records
+    QXmppConfiguration config;
+    config.setDomain("localhost");
+    config.setUser("testuser");
+    config.setPassword("testpwd");
+    config.setIgnoreSslErrors(true);
+    if (tlsDisabled)
+        config.setStreamSecurityMode(QXmppConfiguration::TLSDisabled);
+    client.connectToServer(config);
+    loop.exec();
+
+    QVERIFY(client.isConnected());
+    QCOMPARE(directTlsSpy.size(), expectDirectTls ? 1 : 0);
+    QCOMPARE(startTlsSpy.size(), expectDirectTls ? 0 : 1);
+    QCOMPARE(resolver->requests.contains("_xmpps-client._tcp.localhost"), !tlsDisabled);
+
+    client.disconnectFromServer();
+}
+
+void tst_QXmppOutgoingClient::testReconnectCompressed()
+{
+    if (!QXmppStreamCompressor::isSupported())
+        QSKIP("QXmpp was built without zlib");
+
+    const quint16 directTlsPort = 12346;
+
+    auto *resolver = new TestResolver;
+    resolver->records.insert("_xmpps-client._tcp.localhost", { QXmppServiceRecord { "127.0.0.1", directTlsPort, 0, 0, false } });
+    QXmppDnsCache::instance()->setResolver(resolver);
+
+    TestPasswordChecker passwordChecker;
+    passwordChecker.addCredentials("testuser", "testpwd");
+
+    QXmppServer server;
+    server.setDomain("localhost");
+    server.setPasswordChecker(&passwordChecker);
+    server.setLocalCertificate(testCertificate());
+    server.setPrivateKey(testPrivateKey());
+    server.setStreamCompressionEnabled(true);
+    QVERIFY(server.listenForDirectTlsClients(QHostAddress::LocalHost, directTlsPort));
+
+    QXmppConfiguration config;
+    config.setDomain("localhost");
+    config.setUser("testuser");
+    config.setPassword("testpwd");
+    config.setIgnoreSslErrors(true);
+    config.setStreamCompressionEnabled(true);
+
+    QXmppClient client;
+    auto *stream = client.findChild<QXmppOutgoingClient *>();
+    QVERIFY(stream);
+
+    // the raced Direct TLS connection is handed over without connected(),
+    // the second stream must not go through the first one's compressor
+    for (int i = 0; i < 2; ++i) {
+        QSignalSpy connectedSpy(&client, &QXmppClient::connected);
+        client.connectToServer(config);
+        QVERIFY(connectedSpy.wait(10000));
+        QVERIFY(stream->isCompressionEnabled());
+
+        client.disconnectFromServer();
+        QTRY_VERIFY(!stream->isCompressionEnabled());
+    }
+}
+
+QTEST_MAIN(tst_QXmppOutgoingClient)
+#include "tst_qxmppoutgoingclient.moc"
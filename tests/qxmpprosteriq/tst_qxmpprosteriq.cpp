@@ -37,6 +37,7 @@ private slots:
     void testApproved();
     void testVersion_data();
     void testVersion();
+    void testEmptyVersion();
     void testMixAnnotate();
     void testMixChannel();
 };
@@ -181,6 +182,19 @@ void tst_QXmppRosterIq::testVersion()
     serializePacket(iq, xml);
 }
 
+void tst_QXmppRosterIq::testEmptyVersion()
+{
+    // an empty version requests a versioned roster without a cached roster
+    QXmppRosterIq iq;
+    iq.setId(QStringLiteral("bv1bs71f"));
+    iq.setType(QXmppIq::Get);
+    iq.setVersion(QStringLiteral(""));
+    serializePacket(iq, R"(<iq id="bv1bs71f" type="get"><query xmlns="jabber:iq:roster" ver=""/></iq>)");
+
+    iq.setVersion(QString());
+    serializePacket(iq, R"(<iq id="bv1bs71f" type="get"><query xmlns="jabber:iq:roster"/></iq>)");
+}
+
 void tst_QXmppRosterIq::testMixAnnotate()
 {
     const QByteArray xml(
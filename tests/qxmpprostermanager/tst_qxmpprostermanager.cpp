@@ -22,11 +22,51 @@
  */
 
 #include "QXmppClient.h"
+#include "QXmppClientExtension.h"
 #include "QXmppDiscoveryManager.h"
 #include "QXmppRosterManager.h"
+#include "QXmppRosterStore.h"
+#include "QXmppServer.h"
 
 #include "util.h"
 
+// Adds roster versioning to the features the server sends before
+// authentication, either as a stream feature or as an inline feature of
+// Bind 2.
+class RosterVersionAdvertiser : public QXmppClientExtension
+{
+public:
+    RosterVersionAdvertiser(const QString &advertisement)
+        : m_advertisement(advertisement)
+    {
+    }
+
+    bool handleStanza(const QDomElement &stanza) override
+    {
+        const QDomElement authentication = stanza.firstChildElement(QStringLiteral("authentication"));
+        if (stanza.tagName() != QLatin1String("features") || authentication.isNull())
+            return false;
+
+        // the element is shared, so the roster manager sees the change
+        QDomDocument document = stanza.ownerDocument();
+        if (m_advertisement == QLatin1String("ver")) {
+            QDomElement features = stanza;
+            features.appendChild(document.createElementNS(QStringLiteral("urn:xmpp:features:rosterver"), QStringLiteral("ver")));
+        } else if (m_advertisement == QLatin1String("bind2")) {
+            QDomElement bind = authentication.firstChildElement(QStringLiteral("inline")).firstChildElement(QStringLiteral("bind"));
+            QDomElement inlineFeatures = document.createElementNS(QStringLiteral("urn:xmpp:bind:0"), QStringLiteral("inline"));
+            QDomElement feature = document.createElementNS(QStringLiteral("urn:xmpp:bind:0"), QStringLiteral("feature"));
+            feature.setAttribute(QStringLiteral("var"), QStringLiteral("urn:xmpp:features:rosterver"));
+            inlineFeatures.appendChild(feature);
+            bind.appendChild(inlineFeatures);
+        }
+        return false;
+    }
+
+private:
+    QString m_advertisement;
+};
+
 class tst_QXmppRosterManager : public QObject
 {
     Q_OBJECT
@@ -36,6 +76,11 @@ private slots:
 
     void testDiscoFeatures();
     void testRenameItem();
+    void testRosterStore();
+    void testPresenceDeduplication();
+    void testPresenceBatching();
+    void testVersioningBind2_data();
+    void testVersioningBind2();
 
 private:
     QXmppClient client;
@@ -105,5 +150,222 @@ void tst_QXmppRosterManager::testRenameItem()
     QVERIFY(requestSent);
 }
 
+void tst_QXmppRosterManager::testRosterStore()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString fileName = dir.filePath(QStringLiteral("roster.xml"));
+
+    auto createItem = [](const QString &jid, const QString &name) -> QXmppRosterIq::Item {
+        QXmppRosterIq::Item item;
+        item.setBareJid(jid);
+        item.setName(name);
+        item.setSubscriptionType(QXmppRosterIq::Item::Both);
+        return item;
+    };
+
+    // a roster stored by a previous run
+    {
+        QXmppRosterFileStore store(fileName);
+        QVERIFY(store.version().isEmpty());
+        QVERIFY(store.items().isEmpty());
+        store.setRoster(QStringLiteral("ver7"), { createItem("nurse@example.com", "Nurse"), createItem("romeo@example.net", "Romeo") });
+    }
+
+    QXmppRosterFileStore store(fileName);
+    QCOMPARE(store.version(), QStringLiteral("ver7"));
+    QCOMPARE(store.items().size(), 2);
+
+    manager->setRosterStore(&store);
+    QCOMPARE(manager->rosterStore(), &store);
+    QCOMPARE(manager->getRosterBareJids(), QStringList({ "nurse@example.com", "romeo@example.net" }));
+    QCOMPARE(manager->getRosterEntry("romeo@example.net").name(), QStringLiteral("Romeo"));
+
+    // roster pushes are written to the store
+    QXmppRosterIq push;
+    push.setType(QXmppIq::Set);
+    push.setVersion(QStringLiteral("ver8"));
+    push.addItem(createItem("benvolio@example.net", "Benvolio"));
+    QVERIFY(manager->handleStanza(writePacketToDom(push)));
+
+    QXmppRosterIq::Item removed;
+    removed.setBareJid("nurse@example.com");
+    removed.setSubscriptionType(QXmppRosterIq::Item::Remove);
+    push = QXmppRosterIq();
+    push.setType(QXmppIq::Set);
+    push.setVersion(QStringLiteral("ver9"));
+    push.addItem(removed);
+    QVERIFY(manager->handleStanza(writePacketToDom(push)));
+
+    QCOMPARE(manager->getRosterBareJids(), QStringList({ "benvolio@example.net", "romeo@example.net" }));
+    QCOMPARE(store.version(), QStringLiteral("ver9"));
+
+    // the versioned roster is kept when disconnecting
+    QMetaObject::invokeMethod(manager, "_q_disconnected");
+    QCOMPARE(manager->getRosterBareJids(), QStringList({ "benvolio@example.net", "romeo@example.net" }));
+
+    // the file is up to date
+    QXmppRosterFileStore reloaded(fileName);
+    QCOMPARE(reloaded.version(), QStringLiteral("ver9"));
+    QCOMPARE(reloaded.items().size(), 2);
+    QCOMPARE(reloaded.items().first().bareJid(), QStringLiteral("benvolio@example.net"));
+    QCOMPARE(reloaded.items().first().name(), QStringLiteral("Benvolio"));
+    QCOMPARE(reloaded.items().first().subscriptionType(), QXmppRosterIq::Item::Both);
+
+    manager->setRosterStore(nullptr);
+}
+
+static QXmppPresence createPresence(const QString &from, QXmppPresence::Type type, const QString &status = QString())
+{
+    QXmppPresence presence(type);
+    presence.setFrom(from);
+    presence.setStatusText(status);
+    return presence;
+}
+
+void tst_QXmppRosterManager::testPresenceDeduplication()
+{
+    QSignalSpy spy(manager, &QXmppRosterManager::presenceChanged);
+
+    emit client.presenceReceived(createPresence("juliet@example.com/balcony", QXmppPresence::Available, "Hi"));
+    QCOMPARE(spy.size(), 1);
+    QCOMPARE(manager->getResources("juliet@example.com"), QStringList { "balcony" });
+
+    // the same presence with another id is ignored
+    emit client.presenceReceived(createPresence("juliet@example.com/balcony", QXmppPresence::Available, "Hi"));
+    QCOMPARE(spy.size(), 1);
+
+    emit client.presenceReceived(createPresence("juliet@example.com/balcony", QXmppPresence::Available, "Away"));
+    QCOMPARE(spy.size(), 2);
+    QCOMPARE(manager->getPresence("juliet@example.com", "balcony").statusText(), QStringLiteral("Away"));
+
+    emit client.presenceReceived(createPresence("juliet@example.com/chamber", QXmppPresence::Available));
+    QCOMPARE(spy.size(), 3);
+    QCOMPARE(manager->getResources("juliet@example.com"), QStringList({ "balcony", "chamber" }));
+    QCOMPARE(manager->getAllPresencesForBareJid("juliet@example.com").keys(), QStringList({ "balcony", "chamber" }));
+
+    emit client.presenceReceived(createPresence("juliet@example.com/balcony", QXmppPresence::Unavailable));
+    QCOMPARE(spy.size(), 4);
+    QCOMPARE(manager->getPresence("juliet@example.com", "balcony").type(), QXmppPresence::Unavailable);
+
+    // unavailable presences for unknown resources are still reported
+    emit client.presenceReceived(createPresence("juliet@example.com/balcony", QXmppPresence::Unavailable));
+    QCOMPARE(spy.size(), 5);
+    emit client.presenceReceived(createPresence("romeo@example.net/orchard", QXmppPresence::Unavailable));
+    QCOMPARE(spy.size(), 6);
+    QCOMPARE(spy.last().at(0).toString(), QStringLiteral("romeo@example.net"));
+    QVERIFY(manager->getResources("romeo@example.net").isEmpty());
+
+    // other changes than the status text are detected
+    QXmppPresence presence = createPresence("juliet@example.com/chamber", QXmppPresence::Available);
+    presence.setPriority(5);
+    emit client.presenceReceived(presence);
+    QCOMPARE(spy.size(), 7);
+    emit client.presenceReceived(presence);
+    QCOMPARE(spy.size(), 7);
+    presence.setAvailableStatusType(QXmppPresence::DND);
+    emit client.presenceReceived(presence);
+    QCOMPARE(spy.size(), 8);
+    QCOMPARE(manager->getPresence("juliet@example.com", "chamber").availableStatusType(), QXmppPresence::DND);
+
+    QMetaObject::invokeMethod(manager, "_q_disconnected");
+    QVERIFY(manager->getResources("juliet@example.com").isEmpty());
+}
+
+void tst_QXmppRosterManager::testPresenceBatching()
+{
+    QSignalSpy singleSpy(manager, &QXmppRosterManager::presenceChanged);
+    QSignalSpy batchSpy(manager, &QXmppRosterManager::presencesChanged);
+
+    QCOMPARE(manager->presenceBatchInterval(), -1);
+    manager->setPresenceBatchInterval(0);
+
+    emit client.presenceReceived(createPresence("romeo@example.net/orchard", QXmppPresence::Available));
+    emit client.presenceReceived(createPresence("romeo@example.net/garden", QXmppPresence::Available));
+    emit client.presenceReceived(createPresence("benvolio@example.net/street", QXmppPresence::Available));
+    emit client.presenceReceived(createPresence("romeo@example.net/orchard", QXmppPresence::Unavailable));
+    QCOMPARE(batchSpy.size(), 0);
+
+    // the changes are reported once the event loop is reached
+    QVERIFY(batchSpy.wait());
+    QCOMPARE(batchSpy.size(), 1);
+    QCOMPARE(singleSpy.size(), 0);
+
+    const auto changes = batchSpy.first().first().value<QHash<QString, QSet<QString>>>();
+    QCOMPARE(changes.size(), 2);
+    QCOMPARE(changes.value("romeo@example.net"), QSet<QString>({ "orchard", "garden" }));
+    QCOMPARE(changes.value("benvolio@example.net"), QSet<QString>({ "street" }));
+    QCOMPARE(manager->getResources("romeo@example.net"), QStringList { "garden" });
+
+    // disabling batching reports pending changes
+    emit client.presenceReceived(createPresence("benvolio@example.net/street", QXmppPresence::Unavailable));
+    manager->setPresenceBatchInterval(-1);
+    QCOMPARE(batchSpy.size(), 2);
+
+    emit client.presenceReceived(createPresence("benvolio@example.net/street", QXmppPresence::Available));
+    QCOMPARE(singleSpy.size(), 1);
+    QCOMPARE(batchSpy.size(), 2);
+
+    QMetaObject::invokeMethod(manager, "_q_disconnected");
+}
+
+void tst_QXmppRosterManager::testVersioningBind2_data()
+{
+    QTest::addColumn<QString>("advertisement");
+    QTest::addColumn<bool>("versioned");
+
+    QTest::newRow("none") << QString() << false;
+    QTest::newRow("stream feature") << QStringLiteral("ver") << true;
+    QTest::newRow("bind2 inline feature") << QStringLiteral("bind2") << true;
+}
+
+void tst_QXmppRosterManager::testVersioningBind2()
+{
+    QFETCH(QString, advertisement);
+    QFETCH(bool, versioned);
+
+    TestPasswordChecker passwordChecker;
+    passwordChecker.addCredentials("testuser", "testpwd");
+
+    QXmppServer server;
+    server.setDomain("localhost");
+    server.setPasswordChecker(&passwordChecker);
+    QVERIFY(server.listenForClients(QHostAddress::LocalHost, 12345));
+
+    QXmppLogger clientLogger;
+    clientLogger.setLoggingType(QXmppLogger::SignalLogging);
+
+    QXmppClient client;
+    client.setLogger(&clientLogger);
+    client.insertExtension(0, new RosterVersionAdvertiser(advertisement));
+
+    bool bind2 = false;
+    QString rosterRequest;
+    connect(&clientLogger, &QXmppLogger::message, this, [&](QXmppLogger::MessageType type, const QString &text) {
+        if (type != QXmppLogger::SentMessage)
+            return;
+        if (text.contains(QStringLiteral("urn:xmpp:bind:0")))
+            bind2 = true;
+        if (text.contains(QStringLiteral("jabber:iq:roster")))
+            rosterRequest = text;
+    });
+
+    // the stream is not restarted after authentication
+    QXmppConfiguration config;
+    config.setDomain("localhost");
+    config.setHost(QHostAddress(QHostAddress::LocalHost).toString());
+    config.setPort(12345);
+    config.setUser("testuser");
+    config.setPassword("testpwd");
+    config.setUseSASL2Authentication(true);
+    client.connectToServer(config);
+
+    QTRY_VERIFY_WITH_TIMEOUT(!rosterRequest.isEmpty(), 10000);
+    QVERIFY(bind2);
+    QCOMPARE(rosterRequest.contains(QStringLiteral(" ver=\"")), versioned);
+
+    client.disconnectFromServer();
+}
+
 QTEST_MAIN(tst_QXmppRosterManager)
 #include "tst_qxmpprostermanager.moc"
@@ -40,6 +40,9 @@ private slots:
     void testResponse_data();
     void testResponse();
     void testSuccess();
+    void testSasl2Authenticate();
+    void testSasl2Failure();
+    void testSasl2Success();
 
     // client
     void testClientAvailableMechanisms();
@@ -188,6 +191,107 @@ void tst_QXmppSasl::testSuccess()
     serializePacket(stanza, xml);
 }
 
+void tst_QXmppSasl::testSasl2Authenticate()
+{
+    const QByteArray xml(
+        "<authenticate xmlns=\"urn:xmpp:sasl:2\" mechanism=\"PLAIN\">"
+        "<initial-response>AGZvbwBiYXI=</initial-response>"
+        "<bind xmlns=\"urn:xmpp:bind:0\">"
+        "<tag>QXmpp</tag>"
+        "<enable xmlns=\"urn:xmpp:sm:3\" resume=\"true\"/>"
+        "<enable xmlns=\"urn:xmpp:carbons:2\"/>"
+        "</bind>"
+        "</authenticate>");
+
+    QXmppSasl2Authenticate authenticate;
+    parsePacket(authenticate, xml);
+    QVERIFY(QXmppSasl2Authenticate::isSasl2Authenticate(writePacketToDom(authenticate)));
+    QCOMPARE(authenticate.mechanism(), QStringLiteral("PLAIN"));
+    QCOMPARE(authenticate.initialResponse(), QByteArray("\0foo\0bar", 8));
+    QVERIFY(authenticate.bindRequested());
+    QCOMPARE(authenticate.bindTag(), QStringLiteral("QXmpp"));
+    QCOMPARE(authenticate.bindFeatures(), QStringList() << "urn:xmpp:sm:3"
+                                                        << "urn:xmpp:carbons:2");
+    QVERIFY(!authenticate.resumeRequested());
+    serializePacket(authenticate, xml);
+
+    // resumption
+    const QByteArray resumeXml(
+        "<authenticate xmlns=\"urn:xmpp:sasl:2\" mechanism=\"PLAIN\">"
+        "<resume xmlns=\"urn:xmpp:sm:3\" h=\"3\" previd=\"some-id\"/>"
+        "</authenticate>");
+
+    QXmppSasl2Authenticate resume;
+    parsePacket(resume, resumeXml);
+    QVERIFY(!resume.bindRequested());
+    QVERIFY(resume.resumeRequested());
+    QCOMPARE(resume.resume().h(), 3u);
+    QCOMPARE(resume.resume().prevId(), QStringLiteral("some-id"));
+    serializePacket(resume, resumeXml);
+}
+
+void tst_QXmppSasl::testSasl2Failure()
+{
+    const QByteArray xml(
+        "<failure xmlns=\"urn:xmpp:sasl:2\">"
+        "<not-authorized xmlns=\"urn:ietf:params:xml:ns:xmpp-sasl\"/>"
+        "<text>Wrong password</text>"
+        "</failure>");
+
+    QXmppSasl2Failure failure;
+    parsePacket(failure, xml);
+    QCOMPARE(failure.condition(), QStringLiteral("not-authorized"));
+    QCOMPARE(failure.text(), QStringLiteral("Wrong password"));
+    serializePacket(failure, xml);
+}
+
+void tst_QXmppSasl::testSasl2Success()
+{
+    const QByteArray xml(
+        "<success xmlns=\"urn:xmpp:sasl:2\">"
+        "<authorization-identifier>user@example.org/QXmpp.abcd</authorization-identifier>"
+        "<bound xmlns=\"urn:xmpp:bind:0\">"
+        "<enabled xmlns=\"urn:xmpp:sm:3\" id=\"some-id\" resume=\"true\"/>"
+        "</bound>"
+        "</success>");
+
+    QXmppSasl2Success success;
+    parsePacket(success, xml);
+    QCOMPARE(success.authorizationIdentifier(), QStringLiteral("user@example.org/QXmpp.abcd"));
+    QVERIFY(success.isBound());
+    QVERIFY(!success.isResumed());
+    QVERIFY(success.isStreamManagementEnabled());
+    QCOMPARE(success.streamManagementEnabled().id(), QStringLiteral("some-id"));
+    QVERIFY(success.streamManagementEnabled().resume());
+    serializePacket(success, xml);
+
+    const QByteArray resumedXml(
+        "<success xmlns=\"urn:xmpp:sasl:2\">"
+        "<authorization-identifier>user@example.org/QXmpp.abcd</authorization-identifier>"
+        "<resumed xmlns=\"urn:xmpp:sm:3\" h=\"5\" previd=\"some-id\"/>"
+        "</success>");
+
+    QXmppSasl2Success resumed;
+    parsePacket(resumed, resumedXml);
+    QVERIFY(!resumed.isBound());
+    QVERIFY(resumed.isResumed());
+    QCOMPARE(resumed.resumed().h(), 5u);
+    QVERIFY(!resumed.isResumeFailed());
+    serializePacket(resumed, resumedXml);
+
+    const QByteArray failedXml(
+        "<success xmlns=\"urn:xmpp:sasl:2\">"
+        "<authorization-identifier>user@example.org/QXmpp.abcd</authorization-identifier>"
+        "<failed xmlns=\"urn:xmpp:sm:3\"><item-not-found xmlns=\"urn:ietf:params:xml:ns:xmpp-stanzas\"/></failed>"
+        "</success>");
+
+    QXmppSasl2Success failed;
+    parsePacket(failed, failedXml);
+    QVERIFY(!failed.isBound());
+    QVERIFY(!failed.isResumed());
+    QVERIFY(failed.isResumeFailed());
+}
+
 void tst_QXmppSasl::testClientAvailableMechanisms()
 {
     QCOMPARE(QXmppSaslClient::availableMechanisms(), QStringList() << "SCRAM-SHA-256"
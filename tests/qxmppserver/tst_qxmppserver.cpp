@@ -33,6 +33,8 @@ class tst_QXmppServer : public QObject
 private slots:
     void testConnect_data();
     void testConnect();
+    void testDirectTls();
+    void testDirectTlsWithoutCertificate();
 };
 
 void tst_QXmppServer::testConnect_data()
@@ -40,27 +42,32 @@ void tst_QXmppServer::testConnect_data()
     QTest::addColumn<QString>("username");
     QTest::addColumn<QString>("password");
     QTest::addColumn<QString>("mechanism");
+    QTest::addColumn<bool>("sasl2");
     QTest::addColumn<bool>("connected");
 
-    QTest::newRow("plain-good") << "testuser"
-                                << "testpwd"
-                                << "PLAIN" << true;
-    QTest::newRow("plain-bad-username") << "baduser"
-                                        << "testpwd"
-                                        << "PLAIN" << false;
-    QTest::newRow("plain-bad-password") << "testuser"
-                                        << "badpwd"
-                                        << "PLAIN" << false;
-
-    QTest::newRow("digest-good") << "testuser"
-                                 << "testpwd"
-                                 << "DIGEST-MD5" << true;
-    QTest::newRow("digest-bad-username") << "baduser"
-                                         << "testpwd"
-                                         << "DIGEST-MD5" << false;
-    QTest::newRow("digest-bad-password") << "testuser"
-                                         << "badpwd"
-                                         << "DIGEST-MD5" << false;
+    for (bool sasl2 : { false, true }) {
+        const QByteArray suffix = sasl2 ? "-sasl2" : "";
+
+        QTest::newRow("plain-good" + suffix) << "testuser"
+                                             << "testpwd"
+                                             << "PLAIN" << sasl2 << true;
+        QTest::newRow("plain-bad-username" + suffix) << "baduser"
+                                                     << "testpwd"
+                                                     << "PLAIN" << sasl2 << false;
+        QTest::newRow("plain-bad-password" + suffix) << "testuser"
+                                                     << "badpwd"
+                                                     << "PLAIN" << sasl2 << false;
+
+        QTest::newRow("digest-good" + suffix) << "testuser"
+                                              << "testpwd"
+                                              << "DIGEST-MD5" << sasl2 << true;
+        QTest::newRow("digest-bad-username" + suffix) << "baduser"
+                                                      << "testpwd"
+                                                      << "DIGEST-MD5" << sasl2 << false;
+        QTest::newRow("digest-bad-password" + suffix) << "testuser"
+                                                      << "badpwd"
+                                                      << "DIGEST-MD5" << sasl2 << false;
+    }
 }
 
 void tst_QXmppServer::testConnect()
@@ -68,6 +75,7 @@ void tst_QXmppServer::testConnect()
     QFETCH(QString, username);
     QFETCH(QString, password);
     QFETCH(QString, mechanism);
+    QFETCH(bool, sasl2);
     QFETCH(bool, connected);
 
     const QString testDomain("localhost");
@@ -104,10 +112,57 @@ void tst_QXmppServer::testConnect()
     config.setUser(username);
     config.setPassword(password);
     config.setSaslAuthMechanism(mechanism);
+    config.setUseSASL2Authentication(sasl2);
     client.connectToServer(config);
     loop.exec();
     QCOMPARE(client.isConnected(), connected);
 }
 
+void tst_QXmppServer::testDirectTls()
+{
+    TestPasswordChecker passwordChecker;
+    passwordChecker.addCredentials("testuser", "testpwd");
+
+    QXmppServer server;
+    server.setDomain("localhost");
+    server.setPasswordChecker(&passwordChecker);
+    server.setLocalCertificate(testCertificate());
+    server.setPrivateKey(testPrivateKey());
+    QVERIFY(server.listenForDirectTlsClients(QHostAddress::LocalHost, 12346));
+
+    QSignalSpy connectedSpy(&server, &QXmppServer::clientConnected);
+
+    // the TLS handshake comes first, without STARTTLS
+    QXmppClient client;
+    QEventLoop loop;
+    connect(&client, &QXmppClient::connected, &loop, &QEventLoop::quit);
+    connect(&client, &QXmppClient::disconnected, &loop, &QEventLoop::quit);
+    QTimer::singleShot(10000, &loop, &QEventLoop::quit);
+
+    QXmppConfiguration config;
+    config.setDomain("localhost");
+    config.setHost(QHostAddress(QHostAddress::LocalHost).toString());
+    config.setPort(12346);
+    config.setUser("testuser");
+    config.setPassword("testpwd");
+    config.setStreamSecurityMode(QXmppConfiguration::LegacySSL);
+    config.setIgnoreSslErrors(true);
+    client.connectToServer(config);
+    loop.exec();
+
+    QVERIFY(client.isConnected());
+    QCOMPARE(connectedSpy.size(), 1);
+    QCOMPARE(connectedSpy.first().at(0).toString(), QStringLiteral("testuser@localhost/QXmpp"));
+}
+
+void tst_QXmppServer::testDirectTlsWithoutCertificate()
+{
+    QXmppServer server;
+    server.setDomain("localhost");
+
+    // Direct TLS is not possible without a certificate and a private key
+    QVERIFY(!server.listenForDirectTlsClients(QHostAddress::LocalHost, 12346));
+}
+
 QTEST_MAIN(tst_QXmppServer)
 #include "tst_qxmppserver.moc"
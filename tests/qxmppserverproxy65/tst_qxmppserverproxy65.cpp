@@ -0,0 +1,243 @@
+/*
+ * Copyright (C) 2008-2020 The QXmpp developers
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "QXmppClient.h"
+#include "QXmppDiscoveryIq.h"
+#include "QXmppDiscoveryManager.h"
+#include "QXmppServer.h"
+#include "QXmppServerProxy65.h"
+#include "QXmppTransferManager.h"
+
+#include "util.h"
+#include <QBuffer>
+#include <QObject>
+#include <QTemporaryFile>
+
+class tst_QXmppServerProxy65 : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void init();
+    void cleanup();
+
+    void testDiscovery();
+    void testRelay_data();
+    void testRelay();
+
+    void acceptFile(QXmppTransferJob *job);
+
+private:
+    void connectClient(QXmppClient *client, const QString &user);
+
+    TestPasswordChecker passwordChecker;
+    QXmppServer *server;
+    QXmppServerProxy65 *proxy;
+
+    QBuffer receiverBuffer;
+    QXmppTransferJob *receiverJob;
+};
+
+void tst_QXmppServerProxy65::init()
+{
+    passwordChecker.addCredentials("sender", "testpwd");
+    passwordChecker.addCredentials("receiver", "testpwd");
+
+    proxy = new QXmppServerProxy65;
+    proxy->setHost(QHostAddress(QHostAddress::LocalHost).toString());
+    proxy->setPort(0);
+
+    server = new QXmppServer;
+    server->setDomain("localhost");
+    server->setPasswordChecker(&passwordChecker);
+    server->addExtension(proxy);
+    QVERIFY(server->listenForClients(QHostAddress::LocalHost, 12345));
+
+    receiverBuffer.close();
+    receiverBuffer.setData(QByteArray());
+    receiverJob = nullptr;
+}
+
+void tst_QXmppServerProxy65::cleanup()
+{
+    delete server;
+}
+
+void tst_QXmppServerProxy65::acceptFile(QXmppTransferJob *job)
+{
+    receiverJob = job;
+    receiverBuffer.open(QIODevice::WriteOnly);
+    job->accept(&receiverBuffer);
+}
+
+void tst_QXmppServerProxy65::connectClient(QXmppClient *client, const QString &user)
+{
+    QXmppConfiguration config;
+    config.setDomain("localhost");
+    config.setHost(QHostAddress(QHostAddress::LocalHost).toString());
+    config.setPort(12345);
+    config.setUser(user);
+    config.setPassword("testpwd");
+
+    QEventLoop loop;
+    connect(client, &QXmppClient::connected, &loop, &QEventLoop::quit);
+    connect(client, &QXmppClient::disconnected, &loop, &QEventLoop::quit);
+    client->connectToServer(config);
+    loop.exec();
+}
+
+void tst_QXmppServerProxy65::testDiscovery()
+{
+    QCOMPARE(proxy->jid(), QStringLiteral("proxy.localhost"));
+    QVERIFY(proxy->port() != 0);
+
+    QXmppClient client;
+    connectClient(&client, "sender");
+    QVERIFY(client.isConnected());
+
+    auto *discoveryManager = client.findExtension<QXmppDiscoveryManager>();
+    QVERIFY(discoveryManager);
+
+    QEventLoop loop;
+    QXmppDiscoveryIq info;
+    connect(discoveryManager, &QXmppDiscoveryManager::infoReceived, &loop, [&](const QXmppDiscoveryIq &iq) {
+        info = iq;
+        loop.quit();
+    });
+    discoveryManager->requestInfo("proxy.localhost");
+    loop.exec();
+
+    QCOMPARE(info.type(), QXmppIq::Result);
+    QCOMPARE(info.from(), QStringLiteral("proxy.localhost"));
+    QCOMPARE(info.identities().size(), 1);
+    QCOMPARE(info.identities().first().category(), QStringLiteral("proxy"));
+    QCOMPARE(info.identities().first().type(), QStringLiteral("bytestreams"));
+    QVERIFY(info.features().contains("http://jabber.org/protocol/bytestreams"));
+}
+
+void tst_QXmppServerProxy65::testRelay_data()
+{
+    QTest::addColumn<bool>("splice");
+    QTest::addColumn<qint64>("rateLimit");
+
+    QTest::newRow("splice") << true << qint64(0);
+    QTest::newRow("copy") << false << qint64(0);
+    QTest::newRow("splice, rate limited") << true << qint64(512 * 1024);
+    QTest::newRow("copy, rate limited") << false << qint64(512 * 1024);
+}
+
+void tst_QXmppServerProxy65::testRelay()
+{
+    QFETCH(bool, splice);
+    QFETCH(qint64, rateLimit);
+
+    proxy->setSpliceEnabled(splice);
+    proxy->setRateLimit(rateLimit);
+
+    // prepare a file which takes about a second at the rate limit
+    QTemporaryFile file;
+    QVERIFY(file.open());
+    QByteArray expectedData;
+    for (int i = 0; i < 1024; ++i)
+        expectedData += QByteArray(1024, char('a' + i % 26));
+    QCOMPARE(file.write(expectedData), qint64(expectedData.size()));
+    file.close();
+
+    // the sender may only use the proxy
+    QXmppClient sender;
+    auto *senderManager = new QXmppTransferManager;
+    senderManager->setSupportedMethods(QXmppTransferJob::SocksMethod);
+    senderManager->setProxy(proxy->jid());
+    senderManager->setProxyOnly(true);
+    sender.addExtension(senderManager);
+    connectClient(&sender, "sender");
+    QVERIFY(sender.isConnected());
+
+    QXmppClient receiver;
+    auto *receiverManager = new QXmppTransferManager;
+    receiverManager->setSupportedMethods(QXmppTransferJob::SocksMethod);
+    connect(receiverManager, &QXmppTransferManager::fileReceived,
+            this, &tst_QXmppServerProxy65::acceptFile);
+    receiver.addExtension(receiverManager);
+    connectClient(&receiver, "receiver");
+    QVERIFY(receiver.isConnected());
+
+    QSignalSpy startedSpy(proxy, &QXmppServerProxy65::sessionStarted);
+
+    // the relay of the session is created when it starts, the connection
+    // ends with this test
+    QObject context;
+    QVariant spliced;
+    connect(proxy, &QXmppServerProxy65::sessionStarted, &context, [&]() {
+        const auto children = proxy->children();
+        for (auto *child : children) {
+            if (child->inherits("QXmppProxy65Relay"))
+                spliced = child->property("spliced");
+        }
+    });
+    QSignalSpy finishedSpy(proxy, &QXmppServerProxy65::sessionFinished);
+    const qint64 relayedBefore = proxy->relayedBytes();
+
+    // send file
+    QElapsedTimer timer;
+    timer.start();
+
+    QEventLoop loop;
+    QXmppTransferJob *senderJob = senderManager->sendFile("receiver@localhost/QXmpp", file.fileName());
+    QVERIFY(senderJob);
+    connect(senderJob, &QXmppTransferJob::finished, &loop, &QEventLoop::quit);
+    loop.exec();
+    QCOMPARE(senderJob->error(), QXmppTransferJob::NoError);
+
+    QVERIFY(receiverJob);
+    if (receiverJob->state() != QXmppTransferJob::FinishedState) {
+        connect(receiverJob, &QXmppTransferJob::finished, &loop, &QEventLoop::quit);
+        loop.exec();
+    }
+    QCOMPARE(receiverJob->error(), QXmppTransferJob::NoError);
+    QCOMPARE(receiverJob->method(), QXmppTransferJob::SocksMethod);
+    QCOMPARE(receiverBuffer.data(), expectedData);
+
+    // the first second is covered by the burst allowance
+    if (rateLimit)
+        QVERIFY(timer.elapsed() >= 900);
+
+    // check the proxy's session, data is only spliced on Linux
+    QCOMPARE(startedSpy.size(), 1);
+#ifdef Q_OS_LINUX
+    QCOMPARE(spliced, QVariant(splice));
+#else
+    QCOMPARE(spliced, QVariant(false));
+#endif
+    QCOMPARE(startedSpy.first().at(0).toString(), senderJob->sid());
+    QCOMPARE(startedSpy.first().at(1).toString(), QStringLiteral("sender@localhost/QXmpp"));
+    QCOMPARE(startedSpy.first().at(2).toString(), QStringLiteral("receiver@localhost/QXmpp"));
+
+    if (finishedSpy.isEmpty())
+        QVERIFY(finishedSpy.wait());
+    QCOMPARE(finishedSpy.first().at(0).toString(), senderJob->sid());
+    QCOMPARE(finishedSpy.first().at(1).value<qint64>(), qint64(expectedData.size()));
+    QCOMPARE(finishedSpy.first().at(2).value<qint64>(), qint64(0));
+    QCOMPARE(proxy->relayedBytes() - relayedBefore, qint64(expectedData.size()));
+    QCOMPARE(proxy->sessionCount(), 0);
+}
+
+QTEST_MAIN(tst_QXmppServerProxy65)
+#include "tst_qxmppserverproxy65.moc"
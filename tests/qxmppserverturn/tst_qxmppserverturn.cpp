@@ -0,0 +1,389 @@
+/*
+ * Copyright (C) 2008-2020 The QXmpp developers
+ *
+ * Source:
+ *  https://github.com/qxmpp-project/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "QXmppServer.h"
+#include "QXmppServerTurn.h"
+#include "QXmppStun_p.h"
+#include "QXmppUtils.h"
+
+#include "util.h"
+#include <QCryptographicHash>
+#include <QObject>
+#include <QThread>
+#include <QUdpSocket>
+
+// A password checker which records the digest lookups, and which fails
+// temporarily for the unavailable users.
+class LookupPasswordChecker : public TestPasswordChecker
+{
+public:
+    QXmppPasswordReply::Error getPassword(const QXmppPasswordRequest &request, QString &password) override
+    {
+        if (unavailableUsers.contains(request.username()))
+            return QXmppPasswordReply::TemporaryError;
+        return TestPasswordChecker::getPassword(request, password);
+    }
+
+    QXmppPasswordReply *getDigest(const QXmppPasswordRequest &request) override
+    {
+        lookups << request.username();
+        threads << QThread::currentThread();
+        return TestPasswordChecker::getDigest(request);
+    }
+
+    QStringList lookups;
+    QList<QThread *> threads;
+    QStringList unavailableUsers;
+};
+
+class tst_QXmppServerTurn : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void init();
+    void cleanup();
+
+    void testBinding();
+    void testAllocate_data();
+    void testAllocate();
+    void testAuthentication();
+    void testQuota();
+    void testLookupThread_data();
+    void testLookupThread();
+    void testLookupLimits();
+    void testLookupFailure();
+
+private:
+    void connectAllocation(QXmppTurnAllocation *allocation, const QString &user, const QString &password);
+
+    LookupPasswordChecker passwordChecker;
+    QXmppServer *server;
+    QXmppServerTurn *turn;
+};
+
+void tst_QXmppServerTurn::init()
+{
+    passwordChecker.addCredentials("alice", "testpwd");
+    passwordChecker.lookups.clear();
+    passwordChecker.threads.clear();
+    passwordChecker.unavailableUsers.clear();
+
+    turn = new QXmppServerTurn;
+    turn->setHost(QHostAddress::LocalHost);
+    turn->setPort(0);
+
+    server = new QXmppServer;
+    server->setDomain("localhost");
+    server->setPasswordChecker(&passwordChecker);
+    server->addExtension(turn);
+}
+
+void tst_QXmppServerTurn::cleanup()
+{
+    delete server;
+}
+
+void tst_QXmppServerTurn::connectAllocation(QXmppTurnAllocation *allocation, const QString &user, const QString &password)
+{
+    allocation->setServer(QHostAddress::LocalHost, turn->port());
+    allocation->setUser(user);
+    allocation->setPassword(password);
+
+    QEventLoop loop;
+    connect(allocation, &QXmppTurnAllocation::connected, &loop, &QEventLoop::quit);
+    connect(allocation, &QXmppTurnAllocation::disconnected, &loop, &QEventLoop::quit);
+    allocation->connectToHost();
+    loop.exec();
+}
+
+void tst_QXmppServerTurn::testBinding()
+{
+    QVERIFY(server->listenForClients(QHostAddress::LocalHost, 12345));
+    QVERIFY(turn->port() != 0);
+
+    QUdpSocket socket;
+    QVERIFY(socket.bind(QHostAddress::LocalHost, 0));
+
+    QXmppStunMessage request;
+    request.setType(QXmppStunMessage::Binding | QXmppStunMessage::Request);
+    request.setId(QXmppUtils::generateRandomBytes(12));
+    socket.writeDatagram(request.encode(), QHostAddress::LocalHost, turn->port());
+
+    // the server runs in this thread
+    QTRY_VERIFY(socket.hasPendingDatagrams());
+    QByteArray buffer(socket.pendingDatagramSize(), '\0');
+    socket.readDatagram(buffer.data(), buffer.size());
+
+    QXmppStunMessage response;
+    QVERIFY(response.decode(buffer));
+    QCOMPARE(response.messageClass(), quint16(QXmppStunMessage::Response));
+    QCOMPARE(response.id(), request.id());
+    QCOMPARE(response.xorMappedHost, QHostAddress(QHostAddress::LocalHost));
+    QCOMPARE(response.xorMappedPort, socket.localPort());
+}
+
+void tst_QXmppServerTurn::testAllocate_data()
+{
+    QTest::addColumn<int>("threadCount");
+
+    QTest::newRow("single thread") << 1;
+#ifdef Q_OS_LINUX
+    QTest::newRow("four threads") << 4;
+#endif
+}
+
+void tst_QXmppServerTurn::testAllocate()
+{
+    QFETCH(int, threadCount);
+
+    turn->setThreadCount(threadCount);
+    QVERIFY(server->listenForClients(QHostAddress::LocalHost, 12345));
+
+    QSignalSpy finishedSpy(turn, &QXmppServerTurn::allocationFinished);
+
+    QXmppTurnAllocation allocation;
+    connectAllocation(&allocation, "alice", "testpwd");
+    QCOMPARE(allocation.state(), QXmppTurnAllocation::ConnectedState);
+    QCOMPARE(allocation.relayedHost(), QHostAddress(QHostAddress::LocalHost));
+    QTRY_COMPARE(turn->allocationCount(), 1);
+
+    QUdpSocket peer;
+    QVERIFY(peer.bind(QHostAddress::LocalHost, 0));
+    QList<QByteArray> peerDatagrams;
+    qint64 peerBytes = 0;
+    connect(&peer, &QUdpSocket::readyRead, this, [&]() {
+        while (peer.hasPendingDatagrams()) {
+            QByteArray datagram(peer.pendingDatagramSize(), '\0');
+            QHostAddress host;
+            quint16 port;
+            peer.readDatagram(datagram.data(), datagram.size(), &host, &port);
+            QCOMPARE(host, allocation.relayedHost());
+            QCOMPARE(port, allocation.relayedPort());
+            peerDatagrams << datagram;
+            peerBytes += datagram.size();
+        }
+    });
+
+    // the first datagrams may be sent before the channel is bound
+    for (int i = 0; i < 20 && peerDatagrams.isEmpty(); ++i) {
+        allocation.writeDatagram("hello", QHostAddress::LocalHost, peer.localPort());
+        QTest::qWait(50);
+    }
+    QVERIFY(!peerDatagrams.isEmpty());
+    QCOMPARE(peerDatagrams.first(), QByteArray("hello"));
+
+    // peer to client
+    QSignalSpy receivedSpy(&allocation, &QXmppTurnAllocation::datagramReceived);
+    peer.writeDatagram("world", allocation.relayedHost(), allocation.relayedPort());
+    QVERIFY(receivedSpy.wait());
+    QCOMPARE(receivedSpy.first().at(0).toByteArray(), QByteArray("world"));
+    QCOMPARE(receivedSpy.first().at(1).value<QHostAddress>(), QHostAddress(QHostAddress::LocalHost));
+    QCOMPARE(receivedSpy.first().at(2).value<quint16>(), peer.localPort());
+
+    // bursts in both directions
+    QList<QByteArray> burst;
+    for (int i = 0; i < 20; ++i)
+        burst << QByteArray(1000, char('a' + i));
+
+    peerDatagrams.clear();
+    allocation.writeDatagrams(burst, QHostAddress::LocalHost, peer.localPort());
+    QTRY_COMPARE(peerDatagrams, burst);
+
+    receivedSpy.clear();
+    for (const auto &datagram : burst)
+        peer.writeDatagram(datagram, allocation.relayedHost(), allocation.relayedPort());
+    QTRY_COMPARE(receivedSpy.size(), burst.size());
+    for (int i = 0; i < burst.size(); ++i)
+        QCOMPARE(receivedSpy.at(i).at(0).toByteArray(), burst.at(i));
+
+    QTRY_COMPARE(turn->relayedBytes(), peerBytes + 5 + 20 * 1000);
+
+    // release the allocation
+    QEventLoop loop;
+    connect(&allocation, &QXmppTurnAllocation::disconnected, &loop, &QEventLoop::quit);
+    allocation.disconnectFromHost();
+    loop.exec();
+
+    QTRY_COMPARE(turn->allocationCount(), 0);
+    QTRY_COMPARE(finishedSpy.size(), 1);
+    QCOMPARE(finishedSpy.first().at(0).toString(), QStringLiteral("alice"));
+    QCOMPARE(finishedSpy.first().at(1).value<qint64>(), peerBytes);
+    QCOMPARE(finishedSpy.first().at(2).value<qint64>(), qint64(5 + 20 * 1000));
+}
+
+void tst_QXmppServerTurn::testAuthentication()
+{
+    QVERIFY(server->listenForClients(QHostAddress::LocalHost, 12345));
+
+    // wrong password
+    QXmppTurnAllocation allocation;
+    connectAllocation(&allocation, "alice", "badpwd");
+    QCOMPARE(allocation.state(), QXmppTurnAllocation::UnconnectedState);
+
+    // unknown user
+    QXmppTurnAllocation other;
+    connectAllocation(&other, "bob", "testpwd");
+    QCOMPARE(other.state(), QXmppTurnAllocation::UnconnectedState);
+
+    QCOMPARE(turn->allocationCount(), 0);
+}
+
+void tst_QXmppServerTurn::testQuota()
+{
+    turn->setUserAllocationLimit(1);
+    QVERIFY(server->listenForClients(QHostAddress::LocalHost, 12345));
+
+    QXmppTurnAllocation first;
+    connectAllocation(&first, "alice", "testpwd");
+    QCOMPARE(first.state(), QXmppTurnAllocation::ConnectedState);
+
+    QXmppTurnAllocation second;
+    connectAllocation(&second, "alice", "testpwd");
+    QCOMPARE(second.state(), QXmppTurnAllocation::UnconnectedState);
+    QCOMPARE(turn->allocationCount(), 1);
+}
+
+void tst_QXmppServerTurn::testLookupThread_data()
+{
+    testAllocate_data();
+}
+
+void tst_QXmppServerTurn::testLookupThread()
+{
+    QFETCH(int, threadCount);
+
+    turn->setThreadCount(threadCount);
+    QVERIFY(server->listenForClients(QHostAddress::LocalHost, 12345));
+
+    // the password checker is only called from the thread of the extension
+    QXmppTurnAllocation allocation;
+    connectAllocation(&allocation, "alice", "testpwd");
+    QCOMPARE(allocation.state(), QXmppTurnAllocation::ConnectedState);
+    QCOMPARE(passwordChecker.lookups, QStringList { "alice" });
+    QCOMPARE(passwordChecker.threads, QList<QThread *> { turn->thread() });
+}
+
+void tst_QXmppServerTurn::testLookupLimits()
+{
+    QVERIFY(server->listenForClients(QHostAddress::LocalHost, 12345));
+
+    QUdpSocket socket;
+    QVERIFY(socket.bind(QHostAddress::LocalHost, 0));
+    QList<QXmppStunMessage> responses;
+    connect(&socket, &QUdpSocket::readyRead, this, [&]() {
+        while (socket.hasPendingDatagrams()) {
+            QByteArray buffer(socket.pendingDatagramSize(), '\0');
+            socket.readDatagram(buffer.data(), buffer.size());
+            QXmppStunMessage response;
+            QVERIFY(response.decode(buffer));
+            responses << response;
+        }
+    });
+
+    // learn the realm and nonce
+    QXmppStunMessage request;
+    request.setType(QXmppStunMessage::Allocate | QXmppStunMessage::Request);
+    request.setId(QXmppUtils::generateRandomBytes(12));
+    request.setRequestedTransport(0x11);
+    socket.writeDatagram(request.encode(), QHostAddress::LocalHost, turn->port());
+    QTRY_COMPARE(responses.size(), 1);
+    const QXmppStunMessage challenge = responses.takeFirst();
+    QCOMPARE(challenge.errorCode, 401);
+
+    QList<QByteArray> datagrams;
+    for (int i = 0; i < 8; ++i) {
+        const QString username = QStringLiteral("user%1").arg(i);
+        request.setId(QXmppUtils::generateRandomBytes(12));
+        request.setUsername(username);
+        request.setRealm(challenge.realm());
+        request.setNonce(challenge.nonce());
+        const QByteArray key = QCryptographicHash::hash((username + ":" + challenge.realm() + ":testpwd").toUtf8(), QCryptographicHash::Md5);
+        datagrams << request.encode(key);
+    }
+
+    // a burst of lookups is allowed, the requests over the limit are dropped
+    for (const auto &datagram : datagrams)
+        socket.writeDatagram(datagram, QHostAddress::LocalHost, turn->port());
+    QTRY_COMPARE(responses.size(), 5);
+    QTest::qWait(200);
+    QCOMPARE(responses.size(), 5);
+    for (const auto &response : responses)
+        QCOMPARE(response.errorCode, 401);
+    QCOMPARE(passwordChecker.lookups.size(), 5);
+
+    // unknown users are rejected without a lookup, despite the limit
+    responses.clear();
+    socket.writeDatagram(datagrams.first(), QHostAddress::LocalHost, turn->port());
+    QTRY_COMPARE(responses.size(), 1);
+    QCOMPARE(responses.first().errorCode, 401);
+    QCOMPARE(passwordChecker.lookups.size(), 5);
+}
+
+void tst_QXmppServerTurn::testLookupFailure()
+{
+    passwordChecker.addCredentials("bob", "testpwd");
+    passwordChecker.unavailableUsers << "bob";
+    QVERIFY(server->listenForClients(QHostAddress::LocalHost, 12345));
+
+    QUdpSocket socket;
+    QVERIFY(socket.bind(QHostAddress::LocalHost, 0));
+    QList<QXmppStunMessage> responses;
+    connect(&socket, &QUdpSocket::readyRead, this, [&]() {
+        while (socket.hasPendingDatagrams()) {
+            QByteArray buffer(socket.pendingDatagramSize(), '\0');
+            socket.readDatagram(buffer.data(), buffer.size());
+            QXmppStunMessage response;
+            QVERIFY(response.decode(buffer));
+            responses << response;
+        }
+    });
+
+    // learn the realm and nonce
+    QXmppStunMessage request;
+    request.setType(QXmppStunMessage::Allocate | QXmppStunMessage::Request);
+    request.setId(QXmppUtils::generateRandomBytes(12));
+    request.setRequestedTransport(0x11);
+    socket.writeDatagram(request.encode(), QHostAddress::LocalHost, turn->port());
+    QTRY_COMPARE(responses.size(), 1);
+    const QXmppStunMessage challenge = responses.takeFirst();
+
+    request.setUsername("bob");
+    request.setRealm(challenge.realm());
+    request.setNonce(challenge.nonce());
+    const QByteArray key = QCryptographicHash::hash(QByteArray("bob:") + challenge.realm().toUtf8() + ":testpwd", QCryptographicHash::Md5);
+
+    // a temporary failure is not reported as wrong credentials
+    request.setId(QXmppUtils::generateRandomBytes(12));
+    socket.writeDatagram(request.encode(key), QHostAddress::LocalHost, turn->port());
+    QTRY_COMPARE(responses.size(), 1);
+    QCOMPARE(responses.takeFirst().errorCode, 500);
+
+    // and the user is not rejected without a lookup
+    passwordChecker.unavailableUsers.clear();
+    request.setId(QXmppUtils::generateRandomBytes(12));
+    socket.writeDatagram(request.encode(key), QHostAddress::LocalHost, turn->port());
+    QTRY_COMPARE(responses.size(), 1);
+    QCOMPARE(responses.first().errorCode, 0);
+    QCOMPARE(passwordChecker.lookups, QStringList({ "bob", "bob" }));
+}
+
+QTEST_MAIN(tst_QXmppServerTurn)
+#include "tst_qxmppserverturn.moc"
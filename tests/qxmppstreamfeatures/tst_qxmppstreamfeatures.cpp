@@ -33,6 +33,7 @@ private slots:
     void testEmpty();
     void testRequired();
     void testFull();
+    void testSasl2();
     void testSetters();
 };
 
@@ -112,6 +113,36 @@ void tst_QXmppStreamFeatures::testFull()
     serializePacket(features, xml);
 }
 
+void tst_QXmppStreamFeatures::testSasl2()
+{
+    const QByteArray xml("<stream:features>"
+                         "<authentication xmlns=\"urn:xmpp:sasl:2\">"
+                         "<mechanism>SCRAM-SHA-1</mechanism>"
+                         "<mechanism>PLAIN</mechanism>"
+                         "<inline>"
+                         "<bind xmlns=\"urn:xmpp:bind:0\">"
+                         "<inline>"
+                         "<feature var=\"urn:xmpp:carbons:2\"/>"
+                         "<feature var=\"urn:xmpp:sm:3\"/>"
+                         "</inline>"
+                         "</bind>"
+                         "<sm xmlns=\"urn:xmpp:sm:3\"/>"
+                         "</inline>"
+                         "</authentication>"
+                         "</stream:features>");
+
+    QXmppStreamFeatures features;
+    parsePacket(features, xml);
+    QCOMPARE(features.authMechanisms(), QStringList());
+    QCOMPARE(features.sasl2Mechanisms(), QStringList() << "SCRAM-SHA-1"
+                                                       << "PLAIN");
+    QVERIFY(features.bind2Available());
+    QCOMPARE(features.bind2Features(), QStringList() << "urn:xmpp:carbons:2"
+                                                     << "urn:xmpp:sm:3");
+    QVERIFY(features.sasl2StreamManagementAvailable());
+    serializePacket(features, xml);
+}
+
 void tst_QXmppStreamFeatures::testSetters()
 {
     QXmppStreamFeatures features;
@@ -44,6 +44,7 @@ void tst_QXmppStreamInitiationIq::testFileInfo_data()
     QTest::addColumn<QDateTime>("date");
     QTest::addColumn<QString>("description");
     QTest::addColumn<QByteArray>("hash");
+    QTest::addColumn<int>("hashAlgorithm");
     QTest::addColumn<QString>("name");
     QTest::addColumn<qint64>("size");
 
@@ -52,6 +53,7 @@ void tst_QXmppStreamInitiationIq::testFileInfo_data()
         << QDateTime()
         << QString()
         << QByteArray()
+        << int(QCryptographicHash::Md5)
         << QString("test.txt")
         << qint64(1022);
 
@@ -66,6 +68,20 @@ void tst_QXmppStreamInitiationIq::testFileInfo_data()
         << QDateTime(QDate(1969, 7, 21), QTime(2, 56, 15), Qt::UTC)
         << QString("This is a test. If this were a real file...")
         << QByteArray::fromHex("552da749930852c69ae5d2141d3766b1")
+        << int(QCryptographicHash::Md5)
+        << QString("test.txt")
+        << qint64(1022);
+
+    QTest::newRow("sha-256")
+        << QByteArray("<file xmlns=\"http://jabber.org/protocol/si/profile/file-transfer\" "
+                      "name=\"test.txt\" "
+                      "size=\"1022\">"
+                      "<hash xmlns=\"urn:xmpp:hashes:2\" algo=\"sha-256\">2XarmwTlNxDAMkvymloX3S5+VbylNrJt/l5QyPa+YoU=</hash>"
+                      "</file>")
+        << QDateTime()
+        << QString()
+        << QByteArray::fromBase64("2XarmwTlNxDAMkvymloX3S5+VbylNrJt/l5QyPa+YoU=")
+        << int(QCryptographicHash::Sha256)
         << QString("test.txt")
         << qint64(1022);
 }
@@ -76,6 +92,7 @@ void tst_QXmppStreamInitiationIq::testFileInfo()
     QFETCH(QDateTime, date);
     QFETCH(QString, description);
     QFETCH(QByteArray, hash);
+    QFETCH(int, hashAlgorithm);
     QFETCH(QString, name);
     QFETCH(qint64, size);
 
@@ -84,6 +101,7 @@ void tst_QXmppStreamInitiationIq::testFileInfo()
     QCOMPARE(info.date(), date);
     QCOMPARE(info.description(), description);
     QCOMPARE(info.hash(), hash);
+    QCOMPARE(int(info.hashAlgorithm()), hashAlgorithm);
     QCOMPARE(info.name(), name);
     QCOMPARE(info.size(), size);
     serializePacket(info, xml);
@@ -22,10 +22,60 @@
  */
 
 #include "QXmppStun.h"
+#include "QXmppStun_p.h"
 
 #include "util.h"
 #include <QObject>
 
+#include <random>
+
+static const int STUN_HEADER_SIZE = 20;
+
+// builds a message with random attributes
+static QXmppStunMessage randomMessage(std::mt19937 &random)
+{
+    auto randomBytes = [&random](int size) {
+        QByteArray bytes(size, Qt::Uninitialized);
+        for (int i = 0; i < size; ++i)
+            bytes[i] = char(random());
+        return bytes;
+    };
+    auto randomAddress = [&random]() {
+        if (random() % 2)
+            return QHostAddress(quint32(random()));
+        Q_IPV6ADDR addr;
+        for (int i = 0; i < 16; ++i)
+            addr[i] = quint8(random());
+        return QHostAddress(addr);
+    };
+
+    QXmppStunMessage message;
+    message.setType(quint16(random() & 0x3eff));
+    message.setId(randomBytes(12));
+    if (random() % 2)
+        message.setPriority(random());
+    if (random() % 2)
+        message.setUsername(QString::fromLatin1(randomBytes(random() % 40).toHex()));
+    if (random() % 2)
+        message.setLifetime(random());
+    if (random() % 2)
+        message.setData(randomBytes(random() % 200));
+    if (random() % 2)
+        message.setNonce(randomBytes(random() % 20));
+    if (random() % 2) {
+        message.xorMappedHost = randomAddress();
+        message.xorMappedPort = quint16(random() | 1);
+    }
+    if (random() % 2) {
+        message.errorCode = 400 + random() % 100;
+        message.errorPhrase = QStringLiteral("Bad Request");
+    }
+    if (random() % 2)
+        message.iceControlling = randomBytes(8);
+    message.useCandidate = random() % 2;
+    return message;
+}
+
 class tst_QXmppStunMessage : public QObject
 {
     Q_OBJECT
@@ -37,6 +87,11 @@ private slots:
     void testIPv6Address();
     void testXorIPv4Address();
     void testXorIPv6Address();
+    void testView();
+    void testWriter();
+    void testRoundTrip();
+    void benchmarkDecode_data();
+    void benchmarkDecode();
 };
 
 void tst_QXmppStunMessage::testFingerprint()
@@ -132,5 +187,210 @@ void tst_QXmppStunMessage::testXorIPv6Address()
     QCOMPARE(msg2.xorMappedPort, quint16(12345));
 }
 
+void tst_QXmppStunMessage::testView()
+{
+    QXmppStunMessage msg;
+    msg.setType(0x0101);
+    msg.setId(QByteArray("0123456789ab"));
+    msg.setUsername(QStringLiteral("foo:bar"));
+    msg.xorMappedHost = QHostAddress("2001:db8::1");
+    msg.xorMappedPort = 12345;
+    const QByteArray packet = msg.encode(QByteArray("somesecret"), true);
+
+    QXmppStunMessageView view;
+    QVERIFY(view.parse(packet.constData(), packet.size()));
+    QCOMPARE(view.error(), QXmppStunMessageView::NoError);
+    QCOMPARE(view.type(), quint16(0x0101));
+    QCOMPARE(view.messageClass(), quint16(QXmppStunMessage::Response));
+    QCOMPARE(view.messageMethod(), quint16(QXmppStunMessage::Binding));
+    QCOMPARE(view.cookie(), quint32(0x2112A442));
+    QCOMPARE(QByteArray(view.id(), 12), QByteArray("0123456789ab"));
+
+    // integrity
+    QVERIFY(view.hasFingerprint());
+    QVERIFY(view.hasIntegrity());
+    QVERIFY(view.checkIntegrity(QByteArray("somesecret")));
+    QVERIFY(!view.checkIntegrity(QByteArray("othersecret")));
+
+    // attributes are read in place
+    QXmppStunMessageView::Attribute attribute;
+    QVERIFY(view.findAttribute(0x0006, attribute));
+    QCOMPARE(QByteArray(attribute.value, attribute.length), QByteArray("foo:bar"));
+    QVERIFY(attribute.value > packet.constData() && attribute.value < packet.constData() + packet.size());
+
+    QHostAddress host;
+    quint16 port = 0;
+    QVERIFY(view.findAttribute(0x0020, attribute));
+    QVERIFY(view.decodeAddress(attribute, host, port));
+    QCOMPARE(host, QHostAddress("2001:db8::1"));
+    QCOMPARE(port, quint16(12345));
+    QVERIFY(!view.findAttribute(0x0024, attribute));
+
+    // the attributes are listed in order
+    QList<quint16> types;
+    int offset = 0;
+    while (view.nextAttribute(offset, attribute))
+        types << attribute.type;
+    QCOMPARE(types, QList<quint16>({ 0x0020, 0x0006, 0x0008, 0x8028 }));
+
+    // channel data and truncated messages are not STUN
+    QVERIFY(!view.parse("\x40\x00\x00\x04\x00\x00\x00\x00", 8));
+    QCOMPARE(view.error(), QXmppStunMessageView::NotStunError);
+    QVERIFY(!view.parse(packet.constData(), packet.size() - 4));
+    QCOMPARE(view.error(), QXmppStunMessageView::NotStunError);
+
+    // corrupt fingerprint
+    QByteArray corrupt = packet;
+    corrupt[corrupt.size() - 1] = corrupt.at(corrupt.size() - 1) ^ 1;
+    QVERIFY(!view.parse(corrupt.constData(), corrupt.size()));
+    QCOMPARE(view.error(), QXmppStunMessageView::FingerprintError);
+
+    // attribute overflowing the message
+    corrupt = packet;
+    corrupt[22] = char(0xff);
+    QVERIFY(!view.parse(corrupt.constData(), corrupt.size()));
+    QCOMPARE(view.error(), QXmppStunMessageView::InvalidError);
+}
+
+void tst_QXmppStunMessage::testWriter()
+{
+    const QByteArray id(12, 0);
+
+    // same as testIntegrity()
+    char buffer[64];
+    QXmppStunMessageWriter writer(buffer, sizeof(buffer));
+    QVERIFY(writer.writeHeader(0x0001, id.constData()));
+    QVERIFY(writer.addIntegrity(QByteArray("somesecret")));
+    QVERIFY(!writer.hasOverflowed());
+    QCOMPARE(QByteArray(buffer, writer.size()),
+             QByteArray("\x00\x01\x00\x18\x21\x12\xA4\x42\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x08\x00\x14\x96\x4B\x40\xD1\x84\x67\x6A\xFD\xB5\xE0\x7C\xC5\x1F\xFB\xBD\xA2\x61\xAF\xB1\x26", 44));
+
+    // same as testXorIPv4Address() with a fingerprint
+    QXmppStunMessage msg;
+    msg.setType(0x0001);
+    msg.xorMappedHost = QHostAddress("127.0.0.1");
+    msg.xorMappedPort = 12345;
+
+    QXmppStunMessageWriter writer2(buffer, sizeof(buffer));
+    QVERIFY(writer2.writeHeader(0x0001, id.constData()));
+    QVERIFY(writer2.addAddress(0x0020, QHostAddress("127.0.0.1"), 12345));
+    QVERIFY(writer2.addFingerprint());
+    QCOMPARE(QByteArray(buffer, writer2.size()), msg.encode());
+
+    // values are padded
+    QXmppStunMessageWriter writer3(buffer, sizeof(buffer));
+    QVERIFY(writer3.writeHeader(0x0001, id.constData()));
+    QVERIFY(writer3.addAttribute(0x0006, "abcde", 5));
+    QCOMPARE(writer3.size(), 32);
+    QCOMPARE(QByteArray(buffer + 24, 8), QByteArray("abcde\0\0\0", 8));
+
+    // the buffer is too small
+    QVERIFY(!writer3.addAttribute(0x0013, buffer, 40));
+    QVERIFY(writer3.hasOverflowed());
+    QVERIFY(!writer3.addFingerprint());
+    QCOMPARE(writer3.size(), 32);
+}
+
+void tst_QXmppStunMessage::testRoundTrip()
+{
+    std::mt19937 random(20200101);
+    const QByteArray key("somesecret");
+
+    for (int i = 0; i < 500; ++i) {
+        const QXmppStunMessage message = randomMessage(random);
+        const QByteArray packet = message.encode(key, true);
+
+        // the view accepts what was encoded
+        QXmppStunMessageView view;
+        QVERIFY(view.parse(packet.constData(), packet.size()));
+        QCOMPARE(view.type(), message.type());
+        QCOMPARE(QByteArray(view.id(), 12), message.id());
+        QVERIFY(view.checkIntegrity(key));
+
+        // decoding gives the same message back
+        QXmppStunMessage decoded;
+        QVERIFY(decoded.decode(packet, key));
+        QCOMPARE(decoded.type(), message.type());
+        QCOMPARE(decoded.id(), message.id());
+        QCOMPARE(decoded.priority(), message.priority());
+        QCOMPARE(decoded.username(), message.username());
+        QCOMPARE(decoded.lifetime(), message.lifetime());
+        QCOMPARE(decoded.data(), message.data());
+        QCOMPARE(decoded.nonce(), message.nonce());
+        QCOMPARE(decoded.xorMappedHost, message.xorMappedHost);
+        QCOMPARE(decoded.xorMappedPort, message.xorMappedPort);
+        QCOMPARE(decoded.errorCode, message.errorCode);
+        QCOMPARE(decoded.errorPhrase, message.errorPhrase);
+        QCOMPARE(decoded.iceControlling, message.iceControlling);
+        QCOMPARE(decoded.useCandidate, message.useCandidate);
+        QCOMPARE(decoded.encode(key, true), packet);
+
+        // any corrupted byte is caught, unless it hides the attribute
+        // protecting it
+        QByteArray corrupt = packet;
+        const int position = int(random() % quint32(packet.size()));
+        corrupt[position] = char(corrupt.at(position) ^ (1 + random() % 255));
+        if (view.parse(corrupt.constData(), corrupt.size()))
+            QVERIFY(!view.hasFingerprint() || !view.hasIntegrity() || !view.checkIntegrity(key));
+        QXmppStunMessage().decode(corrupt, key);
+
+        // so is any truncation
+        const int size = int(random() % quint32(packet.size()));
+        QVERIFY(!view.parse(packet.constData(), size));
+
+        // random data does not crash the parser
+        QByteArray garbage = packet.left(STUN_HEADER_SIZE);
+        for (int j = STUN_HEADER_SIZE; j < packet.size(); ++j)
+            garbage += char(random());
+        view.parse(garbage.constData(), garbage.size());
+        int offset = 0;
+        QXmppStunMessageView::Attribute attribute;
+        while (view.nextAttribute(offset, attribute)) {
+            QHostAddress host;
+            quint16 port;
+            view.decodeAddress(attribute, host, port);
+        }
+        QXmppStunMessage().decode(garbage);
+    }
+}
+
+void tst_QXmppStunMessage::benchmarkDecode_data()
+{
+    QTest::addColumn<bool>("view");
+
+    QTest::newRow("message") << false;
+    QTest::newRow("view") << true;
+}
+
+void tst_QXmppStunMessage::benchmarkDecode()
+{
+    QFETCH(bool, view);
+
+    QXmppStunMessage msg;
+    msg.setType(0x0001);
+    msg.setId(QByteArray("0123456789ab"));
+    msg.setPriority(1862270975);
+    msg.setUsername(QStringLiteral("9Hkm:wgUb"));
+    msg.iceControlling = QByteArray(8, 'x');
+    msg.useCandidate = true;
+    const QByteArray key("somesecret");
+    const QByteArray packet = msg.encode(key, true);
+
+    if (view) {
+        QBENCHMARK {
+            QXmppStunMessageView parsed;
+            QXmppStunMessageView::Attribute attribute;
+            QVERIFY(parsed.parse(packet.constData(), packet.size()));
+            QVERIFY(parsed.checkIntegrity(key));
+            QVERIFY(parsed.findAttribute(0x0024, attribute));
+        }
+    } else {
+        QBENCHMARK {
+            QXmppStunMessage parsed;
+            QVERIFY(parsed.decode(packet, key));
+        }
+    }
+}
+
 QTEST_MAIN(tst_QXmppStunMessage)
 #include "tst_qxmppstunmessage.moc"
@@ -22,12 +22,60 @@
  */
 
 #include "QXmppClient.h"
+#include "QXmppDiscoveryIq.h"
+#include "QXmppDiscoveryManager.h"
+#include "QXmppPresence.h"
 #include "QXmppServer.h"
+#include "QXmppSocks.h"
 #include "QXmppTransferManager.h"
 
 #include "util.h"
 #include <QBuffer>
 #include <QObject>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTemporaryFile>
+
+// Returns a SOCKS5 bytestream file offer for sid of a file of the given size.
+static QDomElement socksOffer(const QString &sid, qint64 size)
+{
+    QDomDocument doc;
+    doc.setContent(QStringLiteral(
+                       "<iq id=\"offer-%1\" type=\"set\" from=\"sender@localhost/QXmpp\" to=\"receiver@localhost/QXmpp\">"
+                       "<si xmlns=\"http://jabber.org/protocol/si\" id=\"%1\" "
+                       "profile=\"http://jabber.org/protocol/si/profile/file-transfer\">"
+                       "<file xmlns=\"http://jabber.org/protocol/si/profile/file-transfer\" name=\"test.txt\" size=\"%2\"/>"
+                       "<feature xmlns=\"http://jabber.org/protocol/feature-neg\">"
+                       "<x xmlns=\"jabber:x:data\" type=\"form\">"
+                       "<field var=\"stream-method\" type=\"list-single\">"
+                       "<option><value>http://jabber.org/protocol/bytestreams</value></option>"
+                       "</field>"
+                       "</x>"
+                       "</feature>"
+                       "</si>"
+                       "</iq>")
+                       .arg(sid, QString::number(size)),
+                   true);
+    return doc.documentElement();
+}
+
+// Returns a SOCKS5 bytestream request for sid listing local stream hosts on
+// the given ports.
+static QDomElement socksStreamHosts(const QString &sid, const QList<quint16> &ports)
+{
+    QString hosts;
+    for (int i = 0; i < ports.size(); ++i)
+        hosts += QStringLiteral("<streamhost jid=\"proxy%1.localhost\" host=\"127.0.0.1\" port=\"%2\"/>").arg(QString::number(i), QString::number(ports.at(i)));
+
+    QDomDocument doc;
+    doc.setContent(QStringLiteral(
+                       "<iq id=\"hosts-%1\" type=\"set\" from=\"sender@localhost/QXmpp\" to=\"receiver@localhost/QXmpp\">"
+                       "<query xmlns=\"http://jabber.org/protocol/bytestreams\" sid=\"%1\" mode=\"tcp\">%2</query>"
+                       "</iq>")
+                       .arg(sid, hosts),
+                   true);
+    return doc.documentElement();
+}
 
 class tst_QXmppTransferManager : public QObject
 {
@@ -37,10 +85,21 @@ private slots:
     void init();
     void testSendFile_data();
     void testSendFile();
+    void testSendFileInBand_data();
+    void testSendFileInBand();
+    void testResumeFile_data();
+    void testResumeFile();
+    void testSendFileRanges();
+    void testAcceptRange_data();
+    void testAcceptRange();
+    void testStreamHostRacing();
+    void benchmarkSendFile();
 
     void acceptFile(QXmppTransferJob *job);
 
 private:
+    void connectClient(QXmppClient *client, const QString &user);
+
     QBuffer receiverBuffer;
     QXmppTransferJob *receiverJob;
 };
@@ -59,23 +118,43 @@ void tst_QXmppTransferManager::acceptFile(QXmppTransferJob *job)
     job->accept(&receiverBuffer);
 }
 
+void tst_QXmppTransferManager::connectClient(QXmppClient *client, const QString &user)
+{
+    QXmppConfiguration config;
+    config.setDomain("localhost");
+    config.setHost(QHostAddress(QHostAddress::LocalHost).toString());
+    config.setPort(12345);
+    config.setUser(user);
+    config.setPassword("testpwd");
+
+    QEventLoop loop;
+    connect(client, &QXmppClient::connected, &loop, &QEventLoop::quit);
+    connect(client, &QXmppClient::disconnected, &loop, &QEventLoop::quit);
+    client->connectToServer(config);
+    loop.exec();
+}
+
 void tst_QXmppTransferManager::testSendFile_data()
 {
     QTest::addColumn<QXmppTransferJob::Method>("senderMethods");
     QTest::addColumn<QXmppTransferJob::Method>("receiverMethods");
     QTest::addColumn<bool>("works");
+    QTest::addColumn<int>("hashAlgorithm");
+
+    QTest::newRow("any - any") << QXmppTransferJob::AnyMethod << QXmppTransferJob::AnyMethod << true << int(QCryptographicHash::Md5);
+    QTest::newRow("any - inband") << QXmppTransferJob::AnyMethod << QXmppTransferJob::InBandMethod << true << int(QCryptographicHash::Md5);
+    QTest::newRow("any - socks") << QXmppTransferJob::AnyMethod << QXmppTransferJob::SocksMethod << true << int(QCryptographicHash::Md5);
 
-    QTest::newRow("any - any") << QXmppTransferJob::AnyMethod << QXmppTransferJob::AnyMethod << true;
-    QTest::newRow("any - inband") << QXmppTransferJob::AnyMethod << QXmppTransferJob::InBandMethod << true;
-    QTest::newRow("any - socks") << QXmppTransferJob::AnyMethod << QXmppTransferJob::SocksMethod << true;
+    QTest::newRow("inband - any") << QXmppTransferJob::InBandMethod << QXmppTransferJob::AnyMethod << true << int(QCryptographicHash::Md5);
+    QTest::newRow("inband - inband") << QXmppTransferJob::InBandMethod << QXmppTransferJob::InBandMethod << true << int(QCryptographicHash::Md5);
+    QTest::newRow("inband - socks") << QXmppTransferJob::InBandMethod << QXmppTransferJob::SocksMethod << false << int(QCryptographicHash::Md5);
 
-    QTest::newRow("inband - any") << QXmppTransferJob::InBandMethod << QXmppTransferJob::AnyMethod << true;
-    QTest::newRow("inband - inband") << QXmppTransferJob::InBandMethod << QXmppTransferJob::InBandMethod << true;
-    QTest::newRow("inband - socks") << QXmppTransferJob::InBandMethod << QXmppTransferJob::SocksMethod << false;
+    QTest::newRow("socks - any") << QXmppTransferJob::SocksMethod << QXmppTransferJob::AnyMethod << true << int(QCryptographicHash::Md5);
+    QTest::newRow("socks - inband") << QXmppTransferJob::SocksMethod << QXmppTransferJob::InBandMethod << false << int(QCryptographicHash::Md5);
+    QTest::newRow("socks - socks") << QXmppTransferJob::SocksMethod << QXmppTransferJob::SocksMethod << true << int(QCryptographicHash::Md5);
 
-    QTest::newRow("socks - any") << QXmppTransferJob::SocksMethod << QXmppTransferJob::AnyMethod << true;
-    QTest::newRow("socks - inband") << QXmppTransferJob::SocksMethod << QXmppTransferJob::InBandMethod << false;
-    QTest::newRow("socks - socks") << QXmppTransferJob::SocksMethod << QXmppTransferJob::SocksMethod << true;
+    QTest::newRow("any - any, sha-256") << QXmppTransferJob::AnyMethod << QXmppTransferJob::AnyMethod << true << int(QCryptographicHash::Sha256);
+    QTest::newRow("inband - inband, sha3-512") << QXmppTransferJob::InBandMethod << QXmppTransferJob::InBandMethod << true << int(QCryptographicHash::Sha3_512);
 }
 
 void tst_QXmppTransferManager::testSendFile()
@@ -83,6 +162,7 @@ void tst_QXmppTransferManager::testSendFile()
     QFETCH(QXmppTransferJob::Method, senderMethods);
     QFETCH(QXmppTransferJob::Method, receiverMethods);
     QFETCH(bool, works);
+    QFETCH(int, hashAlgorithm);
 
     const QString testDomain("localhost");
     const QHostAddress testHost(QHostAddress::LocalHost);
@@ -106,6 +186,7 @@ void tst_QXmppTransferManager::testSendFile()
     QXmppClient sender;
     auto *senderManager = new QXmppTransferManager;
     senderManager->setSupportedMethods(senderMethods);
+    senderManager->setHashAlgorithm(QCryptographicHash::Algorithm(hashAlgorithm));
     sender.addExtension(senderManager);
     sender.setLogger(&logger);
 
@@ -161,6 +242,8 @@ void tst_QXmppTransferManager::testSendFile()
 
         QCOMPARE(receiverJob->state(), QXmppTransferJob::FinishedState);
         QCOMPARE(receiverJob->error(), QXmppTransferJob::NoError);
+        QCOMPARE(int(receiverJob->fileInfo().hashAlgorithm()), hashAlgorithm);
+        QVERIFY(!receiverJob->fileInfo().hash().isEmpty());
 
         // check received file
         QFile expectedFile(":/test.svg");
@@ -177,5 +260,488 @@ void tst_QXmppTransferManager::testSendFile()
     }
 }
 
+void tst_QXmppTransferManager::testSendFileInBand_data()
+{
+    QTest::addColumn<bool>("ibbMessages");
+    QTest::addColumn<int>("windowSize");
+
+    QTest::newRow("iq, window 1") << false << 1;
+    QTest::newRow("iq, window 16") << false << 16;
+    QTest::newRow("messages, window 1") << true << 1;
+    QTest::newRow("messages, window 16") << true << 16;
+}
+
+void tst_QXmppTransferManager::testSendFileInBand()
+{
+    QFETCH(bool, ibbMessages);
+    QFETCH(int, windowSize);
+
+    QFile expectedFile(":/test.svg");
+    QVERIFY(expectedFile.open(QIODevice::ReadOnly));
+    const QByteArray expectedData = expectedFile.readAll();
+
+    // prepare server and clients
+    TestPasswordChecker passwordChecker;
+    passwordChecker.addCredentials("sender", "testpwd");
+    passwordChecker.addCredentials("receiver", "testpwd");
+
+    QXmppServer server;
+    server.setDomain("localhost");
+    server.setPasswordChecker(&passwordChecker);
+    server.listenForClients(QHostAddress::LocalHost, 12345);
+
+    // count the data blocks sent in messages
+    QXmppLogger logger;
+    logger.setLoggingType(QXmppLogger::SignalLogging);
+    int dataMessages = 0;
+    connect(&logger, &QXmppLogger::message, this, [&](QXmppLogger::MessageType type, const QString &text) {
+        if (type == QXmppLogger::SentMessage && text.startsWith(QStringLiteral("<message")) &&
+            text.contains(QStringLiteral("http://jabber.org/protocol/ibb")))
+            dataMessages++;
+    });
+
+    QXmppClient sender;
+    auto *senderManager = new QXmppTransferManager;
+    senderManager->setSupportedMethods(QXmppTransferJob::InBandMethod);
+    senderManager->setIbbMessagesEnabled(ibbMessages);
+    senderManager->setIbbWindowSize(windowSize);
+    sender.addExtension(senderManager);
+    sender.setLogger(&logger);
+    connectClient(&sender, "sender");
+    QVERIFY(sender.isConnected());
+
+    QXmppClient receiver;
+    auto *receiverManager = new QXmppTransferManager;
+    receiverManager->setSupportedMethods(QXmppTransferJob::InBandMethod);
+    connect(receiverManager, &QXmppTransferManager::fileReceived,
+            this, &tst_QXmppTransferManager::acceptFile);
+    receiver.addExtension(receiverManager);
+    connectClient(&receiver, "receiver");
+    QVERIFY(receiver.isConnected());
+
+    // send file
+    QXmppTransferJob *senderJob = senderManager->sendFile("receiver@localhost/QXmpp", ":/test.svg");
+    QVERIFY(senderJob);
+    QTRY_COMPARE_WITH_TIMEOUT(senderJob->state(), QXmppTransferJob::FinishedState, 10000);
+    QCOMPARE(senderJob->error(), QXmppTransferJob::NoError);
+
+    QVERIFY(receiverJob);
+    QTRY_COMPARE_WITH_TIMEOUT(receiverJob->state(), QXmppTransferJob::FinishedState, 10000);
+    QCOMPARE(receiverJob->error(), QXmppTransferJob::NoError);
+    QCOMPARE(receiverBuffer.data(), expectedData);
+
+    // the blocks are sent in messages only if enabled
+    QCOMPARE(dataMessages > 0, ibbMessages);
+
+    logger.disconnect(this);
+}
+
+void tst_QXmppTransferManager::testResumeFile_data()
+{
+    QTest::addColumn<QXmppTransferJob::Method>("method");
+    QTest::addColumn<bool>("corrupt");
+
+    QTest::newRow("inband") << QXmppTransferJob::InBandMethod << false;
+    QTest::newRow("socks") << QXmppTransferJob::SocksMethod << false;
+    QTest::newRow("socks, corrupt") << QXmppTransferJob::SocksMethod << true;
+}
+
+void tst_QXmppTransferManager::testResumeFile()
+{
+    QFETCH(QXmppTransferJob::Method, method);
+    QFETCH(bool, corrupt);
+
+    QFile expectedFile(":/test.svg");
+    QVERIFY(expectedFile.open(QIODevice::ReadOnly));
+    const QByteArray expectedData = expectedFile.readAll();
+
+    // a previous attempt received half of the file
+    const int held = expectedData.size() / 2;
+    QByteArray heldData = expectedData.left(held);
+    if (corrupt)
+        heldData[0] = heldData[0] ^ 0xff;
+
+    QTemporaryFile file;
+    QVERIFY(file.open());
+    file.write(heldData);
+    file.close();
+
+    // prepare server and clients
+    TestPasswordChecker passwordChecker;
+    passwordChecker.addCredentials("sender", "testpwd");
+    passwordChecker.addCredentials("receiver", "testpwd");
+
+    QXmppServer server;
+    server.setDomain("localhost");
+    server.setPasswordChecker(&passwordChecker);
+    server.listenForClients(QHostAddress::LocalHost, 12345);
+
+    QXmppClient sender;
+    auto *senderManager = new QXmppTransferManager;
+    senderManager->setSupportedMethods(method);
+    sender.addExtension(senderManager);
+    connectClient(&sender, "sender");
+    QVERIFY(sender.isConnected());
+
+    QXmppClient receiver;
+    auto *receiverManager = new QXmppTransferManager;
+    connect(receiverManager, &QXmppTransferManager::fileReceived, this, [this, &file](QXmppTransferJob *job) {
+        receiverJob = job;
+        QVERIFY(job->fileInfo().isRangeSupported());
+        job->resume(file.fileName());
+    });
+    receiver.addExtension(receiverManager);
+    connectClient(&receiver, "receiver");
+    QVERIFY(receiver.isConnected());
+
+    // send file
+    QEventLoop loop;
+    QXmppTransferJob *senderJob = senderManager->sendFile("receiver@localhost/QXmpp", ":/test.svg");
+    QVERIFY(senderJob);
+    QSignalSpy progressSpy(senderJob, &QXmppTransferJob::progress);
+    connect(senderJob, &QXmppTransferJob::finished, &loop, &QEventLoop::quit);
+    loop.exec();
+    QCOMPARE(senderJob->error(), QXmppTransferJob::NoError);
+
+    // only the missing part was sent
+    QVERIFY(!progressSpy.isEmpty());
+    QVERIFY(progressSpy.first().at(0).toLongLong() > held);
+
+    // the whole file is verified
+    QVERIFY(receiverJob);
+    if (receiverJob->state() != QXmppTransferJob::FinishedState) {
+        connect(receiverJob, &QXmppTransferJob::finished, &loop, &QEventLoop::quit);
+        loop.exec();
+    }
+    if (corrupt) {
+        QCOMPARE(receiverJob->error(), QXmppTransferJob::FileCorruptError);
+    } else {
+        QCOMPARE(receiverJob->error(), QXmppTransferJob::NoError);
+
+        QVERIFY(file.open());
+        QCOMPARE(file.readAll(), expectedData);
+    }
+}
+
+void tst_QXmppTransferManager::testSendFileRanges()
+{
+    QFile expectedFile(":/test.svg");
+    QVERIFY(expectedFile.open(QIODevice::ReadOnly));
+    const QByteArray expectedData = expectedFile.readAll();
+
+    QTemporaryFile file;
+    QVERIFY(file.open());
+    file.close();
+
+    // prepare server and clients
+    TestPasswordChecker passwordChecker;
+    passwordChecker.addCredentials("sender", "testpwd");
+    passwordChecker.addCredentials("receiver", "testpwd");
+
+    QXmppServer server;
+    server.setDomain("localhost");
+    server.setPasswordChecker(&passwordChecker);
+    server.listenForClients(QHostAddress::LocalHost, 12345);
+
+    QXmppClient sender;
+    auto *senderManager = new QXmppTransferManager;
+    sender.addExtension(senderManager);
+    connectClient(&sender, "sender");
+    QVERIFY(sender.isConnected());
+
+    // the file is sent in one piece if ranges are not known to be supported
+    const auto singleJobs = senderManager->sendFileRanges("receiver@localhost/QXmpp", ":/test.svg", 3);
+    QCOMPARE(singleJobs.size(), 1);
+    QCOMPARE(singleJobs.at(0)->fileInfo().rangeLength(), qint64(0));
+    singleJobs.at(0)->abort();
+
+    // each range is written in place
+    QEventLoop loop;
+    QList<QXmppTransferJob *> receiverJobs;
+    QXmppClient receiver;
+    auto *receiverManager = new QXmppTransferManager;
+    connect(receiverManager, &QXmppTransferManager::fileReceived, this, [&](QXmppTransferJob *job) {
+        receiverJobs << job;
+        connect(job, &QXmppTransferJob::finished, &loop, [&]() {
+            for (auto *receiverJob : qAsConst(receiverJobs)) {
+                if (receiverJob->state() != QXmppTransferJob::FinishedState)
+                    return;
+            }
+            if (receiverJobs.size() == 3)
+                loop.quit();
+        });
+        job->accept(file.fileName());
+    });
+    receiver.addExtension(receiverManager);
+    connectClient(&receiver, "receiver");
+    QVERIFY(receiver.isConnected());
+
+    // the sender learns the receiver's capabilities
+    auto *senderDiscovery = sender.findExtension<QXmppDiscoveryManager>();
+    auto *receiverDiscovery = receiver.findExtension<QXmppDiscoveryManager>();
+    const QByteArray ver = receiverDiscovery->capabilitiesVerificationString();
+    int infoCount = 0;
+    connect(senderDiscovery, &QXmppDiscoveryManager::infoReceived, this, [&]() {
+        infoCount++;
+    });
+    senderDiscovery->requestInfo("receiver@localhost/QXmpp", receiverDiscovery->clientCapabilitiesNode() + "#" + ver.toBase64());
+    QTRY_COMPARE(infoCount, 1);
+
+    QXmppPresence presence;
+    presence.setFrom("receiver@localhost/QXmpp");
+    presence.setCapabilityHash("sha-1");
+    presence.setCapabilityNode(receiverDiscovery->clientCapabilitiesNode());
+    presence.setCapabilityVer(ver);
+    emit sender.presenceReceived(presence);
+
+    QXmppDiscoveryIq info;
+    QVERIFY(senderDiscovery->cachedInfo("receiver@localhost/QXmpp", info));
+
+    // send file
+    const auto senderJobs = senderManager->sendFileRanges("receiver@localhost/QXmpp", ":/test.svg", 3);
+    QCOMPARE(senderJobs.size(), 3);
+    QCOMPARE(senderJobs.at(0)->fileInfo().rangeOffset(), qint64(0));
+    QCOMPARE(senderJobs.at(1)->fileInfo().rangeOffset(), senderJobs.at(0)->fileInfo().rangeLength());
+    loop.exec();
+
+    QCOMPARE(receiverJobs.size(), 3);
+    for (auto *job : qAsConst(receiverJobs))
+        QCOMPARE(job->error(), QXmppTransferJob::NoError);
+
+    QVERIFY(file.open());
+    QCOMPARE(file.readAll(), expectedData);
+}
+
+void tst_QXmppTransferManager::testAcceptRange_data()
+{
+    QTest::addColumn<QString>("offset");
+    QTest::addColumn<QString>("length");
+    QTest::addColumn<bool>("valid");
+
+    QTest::newRow("valid") << "100" << "200" << true;
+    QTest::newRow("up to the end") << "800" << "200" << true;
+    QTest::newRow("negative offset") << "-100" << "200" << false;
+    QTest::newRow("negative length") << "100" << "-200" << false;
+    QTest::newRow("past the end") << "900" << "200" << false;
+    QTest::newRow("offset past the end") << "1100" << "" << false;
+}
+
+void tst_QXmppTransferManager::testAcceptRange()
+{
+    QFETCH(QString, offset);
+    QFETCH(QString, length);
+    QFETCH(bool, valid);
+
+    QTemporaryFile file;
+    QVERIFY(file.open());
+    file.close();
+
+    QXmppClient client;
+    auto *manager = new QXmppTransferManager;
+    client.addExtension(manager);
+
+    QXmppTransferJob *job = nullptr;
+    connect(manager, &QXmppTransferManager::fileReceived, this, [&](QXmppTransferJob *offer) {
+        job = offer;
+        job->accept(file.fileName());
+    });
+
+    // an offer proposing a range of a file of 1000 bytes
+    const QString xml = QStringLiteral(
+        "<iq id=\"offer1\" type=\"set\" from=\"sender@localhost/QXmpp\" to=\"receiver@localhost/QXmpp\">"
+        "<si xmlns=\"http://jabber.org/protocol/si\" id=\"sid1\" mime-type=\"image/svg+xml\" "
+        "profile=\"http://jabber.org/protocol/si/profile/file-transfer\">"
+        "<file xmlns=\"http://jabber.org/protocol/si/profile/file-transfer\" name=\"test.svg\" size=\"1000\">"
+        "<range offset=\"%1\" length=\"%2\"/>"
+        "</file>"
+        "<feature xmlns=\"http://jabber.org/protocol/feature-neg\">"
+        "<x xmlns=\"jabber:x:data\" type=\"form\">"
+        "<field var=\"stream-method\" type=\"list-single\">"
+        "<option><value>http://jabber.org/protocol/ibb</value></option>"
+        "</field>"
+        "</x>"
+        "</feature>"
+        "</si>"
+        "</iq>").arg(offset, length);
+
+    QDomDocument doc;
+    QVERIFY(doc.setContent(xml, true));
+    QVERIFY(manager->handleStanza(doc.documentElement()));
+
+    QVERIFY(job);
+    if (valid) {
+        QCOMPARE(job->state(), QXmppTransferJob::StartState);
+        QCOMPARE(job->error(), QXmppTransferJob::NoError);
+    } else {
+        QCOMPARE(job->state(), QXmppTransferJob::FinishedState);
+        QCOMPARE(job->error(), QXmppTransferJob::AbortError);
+    }
+}
+
+void tst_QXmppTransferManager::testStreamHostRacing()
+{
+    QXmppClient client;
+    auto *manager = new QXmppTransferManager;
+    client.addExtension(manager);
+
+    QBuffer buffer;
+    QVERIFY(buffer.open(QIODevice::WriteOnly));
+    QXmppTransferJob *job = nullptr;
+    connect(manager, &QXmppTransferManager::fileReceived, this, [&](QXmppTransferJob *offer) {
+        job = offer;
+        job->accept(&buffer);
+    });
+
+    // the first stream host accepts connections but never answers the
+    // SOCKS5 handshake, the second one is working
+    QTcpServer deadHost;
+    QVERIFY(deadHost.listen(QHostAddress::LocalHost));
+    QElapsedTimer timer;
+    qint64 deadConnected = -1;
+    connect(&deadHost, &QTcpServer::newConnection, this, [&]() {
+        deadConnected = timer.elapsed();
+    });
+
+    QXmppSocksServer liveHost;
+    QVERIFY(liveHost.listen());
+    qint64 liveConnected = -1;
+    QTcpSocket *liveSocket = nullptr;
+    connect(&liveHost, &QXmppSocksServer::newConnection, this, [&](QTcpSocket *socket, const QString &, quint16) {
+        liveConnected = timer.elapsed();
+        liveSocket = socket;
+    });
+
+    QVERIFY(manager->handleStanza(socksOffer("sid1", 5)));
+    QVERIFY(job);
+    QCOMPARE(job->state(), QXmppTransferJob::StartState);
+
+    timer.start();
+    QVERIFY(manager->handleStanza(socksStreamHosts("sid1", { deadHost.serverPort(), liveHost.serverPort() })));
+
+    // the second host is tried after a delay, without waiting for the first
+    // one to time out, and wins the race
+    QTRY_COMPARE_WITH_TIMEOUT(job->state(), QXmppTransferJob::TransferState, 5000);
+    QVERIFY(deadConnected >= 0);
+    QVERIFY(liveConnected >= 200);
+    QVERIFY(liveSocket);
+
+    // the attempt to the first host is torn down
+    QTcpSocket *deadSocket = deadHost.nextPendingConnection();
+    QVERIFY(deadSocket);
+    QTRY_COMPARE(deadSocket->state(), QAbstractSocket::UnconnectedState);
+
+    liveSocket->write("hello");
+    liveSocket->disconnectFromHost();
+    QTRY_COMPARE(job->state(), QXmppTransferJob::FinishedState);
+    QCOMPARE(job->error(), QXmppTransferJob::NoError);
+    QCOMPARE(buffer.data(), QByteArray("hello"));
+
+    // no more than four attempts run at the same time
+    QList<QTcpServer *> deadHosts;
+    QList<quint16> deadPorts;
+    int attempts = 0;
+    for (int i = 0; i < 6; ++i) {
+        auto *host = new QTcpServer(this);
+        QVERIFY(host->listen(QHostAddress::LocalHost));
+        connect(host, &QTcpServer::newConnection, this, [&]() {
+            attempts++;
+        });
+        deadHosts << host;
+        deadPorts << host->serverPort();
+    }
+
+    job = nullptr;
+    QVERIFY(manager->handleStanza(socksOffer("sid2", 5)));
+    QVERIFY(job);
+    QVERIFY(manager->handleStanza(socksStreamHosts("sid2", deadPorts)));
+
+    QTRY_COMPARE(attempts, 4);
+    QTest::qWait(1000);
+    QCOMPARE(attempts, 4);
+    QCOMPARE(job->state(), QXmppTransferJob::StartState);
+
+    job->abort();
+    qDeleteAll(deadHosts);
+}
+
+void tst_QXmppTransferManager::benchmarkSendFile()
+{
+    const QString testDomain("localhost");
+    const QHostAddress testHost(QHostAddress::LocalHost);
+    const quint16 testPort = 12345;
+
+    // prepare a file of 16 MiB, larger sizes can be given in MiB using the
+    // QXMPP_BENCHMARK_SIZE environment variable
+    const int blocks = qMax(1, qEnvironmentVariableIsSet("QXMPP_BENCHMARK_SIZE") ? qEnvironmentVariableIntValue("QXMPP_BENCHMARK_SIZE") : 16);
+    QTemporaryFile file;
+    QVERIFY(file.open());
+    const QByteArray block(1024 * 1024, 'x');
+    for (int i = 0; i < blocks; ++i)
+        QCOMPARE(file.write(block), qint64(block.size()));
+    file.close();
+
+    // prepare server
+    TestPasswordChecker passwordChecker;
+    passwordChecker.addCredentials("sender", "testpwd");
+    passwordChecker.addCredentials("receiver", "testpwd");
+
+    QXmppServer server;
+    server.setDomain(testDomain);
+    server.setPasswordChecker(&passwordChecker);
+    server.listenForClients(testHost, testPort);
+
+    // prepare clients, the file is sent directly through the sender's
+    // SOCKS5 server
+    QXmppConfiguration config;
+    config.setDomain(testDomain);
+    config.setHost(testHost.toString());
+    config.setPort(testPort);
+    config.setPassword("testpwd");
+
+    QXmppClient sender;
+    auto *senderManager = new QXmppTransferManager;
+    senderManager->setSupportedMethods(QXmppTransferJob::SocksMethod);
+    sender.addExtension(senderManager);
+
+    QXmppClient receiver;
+    auto *receiverManager = new QXmppTransferManager;
+    receiverManager->setSupportedMethods(QXmppTransferJob::SocksMethod);
+    connect(receiverManager, &QXmppTransferManager::fileReceived,
+            this, &tst_QXmppTransferManager::acceptFile);
+    receiver.addExtension(receiverManager);
+
+    QEventLoop connectLoop;
+    connect(&sender, &QXmppClient::connected, &connectLoop, &QEventLoop::quit);
+    config.setUser("sender");
+    sender.connectToServer(config);
+    connectLoop.exec();
+    QVERIFY(sender.isConnected());
+
+    connect(&receiver, &QXmppClient::connected, &connectLoop, &QEventLoop::quit);
+    config.setUser("receiver");
+    receiver.connectToServer(config);
+    connectLoop.exec();
+    QVERIFY(receiver.isConnected());
+
+    QBENCHMARK_ONCE {
+        QXmppTransferJob *senderJob = senderManager->sendFile("receiver@localhost/QXmpp", file.fileName());
+        QVERIFY(senderJob);
+
+        QEventLoop loop;
+        connect(senderJob, &QXmppTransferJob::finished, &loop, &QEventLoop::quit);
+        loop.exec();
+        QCOMPARE(senderJob->error(), QXmppTransferJob::NoError);
+
+        QVERIFY(receiverJob);
+        if (receiverJob->state() != QXmppTransferJob::FinishedState) {
+            connect(receiverJob, &QXmppTransferJob::finished, &loop, &QEventLoop::quit);
+            loop.exec();
+        }
+        QCOMPARE(receiverJob->error(), QXmppTransferJob::NoError);
+    }
+
+    QCOMPARE(receiverBuffer.data().size(), blocks * block.size());
+}
+
 QTEST_MAIN(tst_QXmppTransferManager)
 #include "tst_qxmpptransfermanager.moc"
@@ -38,6 +38,7 @@ private slots:
     void testPhone_data();
     void testPhone();
     void testVCard();
+    void testLazyPhoto();
 };
 
 void tst_QXmppVCardIq::testAddress_data()
@@ -260,5 +261,54 @@ void tst_QXmppVCardIq::testVCard()
     serializePacket(vcard, xml);
 }
 
+void tst_QXmppVCardIq::testLazyPhoto()
+{
+    const QByteArray xml(
+        "<iq id=\"vcard1\" type=\"result\">"
+        "<vCard xmlns=\"vcard-temp\">"
+        "<NICKNAME>FooBar</NICKNAME>"
+        "<PHOTO>"
+        "<TYPE>image/png</TYPE>"
+        "<BINVAL>"
+        "iVBORw0KGgoAAAANSUhEUgAAAAgAAAAICAIAAABLbSncAAAAAXNSR0IArs4c6QAAAAlwSFlzAAA\n"
+        "UIgAAFCIBjw1HyAAAAAd0SU1FB9oIHQInNvuJovgAAAAiSURBVAjXY2TQ+s/AwMDAwPD/GiMDlP\n"
+        "WfgYGBiQEHGJwSAK2BBQ1f3uvpAAAAAElFTkSuQmCC"
+        "</BINVAL>"
+        "</PHOTO>"
+        "</vCard>"
+        "</iq>");
+    const QByteArray photo = QByteArray::fromBase64(
+        "iVBORw0KGgoAAAANSUhEUgAAAAgAAAAICAIAAABLbSncAAAAAXNSR0IArs4c6QAAAAlwSFlzAAA"
+        "UIgAAFCIBjw1HyAAAAAd0SU1FB9oIHQInNvuJovgAAAAiSURBVAjXY2TQ+s/AwMDAwPD/GiMDlP"
+        "WfgYGBiQEHGJwSAK2BBQ1f3uvpAAAAAElFTkSuQmCC");
+
+    // a photo which is not accessed is written back unchanged
+    QXmppVCardIq vcard;
+    parsePacket(vcard, xml);
+    QCOMPARE(vcard.nickName(), QLatin1String("FooBar"));
+    serializePacket(vcard, xml);
+
+    // it is decoded on first access, also for copies
+    const QXmppVCardIq copy = vcard;
+    QCOMPARE(vcard.photo(), photo);
+    QCOMPARE(copy.photo(), photo);
+
+    vcard.setPhoto(QByteArray("photo"));
+    QCOMPARE(vcard.photo(), QByteArray("photo"));
+    QCOMPARE(copy.photo(), photo);
+
+    // a photo which decodes to nothing is not written back
+    QXmppVCardIq blank;
+    parsePacket(blank, "<iq id=\"vcard1\" type=\"result\">"
+                       "<vCard xmlns=\"vcard-temp\">"
+                       "<PHOTO><TYPE>image/png</TYPE><BINVAL>\n==\n</BINVAL></PHOTO>"
+                       "</vCard>"
+                       "</iq>");
+    QVERIFY(blank.photo().isEmpty());
+    serializePacket(blank, "<iq id=\"vcard1\" type=\"result\">"
+                           "<vCard xmlns=\"vcard-temp\"/>"
+                           "</iq>");
+}
+
 QTEST_MAIN(tst_QXmppVCardIq)
 #include "tst_qxmppvcardiq.moc"
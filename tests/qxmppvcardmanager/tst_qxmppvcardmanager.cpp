@@ -24,9 +24,11 @@
 
 #include <QObject>
 #include "QXmppClient.h"
+#include "QXmppPresence.h"
 #include "QXmppVCardIq.h"
 #include "QXmppVCardManager.h"
 #include "util.h"
+#include <QTemporaryDir>
 
 Q_DECLARE_METATYPE(QXmppVCardIq);
 
@@ -37,6 +39,7 @@ class tst_QXmppVCardManager : public QObject
 private slots:
     void testHandleStanza_data();
     void testHandleStanza();
+    void testCache();
 
 private:
     QXmppClient m_client;
@@ -104,5 +107,97 @@ void tst_QXmppVCardManager::testHandleStanza()
     m_client.removeExtension(manager);
 }
 
+static QXmppPresence avatarPresence(const QString &from, const QByteArray &photo)
+{
+    QXmppPresence presence;
+    presence.setFrom(from);
+    presence.setVCardUpdateType(QXmppPresence::VCardUpdateValidPhoto);
+    presence.setPhotoHash(QCryptographicHash::hash(photo, QCryptographicHash::Sha1));
+    return presence;
+}
+
+void tst_QXmppVCardManager::testCache()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+
+    const QString romeo = QStringLiteral("romeo@montague.lit");
+    const QByteArray photo("\x89PNG avatar");
+
+    QXmppVCardIq iq;
+    iq.setType(QXmppIq::Result);
+    iq.setFrom(romeo);
+    iq.setFullName("Romeo Montague");
+    iq.setPhoto(photo);
+    iq.setPhotoType("image/png");
+
+    {
+        QXmppClient client;
+        auto *manager = new QXmppVCardManager;
+        client.addExtension(manager);
+        manager->setVCardCacheSize(10);
+        manager->setVCardCacheDirectory(dir.path());
+        QCOMPARE(manager->vCardCacheSize(), 10);
+        QCOMPARE(manager->vCardCacheDirectory(), dir.path());
+
+        QXmppVCardIq cached;
+        QVERIFY(!manager->cachedVCard(romeo, cached));
+
+        // received vCards are cached
+        QVERIFY(manager->handleStanza(writePacketToDom(iq)));
+        QVERIFY(manager->cachedVCard(romeo, cached));
+        QCOMPARE(cached.fullName(), QStringLiteral("Romeo Montague"));
+        QCOMPARE(cached.photo(), photo);
+
+        // cached vCards are returned without a request
+        QObject context;
+        int received = 0;
+        connect(manager, &QXmppVCardManager::vCardReceived, &context, [&](QXmppVCardIq vCard) {
+            received++;
+            QCOMPARE(vCard.from(), romeo);
+            QCOMPARE(vCard.photo(), photo);
+        });
+        const QString id = manager->requestVCard(romeo);
+        QVERIFY(!id.isEmpty());
+        QCOMPARE(received, 0);
+        QTRY_COMPARE(received, 1);
+
+        // the advertised hash matches the cached photo
+        emit client.presenceReceived(avatarPresence(romeo + "/orchard", photo));
+        QVERIFY(manager->cachedVCard(romeo, cached));
+    }
+
+    // the cache is kept on disk
+    QXmppClient client;
+    auto *manager = new QXmppVCardManager;
+    client.addExtension(manager);
+    manager->setVCardCacheDirectory(dir.path());
+
+    QXmppVCardIq cached;
+    QVERIFY(manager->cachedVCard(romeo, cached));
+    QCOMPARE(cached.fullName(), QStringLiteral("Romeo Montague"));
+    QCOMPARE(cached.photo(), photo);
+
+    // a new avatar invalidates the cached vCard
+    emit client.presenceReceived(avatarPresence(romeo + "/orchard", QByteArray("new avatar")));
+    QVERIFY(!manager->cachedVCard(romeo, cached));
+    QVERIFY(QDir(dir.path()).entryList(QDir::Files).isEmpty());
+
+    QVERIFY(manager->handleStanza(writePacketToDom(iq)));
+    QVERIFY(!manager->cachedVCard(romeo, cached));
+
+    // the advertised hashes are forgotten on disconnect
+    emit client.disconnected();
+    QVERIFY(manager->cachedVCard(romeo, cached));
+
+    // old vCards are retrieved again
+    QCOMPARE(manager->vCardCacheMaxAge(), 24 * 3600);
+    manager->setVCardCacheMaxAge(0);
+    QVERIFY(!manager->cachedVCard(romeo, cached));
+
+    manager->clearVCardCache();
+    QVERIFY(QDir(dir.path()).entryList(QDir::Files).isEmpty());
+}
+
 QTEST_MAIN(tst_QXmppVCardManager)
 #include "tst_qxmppvcardmanager.moc"